@@ -57,6 +57,7 @@ LIBADB_SRC_FILES := \
     transport_usb.cpp \
 
 LIBADB_TEST_SRCS := \
+    adb_test.cpp \
     adb_io_test.cpp \
     adb_utils_test.cpp \
     fdevent_test.cpp \
@@ -147,13 +148,15 @@ LOCAL_CFLAGS := -DADB_HOST=0 $(LIBADB_CFLAGS)
 LOCAL_SRC_FILES := \
     $(LIBADB_TEST_SRCS) \
     $(LIBADB_TEST_linux_SRCS) \
+    file_sync_compress.cpp \
+    file_sync_compress_test.cpp \
     shell_service.cpp \
     shell_service_protocol.cpp \
     shell_service_protocol_test.cpp \
     shell_service_test.cpp \
 
 LOCAL_SANITIZE := $(adb_target_sanitize)
-LOCAL_STATIC_LIBRARIES := libadbd
+LOCAL_STATIC_LIBRARIES := libadbd libz
 LOCAL_SHARED_LIBRARIES := liblog libbase libcutils
 include $(BUILD_NATIVE_TEST)
 
@@ -185,6 +188,8 @@ LOCAL_SRC_FILES := \
     adb_client.cpp \
     bugreport.cpp \
     bugreport_test.cpp \
+    file_sync_compress.cpp \
+    file_sync_compress_test.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -201,6 +206,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcutils \
     libdiagnose_usb \
     libgmock_host \
+    libz \
 
 # Set entrypoint to wmain from sysdeps_win32.cpp instead of main
 LOCAL_LDFLAGS_windows := -municode
@@ -252,6 +258,7 @@ LOCAL_SRC_FILES := \
     console.cpp \
     commandline.cpp \
     file_sync_client.cpp \
+    file_sync_compress.cpp \
     line_printer.cpp \
     services.cpp \
     shell_service_protocol.cpp \
@@ -282,6 +289,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcrypto_static \
     libdiagnose_usb \
     liblog \
+    libz \
 
 # Don't use libcutils on Windows.
 LOCAL_STATIC_LIBRARIES_darwin := libcutils
@@ -313,6 +321,7 @@ LOCAL_CLANG := true
 LOCAL_SRC_FILES := \
     daemon/main.cpp \
     services.cpp \
+    file_sync_compress.cpp \
     file_sync_service.cpp \
     framebuffer_service.cpp \
     remount_service.cpp \
@@ -356,6 +365,7 @@ LOCAL_STATIC_LIBRARIES := \
     libcutils \
     libbase \
     libcrypto_static \
-    libminijail
+    libminijail \
+    libz
 
 include $(BUILD_EXECUTABLE)
@@ -30,6 +30,7 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -82,22 +83,95 @@ void fatal_errno(const char* fmt, ...) {
     exit(-1);
 }
 
-apacket* get_apacket(void)
+// Transports that send a packet in one write rely on the payload following
+// the header directly.
+static_assert(offsetof(apacket, msg) + sizeof(amessage) == sizeof(apacket),
+              "apacket payload must follow its header");
+
+// Most packets are header-only OKAY/CLSE/SYNC packets or small control
+// packets; only socket data needs the full MAX_PAYLOAD. Freed packets are
+// kept per size class, up to a limit, so steady traffic doesn't keep
+// allocating (and faulting in) fresh 256KiB blocks.
+struct apacket_pool {
+    size_t capacity;
+    size_t max_free;
+    size_t free_count;
+    apacket* free_list;
+};
+
+static apacket_pool apacket_pools[] = {
+    {0, 256, 0, nullptr},
+    {MAX_PAYLOAD_V1, 64, 0, nullptr},
+    {MAX_PAYLOAD_V2, 16, 0, nullptr},
+};
+
+static std::mutex& apacket_pool_lock = *new std::mutex();
+
+static apacket_pool* find_apacket_pool(size_t payload) {
+    for (apacket_pool& pool : apacket_pools) {
+        if (payload <= pool.capacity) {
+            return &pool;
+        }
+    }
+    return nullptr;
+}
+
+apacket* get_apacket(size_t payload)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    apacket_pool* pool = find_apacket_pool(payload);
+    if (pool == nullptr) {
+        fatal("apacket payload too large: %zu", payload);
+    }
+
+    apacket* p = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(apacket_pool_lock);
+        if (pool->free_list != nullptr) {
+            p = pool->free_list;
+            pool->free_list = p->next;
+            pool->free_count--;
+        }
+    }
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket) + pool->capacity));
+        if (p == nullptr) {
+            fatal("failed to allocate an apacket");
+        }
     }
 
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
+    memset(p, 0, sizeof(apacket));
+    p->capacity = pool->capacity;
+    p->data = reinterpret_cast<unsigned char*>(p + 1);
     return p;
 }
 
-void put_apacket(apacket *p)
+void put_apacket(apacket* p)
 {
+    apacket_pool* pool = find_apacket_pool(p->capacity);
+    {
+        std::lock_guard<std::mutex> lock(apacket_pool_lock);
+        if (pool->free_count < pool->max_free) {
+            p->next = pool->free_list;
+            pool->free_list = p;
+            pool->free_count++;
+            return;
+        }
+    }
     free(p);
 }
 
+apacket* resize_apacket(apacket* p, size_t payload)
+{
+    if (find_apacket_pool(payload) == find_apacket_pool(p->capacity)) {
+        return p;
+    }
+    apacket* resized = get_apacket(payload);
+    resized->msg = p->msg;
+    put_apacket(p);
+    return resized;
+}
+
 void handle_online(atransport *t)
 {
     D("adb: online");
@@ -161,7 +235,7 @@ void print_packet(const char *label, apacket *p)
 static void send_ready(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_ready");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_OKAY;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -171,7 +245,7 @@ static void send_ready(unsigned local, unsigned remote, atransport *t)
 static void send_close(unsigned local, unsigned remote, atransport *t)
 {
     D("Calling send_close");
-    apacket *p = get_apacket();
+    apacket *p = get_apacket(0);
     p->msg.command = A_CLSE;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
@@ -206,7 +280,7 @@ std::string get_connection_string() {
 
 void send_connect(atransport* t) {
     D("Calling send_connect");
-    apacket* cp = get_apacket();
+    apacket* cp = get_apacket(MAX_PAYLOAD_V1);
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = t->get_protocol_version();
     cp->msg.arg1 = t->get_max_payload();
@@ -50,7 +50,7 @@ constexpr size_t MAX_PAYLOAD = MAX_PAYLOAD_V2;
 std::string adb_version();
 
 // Increment this when we want to force users to start a new adb server.
-#define ADB_SERVER_VERSION 36
+#define ADB_SERVER_VERSION 38
 
 class atransport;
 struct usb_handle;
@@ -64,15 +64,19 @@ struct amessage {
     unsigned magic;         /* command ^ 0xffffffff             */
 };
 
+// The payload storage is allocated along with the packet, right after |msg|,
+// so a packet's header and payload can go out in a single write. Its size is
+// the size class the packet was taken from, see get_apacket().
 struct apacket
 {
     apacket *next;
 
     unsigned len;
+    unsigned capacity;
     unsigned char *ptr;
+    unsigned char *data;
 
     amessage msg;
-    unsigned char data[MAX_PAYLOAD];
 };
 
 /* the adisconnect structure is used to record a callback that
@@ -185,9 +189,15 @@ void framebuffer_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
-/* packet allocator */
-apacket *get_apacket(void);
-void put_apacket(apacket *p);
+// Packet allocator. get_apacket() returns a packet with room for at least
+// |payload| bytes of data, taken from a pool of packets of that size class;
+// header-only packets (OKAY, CLSE, ...) should ask for 0. put_apacket()
+// returns it to the pool. resize_apacket() returns a packet with the header of
+// |p| and room for |payload| bytes, |p| itself if its size class is the one
+// for |payload|, and otherwise puts |p|.
+apacket* get_apacket(size_t payload = MAX_PAYLOAD);
+void put_apacket(apacket* p);
+apacket* resize_apacket(apacket* p, size_t payload);
 
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adb.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+// Packets come from the smallest size class that holds the payload asked
+// for, with their payload right after the header.
+TEST(adb, get_apacket_size_classes) {
+    struct {
+        size_t payload;
+        size_t capacity;
+    } classes[] = {
+        {0, 0},
+        {1, MAX_PAYLOAD_V1},
+        {MAX_PAYLOAD_V1, MAX_PAYLOAD_V1},
+        {MAX_PAYLOAD_V1 + 1, MAX_PAYLOAD_V2},
+        {MAX_PAYLOAD, MAX_PAYLOAD_V2},
+    };
+    for (const auto& c : classes) {
+        apacket* p = get_apacket(c.payload);
+        EXPECT_EQ(c.capacity, p->capacity) << c.payload;
+        EXPECT_EQ(reinterpret_cast<unsigned char*>(p + 1), p->data);
+        EXPECT_EQ(0U, p->len);
+        EXPECT_EQ(0U, p->msg.command);
+        memset(p->data, 0xff, p->capacity);
+        put_apacket(p);
+    }
+
+    apacket* p = get_apacket();
+    EXPECT_EQ(MAX_PAYLOAD, p->capacity);
+    put_apacket(p);
+}
+
+// A packet put back is handed out again for its own size class only, and
+// cleared.
+TEST(adb, put_apacket_reuse) {
+    apacket* p = get_apacket(100);
+    p->len = 100;
+    p->msg.command = A_WRTE;
+    put_apacket(p);
+
+    apacket* q = get_apacket(0);
+    EXPECT_NE(p, q);
+    apacket* r = get_apacket(MAX_PAYLOAD);
+    EXPECT_NE(p, r);
+
+    apacket* s = get_apacket(MAX_PAYLOAD_V1);
+    EXPECT_EQ(p, s);
+    EXPECT_EQ(0U, s->len);
+    EXPECT_EQ(0U, s->msg.command);
+
+    put_apacket(q);
+    put_apacket(r);
+    put_apacket(s);
+}
+
+// A header read into a header-only packet moves into one with room for the
+// payload it announces, and stays put if it already has the right room.
+TEST(adb, resize_apacket) {
+    apacket* p = get_apacket(0);
+    p->msg.command = A_WRTE;
+    p->msg.arg0 = 1;
+    p->msg.arg1 = 2;
+    p->msg.data_length = MAX_PAYLOAD_V1 + 1;
+
+    apacket* q = resize_apacket(p, p->msg.data_length);
+    EXPECT_EQ(MAX_PAYLOAD_V2, q->capacity);
+    EXPECT_EQ(static_cast<unsigned>(A_WRTE), q->msg.command);
+    EXPECT_EQ(1U, q->msg.arg0);
+    EXPECT_EQ(2U, q->msg.arg1);
+    EXPECT_EQ(MAX_PAYLOAD_V1 + 1, q->msg.data_length);
+
+    EXPECT_EQ(q, resize_apacket(q, MAX_PAYLOAD));
+
+    apacket* r = resize_apacket(q, 0);
+    EXPECT_EQ(0U, r->capacity);
+    EXPECT_EQ(static_cast<unsigned>(A_WRTE), r->msg.command);
+    put_apacket(r);
+}
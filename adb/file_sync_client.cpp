@@ -28,8 +28,11 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "sysdeps.h"
@@ -38,19 +41,15 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "file_sync_compress.h"
 #include "file_sync_service.h"
 #include "line_printer.h"
+#include "transport.h"
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 
-struct syncsendbuf {
-    unsigned id;
-    unsigned size;
-    char data[SYNC_DATA_MAX];
-};
-
 static void ensure_trailing_separators(std::string& local_path, std::string& remote_path) {
     if (!adb_is_separator(local_path.back())) {
         local_path.push_back(OS_PATH_SEPARATOR);
@@ -94,21 +93,30 @@ struct copyinfo {
     }
 };
 
+// ADB_SYNC_DEFLATE=0 turns off compression of sync transfers, for links fast
+// enough that deflating only slows them down.
+static bool SyncDeflateAllowed() {
+    const char* setting = getenv("ADB_SYNC_DEFLATE");
+    return setting == nullptr || strcmp(setting, "0") != 0;
+}
+
 class SyncConnection {
   public:
     SyncConnection()
             : total_bytes_(0),
               start_time_ms_(CurrentTimeMs()),
               expected_total_bytes_(0),
-              expect_multiple_files_(false),
-              expect_done_(false) {
-        max = SYNC_DATA_MAX; // TODO: decide at runtime.
-
+              expect_multiple_files_(false) {
+        FeatureSet features;
         std::string error;
-        fd = adb_connect("sync:", &error);
-        if (fd < 0) {
-            Error("connect failed: %s", error.c_str());
-        }
+        bool have_features = adb_get_feature_set(&features, &error);
+        max = have_features && CanUseFeature(features, kFeatureSyncLargeChunks)
+                  ? SYNC_DATA_MAX_V2 : SYNC_DATA_MAX;
+        compress = have_features && CanUseFeature(features, kFeatureSyncDeflate) &&
+                   SyncDeflateAllowed();
+        buffer.resize(sizeof(SyncRequest) + max);
+
+        Connect();
     }
 
     ~SyncConnection() {
@@ -130,6 +138,24 @@ class SyncConnection {
 
     bool IsValid() { return fd >= 0; }
 
+    // adbd closes the connection after failing a file, and with it the
+    // requests for any files sent or requested after that one. Returns the
+    // (from, to) of the file adbd failed, or nullptr if a copy failed some
+    // other way.
+    const std::pair<std::string, std::string>* FailedFile() const {
+        return failed_file_.first.empty() ? nullptr : &failed_file_;
+    }
+
+    // Replace a connection adbd closed after failing a file with a new one,
+    // to go on with the files after it.
+    bool Reconnect() {
+        adb_close(fd);
+        deferred_acknowledgements_.clear();
+        failed_file_ = {};
+        Connect();
+        return IsValid();
+    }
+
     bool ReceivedError(const char* from, const char* to) {
         adb_pollfd pfd = {.fd = fd, .events = POLLIN};
         int rc = adb_poll(&pfd, 1, 0);
@@ -140,6 +166,11 @@ class SyncConnection {
         return rc != 0;
     }
 
+    // Request rpath, its chunks compressed if the device can.
+    bool SendRecvRequest(const char* rpath) {
+        return SendRequest(compress ? ID_RCVZ : ID_RECV, rpath);
+    }
+
     bool SendRequest(int id, const char* path_and_mode) {
         size_t path_length = strlen(path_and_mode);
         if (path_length > 1024) {
@@ -173,8 +204,18 @@ class SyncConnection {
             return false;
         }
 
+        unsigned data_id = ID_DATA;
+        const char* payload = data;
+        size_t payload_length = data_length;
+        compressor.StartFile();
+        if (compress && compressor.Compress(data, data_length, &chunk_)) {
+            data_id = ID_ZDAT;
+            payload = chunk_.data();
+            payload_length = chunk_.size();
+        }
+
         std::vector<char> buf(sizeof(SyncRequest) + path_length +
-                              sizeof(SyncRequest) + data_length +
+                              sizeof(SyncRequest) + payload_length +
                               sizeof(SyncRequest));
         char* p = &buf[0];
 
@@ -186,19 +227,21 @@ class SyncConnection {
         p += path_length;
 
         SyncRequest* req_data = reinterpret_cast<SyncRequest*>(p);
-        req_data->id = ID_DATA;
-        req_data->path_length = data_length;
+        req_data->id = data_id;
+        req_data->path_length = payload_length;
         p += sizeof(SyncRequest);
-        memcpy(p, data, data_length);
-        p += data_length;
+        memcpy(p, payload, payload_length);
+        p += payload_length;
 
         SyncRequest* req_done = reinterpret_cast<SyncRequest*>(p);
         req_done->id = ID_DONE;
         req_done->path_length = mtime;
         p += sizeof(SyncRequest);
 
-        WriteOrDie(lpath, rpath, &buf[0], (p - &buf[0]));
-        expect_done_ = true;
+        if (!WriteOrFail(lpath, rpath, &buf[0], (p - &buf[0]))) {
+            return false;
+        }
+        deferred_acknowledgements_.emplace_back(lpath, rpath);
         total_bytes_ += data_length;
         ReportProgress(rpath, data_length, data_length);
         return true;
@@ -227,10 +270,12 @@ class SyncConnection {
             return false;
         }
 
-        syncsendbuf sbuf;
-        sbuf.id = ID_DATA;
+        SyncRequest* req = reinterpret_cast<SyncRequest*>(&buffer[0]);
+        char* data = &buffer[sizeof(SyncRequest)];
+        bool received_error = false;
+        compressor.StartFile();
         while (true) {
-            int bytes_read = adb_read(lfd, sbuf.data, max);
+            int bytes_read = adb_read(lfd, data, max);
             if (bytes_read == -1) {
                 Error("reading '%s' locally failed: %s", lpath, strerror(errno));
                 adb_close(lfd);
@@ -239,15 +284,32 @@ class SyncConnection {
                 break;
             }
 
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+            req->id = ID_DATA;
+            req->path_length = bytes_read;
+            if (compress && compressor.Compress(data, bytes_read, &chunk_)) {
+                req->id = ID_ZDAT;
+                req->path_length = chunk_.size();
+                memcpy(data, chunk_.data(), chunk_.size());
+            }
+            if (!WriteOrFail(lpath, rpath, req, sizeof(SyncRequest) + req->path_length)) {
+                adb_close(lfd);
+                return false;
+            }
 
             total_bytes_ += bytes_read;
             bytes_copied += bytes_read;
 
             // Check to see if we've received an error from the other side.
+            // Acknowledgements of the files sent before this one come first.
             if (ReceivedError(lpath, rpath)) {
-                break;
+                if (deferred_acknowledgements_.empty()) {
+                    received_error = true;
+                    break;
+                }
+                if (!ReadAcknowledgement()) {
+                    adb_close(lfd);
+                    return false;
+                }
             }
 
             ReportProgress(rpath, bytes_copied, total_size);
@@ -258,24 +320,33 @@ class SyncConnection {
         syncmsg msg;
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
-        expect_done_ = true;
-        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        if (!WriteOrFail(lpath, rpath, &msg.data, sizeof(msg.data))) {
+            return false;
+        }
+        deferred_acknowledgements_.emplace_back(lpath, rpath);
+        return !received_error || ReadAcknowledgements(true);
     }
 
-    bool CopyDone(const char* from, const char* to) {
+    // Read the OKAY or FAIL adbd answers each file sent with, oldest first.
+    bool ReadAcknowledgement() {
+        std::pair<std::string, std::string> files;
+        if (!deferred_acknowledgements_.empty()) {
+            files = std::move(deferred_acknowledgements_.front());
+            deferred_acknowledgements_.pop_front();
+        }
+        const char* from = files.first.c_str();
+        const char* to = files.second.c_str();
+
         syncmsg msg;
         if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
             Error("failed to copy '%s' to '%s': couldn't read from device", from, to);
             return false;
         }
         if (msg.status.id == ID_OKAY) {
-            if (expect_done_) {
-                expect_done_ = false;
-                return true;
-            } else {
+            if (files.first.empty()) {
                 Error("failed to copy '%s' to '%s': received premature success", from, to);
-                return true;
             }
+            return true;
         }
         if (msg.status.id != ID_FAIL) {
             Error("failed to copy '%s' to '%s': unknown reason %d", from, to, msg.status.id);
@@ -284,6 +355,21 @@ class SyncConnection {
         return ReportCopyFailure(from, to, msg);
     }
 
+    // Files are sent without waiting for adbd to acknowledge the previous
+    // ones, so a tree of small files is not paced by the round trip. The
+    // acknowledgements are read once more than kMaxDeferredAcknowledgements
+    // are outstanding, or all of them if read_all. adbd answers requests
+    // in order and, after a failure, closes the connection.
+    bool ReadAcknowledgements(bool read_all = false) {
+        while (!deferred_acknowledgements_.empty() &&
+               (read_all || deferred_acknowledgements_.size() > kMaxDeferredAcknowledgements)) {
+            if (!ReadAcknowledgement()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     bool ReportCopyFailure(const char* from, const char* to, const syncmsg& msg) {
         std::vector<char> buf(msg.status.msglen + 1);
         if (!ReadFdExactly(fd, &buf[0], msg.status.msglen)) {
@@ -293,6 +379,7 @@ class SyncConnection {
         }
         buf[msg.status.msglen] = 0;
         Error("failed to copy '%s' to '%s': %s", from, to, &buf[0]);
+        failed_file_ = std::make_pair(from, to);
         return false;
     }
 
@@ -385,25 +472,71 @@ class SyncConnection {
 
     uint64_t total_bytes_;
 
-    // TODO: add a char[max] buffer here, to replace syncsendbuf...
     int fd;
+    // The largest chunk adbd takes and sends, SYNC_DATA_MAX_V2 if it has
+    // kFeatureSyncLargeChunks.
     size_t max;
 
+    // Room for a chunk of max bytes and the sync request ahead of it, and
+    // for a chunk decompressed.
+    std::vector<char> buffer;
+    std::vector<char> inflated;
+
+    // Data chunks go as ID_ZDAT where that makes them smaller, if the device
+    // has kFeatureSyncDeflate.
+    bool compress;
+    SyncCompressor compressor;
+
   private:
     uint64_t start_time_ms_;
 
     uint64_t expected_total_bytes_;
     bool expect_multiple_files_;
-    bool expect_done_;
+
+    // An OKAY is 8 bytes, so adbd can write this many into the socket
+    // buffers between us without blocking, and stop reading the next file.
+    static constexpr size_t kMaxDeferredAcknowledgements = 128;
+    // (lpath, rpath) of the files sent and not yet acknowledged
+    std::deque<std::pair<std::string, std::string>> deferred_acknowledgements_;
+
+    // the last file adbd failed, and closed the connection after
+    std::pair<std::string, std::string> failed_file_;
+
+    // the last chunk compressed
+    std::vector<char> chunk_;
 
     LinePrinter line_printer_;
 
+    void Connect() {
+        std::string error;
+        fd = adb_connect("sync:", &error);
+        if (fd < 0) {
+            Error("connect failed: %s", error.c_str());
+            return;
+        }
+
+        // The device sends 64k chunks unless asked for more; other sync
+        // clients going through the same adb server may not take them.
+        if (max > SYNC_DATA_MAX && !SendRequest(ID_LRGE, "")) {
+            adb_close(fd);
+            fd = -1;
+        }
+    }
+
     bool SendQuit() {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
 
-    bool WriteOrDie(const char* from, const char* to, const void* data, size_t data_length) {
+    bool WriteOrFail(const char* from, const char* to, const void* data, size_t data_length) {
         if (!WriteFdExactly(fd, data, data_length)) {
+            // adbd closes the connection after failing a file, which may be
+            // one sent before this and not yet acknowledged.
+            int saved_errno = errno;
+            if (!ReadAcknowledgements(true)) {
+                return false;
+            }
+            errno = saved_errno;
+
             if (errno == ECONNRESET) {
                 // Assume adbd told us why it was closing the connection, and
                 // try to read failure reason from adbd.
@@ -418,7 +551,7 @@ class SyncConnection {
             } else {
                 Error("%zu-byte write failed: %s", data_length, strerror(errno));
             }
-            _exit(1);
+            return false;
         }
         return true;
     }
@@ -434,6 +567,7 @@ typedef void (sync_ls_cb)(unsigned mode, unsigned size, unsigned time, const cha
 
 static bool sync_ls(SyncConnection& sc, const char* path,
                     std::function<sync_ls_cb> func) {
+    if (!sc.ReadAcknowledgements(true)) return false;
     if (!sc.SendRequest(ID_LIST, path)) return false;
 
     while (true) {
@@ -470,7 +604,8 @@ static bool sync_finish_stat(SyncConnection& sc, unsigned int* timestamp,
 
 static bool sync_stat(SyncConnection& sc, const char* path,
                       unsigned int* timestamp, unsigned int* mode, unsigned int* size) {
-    return sc.SendRequest(ID_STAT, path) && sync_finish_stat(sc, timestamp, mode, size);
+    return sc.ReadAcknowledgements(true) && sc.SendRequest(ID_STAT, path) &&
+           sync_finish_stat(sc, timestamp, mode, size);
 }
 
 static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
@@ -491,7 +626,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime, buf, data_length)) {
             return false;
         }
-        return sc.CopyDone(lpath, rpath);
+        return sc.ReadAcknowledgements();
 #endif
     }
 
@@ -500,7 +635,7 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         sc.Error("failed to stat local file '%s': %s", lpath, strerror(errno));
         return false;
     }
-    if (st.st_size < SYNC_DATA_MAX) {
+    if (static_cast<uint64_t>(st.st_size) < sc.max) {
         std::string data;
         if (!android::base::ReadFileToString(lpath, &data)) {
             sc.Error("failed to read all of '%s': %s", lpath, strerror(errno));
@@ -515,16 +650,13 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
             return false;
         }
     }
-    return sc.CopyDone(lpath, rpath);
+    return sc.ReadAcknowledgements();
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
-                      const char* name=nullptr) {
-    unsigned size = 0;
-    if (!sync_stat(sc, rpath, nullptr, nullptr, &size)) return false;
-
-    if (!sc.SendRequest(ID_RECV, rpath)) return false;
-
+// Receive the response to an ID_RECV request for rpath already sent. size
+// is what the file is expected to be, for progress reporting.
+static bool sync_finish_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                             uint64_t size, const char* name=nullptr) {
     adb_unlink(lpath);
     int lfd = adb_creat(lpath, 0644);
     if (lfd < 0) {
@@ -543,7 +675,7 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
 
         if (msg.data.id == ID_DONE) break;
 
-        if (msg.data.id != ID_DATA) {
+        if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             adb_close(lfd);
             adb_unlink(lpath);
             sc.ReportCopyFailure(rpath, lpath, msg);
@@ -557,23 +689,37 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
             return false;
         }
 
-        char buffer[SYNC_DATA_MAX];
+        char* buffer = &sc.buffer[0];
         if (!ReadFdExactly(sc.fd, buffer, msg.data.size)) {
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
-        if (!WriteFdExactly(lfd, buffer, msg.data.size)) {
+        const char* data = buffer;
+        size_t data_length = msg.data.size;
+        if (msg.data.id == ID_ZDAT) {
+            sc.inflated.resize(sc.max);
+            if (!sc.compressor.Decompress(buffer, msg.data.size,
+                                          &sc.inflated[0], sc.inflated.size(), &data_length)) {
+                sc.Error("failed to copy '%s' to '%s': corrupt compressed data", rpath, lpath);
+                adb_close(lfd);
+                adb_unlink(lpath);
+                return false;
+            }
+            data = &sc.inflated[0];
+        }
+
+        if (!WriteFdExactly(lfd, data, data_length)) {
             sc.Error("cannot write '%s': %s", lpath, strerror(errno));
             adb_close(lfd);
             adb_unlink(lpath);
             return false;
         }
 
-        sc.total_bytes_ += msg.data.size;
+        sc.total_bytes_ += data_length;
 
-        bytes_copied += msg.data.size;
+        bytes_copied += data_length;
 
         sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, size);
     }
@@ -582,6 +728,12 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
     return true;
 }
 
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                      uint64_t size, const char* name=nullptr) {
+    return sc.ReadAcknowledgements(true) && sc.SendRecvRequest(rpath) &&
+           sync_finish_recv(sc, rpath, lpath, size, name);
+}
+
 bool do_sync_ls(const char* path) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
@@ -592,6 +744,10 @@ bool do_sync_ls(const char* path) {
     });
 }
 
+// ID_RECV requests outstanding while pulling a directory, at most 1032
+// bytes each.
+static constexpr size_t kMaxPendingRecv = 32;
+
 static bool IsDotOrDotDot(const char* name) {
     return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
 }
@@ -697,25 +853,53 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
 
     sc.ComputeExpectedTotalBytes(file_list);
 
-    for (const copyinfo& ci : file_list) {
-        if (!ci.skip) {
+    // A file adbd fails is reported, and the files sent after it, lost with
+    // the connection adbd closes, are sent again over a new one.
+    int failed = 0;
+    size_t i = 0;
+    while (true) {
+        for (; i < file_list.size(); ++i) {
+            const copyinfo& ci = file_list[i];
+            if (ci.skip) {
+                continue;
+            }
             if (list_only) {
                 sc.Error("would push: %s -> %s", ci.lpath.c_str(), ci.rpath.c_str());
-            } else {
-                if (!sync_send(sc, ci.lpath.c_str(), ci.rpath.c_str(), ci.time, ci.mode)) {
-                    return false;
-                }
+            } else if (!sync_send(sc, ci.lpath.c_str(), ci.rpath.c_str(), ci.time, ci.mode)) {
+                break;
             }
+        }
+        if (i == file_list.size() && sc.ReadAcknowledgements(true)) {
+            break;
+        }
+
+        const std::pair<std::string, std::string>* failed_file = sc.FailedFile();
+        if (failed_file == nullptr) {
+            return false;
+        }
+        auto it = std::find_if(file_list.begin(), file_list.end(), [&](const copyinfo& ci) {
+            return !ci.skip && ci.lpath == failed_file->first && ci.rpath == failed_file->second;
+        });
+        if (it == file_list.end() || !sc.Reconnect()) {
+            return false;
+        }
+        i = it - file_list.begin() + 1;
+        failed++;
+    }
+
+    for (const copyinfo& ci : file_list) {
+        if (!ci.skip) {
             pushed++;
         } else {
             skipped++;
         }
     }
+    pushed -= failed;
 
     sc.Printf("%s: %d file%s pushed. %d file%s skipped.%s", rpath.c_str(),
               pushed, (pushed == 1) ? "" : "s", skipped,
               (skipped == 1) ? "" : "s", sc.TransferRate().c_str());
-    return true;
+    return failed == 0;
 }
 
 bool do_sync_push(const std::vector<const char*>& srcs, const char* dst) {
@@ -794,6 +978,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst) {
         success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode);
     }
 
+    success &= sc.ReadAcknowledgements(true);
     return success;
 }
 
@@ -892,9 +1077,35 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    // Request files ahead of the one being received, so adbd goes straight
+    // from one into the next rather than waiting a round trip for each
+    // request. adbd answers them in order. It does not read requests while
+    // it is sending a file, so the window is bounded by what the socket
+    // buffers to adbd can hold.
+    size_t requested = 0;
+    size_t pending = 0;
+    auto request_ahead = [&]() {
+        while (requested < file_list.size() && pending < kMaxPendingRecv) {
+            const copyinfo& ci = file_list[requested++];
+            if (ci.skip || S_ISDIR(ci.mode)) {
+                continue;
+            }
+            if (!sc.SendRecvRequest(ci.rpath.c_str())) {
+                return false;
+            }
+            ++pending;
+        }
+        return true;
+    };
+
     int pulled = 0;
     int skipped = 0;
-    for (const copyinfo &ci : file_list) {
+    bool success = true;
+    for (size_t i = 0; i < file_list.size(); ++i) {
+        const copyinfo& ci = file_list[i];
+        if (!request_ahead()) {
+            return false;
+        }
         if (!ci.skip) {
             if (S_ISDIR(ci.mode)) {
                 // Entry is for an empty directory, create it and continue.
@@ -908,8 +1119,17 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
                 continue;
             }
 
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str())) {
-                return false;
+            --pending;
+            if (!sync_finish_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), ci.size)) {
+                // The files requested after one adbd fails are lost with the
+                // connection adbd closes. Request them again over a new one.
+                if (sc.FailedFile() == nullptr || !sc.Reconnect()) {
+                    return false;
+                }
+                requested = i + 1;
+                pending = 0;
+                success = false;
+                continue;
             }
 
             if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
@@ -924,7 +1144,7 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
     sc.Printf("%s: %d file%s pulled. %d file%s skipped.%s", rpath.c_str(),
               pulled, (pulled == 1) ? "" : "s", skipped,
               (skipped == 1) ? "" : "s", sc.TransferRate().c_str());
-    return true;
+    return success;
 }
 
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
@@ -1023,7 +1243,10 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
         }
 
         sc.SetExpectedTotalBytes(src_size);
-        if (!sync_recv(sc, src_path, dst_path, name)) {
+        if (!sync_recv(sc, src_path, dst_path, src_size, name)) {
+            if (sc.FailedFile() != nullptr && !sc.Reconnect()) {
+                return false;
+            }
             success = false;
             continue;
         }
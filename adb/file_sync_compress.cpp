@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_compress.h"
+
+#include <string.h>
+
+SyncCompressor::SyncCompressor() {
+    memset(&deflate_, 0, sizeof(deflate_));
+    memset(&inflate_, 0, sizeof(inflate_));
+}
+
+SyncCompressor::~SyncCompressor() {
+    if (deflate_ready_) {
+        deflateEnd(&deflate_);
+    }
+    if (inflate_ready_) {
+        inflateEnd(&inflate_);
+    }
+}
+
+bool SyncCompressor::Compress(const void* data, size_t length, std::vector<char>* out) {
+    if (incompressible_ >= kMaxIncompressibleChunks) {
+        return false;
+    }
+    if (!Deflate(data, length, out)) {
+        ++incompressible_;
+        return false;
+    }
+    incompressible_ = 0;
+    return true;
+}
+
+bool SyncCompressor::Deflate(const void* data, size_t length, std::vector<char>* out) {
+    if (length < 2) {
+        return false;
+    }
+
+    if (!deflate_ready_) {
+        // Favor speed, the link is what we are trying to get ahead of.
+        if (deflateInit(&deflate_, Z_BEST_SPEED) != Z_OK) {
+            return false;
+        }
+        deflate_ready_ = true;
+    } else if (deflateReset(&deflate_) != Z_OK) {
+        return false;
+    }
+
+    // Anything that does not fit in less than the input is not worth it.
+    out->resize(length - 1);
+    deflate_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    deflate_.avail_in = length;
+    deflate_.next_out = reinterpret_cast<Bytef*>(out->data());
+    deflate_.avail_out = out->size();
+    if (deflate(&deflate_, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    out->resize(out->size() - deflate_.avail_out);
+    return true;
+}
+
+bool SyncCompressor::Decompress(const void* data, size_t length, void* out, size_t capacity,
+                                size_t* out_length) {
+    if (!inflate_ready_) {
+        if (inflateInit(&inflate_) != Z_OK) {
+            return false;
+        }
+        inflate_ready_ = true;
+    } else if (inflateReset(&inflate_) != Z_OK) {
+        return false;
+    }
+
+    inflate_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    inflate_.avail_in = length;
+    inflate_.next_out = reinterpret_cast<Bytef*>(out);
+    inflate_.avail_out = capacity;
+    if ((inflate(&inflate_, Z_FINISH) != Z_STREAM_END) || inflate_.avail_in) {
+        return false;
+    }
+    *out_length = capacity - inflate_.avail_out;
+    return true;
+}
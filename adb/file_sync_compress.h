@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILE_SYNC_COMPRESS_H_
+#define FILE_SYNC_COMPRESS_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <android-base/macros.h>
+#include <zlib.h>
+
+// Compresses and decompresses the ID_ZDAT chunks of a sync connection, used
+// when both the adb client and adbd have kFeatureSyncDeflate. Each chunk is
+// a complete zlib stream of its own, so a chunk that does not compress can
+// be sent as a plain ID_DATA instead without upsetting the next one.
+//
+// A file whose chunks keep not getting smaller, already compressed media
+// say, is given up on and sent as ID_DATA without spending more time on it.
+//
+// Example: send a file's chunks compressed where that makes them smaller.
+//   compressor.StartFile();
+//   std::vector<char> deflated;
+//   if (compressor.Compress(data, length, &deflated)) {
+//       // send deflated as ID_ZDAT
+//   } else {
+//       // send data as ID_DATA
+//   }
+class SyncCompressor {
+  public:
+    SyncCompressor();
+    ~SyncCompressor();
+
+    // Starts compressing the chunks of another file.
+    void StartFile() { incompressible_ = 0; }
+
+    // Compresses |length| bytes of |data| into |out|.
+    //
+    // Returns false if the result would not be smaller than |data|, or if
+    // kMaxIncompressibleChunks chunks in a row of this file did not get
+    // smaller, in which case the chunk should be sent uncompressed.
+    bool Compress(const void* data, size_t length, std::vector<char>* out);
+
+    // Decompresses the |length| bytes of a chunk at |data| into |out|, which
+    // has room for |capacity| bytes, and sets |out_length| to how many it
+    // holds.
+    //
+    // Returns false if the chunk is corrupt or does not fit.
+    bool Decompress(const void* data, size_t length, void* out, size_t capacity,
+                    size_t* out_length);
+
+    static constexpr size_t kMaxIncompressibleChunks = 4;
+
+  private:
+    bool Deflate(const void* data, size_t length, std::vector<char>* out);
+
+    // The streams are initialized on first use, a connection may only ever
+    // go one way.
+    z_stream deflate_;
+    z_stream inflate_;
+    bool deflate_ready_ = false;
+    bool inflate_ready_ = false;
+
+    // Chunks in a row of the current file that did not get smaller.
+    size_t incompressible_ = 0;
+
+    DISALLOW_COPY_AND_ASSIGN(SyncCompressor);
+};
+
+#endif  // FILE_SYNC_COMPRESS_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_compress.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "file_sync_service.h"
+
+// A full chunk of text, the kind of data that compresses well.
+static std::string TextChunk() {
+    std::string text;
+    for (int i = 0; text.size() < SYNC_DATA_MAX; ++i) {
+        text += "line " + std::to_string(i) + " of some compressible text\n";
+    }
+    text.resize(SYNC_DATA_MAX);
+    return text;
+}
+
+// A full chunk of noise, which does not.
+static std::vector<char> RandomChunk() {
+    std::vector<char> data(SYNC_DATA_MAX);
+    srand(0);
+    for (char& c : data) {
+        c = rand();
+    }
+    return data;
+}
+
+// Chunks compress smaller and come back intact, repeatedly on one stream.
+TEST(FileSyncCompressTest, RoundTrip) {
+    SyncCompressor sender, receiver;
+    std::string text = TextChunk();
+    std::vector<char> deflated;
+    std::vector<char> inflated(SYNC_DATA_MAX);
+
+    for (size_t length : {text.size(), size_t(100), text.size()}) {
+        ASSERT_TRUE(sender.Compress(text.data(), length, &deflated));
+        EXPECT_LT(deflated.size(), length);
+
+        size_t inflated_length;
+        ASSERT_TRUE(receiver.Decompress(deflated.data(), deflated.size(), inflated.data(),
+                                        inflated.size(), &inflated_length));
+        ASSERT_EQ(length, inflated_length);
+        EXPECT_EQ(0, memcmp(text.data(), inflated.data(), length));
+    }
+}
+
+// A chunk that doesn't get smaller is left to be sent as ID_DATA, and
+// doesn't upset the next one.
+TEST(FileSyncCompressTest, Incompressible) {
+    SyncCompressor sender, receiver;
+    std::vector<char> noise = RandomChunk();
+    std::vector<char> deflated;
+    EXPECT_FALSE(sender.Compress(noise.data(), noise.size(), &deflated));
+    EXPECT_FALSE(sender.Compress("x", 1, &deflated));
+
+    std::string text = TextChunk();
+    ASSERT_TRUE(sender.Compress(text.data(), text.size(), &deflated));
+    std::vector<char> inflated(SYNC_DATA_MAX);
+    size_t inflated_length;
+    ASSERT_TRUE(receiver.Decompress(deflated.data(), deflated.size(), inflated.data(),
+                                    inflated.size(), &inflated_length));
+    EXPECT_EQ(text, std::string(inflated.data(), inflated_length));
+}
+
+// A file whose chunks keep not getting smaller is given up on, until the
+// next file.
+TEST(FileSyncCompressTest, GiveUp) {
+    SyncCompressor sender;
+    std::vector<char> noise = RandomChunk();
+    std::string text = TextChunk();
+    std::vector<char> deflated;
+
+    // A chunk that compresses starts the run over.
+    sender.StartFile();
+    for (size_t i = 1; i < SyncCompressor::kMaxIncompressibleChunks; ++i) {
+        EXPECT_FALSE(sender.Compress(noise.data(), noise.size(), &deflated));
+    }
+    EXPECT_TRUE(sender.Compress(text.data(), text.size(), &deflated));
+
+    for (size_t i = 0; i < SyncCompressor::kMaxIncompressibleChunks; ++i) {
+        EXPECT_FALSE(sender.Compress(noise.data(), noise.size(), &deflated));
+    }
+    EXPECT_FALSE(sender.Compress(text.data(), text.size(), &deflated));
+
+    sender.StartFile();
+    EXPECT_TRUE(sender.Compress(text.data(), text.size(), &deflated));
+}
+
+// Corrupt or truncated chunks, and chunks that inflate to more than the
+// receiver has room for, are rejected.
+TEST(FileSyncCompressTest, Invalid) {
+    SyncCompressor sender, receiver;
+    std::string text = TextChunk();
+    std::vector<char> deflated;
+    ASSERT_TRUE(sender.Compress(text.data(), text.size(), &deflated));
+
+    std::vector<char> inflated(SYNC_DATA_MAX);
+    size_t inflated_length;
+    EXPECT_FALSE(receiver.Decompress(deflated.data(), deflated.size() / 2, inflated.data(),
+                                     inflated.size(), &inflated_length));
+    EXPECT_FALSE(receiver.Decompress(deflated.data(), deflated.size(), inflated.data(),
+                                     inflated.size() - 1, &inflated_length));
+
+    std::vector<char> corrupt(deflated);
+    corrupt[0] ^= 0xff;
+    EXPECT_FALSE(receiver.Decompress(corrupt.data(), corrupt.size(), inflated.data(),
+                                     inflated.size(), &inflated_length));
+
+    // The stream is still good for the next chunk.
+    ASSERT_TRUE(receiver.Decompress(deflated.data(), deflated.size(), inflated.data(),
+                                    inflated.size(), &inflated_length));
+    EXPECT_EQ(text, std::string(inflated.data(), inflated_length));
+}
@@ -21,19 +21,27 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <log/log.h>
 #include <selinux/android.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 #include <utime.h>
 
+#include <linux/magic.h>
+
+#include <algorithm>
+
 #include "adb.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "file_sync_compress.h"
 #include "private/android_filesystem_config.h"
 #include "security_log_tags.h"
 
@@ -146,8 +154,151 @@ static bool SendSyncFailErrno(int fd, const std::string& reason) {
     return SendSyncFail(fd, android::base::StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
+// What a sync connection keeps from one request to the next.
+struct SyncState {
+    explicit SyncState(size_t max_chunk)
+            : buffer(SYNC_DATA_MAX_V2), scratch(SYNC_DATA_MAX_V2), max_chunk(max_chunk) {
+        if (pipe2(splice_pipe, O_CLOEXEC) == -1) {
+            splice_pipe[0] = splice_pipe[1] = -1;
+            return;
+        }
+        // Room for a whole chunk, else it goes a pipe's worth at a time.
+        fcntl(splice_pipe[1], F_SETPIPE_SZ, SYNC_DATA_MAX_V2);
+    }
+
+    ~SyncState() {
+        CloseSplicePipe();
+    }
+
+    void CloseSplicePipe() {
+        if (splice_pipe[0] != -1) {
+            adb_close(splice_pipe[0]);
+            adb_close(splice_pipe[1]);
+            splice_pipe[0] = splice_pipe[1] = -1;
+        }
+    }
+
+    // A chunk; any client's chunks fit.
+    std::vector<char> buffer;
+    // A chunk compressed or decompressed.
+    std::vector<char> scratch;
+    // The other side of ID_ZDAT chunks.
+    SyncCompressor compressor;
+    // The largest chunk the client takes, raised by ID_LRGE.
+    size_t max_chunk;
+    // ID_SEND data is spliced through this on its way from the socket to the
+    // file, so it isn't copied through adbd. -1 if that isn't possible.
+    int splice_pipe[2];
+};
+
+// Copies |length| bytes of file data from |s| to |fd|, by way of the splice
+// pipe if the connection has one. AF_UNIX sockets can't be spliced from
+// before Linux 4.5, in which case the pipe is given up for the buffer. If
+// writing |fd| fails, |*write_errno| is set but the data is still read, to
+// keep the connection in step.
+//
+// Returns false if reading |s| fails.
+static bool receive_file_data(int s, int fd, size_t length, SyncState& state, int* write_errno) {
+    *write_errno = 0;
+    while (length > 0 && state.splice_pipe[0] != -1) {
+        ssize_t n = TEMP_FAILURE_RETRY(splice(s, nullptr, state.splice_pipe[1], nullptr,
+                                              length, SPLICE_F_MOVE));
+        if (n == -1 && errno == EINVAL) {
+            state.CloseSplicePipe();
+            break;
+        }
+        if (n <= 0) return false;
+        length -= n;
+
+        size_t pending = n;
+        while (pending > 0 && *write_errno == 0) {
+            ssize_t written = TEMP_FAILURE_RETRY(splice(state.splice_pipe[0], nullptr, fd,
+                                                        nullptr, pending, SPLICE_F_MOVE));
+            if (written > 0) {
+                pending -= written;
+            } else if (written == -1 && errno == EINVAL) {
+                break;  // Not a file that can be spliced to.
+            } else {
+                *write_errno = (written == -1) ? errno : EIO;
+            }
+        }
+        if (pending > 0) {
+            // Whatever is left in the pipe is written, or discarded, from the buffer.
+            if (!ReadFdExactly(state.splice_pipe[0], &state.buffer[0], pending)) return false;
+            if (*write_errno == 0 && !WriteFdExactly(fd, &state.buffer[0], pending)) {
+                *write_errno = errno;
+            }
+        }
+    }
+
+    while (length > 0) {
+        size_t n = std::min(length, state.buffer.size());
+        if (!ReadFdExactly(s, &state.buffer[0], n)) return false;
+        length -= n;
+        if (*write_errno == 0 && !WriteFdExactly(fd, &state.buffer[0], n)) {
+            *write_errno = errno;
+        }
+    }
+    return true;
+}
+
+// Copies up to |*length| bytes of file data from |fd| to |s|, with sendfile
+// while |*use_sendfile| so it isn't copied through adbd. That's cleared if
+// the file doesn't support it, and the buffer used instead. If |fd| ends
+// early, |*length| is left at what wasn't sent.
+//
+// Returns false on error.
+static bool send_file_data(int s, int fd, size_t* length, SyncState& state,
+                           bool* use_sendfile) {
+    while (*length > 0 && *use_sendfile) {
+        ssize_t n = TEMP_FAILURE_RETRY(sendfile(s, fd, nullptr, *length));
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            *use_sendfile = false;
+            break;
+        }
+        if (n < 0) return false;
+        if (n == 0) return true;
+        *length -= n;
+    }
+    while (*length > 0) {
+        int r = adb_read(fd, &state.buffer[0], std::min(*length, state.buffer.size()));
+        if (r < 0) return false;
+        if (r == 0) return true;
+        if (!WriteFdExactly(s, &state.buffer[0], r)) return false;
+        *length -= r;
+    }
+    return true;
+}
+
+#ifndef F2FS_SUPER_MAGIC
+#define F2FS_SUPER_MAGIC 0xF2F52010
+#endif
+#ifndef SDCARDFS_SUPER_MAGIC
+#define SDCARDFS_SUPER_MAGIC 0x5DCA2DF5
+#endif
+
+// Whether st_size of a regular file on the filesystem of |fd| is the size of
+// its content, so that chunks of it can be promised before they're read.
+// sysfs, procfs, debugfs and the like report a page, or nothing, instead.
+static bool is_size_trusted(int fd) {
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) == -1) return false;
+    switch (static_cast<uint32_t>(sfs.f_type)) {
+      case EXT4_SUPER_MAGIC:
+      case F2FS_SUPER_MAGIC:
+      case MSDOS_SUPER_MAGIC:
+      case SDCARDFS_SUPER_MAGIC:
+      case SQUASHFS_MAGIC:
+      case TMPFS_MAGIC:
+        return true;
+      default:
+        return false;
+    }
+}
+
 static bool handle_send_file(int s, const char* path, uid_t uid,
-                             gid_t gid, mode_t mode, std::vector<char>& buffer, bool do_unlink) {
+                             gid_t gid, mode_t mode, SyncState& state, bool do_unlink) {
+    std::vector<char>& buffer = state.buffer;
     syncmsg msg;
     unsigned int timestamp = 0;
 
@@ -185,7 +336,7 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
     while (true) {
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
 
-        if (msg.data.id != ID_DATA) {
+        if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             if (msg.data.id == ID_DONE) {
                 timestamp = msg.data.size;
                 break;
@@ -199,9 +350,29 @@ static bool handle_send_file(int s, const char* path, uid_t uid,
             goto abort;
         }
 
+        if (msg.data.id == ID_DATA) {
+            int write_errno;
+            if (!receive_file_data(s, fd, msg.data.size, state, &write_errno)) goto abort;
+            if (write_errno != 0) {
+                errno = write_errno;
+                SendSyncFailErrno(s, "write failed");
+                goto fail;
+            }
+            continue;
+        }
+
         if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
 
-        if (!WriteFdExactly(fd, &buffer[0], msg.data.size)) {
+        std::vector<char>& inflated = state.scratch;
+        inflated.resize(SYNC_DATA_MAX_V2);
+        size_t inflated_length;
+        if (!state.compressor.Decompress(&buffer[0], msg.data.size,
+                                         &inflated[0], inflated.size(), &inflated_length)) {
+            SendSyncFail(s, "invalid compressed data message");
+            goto abort;
+        }
+
+        if (!WriteFdExactly(fd, &inflated[0], inflated_length)) {
             SendSyncFailErrno(s, "write failed");
             goto fail;
         }
@@ -230,7 +401,7 @@ fail:
 
         if (msg.data.id == ID_DONE) {
             goto abort;
-        } else if (msg.data.id != ID_DATA) {
+        } else if (msg.data.id != ID_DATA && msg.data.id != ID_ZDAT) {
             char id[5];
             memcpy(id, &msg.data.id, sizeof(msg.data.id));
             id[4] = '\0';
@@ -303,7 +474,7 @@ static bool handle_send_link(int s, const std::string& path, std::vector<char>&
 }
 #endif
 
-static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
+static bool do_send(int s, const std::string& spec, SyncState& state) {
     // 'spec' is of the form "/some/path,0755". Break it up.
     size_t comma = spec.find_last_of(',');
     if (comma == std::string::npos) {
@@ -328,7 +499,7 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
     }
 
     if (S_ISLNK(mode)) {
-        return handle_send_link(s, path.c_str(), buffer);
+        return handle_send_link(s, path.c_str(), state.buffer);
     }
 
     // Copy user permission bits to "group" and "other" permissions.
@@ -344,10 +515,15 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
         fs_config(path.c_str(), 0, nullptr, &uid, &gid, &broken_api_hack, &cap);
         mode = broken_api_hack;
     }
-    return handle_send_file(s, path.c_str(), uid, gid, mode, buffer, do_unlink);
+    return handle_send_file(s, path.c_str(), uid, gid, mode, state, do_unlink);
 }
 
-static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
+// Chunks are sent as ID_ZDAT where that makes them smaller if compress is
+// set. Otherwise a regular file on a filesystem whose sizes can be trusted
+// is sent straight from the file as far as the size it had when opened, the
+// header of each chunk having promised its size. Files elsewhere, such as
+// sysfs attributes that all claim a page, are sent as they're read.
+static bool do_recv(int s, const char* path, SyncState& state, bool compress) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     int fd = adb_open(path, O_RDONLY | O_CLOEXEC);
@@ -356,18 +532,63 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
         return false;
     }
 
+    struct stat st;
+    uint64_t remaining = 0;
+    if (!compress && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && is_size_trusted(fd)) {
+        remaining = st.st_size;
+    }
+    bool use_sendfile = true;
+
+    std::vector<char>& buffer = state.buffer;
+    std::vector<char>& deflated = state.scratch;
+    state.compressor.StartFile();
     syncmsg msg;
-    msg.data.id = ID_DATA;
+    while (remaining > 0) {
+        size_t length = std::min<uint64_t>(remaining, state.max_chunk);
+        size_t unsent = length;
+        msg.data.id = ID_DATA;
+        msg.data.size = length;
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
+                !send_file_data(s, fd, &unsent, state, &use_sendfile)) {
+            adb_close(fd);
+            return false;
+        }
+        if (unsent > 0) {
+            // The file was truncated as it was sent. Make up the chunk that
+            // was promised so that the failure reaches the client intact.
+            adb_close(fd);
+            std::fill(buffer.begin(), buffer.begin() + std::min(unsent, buffer.size()), 0);
+            while (unsent > 0) {
+                size_t n = std::min(unsent, buffer.size());
+                if (!WriteFdExactly(s, &buffer[0], n)) return false;
+                unsent -= n;
+            }
+            SendSyncFail(s, "file truncated while being read");
+            return false;
+        }
+        remaining -= length;
+    }
+
+    // Anything else, including anything the file has grown by, is read a
+    // chunk at a time.
     while (true) {
-        int r = adb_read(fd, &buffer[0], buffer.size());
+        int r = adb_read(fd, &buffer[0], state.max_chunk);
         if (r <= 0) {
             if (r == 0) break;
             SendSyncFailErrno(s, "read failed");
             adb_close(fd);
             return false;
         }
+        const char* data = &buffer[0];
+        msg.data.id = ID_DATA;
         msg.data.size = r;
-        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, &buffer[0], r)) {
+        if (compress && state.compressor.Compress(&buffer[0], r, &deflated)) {
+            data = &deflated[0];
+            msg.data.id = ID_ZDAT;
+            msg.data.size = deflated.size();
+        }
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
+                !WriteFdExactly(s, data, msg.data.size)) {
             adb_close(fd);
             return false;
         }
@@ -380,7 +601,7 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
     return WriteFdExactly(s, &msg.data, sizeof(msg.data));
 }
 
-static bool handle_sync_command(int fd, std::vector<char>& buffer) {
+static bool handle_sync_command(int fd, SyncState& state) {
     D("sync: waiting for request");
 
     SyncRequest request;
@@ -411,10 +632,16 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
         if (!do_list(fd, name)) return false;
         break;
       case ID_SEND:
-        if (!do_send(fd, name, buffer)) return false;
+        if (!do_send(fd, name, state)) return false;
         break;
       case ID_RECV:
-        if (!do_recv(fd, name, buffer)) return false;
+        if (!do_recv(fd, name, state, false)) return false;
+        break;
+      case ID_RCVZ:
+        if (!do_recv(fd, name, state, true)) return false;
+        break;
+      case ID_LRGE:
+        state.max_chunk = SYNC_DATA_MAX_V2;
         break;
       case ID_QUIT:
         return false;
@@ -428,9 +655,9 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
 }
 
 void file_sync_service(int fd, void* cookie) {
-    std::vector<char> buffer(SYNC_DATA_MAX);
+    SyncState state(SYNC_DATA_MAX);
 
-    while (handle_sync_command(fd, buffer)) {
+    while (handle_sync_command(fd, state)) {
     }
 
     D("sync: done");
@@ -32,6 +32,13 @@
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+// With kFeatureSyncDeflate, an ID_DATA chunk deflated by SyncCompressor,
+// and an ID_RECV request answered with those where they are smaller.
+#define ID_ZDAT MKID('Z','D','A','T')
+#define ID_RCVZ MKID('R','C','V','Z')
+// With kFeatureSyncLargeChunks, a request for chunks of up to
+// SYNC_DATA_MAX_V2 for the rest of the connection.
+#define ID_LRGE MKID('L','R','G','E')
 
 struct SyncRequest {
     uint32_t id;  // ID_STAT, et cetera.
@@ -72,5 +79,7 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst,
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only);
 
 #define SYNC_DATA_MAX (64*1024)
+// MAX_PAYLOAD_V2, the largest chunk with kFeatureSyncLargeChunks
+#define SYNC_DATA_MAX_V2 (256*1024)
 
 #endif
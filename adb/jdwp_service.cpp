@@ -26,6 +26,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "adb.h"
 #include "adb_utils.h"
 
@@ -176,6 +178,22 @@ jdwp_process_list_msg( char*  buffer, int  bufferlen )
 
 static void  jdwp_process_list_updated(void);
 
+/* the list of pids, as a message if 'msg' is set, in a packet
+ * sized for it rather than for the largest payload
+ */
+static apacket*
+jdwp_process_list_packet( asocket*  s, bool  msg )
+{
+    char  buffer[MAX_PAYLOAD_V1];
+    int   size = std::min<size_t>(sizeof(buffer), s->get_max_payload());
+    int   len  = msg ? jdwp_process_list_msg(buffer, size)
+                     : jdwp_process_list(buffer, size);
+    apacket*  p = get_apacket(len);
+    memcpy(p->data, buffer, len);
+    p->len = len;
+    return p;
+}
+
 static void
 jdwp_process_free( JdwpProcess*  proc )
 {
@@ -599,9 +617,7 @@ jdwp_socket_ready( asocket*  s )
     * on the second one, close the connection
     */
     if (jdwp->pass == 0) {
-        apacket*  p = get_apacket();
-        p->len = jdwp_process_list((char*)p->data, s->get_max_payload());
-        peer->enqueue(peer, p);
+        peer->enqueue(peer, jdwp_process_list_packet(s, false));
         jdwp->pass = 1;
     }
     else {
@@ -645,18 +661,11 @@ static JdwpTracker   _jdwp_trackers_list;
 static void
 jdwp_process_list_updated(void)
 {
-    char             buffer[1024];
-    int              len;
     JdwpTracker*  t = _jdwp_trackers_list.next;
 
-    len = jdwp_process_list_msg(buffer, sizeof(buffer));
-
     for ( ; t != &_jdwp_trackers_list; t = t->next ) {
-        apacket*  p    = get_apacket();
         asocket*  peer = t->socket.peer;
-        memcpy(p->data, buffer, len);
-        p->len = len;
-        peer->enqueue( peer, p );
+        peer->enqueue( peer, jdwp_process_list_packet(&t->socket, true) );
     }
 }
 
@@ -685,10 +694,8 @@ jdwp_tracker_ready( asocket*  s )
     JdwpTracker*  t = (JdwpTracker*) s;
 
     if (t->need_update) {
-        apacket*  p = get_apacket();
         t->need_update = 0;
-        p->len = jdwp_process_list_msg((char*)p->data, s->get_max_payload());
-        s->peer->enqueue(s->peer, p);
+        s->peer->enqueue(s->peer, jdwp_process_list_packet(s, true));
     }
 }
 
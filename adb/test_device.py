@@ -657,6 +657,16 @@ class FileOperationsTest(DeviceTest):
             host_md5 = compute_md5(host_file.read())
             self.assertEqual(host_md5, checksum)
 
+    def _remote_checksums(self, remote_dir):
+        """Map the names of the files in remote_dir to their checksums."""
+        _, out, _ = self.device.shell_nocheck(
+            [get_md5_prog(self.device), posixpath.join(remote_dir, '*')])
+        checksums = {}
+        for line in out.splitlines():
+            checksum, path = line.split()
+            checksums[posixpath.basename(path)] = checksum
+        return checksums
+
     def test_push(self):
         """Push a randomly generated file to specified device."""
         kbytes = 512
@@ -783,6 +793,51 @@ class FileOperationsTest(DeviceTest):
 
             self.assertIn('Permission denied', output)
 
+    def test_push_dir_failure(self):
+        """Push many small files, one of which the device can't write.
+
+        adbd closes the connection after failing a file, dropping the files
+        sent after it. The failure must be reported against that file, and
+        the files after it still pushed.
+        """
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', self.DEVICE_TEMP_DIR])
+
+        try:
+            host_dir = tempfile.mkdtemp()
+
+            # Make sure the temp directory isn't setuid, or else adb will complain.
+            os.chmod(host_dir, 0o700)
+
+            temp_files = make_random_host_files(in_dir=host_dir, num_files=300)
+            remote_dir = posixpath.join(self.DEVICE_TEMP_DIR,
+                                        os.path.basename(host_dir))
+
+            # A directory in the way fails the file.
+            bad_file = temp_files[len(temp_files) // 2]
+            bad_path = posixpath.join(remote_dir, bad_file.base_name)
+            self.device.shell(['mkdir', '-p', bad_path])
+
+            try:
+                self.device.push(host_dir, self.DEVICE_TEMP_DIR)
+                self.fail('push should not have succeeded')
+            except subprocess.CalledProcessError as e:
+                output = e.output
+
+            self.assertEqual(1, output.count('failed to copy'))
+            self.assertIn("failed to copy '{}' to '{}'".format(
+                bad_file.full_path, bad_path), output)
+
+            checksums = self._remote_checksums(remote_dir)
+            for temp_file in temp_files:
+                if temp_file is not bad_file:
+                    self.assertEqual(temp_file.checksum,
+                                     checksums.get(temp_file.base_name))
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
     def _test_pull(self, remote_file, checksum):
         tmp_write = tempfile.NamedTemporaryFile(mode='wb', delete=False)
         tmp_write.close()
@@ -807,6 +862,61 @@ class FileOperationsTest(DeviceTest):
 
         self.device.shell(['rm', '-f', self.DEVICE_TEMP_FILE])
 
+    def test_pull_dir_failure(self):
+        """Pull many small files, one of which the device can't read.
+
+        adbd closes the connection after failing a file, dropping the
+        requests for the files after it. The failure must be reported
+        against that file, and the files after it still pulled.
+        """
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', '-p', self.DEVICE_TEMP_DIR])
+
+        try:
+            host_dir = tempfile.mkdtemp()
+
+            # Files are pulled ahead of the links beside them, and those
+            # ahead of the subdirectories, so the dangling link that fails
+            # is pulled between the two halves of the files.
+            src_dir = os.path.join(host_dir, 'src')
+            os.mkdir(src_dir)
+            os.chmod(src_dir, 0o700)
+            temp_files = make_random_host_files(in_dir=src_dir, num_files=150)
+            subdir = os.path.join(src_dir, 'subdir')
+            os.mkdir(subdir)
+            subdir_temp_files = make_random_host_files(in_dir=subdir,
+                                                       num_files=150)
+            self.device.push(src_dir, self.DEVICE_TEMP_DIR)
+
+            remote_dir = posixpath.join(self.DEVICE_TEMP_DIR, 'src')
+            bad_path = posixpath.join(remote_dir, 'dangling')
+            self.device.shell(['ln', '-s', '/nonexistent', bad_path])
+
+            dst_dir = os.path.join(host_dir, 'dst')
+            os.mkdir(dst_dir)
+            try:
+                self.device.pull(remote=remote_dir, local=dst_dir)
+                self.fail('pull should not have succeeded')
+            except subprocess.CalledProcessError as e:
+                output = e.output
+
+            self.assertEqual(1, output.count('failed to copy'))
+            self.assertIn("failed to copy '{}' to '{}'".format(
+                bad_path, os.path.join(dst_dir, 'src', 'dangling')), output)
+
+            for temp_file in temp_files:
+                local_path = os.path.join(dst_dir, 'src', temp_file.base_name)
+                self._verify_local(temp_file.checksum, local_path)
+            for subdir_temp_file in subdir_temp_files:
+                local_path = os.path.join(dst_dir, 'src', 'subdir',
+                                          subdir_temp_file.base_name)
+                self._verify_local(subdir_temp_file.checksum, local_path)
+
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
     def test_pull(self):
         """Pull a randomly generated file from specified device."""
         kbytes = 512
@@ -820,6 +930,32 @@ class FileOperationsTest(DeviceTest):
         self._test_pull(self.DEVICE_TEMP_FILE, dev_md5)
         self.device.shell_nocheck(['rm', self.DEVICE_TEMP_FILE])
 
+    def test_pull_short_file(self):
+        """Pull a file holding less than its st_size, as sysfs files do."""
+        remote_file = '/sys/devices/system/cpu/online'
+        size = int(self.device.shell(['stat', '-c', '%s', remote_file])[0])
+        contents = self.device.shell(['cat', remote_file])[0]
+        if size <= len(contents):
+            raise unittest.SkipTest('{} is not short'.format(remote_file))
+        self._test_pull(remote_file, compute_md5(contents))
+
+    def test_push_pull_chunk_boundaries(self):
+        """Push and pull files sized around the 256k sync chunk."""
+        chunk = 256 * 1024
+        for size in [chunk - 1, chunk, chunk + 1, 4 * chunk + 1]:
+            tmp = tempfile.NamedTemporaryFile(mode='wb', delete=False)
+            rand_str = os.urandom(size)
+            tmp.write(rand_str)
+            tmp.close()
+
+            self.device.shell(['rm', '-f', self.DEVICE_TEMP_FILE])
+            self.device.push(local=tmp.name, remote=self.DEVICE_TEMP_FILE)
+            self._verify_remote(compute_md5(rand_str), self.DEVICE_TEMP_FILE)
+            self._test_pull(self.DEVICE_TEMP_FILE, compute_md5(rand_str))
+
+            self.device.shell(['rm', '-f', self.DEVICE_TEMP_FILE])
+            os.remove(tmp.name)
+
     def test_pull_dir(self):
         """Pull a randomly generated directory of files from the device."""
         try:
@@ -47,6 +47,8 @@ ADB_MUTEX_DEFINE( transport_lock );
 
 const char* const kFeatureShell2 = "shell_v2";
 const char* const kFeatureCmd = "cmd";
+const char* const kFeatureSyncDeflate = "sync_deflate";
+const char* const kFeatureSyncLargeChunks = "sync_large_chunks";
 
 static std::string dump_packet(const char* name, const char* func, apacket* p) {
     unsigned  command = p->msg.command;
@@ -199,7 +201,7 @@ static void read_transport_thread(void* _t) {
                                                    (t->serial != nullptr ? t->serial : "transport")));
     D("%s: starting read_transport thread on fd %d, SYNC online (%d)",
        t->serial, t->fd, t->sync_token + 1);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 1;
     p->msg.arg1 = ++(t->sync_token);
@@ -212,9 +214,9 @@ static void read_transport_thread(void* _t) {
 
     D("%s: data pump started", t->serial);
     for(;;) {
-        p = get_apacket();
+        p = get_apacket(0);
 
-        if(t->read_from_remote(p, t) == 0){
+        if(t->read_from_remote(&p, t) == 0){
             D("%s: received remote packet, sending to transport",
               t->serial);
             if(write_packet(t->fd, t->serial, &p)){
@@ -230,7 +232,7 @@ static void read_transport_thread(void* _t) {
     }
 
     D("%s: SYNC offline for transport", t->serial);
-    p = get_apacket();
+    p = get_apacket(0);
     p->msg.command = A_SYNC;
     p->msg.arg0 = 0;
     p->msg.arg1 = 0;
@@ -369,7 +371,8 @@ device_tracker_enqueue( asocket*  socket, apacket*  p )
 }
 
 static int device_tracker_send(device_tracker* tracker, const std::string& string) {
-    apacket* p = get_apacket();
+    // Room for the length prefix and the terminating NUL snprintf writes.
+    apacket* p = get_apacket(4 + string.size() + 1);
     asocket* peer = tracker->socket.peer;
 
     snprintf(reinterpret_cast<char*>(p->data), 5, "%04x", static_cast<int>(string.size()));
@@ -784,7 +787,9 @@ const FeatureSet& supported_features() {
     // Local static allocation to avoid global non-POD variables.
     static const FeatureSet* features = new FeatureSet{
         kFeatureShell2,
-        kFeatureCmd
+        kFeatureCmd,
+        kFeatureSyncDeflate,
+        kFeatureSyncLargeChunks
         // Increment ADB_SERVER_VERSION whenever the feature list changes to
         // make sure that the adb client and server features stay in sync
         // (http://b/24370690).
@@ -41,6 +41,10 @@ bool CanUseFeature(const FeatureSet& feature_set, const std::string& feature);
 extern const char* const kFeatureShell2;
 // The 'cmd' command is available
 extern const char* const kFeatureCmd;
+// The sync service takes ID_ZDAT chunks and ID_RCVZ requests
+extern const char* const kFeatureSyncDeflate;
+// The sync service takes and sends chunks of up to SYNC_DATA_MAX_V2
+extern const char* const kFeatureSyncLargeChunks;
 
 class atransport {
 public:
@@ -57,7 +61,10 @@ public:
 
     virtual ~atransport() {}
 
-    int (*read_from_remote)(apacket* p, atransport* t) = nullptr;
+    // Reads a packet into *p, which starts out header-only. The transport
+    // resizes it, see resize_apacket(), once the header says how much payload
+    // follows.
+    int (*read_from_remote)(apacket** p, atransport* t) = nullptr;
     int (*write_to_remote)(apacket* p, atransport* t) = nullptr;
     void (*close)(atransport* t) = nullptr;
     void SetKickFunction(void (*kick_func)(atransport*)) {
@@ -53,8 +53,9 @@ ADB_MUTEX_DEFINE(local_transports_lock);
 static atransport*  local_transports[ ADB_LOCAL_TRANSPORT_MAX ];
 #endif /* ADB_HOST */
 
-static int remote_read(apacket *p, atransport *t)
+static int remote_read(apacket **pp, atransport *t)
 {
+    apacket *p = *pp;
     if(!ReadFdExactly(t->sfd, &p->msg, sizeof(amessage))){
         D("remote local: read terminated (message)");
         return -1;
@@ -65,6 +66,8 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
+    p = *pp = resize_apacket(p, p->msg.data_length);
+
     if(!ReadFdExactly(t->sfd, p->data, p->msg.data_length)){
         D("remote local: terminated (data)");
         return -1;
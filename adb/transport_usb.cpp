@@ -25,8 +25,9 @@
 
 #include "adb.h"
 
-static int remote_read(apacket *p, atransport *t)
+static int remote_read(apacket **pp, atransport *t)
 {
+    apacket *p = *pp;
     if(usb_read(t->usb, &p->msg, sizeof(amessage))){
         D("remote usb: read terminated (message)");
         return -1;
@@ -37,6 +38,8 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
+    p = *pp = resize_apacket(p, p->msg.data_length);
+
     if(p->msg.data_length) {
         if(usb_read(t->usb, p->data, p->msg.data_length)){
             D("remote usb: terminated (data)");
@@ -61,7 +64,7 @@ static int remote_write(apacket *p, atransport *t)
         return -1;
     }
     if(p->msg.data_length == 0) return 0;
-    if(usb_write(t->usb, &p->data, size)) {
+    if(usb_write(t->usb, p->data, size)) {
         D("remote usb: 2 - write terminated");
         return -1;
     }
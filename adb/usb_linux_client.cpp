@@ -21,12 +21,14 @@
 #include <cutils/properties.h>
 #include <dirent.h>
 #include <errno.h>
+#include <linux/aio_abi.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -49,11 +51,34 @@
 // fragmentation. 16k chosen arbitrarily to match the write limit.
 #define USB_FFS_MAX_READ 16384
 
+// Transfers queued at once on each FunctionFS bulk endpoint, so the controller
+// has the next one to hand when one completes.
+#define USB_FFS_NUM_BUFS 16
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
 static int dummy_fd = -1;
 
+// The transfers in flight on a FunctionFS bulk endpoint, by kernel AIO. ctx is
+// 0 if the kernel can't do AIO on FunctionFS (before 3.15), and the endpoint is
+// read or written a transfer at a time instead.
+struct aio_block {
+    aio_context_t ctx;
+    // Held to submit or cancel, usb_ffs_kick cancels from another thread.
+    adb_mutex_t lock;
+    struct iocb iocb[USB_FFS_NUM_BUFS];
+    struct io_event events[USB_FFS_NUM_BUFS];
+    // A slot is busy from submission until its result has been taken.
+    bool busy[USB_FFS_NUM_BUFS];
+    bool completed[USB_FFS_NUM_BUFS];
+    int64_t result[USB_FFS_NUM_BUFS];
+    // Transfers submitted and not yet completed.
+    int pending;
+    // Until something has been submitted, EINVAL from io_submit means no AIO.
+    bool submitted;
+};
+
 struct usb_handle
 {
     adb_cond_t notify;
@@ -73,6 +98,8 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+    aio_block read_aiob;   // bulk_out
+    aio_block write_aiob;  // bulk_in
 };
 
 struct func_desc {
@@ -491,7 +518,174 @@ static void usb_ffs_open_thread(void* x) {
     abort();
 }
 
-static int usb_ffs_write(usb_handle* h, const void* data, int len) {
+// bionic has no wrappers for the AIO system calls.
+static int io_setup(unsigned nr, aio_context_t* ctx) {
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx) {
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb** iocbs) {
+    return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event* events,
+                        struct timespec* timeout) {
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static int io_cancel(aio_context_t ctx, struct iocb* iocb, struct io_event* result) {
+    return syscall(__NR_io_cancel, ctx, iocb, result);
+}
+
+static void aio_block_init(aio_block* aiob) {
+    adb_mutex_init(&aiob->lock, 0);
+    if (io_setup(USB_FFS_NUM_BUFS, &aiob->ctx) == -1) {
+        D("[ aio: io_setup failed: errno=%d ]", errno);
+        aiob->ctx = 0;
+    }
+}
+
+// Gives up on AIO for the endpoint, with nothing in flight. Under the lock,
+// usb_ffs_kick may be cancelling from another thread.
+static void aio_block_disable(aio_block* aiob) {
+    D("[ aio: not supported, falling back to synchronous I/O ]");
+    adb_mutex_lock(&aiob->lock);
+    io_destroy(aiob->ctx);
+    aiob->ctx = 0;
+    adb_mutex_unlock(&aiob->lock);
+}
+
+static int aio_free_slot(aio_block* aiob) {
+    for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+        if (!aiob->busy[i]) return i;
+    }
+    return -1;
+}
+
+// Queues a transfer of len bytes between buf and fd in slot.
+static bool aio_submit(aio_block* aiob, int slot, int fd, uint16_t opcode, void* buf,
+                       size_t len) {
+    struct iocb* iocb = &aiob->iocb[slot];
+    adb_mutex_lock(&aiob->lock);
+    memset(iocb, 0, sizeof(*iocb));
+    iocb->aio_data = slot;
+    iocb->aio_lio_opcode = opcode;
+    iocb->aio_fildes = fd;
+    iocb->aio_buf = reinterpret_cast<uintptr_t>(buf);
+    iocb->aio_nbytes = len;
+    bool ok = io_submit(aiob->ctx, 1, &iocb) == 1;
+    adb_mutex_unlock(&aiob->lock);
+    if (!ok) {
+        return false;
+    }
+    aiob->busy[slot] = true;
+    aiob->completed[slot] = false;
+    aiob->pending++;
+    aiob->submitted = true;
+    return true;
+}
+
+// Waits for at least min of the transfers in flight to complete, or if min
+// is 0 collects those that already have, leaving each result in its slot.
+// Returns false if waiting fails.
+static bool aio_reap(aio_block* aiob, int min) {
+    struct timespec zero = {};
+    int n = TEMP_FAILURE_RETRY(io_getevents(aiob->ctx, min, USB_FFS_NUM_BUFS, aiob->events,
+                                            min ? nullptr : &zero));
+    if (n < 0) {
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        const struct io_event& event = aiob->events[i];
+        int slot = event.data;
+        aiob->completed[slot] = true;
+        aiob->result[slot] = event.res;
+        aiob->pending--;
+    }
+    return true;
+}
+
+// Cancels the transfers in flight. Any slot may be passed to io_cancel, it
+// just fails for those not in flight.
+static void aio_cancel_all(aio_block* aiob) {
+    adb_mutex_lock(&aiob->lock);
+    if (aiob->ctx != 0) {
+        for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+            struct io_event event;
+            io_cancel(aiob->ctx, &aiob->iocb[i], &event);
+        }
+    }
+    adb_mutex_unlock(&aiob->lock);
+}
+
+// Cancels the transfers in flight and waits for them, the caller's buffer
+// must be done with before it's returned. Leaves errno as it was, for the
+// error being reported.
+static void aio_drain(aio_block* aiob) {
+    if (aiob->ctx == 0) return;
+    int saved_errno = errno;
+    aio_cancel_all(aiob);
+    while (aiob->pending > 0) {
+        if (!aio_reap(aiob, 1)) break;
+    }
+    memset(aiob->busy, 0, sizeof(aiob->busy));
+    aiob->pending = 0;
+    errno = saved_errno;
+}
+
+// Frees the slots of completed writes. Returns false if any failed; an IN
+// transfer completes in full or not at all.
+static bool aio_finish_writes(aio_block* aiob) {
+    bool ok = true;
+    for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+        if (!aiob->busy[i] || !aiob->completed[i]) continue;
+        aiob->busy[i] = false;
+        if (aiob->result[i] != static_cast<int64_t>(aiob->iocb[i].aio_nbytes)) {
+            errno = (aiob->result[i] < 0) ? -aiob->result[i] : EIO;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Cancels the writes left in flight and reaps them, logging those that
+// didn't go out in full before the slots are freed.
+static void aio_drain_writes(aio_block* aiob, int fd) {
+    if (aiob->ctx == 0) return;
+    aio_cancel_all(aiob);
+    while (aiob->pending > 0) {
+        if (!aio_reap(aiob, 1)) {
+            D("ERROR: fd = %d: %s", fd, strerror(errno));
+            break;
+        }
+    }
+    for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+        if (!aiob->busy[i] || !aiob->completed[i]) continue;
+        if (aiob->result[i] != static_cast<int64_t>(aiob->iocb[i].aio_nbytes)) {
+            D("ERROR: fd = %d, write of %llu bytes left at close: %s", fd,
+              static_cast<unsigned long long>(aiob->iocb[i].aio_nbytes),
+              aiob->result[i] < 0 ? strerror(-aiob->result[i]) : "short");
+        }
+    }
+    aio_drain(aiob);
+}
+
+// The busy read slot that starts lowest in the caller's buffer, -1 if none.
+static int aio_first_read(aio_block* aiob) {
+    int first = -1;
+    for (int i = 0; i < USB_FFS_NUM_BUFS; ++i) {
+        if (aiob->busy[i] &&
+            (first == -1 || aiob->iocb[i].aio_buf < aiob->iocb[first].aio_buf)) {
+            first = i;
+        }
+    }
+    return first;
+}
+
+static int usb_ffs_sync_write(usb_handle* h, const void* data, int len) {
     D("about to write (fd=%d, len=%d)", h->bulk_in, len);
 
     const char* buf = static_cast<const char*>(data);
@@ -510,7 +704,7 @@ static int usb_ffs_write(usb_handle* h, const void* data, int len) {
     return 0;
 }
 
-static int usb_ffs_read(usb_handle* h, void* data, int len) {
+static int usb_ffs_sync_read(usb_handle* h, void* data, int len) {
     D("about to read (fd=%d, len=%d)", h->bulk_out, len);
 
     char* buf = static_cast<char*>(data);
@@ -529,6 +723,115 @@ static int usb_ffs_read(usb_handle* h, void* data, int len) {
     return 0;
 }
 
+// Queues the transfers straight from data, and returns once they have all
+// completed, so that a failed transfer is reported by the write it belongs
+// to, the last one before the link goes quiet included.
+static int usb_ffs_aio_write(usb_handle* h, const void* data, int len) {
+    aio_block* aiob = &h->write_aiob;
+    D("about to write (fd=%d, len=%d)", h->bulk_in, len);
+
+    const char* buf = static_cast<const char*>(data);
+    int tail = 0;  // Where the next transfer starts, past those in flight.
+    while (tail < len || aiob->pending > 0) {
+        while (tail < len && aiob->pending < USB_FFS_NUM_BUFS) {
+            int slot = aio_free_slot(aiob);
+            int write_len = std::min(USB_FFS_MAX_WRITE, len - tail);
+            if (!aio_submit(aiob, slot, h->bulk_in, IOCB_CMD_PWRITE,
+                            const_cast<char*>(buf + tail), write_len)) {
+                if (errno == EINVAL && !aiob->submitted) {
+                    aio_block_disable(aiob);
+                    return usb_ffs_sync_write(h, buf, len);
+                }
+                D("ERROR: fd = %d, io_submit: %s", h->bulk_in, strerror(errno));
+                aio_drain(aiob);
+                return -1;
+            }
+            tail += write_len;
+        }
+        if (!aio_reap(aiob, 1) || !aio_finish_writes(aiob)) {
+            D("ERROR: fd = %d: %s", h->bulk_in, strerror(errno));
+            aio_drain(aiob);
+            return -1;
+        }
+    }
+
+    D("[ done fd=%d ]", h->bulk_in);
+    return 0;
+}
+
+// Queues the transfers straight into data, and returns once len bytes have
+// arrived. An OUT transfer may complete short, down to a zero length packet,
+// as the synchronous read loop allowed; the data of the transfers queued
+// behind it is then moved down to follow on, and the rest read after.
+static int usb_ffs_aio_read(usb_handle* h, void* data, int len) {
+    aio_block* aiob = &h->read_aiob;
+    D("about to read (fd=%d, len=%d)", h->bulk_out, len);
+
+    char* buf = static_cast<char*>(data);
+    int done = 0;  // Bytes at the start of buf that have arrived.
+    int tail = 0;  // Where the next transfer goes, past those in flight.
+    while (done < len) {
+        while (tail < len && aiob->pending < USB_FFS_NUM_BUFS) {
+            int slot = aio_free_slot(aiob);
+            int read_len = std::min(USB_FFS_MAX_READ, len - tail);
+            if (!aio_submit(aiob, slot, h->bulk_out, IOCB_CMD_PREAD, buf + tail, read_len)) {
+                if (errno == EINVAL && !aiob->submitted) {
+                    aio_block_disable(aiob);
+                    return usb_ffs_sync_read(h, buf, len);
+                }
+                D("ERROR: fd = %d, io_submit: %s", h->bulk_out, strerror(errno));
+                aio_drain(aiob);
+                return -1;
+            }
+            tail += read_len;
+        }
+        if (!aio_reap(aiob, 1)) {
+            D("ERROR: fd = %d: %s", h->bulk_out, strerror(errno));
+            aio_drain(aiob);
+            return -1;
+        }
+
+        // Take the transfers that have completed, in order.
+        int slot;
+        while ((slot = aio_first_read(aiob)) != -1 && aiob->completed[slot]) {
+            int64_t res = aiob->result[slot];
+            if (res < 0) {
+                errno = -res;
+                D("ERROR: fd = %d: %s", h->bulk_out, strerror(errno));
+                aio_drain(aiob);
+                return -1;
+            }
+            char* slot_buf = reinterpret_cast<char*>(aiob->iocb[slot].aio_buf);
+            if (slot_buf != buf + done) {
+                memmove(buf + done, slot_buf, res);
+            }
+            done += res;
+            aiob->busy[slot] = false;
+        }
+        if (slot == -1) {
+            // Short transfers left a gap, carry on from what has arrived.
+            tail = done;
+        }
+    }
+
+    D("[ done fd=%d ]", h->bulk_out);
+    return 0;
+}
+
+static int usb_ffs_write(usb_handle* h, const void* data, int len) {
+    if (h->write_aiob.ctx != 0) {
+        return usb_ffs_aio_write(h, data, len);
+    }
+    return usb_ffs_sync_write(h, data, len);
+}
+
+static int usb_ffs_read(usb_handle* h, void* data, int len) {
+    if (h->read_aiob.ctx != 0) {
+        return usb_ffs_aio_read(h, data, len);
+    }
+    return usb_ffs_sync_read(h, data, len);
+}
+
 static void usb_ffs_kick(usb_handle *h)
 {
     int err;
@@ -550,10 +853,18 @@ static void usb_ffs_kick(usb_handle *h)
     h->kicked = true;
     TEMP_FAILURE_RETRY(dup2(dummy_fd, h->bulk_out));
     TEMP_FAILURE_RETRY(dup2(dummy_fd, h->bulk_in));
+
+    // Transfers already in flight don't see the dup2s, so cancel them.
+    aio_cancel_all(&h->read_aiob);
+    aio_cancel_all(&h->write_aiob);
 }
 
 static void usb_ffs_close(usb_handle *h) {
     h->kicked = false;
+    // A write or read the kick interrupted may have left transfers behind,
+    // they mustn't complete into the next connection.
+    aio_drain(&h->read_aiob);
+    aio_drain_writes(&h->write_aiob, h->bulk_in);
     adb_close(h->bulk_out);
     adb_close(h->bulk_in);
     // Notify usb_adb_open_thread to open a new connection.
@@ -578,6 +889,8 @@ static void usb_ffs_init()
     h->control = -1;
     h->bulk_out = -1;
     h->bulk_out = -1;
+    aio_block_init(&h->read_aiob);
+    aio_block_init(&h->write_aiob);
 
     h->open_new_connection = true;
     adb_cond_init(&h->notify, 0);
@@ -187,6 +187,18 @@ struct logger_list *android_logger_list_alloc_time(int mode,
                                                    log_time start,
                                                    pid_t pid);
 void android_logger_list_free(struct logger_list *logger_list);
+/*
+ * Ask logd to only send entries that pass these filters, to be called
+ * before the first read. Any may be NULL. tags is a list of filterspecs,
+ * <tag>[:priority], as understood by android_log_addFilterString(); uids
+ * a comma separated list; regex a POSIX extended regular expression
+ * matched against the message. Tag, priority and regex filters apply to
+ * the text log buffers only. logd may send more than asked for, so the
+ * caller must still apply its own filters. Returns 0 or -errno.
+ */
+int android_logger_list_set_filter(struct logger_list *logger_list,
+                                   const char *tags, const char *uids,
+                                   const char *regex);
 /* In the purest sense, the following two are orthogonal interfaces */
 int android_logger_list_read(struct logger_list *logger_list,
                              struct log_msg *log_msg);
@@ -131,6 +131,56 @@ int android_log_processBinaryLogBuffer(struct logger_entry *buf,
     int messageBufLen);
 
 
+/**
+ * Streaming decoder for the payload of a binary log entry, yielding typed
+ * values without formatting them. The state is kept by the caller, nothing
+ * is allocated or copied: strings point into the payload and are not
+ * NUL terminated.
+ */
+typedef struct AndroidEventLogDecoder_t {
+    const uint8_t *pos;
+    size_t len;         /* bytes left in the payload */
+    unsigned depth;     /* lists open */
+    int error;
+    /* elements left to decode at each depth, one at the top level */
+    uint8_t count[ANDROID_MAX_LIST_NEST_DEPTH + 1];
+} AndroidEventLogDecoder;
+
+typedef struct AndroidEventLogValue_t {
+    /*
+     * EVENT_TYPE_INT, EVENT_TYPE_LONG, EVENT_TYPE_FLOAT or
+     * EVENT_TYPE_STRING; EVENT_TYPE_LIST at the start of a list of len
+     * elements, followed by those and EVENT_TYPE_LIST_STOP.
+     */
+    AndroidEventLogType type;
+    unsigned depth;     /* lists enclosing the value */
+    size_t len;         /* of a string, or elements in a list */
+    union {
+        int32_t int32;
+        int64_t int64;
+        float float32;
+        const char *string;
+    } data;
+} AndroidEventLogValue;
+
+/**
+ * Start decoding the event data of a binary log entry, len bytes at
+ * payload, which follow the tag.
+ */
+void android_log_decoder_init(AndroidEventLogDecoder *decoder,
+                              const void *payload, size_t len);
+
+/**
+ * Decode the next value.
+ *
+ * Returns 1 and fills in value, 0 once the event data is complete, leaving
+ * any trailing bytes in decoder->len, or -1 on invalid data (value->type
+ * is then EVENT_TYPE_UNKNOWN, and so on for further calls).
+ */
+int android_log_decoder_next(AndroidEventLogDecoder *decoder,
+                             AndroidEventLogValue *value);
+
+
 /**
  * Formats a log message into a buffer
  *
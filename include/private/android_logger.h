@@ -98,10 +98,100 @@ typedef struct __attribute__((__packed__)) {
     char data[];
 } android_log_event_string_t;
 
+/*
+ * Optional shared memory ring from a process to logd. The writer opts in
+ * with __android_log_ring_enable(), and registers the ring with logd by a
+ * datagram on logdw with the header id LOGGER_RING_ID, a payload of
+ * android_log_ring_register_t, and the ring file descriptor attached as
+ * SCM_RIGHTS. The same datagram without a descriptor is a doorbell.
+ * The descriptor must be a memfd with at least LOGGER_RING_SEALS applied,
+ * so the size logd maps cannot change under it; logd rejects anything else.
+ *
+ * Writers reserve space by advancing reserve, fill in the record, then
+ * publish it by setting LOGGER_RING_READY in its state. logd drains
+ * records in order up to the first that is not yet ready, zeroes the space
+ * and advances read. logd sets doorbell before each pass, the writer that
+ * clears it after publishing a record sends the doorbell datagram.
+ */
+#define LOGGER_RING_ID     0xFF
+#define LOGGER_RING_MAGIC  0x676e6952 /* "Ring" */
+#define LOGGER_RING_MIN    4096
+#define LOGGER_RING_MAX    (1024 * 1024)
+#define LOGGER_RING_SEALS  0x0006 /* F_SEAL_SHRINK | F_SEAL_GROW */
+
+#define LOGGER_RING_READY  0x80000000U
+#define LOGGER_RING_PAD    0x40000000U /* skip to the start of the ring */
+#define LOGGER_RING_LENGTH 0x3FFFFFFFU /* bytes in record, 8 byte aligned */
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;
+    uint32_t size;
+} android_log_ring_register_t;
+
+/* Head of the shared memory, size bytes of records follow */
+typedef struct __attribute__((__aligned__(8))) {
+    uint32_t magic;
+    uint32_t size;     /* power of 2 */
+    uint32_t attached; /* set by logd once it accepts the ring */
+    uint32_t doorbell; /* set by logd when it wants to be woken */
+    uint64_t reserve;  /* writers, next offset to be allocated */
+    uint64_t read;     /* logd, next offset to be consumed */
+} android_log_ring_t;
+
+typedef struct __attribute__((__aligned__(8))) {
+    uint32_t state;    /* LOGGER_RING_* */
+    uint16_t id;
+    uint16_t len;      /* bytes of payload following */
+    uint32_t tid;
+    uint32_t reserved;
+    log_time realtime;
+} android_log_ring_record_t;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/*
+ * Send this process's logs to logd through a shared memory ring of size
+ * bytes, a power of 2 between LOGGER_RING_MIN and LOGGER_RING_MAX, rather
+ * than a socket write each. Messages fall back to the socket if the ring
+ * is full, or has not been accepted by logd. Returns 0 or -errno.
+ */
+int __android_log_ring_enable(size_t size);
+
+/*
+ * Switch this process to asynchronous logging. Messages are queued in a
+ * buffer of size bytes, a power of 2 between LOGGER_RING_MIN and
+ * LOGGER_RING_MAX, and written out by a background thread, so that a
+ * logging thread never waits on the transports. A message that does not
+ * fit is dropped with -EAGAIN. Security and fatal messages are written
+ * synchronously, after flushing the queue unless another thread is
+ * draining it already; they never wait, and nor does queueing, so either
+ * may come from a signal handler. Returns 0 or -errno.
+ */
+int __android_log_async_enable(size_t size);
+/*
+ * Write out all queued messages, waiting for any drain in progress. Not
+ * for signal handlers, a fatal message flushes without waiting.
+ */
+void __android_log_async_flush();
+
+/*
+ * Largest command a reader sends to logdr. Filters set with
+ * android_logger_list_set_filter() that do not fit are not sent.
+ */
+#define LOGGER_READER_COMMAND_MAX 4096
+
+/*
+ * Write the compiled, directly mappable, form of the event log tag map
+ * fileName to fd. android_openEventTagMap() prefers it when found next
+ * to the text map as fileName EVENT_TAG_MAP_COMPILED_SUFFIX, and the text
+ * map has the size it was compiled from and is no newer than it. Returns
+ * 0 or -errno.
+ */
+#define EVENT_TAG_MAP_COMPILED_SUFFIX ".bin"
+int android_compileEventTagMap(const char *fileName, int fd);
+
 #define ANDROID_LOG_PMSG_FILE_MAX_SEQUENCE 256 /* 1MB file */
 #define ANDROID_LOG_PMSG_FILE_SEQUENCE     1000
 
@@ -82,4 +82,15 @@ LOCAL_CXX_STL := none
 
 include $(BUILD_SHARED_LIBRARY)
 
+# Event log tag map compiler for host
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags-compile
+LOCAL_SRC_FILES := event_tag_map_compile.c
+LOCAL_CFLAGS := -Werror $(liblog_cflags)
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS_linux := -lrt
+LOCAL_MODULE_HOST_OS := darwin linux
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(call first-makefiles-under,$(LOCAL_PATH))
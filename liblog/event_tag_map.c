@@ -20,9 +20,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/event_tag_map.h>
 #include <log/log.h>
+#include <private/android_logger.h>
 
 #include "log_portability.h"
 
@@ -36,6 +39,30 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Compiled map, see android_compileEventTagMap(). Laid out as
+ *    EventTagMapHeader
+ *    EventTagMapEntry  entries[numTags], sorted by tag index
+ *    uint32_t          hash[hashSize], 1 + entry index, 0 if empty
+ *    char              strings[stringsSize], '\0' terminated tags
+ * in native byte order, so that it can be used straight from a shared
+ * read-only mapping.
+ */
+#define EVENT_TAG_MAP_MAGIC 0x334d5445 /* "ETM3" */
+
+typedef struct EventTagMapHeader {
+    uint32_t        magic;
+    uint32_t        numTags;
+    uint32_t        hashSize;       /* power of 2, > numTags */
+    uint32_t        stringsSize;
+    uint64_t        sourceSize;     /* of the text map it was compiled from */
+} EventTagMapHeader;
+
+typedef struct EventTagMapEntry {
+    uint32_t        tagIndex;
+    uint32_t        tagStr;         /* offset into strings */
+} EventTagMapEntry;
+
 /*
  * Map.
  */
@@ -47,9 +74,14 @@ struct EventTagMap {
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* or, the compiled map at mapAddr */
+    const EventTagMapHeader* compiled;
 };
 
 /* fwd */
+static EventTagMap* openCompiledMap(const char* fileName);
+static EventTagMap* openTextMap(const char* fileName);
 static int processFile(EventTagMap* map);
 static int countMapLines(const EventTagMap* map);
 static int parseMapLines(EventTagMap* map);
@@ -58,12 +90,123 @@ static int sortTags(EventTagMap* map);
 
 
 /*
- * Open the map file and allocate a structure to manage it.
+ * Open the map, preferring its compiled form, and allocate a structure
+ * to manage it.
+ */
+LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName)
+{
+    EventTagMap* newTagMap = openCompiledMap(fileName);
+
+    if (newTagMap == NULL)
+        newTagMap = openTextMap(fileName);
+
+    return newTagMap;
+}
+
+static uint32_t hashTagIndex(uint32_t tagIndex)
+{
+    return tagIndex * 2654435761U; /* Knuth multiplicative */
+}
+
+/*
+ * Check the compiled map is whole. Entry and string offsets are checked as
+ * they are used, so that opening does not touch every page.
+ */
+static int validCompiledMap(const EventTagMapHeader* header, size_t len)
+{
+    uint64_t size;
+
+    if ((len < sizeof(*header)) || (header->magic != EVENT_TAG_MAP_MAGIC)
+            || (header->hashSize <= header->numTags)
+            || (header->hashSize & (header->hashSize - 1))
+            || !header->stringsSize) {
+        return 0;
+    }
+    size = sizeof(*header)
+         + (uint64_t)header->numTags * sizeof(EventTagMapEntry)
+         + (uint64_t)header->hashSize * sizeof(uint32_t)
+         + header->stringsSize;
+    return (size == len) && (((const char*)header)[len - 1] == '\0');
+}
+
+/*
+ * Is the compiled map header, from a file of status compiled, current for
+ * the text map fileName? Without a text map to compare against, it stands.
+ * Otherwise the text map must have the size it was compiled from, and must
+ * not have been modified since. Image builds stamp every file with the same
+ * time, so a compiled map installed with its text map is used; a text map
+ * since edited in place on the device is not. Only stat(2) is consulted.
+ */
+static int currentCompiledMap(const EventTagMapHeader* header,
+                              const struct stat* compiled,
+                              const char* fileName)
+{
+    struct stat st;
+
+    if (stat(fileName, &st))
+        return 1;
+    return ((uint64_t)st.st_size == header->sourceSize)
+        && (st.st_mtime <= compiled->st_mtime);
+}
+
+/*
+ * Open fileName EVENT_TAG_MAP_COMPILED_SUFFIX, if there is one, and it is
+ * current for the text map we have. The mapping is shared and read-only,
+ * nothing is parsed or copied.
+ */
+static EventTagMap* openCompiledMap(const char* fileName)
+{
+    size_t nameLen = strlen(fileName);
+    char compiledName[nameLen + sizeof(EVENT_TAG_MAP_COMPILED_SUFFIX)];
+    EventTagMap* newTagMap;
+    const EventTagMapHeader* header;
+    struct stat st;
+    size_t len;
+    void* addr;
+    int fd;
+
+    strcpy(compiledName, fileName);
+    strcpy(compiledName + nameLen, EVENT_TAG_MAP_COMPILED_SUFFIX);
+
+    fd = open(compiledName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(*header))) {
+        close(fd);
+        return NULL;
+    }
+    len = st.st_size;
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    header = (const EventTagMapHeader*) addr;
+    if (!validCompiledMap(header, len)
+            || !currentCompiledMap(header, &st, fileName)) {
+        munmap(addr, len);
+        return NULL;
+    }
+
+    newTagMap = calloc(1, sizeof(EventTagMap));
+    if (newTagMap == NULL) {
+        munmap(addr, len);
+        return NULL;
+    }
+    newTagMap->mapAddr = addr;
+    newTagMap->mapLen = len;
+    newTagMap->compiled = header;
+
+    return newTagMap;
+}
+
+/*
+ * Open the text map file.
  *
  * We create a private mapping because we want to terminate the log tag
  * strings with '\0'.
  */
-LIBLOG_ABI_PUBLIC EventTagMap* android_openEventTagMap(const char* fileName)
+static EventTagMap* openTextMap(const char* fileName)
 {
     EventTagMap* newTagMap;
     off_t end;
@@ -119,7 +262,9 @@ LIBLOG_ABI_PUBLIC void android_closeEventTagMap(EventTagMap* map)
     if (map == NULL)
         return;
 
-    munmap(map->mapAddr, map->mapLen);
+    if (map->mapAddr)
+        munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
@@ -133,6 +278,29 @@ LIBLOG_ABI_PUBLIC const char* android_lookupEventTag(const EventTagMap* map,
 {
     int hi, lo, mid;
 
+    if (map->compiled) {
+        const EventTagMapHeader* header = map->compiled;
+        const EventTagMapEntry* entries = (const EventTagMapEntry*)(header + 1);
+        const uint32_t* hash = (const uint32_t*)(entries + header->numTags);
+        const char* strings = (const char*)(hash + header->hashSize);
+        uint32_t mask = header->hashSize - 1;
+        uint32_t i = hashTagIndex(tag) & mask;
+        uint32_t index;
+
+        /* hashSize > numTags, there is always an empty slot to stop at */
+        while ((index = hash[i]) != 0) {
+            if (--index >= header->numTags)
+                return NULL;
+            if (entries[index].tagIndex == (uint32_t)tag) {
+                if (entries[index].tagStr >= header->stringsSize)
+                    return NULL;
+                return strings + entries[index].tagStr;
+            }
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    }
+
     lo = 0;
     hi = map->numTags-1;
 
@@ -426,3 +594,90 @@ static int sortTags(EventTagMap* map)
 
     return 0;
 }
+
+/*
+ * Write the compiled form of the text map fileName to fd.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+LIBLOG_ABI_PRIVATE int android_compileEventTagMap(const char* fileName,
+                                                  int fd)
+{
+    EventTagMap* map;
+    EventTagMapHeader* header;
+    EventTagMapEntry* entries;
+    uint32_t* hash;
+    char* strings;
+    char* buffer;
+    size_t stringsSize, size;
+    uint32_t hashSize, mask, i;
+    struct stat st;
+    int ret = 0;
+
+    if (stat(fileName, &st))
+        return -errno;
+
+    map = openTextMap(fileName);
+    if (map == NULL)
+        return -EINVAL;
+
+    stringsSize = 1; /* never empty */
+    for (i = 0; i < (uint32_t)map->numTags; ++i)
+        stringsSize += strlen(map->tagArray[i].tagStr) + 1;
+    /* keep probe sequences short */
+    for (hashSize = 1; hashSize < (uint32_t)map->numTags * 2; hashSize <<= 1)
+        ;
+    if (hashSize <= (uint32_t)map->numTags)
+        hashSize <<= 1;
+    mask = hashSize - 1;
+
+    size = sizeof(*header) + map->numTags * sizeof(*entries)
+         + hashSize * sizeof(*hash) + stringsSize;
+    buffer = calloc(1, size);
+    if (buffer == NULL) {
+        android_closeEventTagMap(map);
+        return -ENOMEM;
+    }
+
+    header = (EventTagMapHeader*) buffer;
+    entries = (EventTagMapEntry*)(header + 1);
+    hash = (uint32_t*)(entries + map->numTags);
+    strings = (char*)(hash + hashSize);
+
+    header->magic = EVENT_TAG_MAP_MAGIC;
+    header->numTags = map->numTags;
+    header->hashSize = hashSize;
+    header->stringsSize = stringsSize;
+    header->sourceSize = st.st_size;
+
+    stringsSize = 1;
+    for (i = 0; i < (uint32_t)map->numTags; ++i) {
+        uint32_t h = hashTagIndex(map->tagArray[i].tagIndex) & mask;
+        size_t len = strlen(map->tagArray[i].tagStr) + 1;
+
+        entries[i].tagIndex = map->tagArray[i].tagIndex;
+        entries[i].tagStr = stringsSize;
+        memcpy(strings + stringsSize, map->tagArray[i].tagStr, len);
+        stringsSize += len;
+
+        while (hash[h])
+            h = (h + 1) & mask;
+        hash[h] = i + 1;
+    }
+
+    android_closeEventTagMap(map);
+
+    for (i = 0; i < size; ) {
+        ssize_t n = write(fd, buffer + i, size - i);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            break;
+        }
+        i += n;
+    }
+
+    free(buffer);
+    return ret;
+}
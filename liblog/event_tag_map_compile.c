@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build time tool, compiles an event-log-tags file into the form that
+ * android_openEventTagMap() maps without parsing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <private/android_logger.h>
+
+int main(int argc, char** argv)
+{
+    int fd, ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <event-log-tags> <output>\n", argv[0]);
+        return 2;
+    }
+
+    fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[2], strerror(errno));
+        return 1;
+    }
+    ret = android_compileEventTagMap(argv[1], fd);
+    if (close(fd) && !ret) {
+        ret = -errno;
+    }
+    if (ret) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(-ret));
+        unlink(argv[2]);
+        return 1;
+    }
+    return 0;
+}
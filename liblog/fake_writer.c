@@ -27,7 +27,7 @@
 
 static int fakeOpen();
 static void fakeClose();
-static int fakeWrite(log_id_t log_id, struct timespec *ts,
+static int fakeWrite(log_id_t log_id, struct timespec *ts, pid_t tid,
                      struct iovec *vec, size_t nr);
 
 static int logFds[(int)LOG_ID_MAX] = { -1, -1, -1, -1, -1, -1 };
@@ -63,7 +63,7 @@ static void fakeClose() {
 }
 
 static int fakeWrite(log_id_t log_id, struct timespec *ts __unused,
-                      struct iovec *vec, size_t nr)
+                     pid_t tid __unused, struct iovec *vec, size_t nr)
 {
     ssize_t ret;
     int logFd;
@@ -14,10 +14,12 @@
 ** limitations under the License.
 */
 
+
 #include <ctype.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
 #include <sys/_system_properties.h>
 
@@ -25,163 +27,227 @@
 
 #include "log_portability.h"
 
-static pthread_mutex_t lock_loggable = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Property values are reduced to the one character we act upon, and are
+ * remembered along with the property area serial they were evaluated at.
+ * Any property change bumps that serial, so a cache is current for as long
+ * as the serial matches. There is no lock: if we trigger a signal handler
+ * in the middle of an update and the signal handler logs a message, it must
+ * not deadlock, and any contention is better served by evaluating the
+ * properties again than by waiting.
+ *
+ * A cache is updated under a sequence count that is odd while the update
+ * is in progress. A reader that sees the count move evaluates the
+ * properties itself, and an updater that finds another update in progress
+ * leaves the cache alone.
+ */
+struct cache {
+    uint32_t seq; /* 0 until first written */
+    uint32_t serial;
+    unsigned char c;
+};
 
-static int lock()
+/* Returns the sequence count to pass to cache_end, or 0 if unreadable */
+static inline uint32_t cache_begin(const struct cache *cache)
 {
-    /*
-     * If we trigger a signal handler in the middle of locked activity and the
-     * signal handler logs a message, we could get into a deadlock state.
-     */
-    /*
-     *  Any contention, and we can turn around and use the non-cached method
-     * in less time than the system call associated with a mutex to deal with
-     * the contention.
-     */
-    return pthread_mutex_trylock(&lock_loggable);
+    uint32_t seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+
+    return (seq & 1) ? 0 : seq;
 }
 
-static void unlock()
+/* Returns non-zero if nothing read since cache_begin was torn */
+static inline int cache_end(const struct cache *cache, uint32_t seq)
 {
-    pthread_mutex_unlock(&lock_loggable);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&cache->seq, __ATOMIC_RELAXED) == seq;
 }
 
-struct cache {
-    const prop_info *pinfo;
-    uint32_t serial;
-    unsigned char c;
-};
+static inline int cache_lock(struct cache *cache, uint32_t *seq)
+{
+    *seq = __atomic_load_n(&cache->seq, __ATOMIC_RELAXED);
+    return !(*seq & 1)
+        && __atomic_compare_exchange_n(&cache->seq, seq, *seq + 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
-static int check_cache(struct cache *cache)
+static inline void cache_unlock(struct cache *cache, uint32_t seq)
 {
-    return cache->pinfo
-        && __system_property_serial(cache->pinfo) != cache->serial;
+    if (!(seq += 2)) { /* 0 is reserved for never written */
+        seq = 2;
+    }
+    __atomic_store_n(&cache->seq, seq, __ATOMIC_RELEASE);
+}
+
+static int cache_read(const struct cache *cache, uint32_t serial,
+                      unsigned char *c)
+{
+    uint32_t seq = cache_begin(cache);
+
+    if (!seq
+            || (__atomic_load_n(&cache->serial, __ATOMIC_RELAXED) != serial)) {
+        return 0;
+    }
+    *c = __atomic_load_n(&cache->c, __ATOMIC_RELAXED);
+    return cache_end(cache, seq);
+}
+
+static void cache_write(struct cache *cache, uint32_t serial, unsigned char c)
+{
+    uint32_t seq;
+
+    if (cache_lock(cache, &seq)) {
+        __atomic_store_n(&cache->serial, serial, __ATOMIC_RELAXED);
+        __atomic_store_n(&cache->c, c, __ATOMIC_RELAXED);
+        cache_unlock(cache, seq);
+    }
+}
+
+/*
+ * A prop_info is never freed or moved once it exists, so it is remembered
+ * without a lock; racing stores all write the same value.
+ */
+static const prop_info *find_property(const prop_info **pinfo,
+                                      const char *key)
+{
+    const prop_info *p = __atomic_load_n(pinfo, __ATOMIC_ACQUIRE);
+
+    if (!p) {
+        p = __system_property_find(key);
+        if (p) {
+            __atomic_store_n(pinfo, p, __ATOMIC_RELEASE);
+        }
+    }
+    return p;
 }
 
 #define BOOLEAN_TRUE 0xFF
 #define BOOLEAN_FALSE 0xFE
 
-static void refresh_cache(struct cache *cache, const char *key)
+/* Returns default_c if the property does not exist */
+static unsigned char property_char(const prop_info *pinfo,
+                                   unsigned char default_c)
 {
     char buf[PROP_VALUE_MAX];
 
-    if (!cache->pinfo) {
-        cache->pinfo = __system_property_find(key);
-        if (!cache->pinfo) {
-            return;
-        }
+    if (!pinfo) {
+        return default_c;
     }
-    cache->serial = __system_property_serial(cache->pinfo);
-    __system_property_read(cache->pinfo, 0, buf);
+    __system_property_read(pinfo, 0, buf);
     switch(buf[0]) {
     case 't': case 'T':
-        cache->c = strcasecmp(buf + 1, "rue") ? buf[0] : BOOLEAN_TRUE;
-        break;
+        return strcasecmp(buf + 1, "rue") ? buf[0] : BOOLEAN_TRUE;
     case 'f': case 'F':
-        cache->c = strcasecmp(buf + 1, "alse") ? buf[0] : BOOLEAN_FALSE;
-        break;
+        return strcasecmp(buf + 1, "alse") ? buf[0] : BOOLEAN_FALSE;
     default:
-        cache->c = buf[0];
+        return buf[0];
     }
 }
 
-static int __android_log_level(const char *tag, int default_prio)
+/* sizeof() is used on this array below */
+static const char log_namespace[] = "persist.log.tag.";
+static const size_t base_offset = 8; /* skip "persist." */
+
+/*
+ * Per-tag cache, direct mapped by a hash of the tag. Tags too long to fit
+ * in a slot are evaluated on every call. A hit costs hashing the tag and
+ * comparing it against the slot, where a miss costs two property lookups.
+ */
+#define TAG_CACHE_SIZE 64 /* power of two */
+
+static struct tag_cache {
+    struct cache cache;
+    uint32_t hash;
+    char tag[PROP_NAME_MAX];
+} tag_cache[TAG_CACHE_SIZE];
+
+static uint32_t tag_hash(const char *tag, size_t taglen)
 {
-    /* sizeof() is used on this array below */
-    static const char log_namespace[] = "persist.log.tag.";
-    static const size_t base_offset = 8; /* skip "persist." */
-    /* calculate the size of our key temporary buffer */
-    const size_t taglen = (tag && *tag) ? strlen(tag) : 0;
-    /* sizeof(log_namespace) = strlen(log_namespace) + 1 */
-    char key[sizeof(log_namespace) + taglen]; /* may be > PROPERTY_KEY_MAX */
-    char *kp;
+    uint32_t hash = 2166136261U; /* FNV-1a */
     size_t i;
-    char c = 0;
-    /*
-     * Single layer cache of four properties. Priorities are:
-     *    log.tag.<tag>
-     *    persist.log.tag.<tag>
-     *    log.tag
-     *    persist.log.tag
-     * Where the missing tag matches all tags and becomes the
-     * system global default. We do not support ro.log.tag* .
-     */
-    static char last_tag[PROP_NAME_MAX];
-    static uint32_t global_serial;
-    /* some compilers erroneously see uninitialized use. !not_locked */
-    uint32_t current_global_serial = 0;
-    static struct cache tag_cache[2];
-    static struct cache global_cache[2];
-    int change_detected;
-    int global_change_detected;
-    int not_locked;
 
-    strcpy(key, log_namespace);
+    for (i = 0; i < taglen; ++i) {
+        hash ^= (unsigned char)tag[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
 
-    global_change_detected = change_detected = not_locked = lock();
+static int tag_cache_read(const struct tag_cache *slot, uint32_t serial,
+                          uint32_t hash, const char *tag, size_t taglen,
+                          unsigned char *c)
+{
+    uint32_t seq = cache_begin(&slot->cache);
 
-    if (!not_locked) {
-        /*
-         *  check all known serial numbers to changes.
-         */
-        for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-            if (check_cache(&tag_cache[i])) {
-                change_detected = 1;
-            }
-        }
-        for (i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-            if (check_cache(&global_cache[i])) {
-                global_change_detected = 1;
-            }
-        }
+    if (!seq
+            || (__atomic_load_n(&slot->cache.serial, __ATOMIC_RELAXED) != serial)
+            || (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) != hash)
+            || memcmp(slot->tag, tag, taglen + 1)) {
+        return 0;
+    }
+    *c = __atomic_load_n(&slot->cache.c, __ATOMIC_RELAXED);
+    return cache_end(&slot->cache, seq);
+}
 
-        current_global_serial = __system_property_area_serial();
-        if (current_global_serial != global_serial) {
-            change_detected = 1;
-            global_change_detected = 1;
-        }
+static void tag_cache_write(struct tag_cache *slot, uint32_t serial,
+                            uint32_t hash, const char *tag, size_t taglen,
+                            unsigned char c)
+{
+    uint32_t seq;
+
+    if (cache_lock(&slot->cache, &seq)) {
+        __atomic_store_n(&slot->cache.serial, serial, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+        memcpy(slot->tag, tag, taglen + 1);
+        __atomic_store_n(&slot->cache.c, c, __ATOMIC_RELAXED);
+        cache_unlock(&slot->cache, seq);
     }
+}
 
-    if (taglen) {
-        int local_change_detected = change_detected;
-        if (!not_locked) {
-            if (!last_tag[0]
-                    || (last_tag[0] != tag[0])
-                    || strncmp(last_tag + 1, tag + 1, sizeof(last_tag) - 1)) {
-                /* invalidate log.tag.<tag> cache */
-                for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-                    tag_cache[i].pinfo = NULL;
-                    tag_cache[i].c = '\0';
-                }
-                last_tag[0] = '\0';
-                local_change_detected = 1;
-            }
-            if (!last_tag[0]) {
-                strncpy(last_tag, tag, sizeof(last_tag));
-            }
-        }
-        strcpy(key + sizeof(log_namespace) - 1, tag);
+/* persist.log.tag.<tag>, then log.tag.<tag> */
+static unsigned char tag_level(const char *tag, size_t taglen)
+{
+    /* sizeof(log_namespace) = strlen(log_namespace) + 1 */
+    char key[sizeof(log_namespace) + taglen]; /* may be > PROPERTY_KEY_MAX */
+    unsigned char c;
 
-        kp = key;
-        for (i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-            struct cache *cache = &tag_cache[i];
-            struct cache temp_cache;
+    strcpy(key, log_namespace);
+    strcpy(key + sizeof(log_namespace) - 1, tag);
 
-            if (not_locked) {
-                temp_cache.pinfo = NULL;
-                temp_cache.c = '\0';
-                cache = &temp_cache;
-            }
-            if (local_change_detected) {
-                refresh_cache(cache, kp);
-            }
+    c = property_char(__system_property_find(key), '\0');
+    if (!c) {
+        c = property_char(__system_property_find(key + base_offset), '\0');
+    }
+    return c;
+}
 
-            if (cache->c) {
-                c = cache->c;
-                break;
-            }
+static int __android_log_level(const char *tag, int default_prio)
+{
+    /*
+     * Priorities are:
+     *    persist.log.tag.<tag>
+     *    log.tag.<tag>
+     *    persist.log.tag
+     *    log.tag
+     * Where the missing tag matches all tags and becomes the
+     * system global default. We do not support ro.log.tag* .
+     */
+    static struct cache global_cache;
+    static const prop_info *global_pinfo[2];
+    const uint32_t serial = __system_property_area_serial();
+    const size_t taglen = (tag && *tag) ? strlen(tag) : 0;
+    unsigned char c = '\0';
 
-            kp = key + base_offset;
+    if (taglen) {
+        const uint32_t hash = tag_hash(tag, taglen);
+        struct tag_cache *slot = &tag_cache[hash & (TAG_CACHE_SIZE - 1)];
+        const int cacheable = taglen < sizeof(slot->tag);
+
+        if (!cacheable
+                || !tag_cache_read(slot, serial, hash, tag, taglen, &c)) {
+            c = tag_level(tag, taglen);
+            if (cacheable) {
+                tag_cache_write(slot, serial, hash, tag, taglen, c);
+            }
         }
     }
 
@@ -197,41 +263,23 @@ static int __android_log_level(const char *tag, int default_prio)
     case BOOLEAN_FALSE: /* Not officially supported */
         break;
     default:
-        /* clear '.' after log.tag */
-        key[sizeof(log_namespace) - 2] = '\0';
-
-        kp = key;
-        for (i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-            struct cache *cache = &global_cache[i];
-            struct cache temp_cache;
-
-            if (not_locked) {
-                temp_cache = *cache;
-                if (temp_cache.pinfo != cache->pinfo) { /* check atomic */
-                    temp_cache.pinfo = NULL;
-                    temp_cache.c = '\0';
-                }
-                cache = &temp_cache;
-            }
-            if (global_change_detected) {
-                refresh_cache(cache, kp);
-            }
+        if (!cache_read(&global_cache, serial, &c)) {
+            char key[sizeof(log_namespace)];
 
-            if (cache->c) {
-                c = cache->c;
-                break;
-            }
+            /* clear '.' after log.tag */
+            strcpy(key, log_namespace);
+            key[sizeof(log_namespace) - 2] = '\0';
 
-            kp = key + base_offset;
+            c = property_char(find_property(&global_pinfo[0], key), '\0');
+            if (!c) {
+                c = property_char(find_property(&global_pinfo[1],
+                                                key + base_offset), '\0');
+            }
+            cache_write(&global_cache, serial, c);
         }
         break;
     }
 
-    if (!not_locked) {
-        global_serial = current_global_serial;
-        unlock();
-    }
-
     switch (toupper(c)) {
     case 'V': return ANDROID_LOG_VERBOSE;
     case 'D': return ANDROID_LOG_DEBUG;
@@ -255,88 +303,66 @@ LIBLOG_ABI_PUBLIC int __android_log_is_loggable(int prio, const char *tag,
 
 LIBLOG_HIDDEN int __android_log_is_debuggable()
 {
-    static uint32_t serial;
-    static struct cache tag_cache;
+    static unsigned char c; /* ro property does not change after set */
+    static struct cache debuggable;
+    static const prop_info *pinfo;
     static const char key[] = "ro.debuggable";
-    int ret;
-
-    if (tag_cache.c) { /* ro property does not change after set */
-        ret = tag_cache.c == '1';
-    } else if (lock()) {
-        struct cache temp_cache = { NULL, -1, '\0' };
-        refresh_cache(&temp_cache, key);
-        ret = temp_cache.c == '1';
-    } else {
-        int change_detected = check_cache(&tag_cache);
-        uint32_t current_serial = __system_property_area_serial();
-        if (current_serial != serial) {
-            change_detected = 1;
-        }
-        if (change_detected) {
-            refresh_cache(&tag_cache, key);
-            serial = current_serial;
-        }
-        ret = tag_cache.c == '1';
+    unsigned char ret = __atomic_load_n(&c, __ATOMIC_RELAXED);
 
-        unlock();
+    if (!ret) {
+        const uint32_t serial = __system_property_area_serial();
+
+        if (!cache_read(&debuggable, serial, &ret)) {
+            ret = property_char(find_property(&pinfo, key), '\0');
+            if (ret) {
+                __atomic_store_n(&c, ret, __ATOMIC_RELAXED);
+            } else {
+                cache_write(&debuggable, serial, ret);
+            }
+        }
     }
 
-    return ret;
+    return ret == '1';
 }
 
 /*
  * For properties that are read often, but generally remain constant.
- * Since a change is rare, we will accept a trylock failure gracefully.
- * Use a separate lock from is_loggable to keep contention down b/25563384.
+ * The evaluated result is cached, rather than the individual properties.
  */
 struct cache2 {
-    pthread_mutex_t lock;
-    uint32_t serial;
+    struct cache cache;
     const char *key_persist;
-    struct cache cache_persist;
+    const prop_info *pinfo_persist;
+    unsigned char default_persist;
     const char *key_ro;
-    struct cache cache_ro;
-    unsigned char (*const evaluate)(const struct cache2 *self);
+    const prop_info *pinfo_ro;
+    unsigned char default_ro;
+    unsigned char (*const evaluate)(unsigned char c_persist,
+                                    unsigned char c_ro);
 };
 
 static inline unsigned char do_cache2(struct cache2 *self)
 {
-    uint32_t current_serial;
-    int change_detected;
+    const uint32_t serial = __system_property_area_serial();
     unsigned char c;
 
-    if (pthread_mutex_trylock(&self->lock)) {
-        /* We are willing to accept some race in this context */
-        return self->evaluate(self);
-    }
-
-    change_detected = check_cache(&self->cache_persist)
-                   || check_cache(&self->cache_ro);
-    current_serial = __system_property_area_serial();
-    if (current_serial != self->serial) {
-        change_detected = 1;
-    }
-    if (change_detected) {
-        refresh_cache(&self->cache_persist, self->key_persist);
-        refresh_cache(&self->cache_ro, self->key_ro);
-        self->serial = current_serial;
+    if (!cache_read(&self->cache, serial, &c)) {
+        c = self->evaluate(
+            property_char(find_property(&self->pinfo_persist,
+                                        self->key_persist),
+                          self->default_persist),
+            property_char(find_property(&self->pinfo_ro, self->key_ro),
+                          self->default_ro));
+        cache_write(&self->cache, serial, c);
     }
-    c = self->evaluate(self);
-
-    pthread_mutex_unlock(&self->lock);
 
     return c;
 }
 
-static unsigned char evaluate_persist_ro(const struct cache2 *self)
+static unsigned char evaluate_persist_ro(unsigned char c_persist,
+                                         unsigned char c_ro)
 {
-    unsigned char c = self->cache_persist.c;
-
-    if (c) {
-        return c;
-    }
-
-    return self->cache_ro.c;
+    return c_persist ? c_persist : c_ro;
 }
 
 /*
@@ -346,12 +372,13 @@ static unsigned char evaluate_persist_ro(const struct cache2 *self)
 LIBLOG_ABI_PUBLIC clockid_t android_log_clockid()
 {
     static struct cache2 clockid = {
-        PTHREAD_MUTEX_INITIALIZER,
-        0,
+        { 0, 0, '\0' },
         "persist.logd.timestamp",
-        { NULL, -1, '\0' },
+        NULL,
+        '\0',
         "ro.logd.timestamp",
-        { NULL, -1, '\0' },
+        NULL,
+        '\0',
         evaluate_persist_ro
     };
 
@@ -364,22 +391,22 @@ LIBLOG_ABI_PUBLIC clockid_t android_log_clockid()
  * Security state generally remains constant, but the DO must be able
  * to turn off logging should it become spammy after an attack is detected.
  */
-static unsigned char evaluate_security(const struct cache2 *self)
+static unsigned char evaluate_security(unsigned char c_persist,
+                                       unsigned char c_ro)
 {
-    unsigned char c = self->cache_ro.c;
-
-    return (c != BOOLEAN_FALSE) && c && (self->cache_persist.c == BOOLEAN_TRUE);
+    return (c_ro != BOOLEAN_FALSE) && c_ro && (c_persist == BOOLEAN_TRUE);
 }
 
 LIBLOG_ABI_PUBLIC int __android_log_security()
 {
     static struct cache2 security = {
-        PTHREAD_MUTEX_INITIALIZER,
-        0,
+        { 0, 0, '\0' },
         "persist.logd.security",
-        { NULL, -1, BOOLEAN_FALSE },
+        NULL,
+        BOOLEAN_FALSE,
         "ro.device_owner",
-        { NULL, -1, BOOLEAN_FALSE },
+        NULL,
+        BOOLEAN_FALSE,
         evaluate_security
     };
 
@@ -475,6 +475,28 @@ static void caught_signal(int signum __unused)
 {
 }
 
+/*
+ * Filters are only sent whole, a reader that finds its filter missing is
+ * sent everything and relies on its own filtering.
+ */
+static char *logdAppendFilter(char *cp, int *remaining,
+                              const char *key, const char *value)
+{
+    size_t len;
+
+    if (!value) {
+        return cp;
+    }
+    len = strlen(key) + strlen(value);
+    if (len >= (size_t)*remaining) {
+        return cp;
+    }
+    strcpy(cp, key);
+    strcpy(cp + strlen(key), value);
+    *remaining -= len;
+    return cp + len;
+}
+
 static int logdOpen(struct android_log_logger_list *logger_list,
                     struct android_log_transport_context *transp)
 {
@@ -482,7 +504,7 @@ static int logdOpen(struct android_log_logger_list *logger_list,
     struct sigaction ignore;
     struct sigaction old_sigaction;
     unsigned int old_alarm = 0;
-    char buffer[256], *cp, c;
+    char buffer[LOGGER_READER_COMMAND_MAX], *cp, c;
     int e, ret, remaining;
 
     int sock = transp->context.sock;
@@ -555,9 +577,15 @@ static int logdOpen(struct android_log_logger_list *logger_list,
     if (logger_list->pid) {
         ret = snprintf(cp, remaining, " pid=%u", logger_list->pid);
         ret = min(ret, remaining);
+        remaining -= ret;
         cp += ret;
     }
 
+    cp = logdAppendFilter(cp, &remaining, " tags=", logger_list->tags);
+    cp = logdAppendFilter(cp, &remaining, " uids=", logger_list->uids);
+    /* last, logd takes the rest of the command as the expression */
+    cp = logdAppendFilter(cp, &remaining, " regex=", logger_list->regex);
+
     if (logger_list->mode & ANDROID_LOG_NONBLOCK) {
         /* Deal with an unresponsive logd */
         memset(&ignore, 0, sizeof(ignore));
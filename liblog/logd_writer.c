@@ -24,7 +24,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -48,9 +50,16 @@
 static int logdAvailable(log_id_t LogId);
 static int logdOpen();
 static void logdClose();
-static int logdWrite(log_id_t logId, struct timespec *ts,
+static int logdWrite(log_id_t logId, struct timespec *ts, pid_t tid,
                      struct iovec *vec, size_t nr);
 
+/* Optional shared memory ring, see __android_log_ring_enable() */
+static android_log_ring_t *logdRing;
+static int logdRingFd = -1;
+static pid_t logdRingPid; /* not inherited across fork */
+
+static void logdRingRegister(int sock);
+
 LIBLOG_HIDDEN struct android_log_transport_write logdLoggerWrite = {
     .node = { &logdLoggerWrite.node, &logdLoggerWrite.node },
     .context.sock = -1,
@@ -85,6 +94,10 @@ static int logdOpen()
                 close(i);
             } else {
                 logdLoggerWrite.context.sock = i;
+                if (logdRing && (logdRingPid == getpid())) {
+                    /* (re)connected, logd needs to (re)attach the ring */
+                    logdRingRegister(i);
+                }
             }
         }
     }
@@ -114,9 +127,217 @@ static int logdAvailable(log_id_t logId)
     return 1;
 }
 
-static int logdWrite(log_id_t logId, struct timespec *ts,
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#endif
+#ifndef F_SEAL_SEAL
+#define F_SEAL_SEAL 0x0001
+#endif
+
+/*
+ * Shared memory region, a memfd sealed at its size. logd only accepts a
+ * sealed memfd, so there is no fallback for kernels without one.
+ */
+static int logdRingCreate(size_t len)
+{
+#if defined(__NR_memfd_create)
+    int fd = syscall(__NR_memfd_create, "liblog",
+                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -errno;
+    }
+    if ((TEMP_FAILURE_RETRY(ftruncate(fd, len)) < 0) ||
+            (fcntl(fd, F_ADD_SEALS, LOGGER_RING_SEALS | F_SEAL_SEAL) < 0)) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    return fd;
+#else
+    (void)len;
+    return -ENOSYS;
+#endif
+}
+
+/*
+ * Send the ring registration to logd, or with fd < 0 just a doorbell.
+ */
+static int logdRingSend(int sock, int fd)
+{
+    android_log_header_t header;
+    android_log_ring_register_t payload;
+    struct iovec vec[2];
+    struct msghdr msg;
+    union {
+        struct cmsghdr cmsg;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&header, 0, sizeof(header));
+    header.id = LOGGER_RING_ID;
+    header.tid = gettid();
+    payload.magic = LOGGER_RING_MAGIC;
+    payload.size = logdRing->size;
+
+    vec[0].iov_base = &header;
+    vec[0].iov_len = sizeof(header);
+    vec[1].iov_base = &payload;
+    vec[1].iov_len = sizeof(payload);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = 2;
+    if (fd >= 0) {
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    if (TEMP_FAILURE_RETRY(sendmsg(sock, &msg, 0)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+/* log_init_lock assumed */
+static void logdRingRegister(int sock)
+{
+    /* not yet attached until logd says so, writes use the socket */
+    __atomic_store_n(&logdRing->attached, 0, __ATOMIC_RELEASE);
+    logdRingSend(sock, logdRingFd);
+}
+
+LIBLOG_ABI_PRIVATE int __android_log_ring_enable(size_t size)
+{
+    android_log_ring_t *ring;
+    size_t len;
+    int fd, ret = 0;
+
+    if ((size < LOGGER_RING_MIN) || (size > LOGGER_RING_MAX) ||
+            (size & (size - 1))) {
+        return -EINVAL;
+    }
+
+    __android_log_lock();
+
+    if (logdRing) {
+        goto done;
+    }
+
+    len = sizeof(android_log_ring_t) + size;
+    fd = logdRingCreate(len);
+    if (fd < 0) {
+        ret = fd;
+        goto done;
+    }
+    ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        ret = -errno;
+        close(fd);
+        goto done;
+    }
+    memset(ring, 0, len);
+    ring->magic = LOGGER_RING_MAGIC;
+    ring->size = size;
+
+    logdRingFd = fd;
+    logdRingPid = getpid();
+    __atomic_store_n(&logdRing, ring, __ATOMIC_RELEASE);
+
+    if (logdLoggerWrite.context.sock >= 0) {
+        logdRingRegister(logdLoggerWrite.context.sock);
+    }
+
+done:
+    __android_log_unlock();
+    return ret;
+}
+
+/*
+ * Place the message in the ring, or return -EAGAIN if it must be sent
+ * through the socket instead.
+ */
+static int logdRingWrite(android_log_ring_t *ring, log_id_t logId,
+                         android_log_header_t *header,
+                         struct iovec *vec, size_t nr)
+{
+    android_log_ring_record_t *record;
+    unsigned char *data = (unsigned char *)(ring + 1);
+    uint64_t reserve, offset;
+    size_t payloadSize, recordSize, pad, i;
+    uint32_t mask = ring->size - 1;
+
+    if (!__atomic_load_n(&ring->attached, __ATOMIC_ACQUIRE) ||
+            (logdRingPid != getpid())) {
+        return -EAGAIN;
+    }
+
+    for (payloadSize = 0, i = 0; i < nr; ++i) {
+        payloadSize += vec[i].iov_len;
+    }
+    recordSize = (sizeof(*record) + payloadSize + sizeof(uint64_t) - 1)
+               & ~(sizeof(uint64_t) - 1);
+
+    /* reserve contiguous space, padding out the end of the ring if need be */
+    reserve = __atomic_load_n(&ring->reserve, __ATOMIC_RELAXED);
+    do {
+        offset = reserve & mask;
+        pad = (ring->size - offset < recordSize) ? ring->size - offset : 0;
+        if ((reserve + pad + recordSize
+                - __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE)) > ring->size) {
+            return -EAGAIN; /* full */
+        }
+    } while (!__atomic_compare_exchange_n(&ring->reserve, &reserve,
+                                          reserve + pad + recordSize, 1,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    if (pad) {
+        record = (android_log_ring_record_t *)(data + offset);
+        __atomic_store_n(&record->state,
+                         LOGGER_RING_READY | LOGGER_RING_PAD | pad,
+                         __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    record = (android_log_ring_record_t *)(data + offset);
+    record->id = logId;
+    record->len = payloadSize;
+    record->tid = header->tid;
+    record->reserved = 0;
+    record->realtime = header->realtime;
+    for (data = (unsigned char *)(record + 1), i = 0; i < nr; ++i) {
+        memcpy(data, vec[i].iov_base, vec[i].iov_len);
+        data += vec[i].iov_len;
+    }
+    __atomic_store_n(&record->state, LOGGER_RING_READY | recordSize,
+                     __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&ring->doorbell, 0, __ATOMIC_SEQ_CST) &&
+            (logdRingSend(logdLoggerWrite.context.sock, -1) < 0)) {
+        /* next writer will try again */
+        __atomic_store_n(&ring->doorbell, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return payloadSize;
+}
+
+static int logdWrite(log_id_t logId, struct timespec *ts, pid_t tid,
                      struct iovec *vec, size_t nr)
 {
+    android_log_ring_t *ring;
     ssize_t ret;
     static const unsigned headerLength = 1;
     struct iovec newVec[nr + headerLength];
@@ -157,7 +378,7 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
      *  };
      */
 
-    header.tid = gettid();
+    header.tid = tid;
     header.realtime.tv_sec = ts->tv_sec;
     header.realtime.tv_nsec = ts->tv_nsec;
 
@@ -221,6 +442,19 @@ static int logdWrite(log_id_t logId, struct timespec *ts,
         }
     }
 
+    /*
+     * Security logs always go through the socket, logd checks the
+     * credentials of each.
+     */
+    ring = __atomic_load_n(&logdRing, __ATOMIC_ACQUIRE);
+    if (ring && (logId != LOG_ID_SECURITY)) {
+        ret = logdRingWrite(ring, logId, &header,
+                            &newVec[headerLength], i - headerLength);
+        if (ret >= 0) {
+            return ret;
+        }
+    }
+
     /*
      * The write below could be lost, but will never block.
      *
@@ -46,7 +46,9 @@ struct android_log_transport_write {
   int (*available)(log_id_t logId);
   int (*open)();
   void (*close)();
-  int (*write)(log_id_t logId, struct timespec *ts, struct iovec *vec, size_t nr);
+  /* tid is the thread the message is from, not always the caller */
+  int (*write)(log_id_t logId, struct timespec *ts, pid_t tid,
+               struct iovec *vec, size_t nr);
 };
 
 struct android_log_logger_list;
@@ -102,6 +104,9 @@ struct android_log_logger_list {
   unsigned int tail;
   log_time start;
   pid_t pid;
+  char *tags;
+  char *uids;
+  char *regex;
 };
 
 struct android_log_logger {
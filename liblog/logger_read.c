@@ -14,6 +14,7 @@
 ** limitations under the License.
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -271,6 +272,60 @@ LIBLOG_ABI_PUBLIC struct logger_list *android_logger_list_alloc_time(
     return (struct logger_list *)logger_list;
 }
 
+/* Replace *field with a copy of value, NULL or empty clears it */
+static int set_filter_field(char **field, const char *value)
+{
+    char *copy = NULL;
+
+    if (value && *value) {
+        copy = strdup(value);
+        if (!copy) {
+            return -ENOMEM;
+        }
+    }
+    free(*field);
+    *field = copy;
+    return 0;
+}
+
+LIBLOG_ABI_PUBLIC int android_logger_list_set_filter(
+        struct logger_list *logger_list,
+        const char *tags,
+        const char *uids,
+        const char *regex)
+{
+    struct android_log_logger_list *logger_list_internal =
+            (struct android_log_logger_list *)logger_list;
+    const char *cp;
+    char *tp;
+    int ret;
+
+    if (!logger_list_internal) {
+        return -EINVAL;
+    }
+    for (cp = uids; cp && *cp; ++cp) {
+        if (!isdigit(*cp) && (*cp != ',')) {
+            return -EINVAL;
+        }
+    }
+
+    ret = set_filter_field(&logger_list_internal->tags, tags);
+    if (ret) {
+        return ret;
+    }
+    /* sent as one word, filterspecs are also comma separated */
+    for (tp = logger_list_internal->tags; tp && *tp; ++tp) {
+        if (isspace(*tp)) {
+            *tp = ',';
+        }
+    }
+    ret = set_filter_field(&logger_list_internal->uids, uids);
+    if (ret) {
+        return ret;
+    }
+    return set_filter_field(&logger_list_internal->regex, regex);
+}
+
 /* android_logger_list_register unimplemented, no use case */
 /* android_logger_list_unregister unimplemented, no use case */
 
@@ -475,5 +530,8 @@ LIBLOG_ABI_PUBLIC void android_logger_list_free(struct logger_list *logger_list)
         android_logger_free((struct logger *)logger);
     }
 
+    free(logger_list_internal->tags);
+    free(logger_list_internal->uids);
+    free(logger_list_internal->regex);
     free(logger_list_internal);
 }
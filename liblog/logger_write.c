@@ -15,10 +15,20 @@
  */
 
 #include <errno.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #ifdef __BIONIC__
 #include <android/set_abort_message.h>
@@ -139,6 +149,9 @@ LIBLOG_ABI_PUBLIC void __android_log_close()
 {
     struct android_log_transport_write *transport;
 
+    /* Deliver what has been queued so far */
+    __android_log_async_flush();
+
     __android_log_lock();
 
     write_to_log = __write_to_log_init;
@@ -221,12 +234,322 @@ static inline uint32_t get4LE(const uint8_t* src)
     return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
 }
 
-static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
+static int __write_to_log_transports(log_id_t log_id, struct timespec *ts,
+                                     pid_t tid, struct iovec *vec, size_t nr)
 {
     struct android_log_transport_write *node;
+    int ret = 0;
+    size_t i = 1 << log_id;
+
+    write_transport_for_each(node, &__android_log_transport_write) {
+        if (node->logMask & i) {
+            ssize_t retval;
+            retval = (*node->write)(log_id, ts, tid, vec, nr);
+            if (ret >= 0) {
+                ret = retval;
+            }
+        }
+    }
+
+    write_transport_for_each(node, &__android_log_persist_write) {
+        if (node->logMask & i) {
+            (void)(*node->write)(log_id, ts, tid, vec, nr);
+        }
+    }
+
+    return ret;
+}
+
+#if !defined(_WIN32)
+
+/*
+ * Optional asynchronous mode, see __android_log_async_enable(). Writers
+ * copy their message into a bounded in-process queue without taking a
+ * lock, and a flusher thread hands the queue content to the transports.
+ * The queue uses the record layout, and reserve/publish protocol, of the
+ * logd shared memory ring. Writers wake the flusher with a write(2) to
+ * an eventfd, or a pipe where there is none, so that a writer may be a
+ * signal handler that interrupted anything, the flusher included.
+ */
+static unsigned char *async_data;
+static uint32_t async_size;
+static uint64_t async_reserve;   /* writers, next offset to be allocated */
+static uint64_t async_read;      /* flusher, next offset to be consumed */
+static uint32_t async_doorbell;  /* flusher wants to be woken */
+static int async_wake[2] = { -1, -1 }; /* read and write ends */
+static pid_t async_pid;          /* active, flusher is not inherited by fork */
+static pthread_mutex_t async_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int __write_to_log_async(log_id_t log_id, struct timespec *ts,
+                                pid_t tid, struct iovec *vec, size_t nr,
+                                size_t len)
+{
+    android_log_ring_record_t *record;
+    unsigned char *data;
+    uint64_t reserve, offset;
+    size_t recordSize, pad, i;
+    uint32_t mask = async_size - 1;
     int ret;
+
+    if (len > LOGGER_ENTRY_MAX_PAYLOAD) {
+        len = LOGGER_ENTRY_MAX_PAYLOAD;
+    }
+    ret = len;
+    recordSize = (sizeof(*record) + len + sizeof(uint64_t) - 1)
+               & ~(sizeof(uint64_t) - 1);
+
+    reserve = __atomic_load_n(&async_reserve, __ATOMIC_RELAXED);
+    do {
+        offset = reserve & mask;
+        pad = (async_size - offset < recordSize) ? async_size - offset : 0;
+        if ((reserve + pad + recordSize
+                - __atomic_load_n(&async_read, __ATOMIC_ACQUIRE)) > async_size) {
+            return -EAGAIN; /* full, never wait on the flusher */
+        }
+    } while (!__atomic_compare_exchange_n(&async_reserve, &reserve,
+                                          reserve + pad + recordSize, 1,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    if (pad) {
+        record = (android_log_ring_record_t *)(async_data + offset);
+        __atomic_store_n(&record->state,
+                         LOGGER_RING_READY | LOGGER_RING_PAD | pad,
+                         __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    record = (android_log_ring_record_t *)(async_data + offset);
+    record->id = log_id;
+    record->len = len;
+    record->tid = tid;
+    record->realtime.tv_sec = ts->tv_sec;
+    record->realtime.tv_nsec = ts->tv_nsec;
+    for (data = (unsigned char *)(record + 1), i = 0; len && (i < nr); ++i) {
+        size_t l = (vec[i].iov_len < len) ? vec[i].iov_len : len;
+        memcpy(data, vec[i].iov_base, l);
+        data += l;
+        len -= l;
+    }
+    __atomic_store_n(&record->state, LOGGER_RING_READY | recordSize,
+                     __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&async_doorbell, 0, __ATOMIC_SEQ_CST)) {
+        static const uint64_t one = 1;
+        int save_errno = errno; /* may be a signal handler */
+        /* EAGAIN is a wakeup already pending */
+        TEMP_FAILURE_RETRY(write(async_wake[1], &one, sizeof(one)));
+        errno = save_errno;
+    }
+
+    return ret;
+}
+
+static int __android_log_async_ready()
+{
+    android_log_ring_record_t *record = (android_log_ring_record_t *)
+        (async_data + (__atomic_load_n(&async_read, __ATOMIC_ACQUIRE)
+                           & (async_size - 1)));
+    return __atomic_load_n(&record->state, __ATOMIC_SEQ_CST) != 0;
+}
+
+/* async_drain_lock assumed */
+static void __android_log_async_drain()
+{
+    for (;;) {
+        uint64_t read = __atomic_load_n(&async_read, __ATOMIC_RELAXED);
+        android_log_ring_record_t *record = (android_log_ring_record_t *)
+            (async_data + (read & (async_size - 1)));
+        uint32_t state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+        uint32_t length = state & LOGGER_RING_LENGTH;
+
+        if (!(state & LOGGER_RING_READY)) {
+            break;
+        }
+        if (!(state & LOGGER_RING_PAD)) {
+            struct timespec ts;
+            struct iovec vec;
+
+            ts.tv_sec = record->realtime.tv_sec;
+            ts.tv_nsec = record->realtime.tv_nsec;
+            vec.iov_base = record + 1;
+            vec.iov_len = record->len;
+            __write_to_log_transports(record->id, &ts, record->tid, &vec, 1);
+        }
+
+        /* writers rely on free space reading as zero */
+        memset(record, 0, length);
+        __atomic_store_n(&async_read, read + length, __ATOMIC_RELEASE);
+    }
+}
+
+static void *__android_log_async_flusher(void *arg __unused)
+{
+    sigset_t set;
+
+    /* leave signals to the threads of the application */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&async_drain_lock);
+        __android_log_async_drain();
+        pthread_mutex_unlock(&async_drain_lock);
+
+        __atomic_store_n(&async_doorbell, 1, __ATOMIC_SEQ_CST);
+        if (!__android_log_async_ready()) {
+            struct pollfd pfd = { async_wake[0], POLLIN, 0 };
+            uint64_t count[8];
+
+            TEMP_FAILURE_RETRY(poll(&pfd, 1, -1));
+            TEMP_FAILURE_RETRY(read(async_wake[0], count, sizeof(count)));
+        }
+    }
+
+    return NULL;
+}
+
+/* Both ends non-blocking and close-on-exec, returns -errno on failure */
+static int __android_log_async_wake_open()
+{
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+    async_wake[0] = async_wake[1] = fd;
+#else
+    int i;
+
+    if (pipe(async_wake)) {
+        return -errno;
+    }
+    for (i = 0; i < 2; ++i) {
+        fcntl(async_wake[i], F_SETFD, FD_CLOEXEC);
+        fcntl(async_wake[i], F_SETFL, O_NONBLOCK);
+    }
+#endif
+    return 0;
+}
+
+static void __android_log_async_wake_close()
+{
+    if (async_wake[1] != async_wake[0]) {
+        close(async_wake[1]);
+    }
+    close(async_wake[0]);
+    async_wake[0] = async_wake[1] = -1;
+}
+
+static int __android_log_async_active()
+{
+    return __atomic_load_n(&async_pid, __ATOMIC_ACQUIRE) == getpid();
+}
+
+LIBLOG_ABI_PRIVATE int __android_log_async_enable(size_t size)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    unsigned char *data;
+    int ret = 0;
+
+    if ((size < LOGGER_RING_MIN) || (size > LOGGER_RING_MAX) ||
+            (size & (size - 1))) {
+        return -EINVAL;
+    }
+
+    __android_log_lock();
+
+    if (__android_log_async_active()) {
+        goto done;
+    }
+
+    if (async_data) {
+        /*
+         * Forked child, the queue and wakeup are the parent's and the
+         * lock may have been held by the parent's flusher.
+         */
+        pthread_mutex_init(&async_drain_lock, NULL);
+        __android_log_async_wake_close();
+        async_data = NULL;
+    }
+
+    data = calloc(1, size);
+    if (!data) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    ret = __android_log_async_wake_open();
+    if (ret) {
+        free(data);
+        goto done;
+    }
+    async_size = size;
+    async_reserve = async_read = 0;
+    async_doorbell = 0;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    async_data = data; /* published to writers by async_pid */
+    ret = -pthread_create(&thread, &attr, __android_log_async_flusher, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        __android_log_async_wake_close();
+        async_data = NULL;
+        free(data);
+        goto done;
+    }
+    __atomic_store_n(&async_pid, getpid(), __ATOMIC_RELEASE);
+
+done:
+    __android_log_unlock();
+    return ret;
+}
+
+LIBLOG_ABI_PRIVATE void __android_log_async_flush()
+{
+    if (!__android_log_async_active()) {
+        return;
+    }
+    pthread_mutex_lock(&async_drain_lock);
+    __android_log_async_drain();
+    pthread_mutex_unlock(&async_drain_lock);
+}
+
+/*
+ * Ahead of a security or fatal message, which may come from a signal
+ * handler or a thread about to abort while holding async_drain_lock.
+ * Never waits: if the queue is being drained already, what is queued is
+ * on its way and the message follows it as closely as it can.
+ */
+static void __android_log_async_tryflush()
+{
+    if (pthread_mutex_trylock(&async_drain_lock)) {
+        return;
+    }
+    __android_log_async_drain();
+    pthread_mutex_unlock(&async_drain_lock);
+}
+
+#else
+
+LIBLOG_ABI_PRIVATE int __android_log_async_enable(size_t size __unused)
+{
+    return -ENOSYS;
+}
+
+LIBLOG_ABI_PRIVATE void __android_log_async_flush()
+{
+}
+
+#endif
+
+static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
+{
     struct timespec ts;
+    pid_t tid;
     size_t len, i;
+    int sync = log_id == LOG_ID_SECURITY;
 
     for (len = i = 0; i < nr; ++i) {
         len += vec[i].iov_len;
@@ -236,6 +559,8 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
     }
 
 #if defined(__BIONIC__)
+    int ret;
+
     if (log_id == LOG_ID_SECURITY) {
         if (vec[0].iov_len < 4) {
             return -EINVAL;
@@ -321,9 +646,13 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
         if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
             return -EPERM;
         }
+
+        /* about to abort, make sure it and all before it are recorded */
+        sync = prio == ANDROID_LOG_FATAL;
     }
 
     clock_gettime(android_log_clockid(), &ts);
+    tid = gettid();
 #else
     /* simulate clock_gettime(CLOCK_REALTIME, &ts); */
     {
@@ -332,27 +661,19 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
         ts.tv_sec = tv.tv_sec;
         ts.tv_nsec = tv.tv_usec * 1000;
     }
+    tid = 0; /* the fake log device has no use for it */
 #endif
 
-    ret = 0;
-    i = 1 << log_id;
-    write_transport_for_each(node, &__android_log_transport_write) {
-        if (node->logMask & i) {
-            ssize_t retval;
-            retval = (*node->write)(log_id, &ts, vec, nr);
-            if (ret >= 0) {
-                ret = retval;
-            }
-        }
-    }
-
-    write_transport_for_each(node, &__android_log_persist_write) {
-        if (node->logMask & i) {
-            (void)(*node->write)(log_id, &ts, vec, nr);
+#if !defined(_WIN32)
+    if (__android_log_async_active()) {
+        if (!sync) {
+            return __write_to_log_async(log_id, &ts, tid, vec, nr, len);
         }
+        __android_log_async_tryflush();
     }
+#endif
 
-    return ret;
+    return __write_to_log_transports(log_id, &ts, tid, vec, nr);
 }
 
 static int __write_to_log_init(log_id_t log_id, struct iovec *vec, size_t nr)
@@ -39,15 +39,40 @@
 #define MS_PER_NSEC 1000000
 #define US_PER_NSEC 1000
 
+/*
+ * Filter rules are matched in three tiers:
+ *    exact tag,      eg "ActivityManager:i"
+ *    longest prefix, eg "Wifi*:w"
+ *    glob,           eg "*Service?:e", most recently added first
+ * Exact and prefix rules live in one hash table, a prefix rule being
+ * looked up once for each distinct prefix length, so the cost per line
+ * does not grow with the number of rules. Only glob rules are walked.
+ */
+typedef enum {
+    FILTER_EXACT,
+    FILTER_PREFIX,
+    FILTER_GLOB,
+} FilterKind;
+
 typedef struct FilterInfo_t {
     char *mTag;
     android_LogPriority mPri;
-    struct FilterInfo_t *p_next;
+    struct FilterInfo_t *p_next;     /* all rules, for android_log_format_free */
+    struct FilterInfo_t *p_hashNext; /* hash bucket, or glob list */
+    FilterKind mKind;
+    size_t mLen;                     /* of mTag, less any trailing '*' */
+    uint32_t mHash;
 } FilterInfo;
 
 struct AndroidLogFormat_t {
     android_LogPriority global_pri;
     FilterInfo *filters;
+    FilterInfo **filterHash;
+    size_t filterHashSize;           /* power of two */
+    size_t filterHashCount;
+    size_t *prefixLengths;           /* distinct, longest first */
+    size_t prefixLengthCount;
+    FilterInfo *globFilters;
     AndroidLogPrintFormat format;
     bool colored_output;
     bool usec_time_output;
@@ -73,18 +98,206 @@ struct AndroidLogFormat_t {
 #define ANDROID_COLOR_RED     196
 #define ANDROID_COLOR_YELLOW  226
 
+static uint32_t filterHashTag(const char *tag, size_t len)
+{
+    uint32_t hash = 2166136261U; /* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        hash ^= (unsigned char)tag[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
 {
     FilterInfo *p_ret;
+    size_t len;
 
     p_ret = (FilterInfo *)calloc(1, sizeof(FilterInfo));
+    if (!p_ret) {
+        return NULL;
+    }
     p_ret->mTag = strdup(tag);
+    if (!p_ret->mTag) {
+        free(p_ret);
+        return NULL;
+    }
     p_ret->mPri = pri;
 
+    len = strlen(tag);
+    if (len && (tag[len - 1] == '*') && (strcspn(tag, "*?") == (len - 1))) {
+        p_ret->mKind = FILTER_PREFIX;
+        --len;
+    } else if (strpbrk(tag, "*?")) {
+        p_ret->mKind = FILTER_GLOB;
+    } else {
+        p_ret->mKind = FILTER_EXACT;
+    }
+    p_ret->mLen = len;
+    p_ret->mHash = filterHashTag(tag, len);
+
     return p_ret;
 }
 
-/* balance to above, filterinfo_free left unimplemented */
+static void filterinfo_free(FilterInfo *p_info)
+{
+    free(p_info->mTag);
+    free(p_info);
+}
+
+/* '*' matches any run of characters, '?' any one character */
+static bool filterGlobMatch(const char *glob, const char *tag)
+{
+    const char *star = NULL;
+    const char *resume = NULL;
+
+    while (*tag) {
+        if (*glob == '*') {
+            star = glob++;
+            resume = tag;
+        } else if ((*glob == '?') || (*glob == *tag)) {
+            ++glob;
+            ++tag;
+        } else if (star) {
+            glob = star + 1;
+            tag = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*glob == '*') {
+        ++glob;
+    }
+    return !*glob;
+}
+
+static FilterInfo *filterHashFind(AndroidLogFormat *p_format,
+                                  FilterKind kind, const char *tag,
+                                  size_t len, uint32_t hash)
+{
+    FilterInfo *p_info;
+
+    if (!p_format->filterHashSize) {
+        return NULL;
+    }
+    for (p_info = p_format->filterHash[hash & (p_format->filterHashSize - 1)]
+            ; p_info != NULL
+            ; p_info = p_info->p_hashNext) {
+        if ((p_info->mHash == hash) && (p_info->mKind == kind)
+                && (p_info->mLen == len) && !memcmp(p_info->mTag, tag, len)) {
+            return p_info;
+        }
+    }
+    return NULL;
+}
+
+static int filterHashGrow(AndroidLogFormat *p_format)
+{
+    size_t size = p_format->filterHashSize ? (p_format->filterHashSize * 2)
+                                           : 16;
+    FilterInfo **hash = calloc(size, sizeof(FilterInfo *));
+    size_t i;
+
+    if (!hash) {
+        return -1;
+    }
+    for (i = 0; i < p_format->filterHashSize; ++i) {
+        FilterInfo *p_info = p_format->filterHash[i];
+        while (p_info) {
+            FilterInfo *p_next = p_info->p_hashNext;
+            FilterInfo **bucket = &hash[p_info->mHash & (size - 1)];
+            p_info->p_hashNext = *bucket;
+            *bucket = p_info;
+            p_info = p_next;
+        }
+    }
+    free(p_format->filterHash);
+    p_format->filterHash = hash;
+    p_format->filterHashSize = size;
+    return 0;
+}
+
+static int filterPrefixLengthAdd(AndroidLogFormat *p_format, size_t len)
+{
+    size_t *lengths;
+    size_t i;
+
+    for (i = 0; i < p_format->prefixLengthCount; ++i) {
+        if (p_format->prefixLengths[i] == len) {
+            return 0;
+        }
+        if (p_format->prefixLengths[i] < len) {
+            break;
+        }
+    }
+    lengths = realloc(p_format->prefixLengths,
+                      (p_format->prefixLengthCount + 1) * sizeof(size_t));
+    if (!lengths) {
+        return -1;
+    }
+    memmove(lengths + i + 1, lengths + i,
+            (p_format->prefixLengthCount - i) * sizeof(size_t));
+    lengths[i] = len;
+    p_format->prefixLengths = lengths;
+    ++p_format->prefixLengthCount;
+    return 0;
+}
+
+/*
+ * Takes ownership of p_fi. A later rule for the same tag replaces the
+ * priority of the earlier one.
+ */
+static int filterAdd(AndroidLogFormat *p_format, FilterInfo *p_fi)
+{
+    FilterInfo *p_info;
+
+    if (p_fi->mKind == FILTER_GLOB) {
+        FilterInfo **p_prev;
+        for (p_prev = &p_format->globFilters
+                ; (p_info = *p_prev) != NULL
+                ; p_prev = &p_info->p_hashNext) {
+            if (!strcmp(p_info->mTag, p_fi->mTag)) {
+                *p_prev = p_info->p_hashNext; /* move to front */
+                p_info->mPri = p_fi->mPri;
+                p_info->p_hashNext = p_format->globFilters;
+                p_format->globFilters = p_info;
+                filterinfo_free(p_fi);
+                return 0;
+            }
+        }
+        p_fi->p_hashNext = p_format->globFilters;
+        p_format->globFilters = p_fi;
+    } else {
+        p_info = filterHashFind(p_format, p_fi->mKind, p_fi->mTag,
+                                p_fi->mLen, p_fi->mHash);
+        if (p_info) {
+            p_info->mPri = p_fi->mPri;
+            filterinfo_free(p_fi);
+            return 0;
+        }
+        if ((p_format->filterHashCount >= p_format->filterHashSize)
+                && filterHashGrow(p_format)) {
+            filterinfo_free(p_fi);
+            return -1;
+        }
+        if ((p_fi->mKind == FILTER_PREFIX)
+                && filterPrefixLengthAdd(p_format, p_fi->mLen)) {
+            filterinfo_free(p_fi);
+            return -1;
+        }
+        FilterInfo **bucket = &p_format->filterHash[
+            p_fi->mHash & (p_format->filterHashSize - 1)];
+        p_fi->p_hashNext = *bucket;
+        *bucket = p_fi;
+        ++p_format->filterHashCount;
+    }
+
+    p_fi->p_next = p_format->filters;
+    p_format->filters = p_fi;
+    return 0;
+}
 
 /*
  * Note: also accepts 0-9 priorities
@@ -162,22 +375,37 @@ static int colorFromPri (android_LogPriority pri)
 static android_LogPriority filterPriForTag(
         AndroidLogFormat *p_format, const char *tag)
 {
-    FilterInfo *p_curFilter;
-
-    for (p_curFilter = p_format->filters
-            ; p_curFilter != NULL
-            ; p_curFilter = p_curFilter->p_next
-    ) {
-        if (0 == strcmp(tag, p_curFilter->mTag)) {
-            if (p_curFilter->mPri == ANDROID_LOG_DEFAULT) {
-                return p_format->global_pri;
-            } else {
-                return p_curFilter->mPri;
+    FilterInfo *p_curFilter = NULL;
+    size_t len = strlen(tag);
+    size_t i;
+
+    if (p_format->filterHashCount) {
+        p_curFilter = filterHashFind(p_format, FILTER_EXACT, tag, len,
+                                     filterHashTag(tag, len));
+        for (i = 0; !p_curFilter && (i < p_format->prefixLengthCount); ++i) {
+            size_t prefix = p_format->prefixLengths[i];
+            if (prefix <= len) {
+                p_curFilter = filterHashFind(p_format, FILTER_PREFIX, tag,
+                                             prefix,
+                                             filterHashTag(tag, prefix));
             }
         }
     }
 
-    return p_format->global_pri;
+    if (!p_curFilter) {
+        for (p_curFilter = p_format->globFilters
+                ; p_curFilter != NULL
+                ; p_curFilter = p_curFilter->p_hashNext) {
+            if (filterGlobMatch(p_curFilter->mTag, tag)) {
+                break;
+            }
+        }
+    }
+
+    if (!p_curFilter || (p_curFilter->mPri == ANDROID_LOG_DEFAULT)) {
+        return p_format->global_pri;
+    }
+    return p_curFilter->mPri;
 }
 
 /**
@@ -224,9 +452,11 @@ LIBLOG_ABI_PUBLIC void android_log_format_free(AndroidLogFormat *p_format)
         p_info_old = p_info;
         p_info = p_info->p_next;
 
-        free(p_info_old);
+        filterinfo_free(p_info_old);
     }
 
+    free(p_format->filterHash);
+    free(p_format->prefixLengths);
     free(p_format);
 
     /* Free conversion resource, can always be reconstructed */
@@ -402,8 +632,9 @@ LIBLOG_ABI_PUBLIC int android_log_addFilterRule(
         FilterInfo *p_fi = filterinfo_new(tagName, pri);
         free(tagName);
 
-        p_fi->p_next = p_format->filters;
-        p_format->filters = p_fi;
+        if (!p_fi || filterAdd(p_format, p_fi)) {
+            goto error;
+        }
     }
 
     return 0;
@@ -560,179 +791,231 @@ static inline uint64_t get8LE(const uint8_t* src)
 }
 
 
-/*
- * Recursively convert binary log data to printable form.
- *
- * This needs to be recursive because you can have lists of lists.
- *
- * If we run out of room, we stop processing immediately.  It's important
- * for us to check for space on every output element to avoid producing
- * garbled output.
- *
- * Returns 0 on success, 1 on buffer full, -1 on failure.
- */
-static int android_log_printBinaryEvent(const unsigned char** pEventData,
-    size_t* pEventDataLen, char** pOutBuf, size_t* pOutBufLen)
+LIBLOG_ABI_PUBLIC void android_log_decoder_init(
+        AndroidEventLogDecoder *decoder,
+        const void *payload, size_t len)
 {
-    const unsigned char* eventData = *pEventData;
-    size_t eventDataLen = *pEventDataLen;
-    char* outBuf = *pOutBuf;
-    size_t outBufLen = *pOutBufLen;
-    unsigned char type;
-    size_t outCount;
-    int result = 0;
+    decoder->pos = payload;
+    decoder->len = len;
+    decoder->depth = 0;
+    decoder->error = 0;
+    decoder->count[0] = 1;
+}
 
-    if (eventDataLen < 1)
+LIBLOG_ABI_PUBLIC int android_log_decoder_next(
+        AndroidEventLogDecoder *decoder,
+        AndroidEventLogValue *value)
+{
+    const uint8_t *pos = decoder->pos;
+    size_t len = decoder->len;
+    uint32_t ival;
+
+    value->type = EVENT_TYPE_UNKNOWN;
+    value->depth = decoder->depth;
+    value->len = 0;
+    if (decoder->error) {
         return -1;
-    type = *eventData++;
-    eventDataLen--;
+    }
+
+    if (decoder->count[decoder->depth] == 0) {
+        if (decoder->depth == 0) {
+            return 0;
+        }
+        value->type = EVENT_TYPE_LIST_STOP;
+        value->depth = --decoder->depth;
+        return 1;
+    }
+
+    if (len < 1) {
+        goto invalid;
+    }
+    value->type = *pos++;
+    len--;
 
-    switch (type) {
+    switch (value->type) {
     case EVENT_TYPE_INT:
         /* 32-bit signed int */
-        {
-            int ival;
-
-            if (eventDataLen < 4)
-                return -1;
-            ival = get4LE(eventData);
-            eventData += 4;
-            eventDataLen -= 4;
-
-            outCount = snprintf(outBuf, outBufLen, "%d", ival);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
-                /* halt output */
-                goto no_room;
-            }
+        if (len < 4) {
+            goto invalid;
         }
+        value->data.int32 = get4LE(pos);
+        pos += 4;
+        len -= 4;
         break;
     case EVENT_TYPE_LONG:
         /* 64-bit signed long */
-        {
-            uint64_t lval;
-
-            if (eventDataLen < 8)
-                return -1;
-            lval = get8LE(eventData);
-            eventData += 8;
-            eventDataLen -= 8;
-
-            outCount = snprintf(outBuf, outBufLen, "%" PRId64, lval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
-                /* halt output */
-                goto no_room;
-            }
+        if (len < 8) {
+            goto invalid;
         }
+        value->data.int64 = get8LE(pos);
+        pos += 8;
+        len -= 8;
         break;
     case EVENT_TYPE_FLOAT:
-        /* float */
-        {
-            uint32_t ival;
-            float fval;
-
-            if (eventDataLen < 4)
-                return -1;
-            ival = get4LE(eventData);
-            fval = *(float*)&ival;
-            eventData += 4;
-            eventDataLen -= 4;
-
-            outCount = snprintf(outBuf, outBufLen, "%f", fval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
-                /* halt output */
-                goto no_room;
-            }
+        if (len < 4) {
+            goto invalid;
         }
+        ival = get4LE(pos);
+        memcpy(&value->data.float32, &ival, sizeof(value->data.float32));
+        pos += 4;
+        len -= 4;
         break;
     case EVENT_TYPE_STRING:
         /* UTF-8 chars, not NULL-terminated */
-        {
-            unsigned int strLen;
-
-            if (eventDataLen < 4)
-                return -1;
-            strLen = get4LE(eventData);
-            eventData += 4;
-            eventDataLen -= 4;
-
-            if (eventDataLen < strLen)
-                return -1;
-
-            if (strLen < outBufLen) {
-                memcpy(outBuf, eventData, strLen);
-                outBuf += strLen;
-                outBufLen -= strLen;
-            } else if (outBufLen > 0) {
-                /* copy what we can */
-                memcpy(outBuf, eventData, outBufLen);
-                outBuf += outBufLen;
-                outBufLen -= outBufLen;
-                goto no_room;
-            }
-            eventData += strLen;
-            eventDataLen -= strLen;
-            break;
+        if (len < 4) {
+            goto invalid;
         }
+        value->len = get4LE(pos);
+        pos += 4;
+        len -= 4;
+        if (len < value->len) {
+            goto invalid;
+        }
+        value->data.string = (const char *)pos;
+        pos += value->len;
+        len -= value->len;
+        break;
     case EVENT_TYPE_LIST:
         /* N items, all different types */
-        {
-            unsigned char count;
-            int i;
+        if ((len < 1) || (decoder->depth >= ANDROID_MAX_LIST_NEST_DEPTH)) {
+            goto invalid;
+        }
+        value->len = *pos++;
+        len--;
+        break;
+    default:
+        goto invalid;
+    }
 
-            if (eventDataLen < 1)
-                return -1;
+    decoder->count[decoder->depth]--;
+    if (value->type == EVENT_TYPE_LIST) {
+        decoder->count[++decoder->depth] = value->len;
+    }
+    decoder->pos = pos;
+    decoder->len = len;
+    return 1;
 
-            count = *eventData++;
-            eventDataLen--;
+invalid:
+    value->type = EVENT_TYPE_UNKNOWN;
+    decoder->error = 1;
+    return -1;
+}
 
-            if (outBufLen > 0) {
-                *outBuf++ = '[';
-                outBufLen--;
-            } else {
+/*
+ * Append the decimal representation of val, without going through the
+ * stdio formatting machinery.
+ */
+static size_t formatDecimal(char *outBuf, size_t outBufLen, int64_t val)
+{
+    char digits[24];
+    char *cp = digits + sizeof(digits);
+    uint64_t u = (val < 0) ? -(uint64_t)val : (uint64_t)val;
+    size_t len;
+
+    do {
+        *--cp = '0' + (u % 10);
+        u /= 10;
+    } while (u);
+    if (val < 0) {
+        *--cp = '-';
+    }
+    len = digits + sizeof(digits) - cp;
+    if (len >= outBufLen) {
+        return 0;
+    }
+    memcpy(outBuf, cp, len);
+    return len;
+}
+
+/*
+ * Convert binary log data to printable form, one decoded value at a time.
+ *
+ * If we run out of room, we stop processing immediately.  It's important
+ * for us to check for space on every output element to avoid producing
+ * garbled output.
+ *
+ * Returns 0 on success, 1 on buffer full, -1 on failure.
+ */
+static int android_log_printBinaryEvent(AndroidEventLogDecoder *decoder,
+    char** pOutBuf, size_t* pOutBufLen)
+{
+    char* outBuf = *pOutBuf;
+    size_t outBufLen = *pOutBufLen;
+    AndroidEventLogValue value;
+    size_t outCount;
+    int separate = 0;
+    int result;
+
+    while ((result = android_log_decoder_next(decoder, &value)) > 0) {
+        if (value.type == EVENT_TYPE_LIST_STOP) {
+            if (outBufLen == 0) {
                 goto no_room;
             }
+            *outBuf++ = ']';
+            outBufLen--;
+            separate = 1;
+            continue;
+        }
 
-            for (i = 0; i < count; i++) {
-                result = android_log_printBinaryEvent(&eventData, &eventDataLen,
-                        &outBuf, &outBufLen);
-                if (result != 0)
-                    goto bail;
-
-                if (i < count-1) {
-                    if (outBufLen > 0) {
-                        *outBuf++ = ',';
-                        outBufLen--;
-                    } else {
-                        goto no_room;
-                    }
-                }
+        if (separate) {
+            if (outBufLen == 0) {
+                goto no_room;
             }
+            *outBuf++ = ',';
+            outBufLen--;
+        }
+        separate = 1;
 
-            if (outBufLen > 0) {
-                *outBuf++ = ']';
-                outBufLen--;
-            } else {
+        switch (value.type) {
+        case EVENT_TYPE_INT:
+            outCount = formatDecimal(outBuf, outBufLen, value.data.int32);
+            if (outCount == 0) {
                 goto no_room;
             }
+            break;
+        case EVENT_TYPE_LONG:
+            outCount = formatDecimal(outBuf, outBufLen, value.data.int64);
+            if (outCount == 0) {
+                goto no_room;
+            }
+            break;
+        case EVENT_TYPE_FLOAT:
+            outCount = snprintf(outBuf, outBufLen, "%f", value.data.float32);
+            if (outCount >= outBufLen) {
+                goto no_room;
+            }
+            break;
+        case EVENT_TYPE_STRING:
+            if (value.len >= outBufLen) {
+                /* copy what we can */
+                memcpy(outBuf, value.data.string, outBufLen);
+                outBuf += outBufLen;
+                outBufLen = 0;
+                goto no_room;
+            }
+            memcpy(outBuf, value.data.string, value.len);
+            outCount = value.len;
+            break;
+        case EVENT_TYPE_LIST:
+            if (outBufLen == 0) {
+                goto no_room;
+            }
+            *outBuf = '[';
+            outCount = 1;
+            separate = 0;
+            break;
+        default:
+            outCount = 0;
+            break;
         }
-        break;
-    default:
-        fprintf(stderr, "Unknown binary event type %d\n", type);
-        return -1;
+        outBuf += outCount;
+        outBufLen -= outCount;
+    }
+    if (result < 0) {
+        fprintf(stderr, "Invalid binary event data\n");
     }
 
 bail:
-    *pEventData = eventData;
-    *pEventDataLen = eventDataLen;
     *pOutBuf = outBuf;
     *pOutBufLen = outBufLen;
     return result;
@@ -813,11 +1096,14 @@ LIBLOG_ABI_PUBLIC int android_log_processBinaryLogBuffer(
     /*
      * Format the event log data into the buffer.
      */
+    AndroidEventLogDecoder decoder;
     char* outBuf = messageBuf;
     size_t outRemaining = messageBufLen-1;      /* leave one for nul byte */
     int result;
-    result = android_log_printBinaryEvent(&eventData, &inCount, &outBuf,
-                &outRemaining);
+    android_log_decoder_init(&decoder, eventData, inCount);
+    result = android_log_printBinaryEvent(&decoder, &outBuf, &outRemaining);
+    eventData = decoder.pos;
+    inCount = decoder.len;
     if (result < 0) {
         fprintf(stderr, "Binary log entry conversion failed\n");
         return -1;
@@ -38,7 +38,7 @@
 static int pmsgOpen();
 static void pmsgClose();
 static int pmsgAvailable(log_id_t logId);
-static int pmsgWrite(log_id_t logId, struct timespec *ts,
+static int pmsgWrite(log_id_t logId, struct timespec *ts, pid_t tid,
                       struct iovec *vec, size_t nr);
 
 LIBLOG_HIDDEN struct android_log_transport_write pmsgLoggerWrite = {
@@ -95,7 +95,7 @@ static inline uint32_t get4LE(const uint8_t* src)
     return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3] << 24);
 }
 
-static int pmsgWrite(log_id_t logId, struct timespec *ts,
+static int pmsgWrite(log_id_t logId, struct timespec *ts, pid_t tid,
                       struct iovec *vec, size_t nr)
 {
     static const unsigned headerLength = 2;
@@ -145,7 +145,7 @@ static int pmsgWrite(log_id_t logId, struct timespec *ts,
     pmsgHeader.pid = getpid();
 
     header.id = logId;
-    header.tid = gettid();
+    header.tid = tid;
     header.realtime.tv_sec = ts->tv_sec;
     header.realtime.tv_nsec = ts->tv_nsec;
 
@@ -279,7 +279,7 @@ LIBLOG_ABI_PRIVATE ssize_t __android_log_pmsg_file_write(
         vec[2].iov_base = (unsigned char *)buf;
         vec[2].iov_len  = transfer;
 
-        ret = pmsgWrite(logId, &ts, vec, sizeof(vec) / sizeof(vec[0]));
+        ret = pmsgWrite(logId, &ts, gettid(), vec, sizeof(vec) / sizeof(vec[0]));
 
         if (ret <= 0) {
             free(cp);
@@ -134,6 +134,8 @@ static inline void BenchmarkAddArg(::testing::Benchmark* b, const char* name, T
 }
 
 void SetBenchmarkBytesProcessed(uint64_t);
+// Record the latency of one operation, reported as percentiles
+void AddBenchmarkLatency(uint64_t);
 void ResetBenchmarkTiming(void);
 void StopBenchmarkTiming(void);
 void StartBenchmarkTiming(void);
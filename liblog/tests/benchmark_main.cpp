@@ -21,6 +21,8 @@
 #include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <string>
 #include <map>
@@ -32,6 +34,13 @@ static uint64_t gBenchmarkTotalTimeNsSquared;
 static uint64_t gBenchmarkNum;
 static uint64_t gBenchmarkStartTimeNs;
 
+// Latency histogram, each power of two range of nanoseconds is split into
+// 2^kLatencySubBits linear buckets, for a resolution of better than 7%.
+static const unsigned kLatencySubBits = 4;
+static const unsigned kLatencyBuckets = 64 << kLatencySubBits;
+static uint64_t gLatencyHistogram[kLatencyBuckets];
+static uint64_t gLatencyNum;
+
 typedef std::vector< ::testing::Benchmark* > BenchmarkList;
 static BenchmarkList* gBenchmarks;
 
@@ -56,6 +65,37 @@ static uint64_t NanoTime() {
   return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
 }
 
+static unsigned LatencyBucket(uint64_t ns) {
+  if (ns < (1U << kLatencySubBits)) {
+    return ns;
+  }
+  unsigned msb = 63 - __builtin_clzll(ns);
+  unsigned sub = (ns >> (msb - kLatencySubBits)) & ((1U << kLatencySubBits) - 1);
+  return ((msb - kLatencySubBits + 1) << kLatencySubBits) + sub;
+}
+
+// Largest latency that lands in bucket
+static uint64_t LatencyBucketLimit(unsigned bucket) {
+  if (bucket < (1U << kLatencySubBits)) {
+    return bucket;
+  }
+  unsigned msb = (bucket >> kLatencySubBits) + kLatencySubBits - 1;
+  uint64_t sub = bucket & ((1U << kLatencySubBits) - 1);
+  return (((1ULL << kLatencySubBits) + sub + 1) << (msb - kLatencySubBits)) - 1;
+}
+
+static uint64_t LatencyPercentile(unsigned percent) {
+  uint64_t target = (gLatencyNum * percent + 99) / 100;
+  uint64_t count = 0;
+  for (unsigned bucket = 0; bucket < kLatencyBuckets; ++bucket) {
+    count += gLatencyHistogram[bucket];
+    if (count && (count >= target)) {
+      return LatencyBucketLimit(bucket);
+    }
+  }
+  return 0;
+}
+
 namespace testing {
 
 int PrettyPrintInt(char* str, int len, unsigned int arg)
@@ -146,6 +186,13 @@ void Run(Benchmark* b) {
     snprintf(throughput, sizeof(throughput), " %8.2f MiB/s", mib_processed/seconds);
   }
 
+  char latency[100];
+  latency[0] = '\0';
+  if (gLatencyNum > 0) {
+    snprintf(latency, sizeof(latency), " p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64,
+             LatencyPercentile(50), LatencyPercentile(90), LatencyPercentile(99));
+  }
+
   char full_name[100];
   snprintf(full_name, sizeof(full_name), "%s%s%s", b->Name(),
            b->ArgName() ? "/" : "",
@@ -160,11 +207,11 @@ void Run(Benchmark* b) {
     sdev = (sqrt((double)nXvariance) / gBenchmarkNum / gBenchmarkNum) + 0.5;
   }
   if (mean > (10000 * sdev)) {
-    printf("%-25s %10" PRIu64 " %10" PRIu64 "%s\n", full_name,
-            static_cast<uint64_t>(iterations), mean, throughput);
+    printf("%-25s %10" PRIu64 " %10" PRIu64 "%s%s\n", full_name,
+            static_cast<uint64_t>(iterations), mean, throughput, latency);
   } else {
-    printf("%-25s %10" PRIu64 " %10" PRIu64 "(\317\203%" PRIu64 ")%s\n", full_name,
-           static_cast<uint64_t>(iterations), mean, sdev, throughput);
+    printf("%-25s %10" PRIu64 " %10" PRIu64 "(\317\203%" PRIu64 ")%s%s\n", full_name,
+           static_cast<uint64_t>(iterations), mean, sdev, throughput, latency);
   }
   fflush(stdout);
 }
@@ -175,11 +222,18 @@ void SetBenchmarkBytesProcessed(uint64_t x) {
   gBytesProcessed = x;
 }
 
+void AddBenchmarkLatency(uint64_t ns) {
+  ++gLatencyHistogram[LatencyBucket(ns)];
+  ++gLatencyNum;
+}
+
 void ResetBenchmarkTiming() {
   gBenchmarkStartTimeNs = 0;
   gBenchmarkTotalTimeNs = 0;
   gBenchmarkTotalTimeNsSquared = 0;
   gBenchmarkNum = 0;
+  memset(gLatencyHistogram, 0, sizeof(gLatencyHistogram));
+  gLatencyNum = 0;
 }
 
 void StopBenchmarkTiming(void) {
@@ -16,14 +16,22 @@
 
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <string>
+
 #include <cutils/properties.h>
 #include <gtest/gtest.h>
+#include <log/event_tag_map.h>
 #include <log/log.h>
 #include <log/logger.h>
 #include <log/log_read.h>
@@ -124,6 +132,136 @@ TEST(liblog, concurrent_name(__android_log_buf_print, NUM_CONCURRENT)) {
     ASSERT_LT(0, ret);
 }
 
+static const char async_tag[] = "TEST__android_log_async";
+static const char async_fatal_tag[] = "TEST__android_log_async_fatal";
+static volatile int async_handler_sent;
+static volatile int async_fatal_sent;
+
+// Interrupts whatever the thread is doing, a flush holding the drain lock
+// included. The fatal message is written synchronously after a flush.
+static void async_handler(int /* signum */) {
+    if (__android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                async_tag, "handler") > 0) {
+        ++async_handler_sent;
+    }
+    if (!(async_handler_sent & 15) &&
+            (__android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_FATAL,
+                                     async_fatal_tag, "handler") > 0)) {
+        ++async_fatal_sent;
+    }
+}
+
+static void* AsyncWriteFn(void *arg) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    int *sent = reinterpret_cast<int *>(arg);
+    for (int i = 0; i < 1000; ++i) {
+        if (__android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                    async_tag, "thread") > 0) {
+            ++*sent;
+        }
+    }
+    return NULL;
+}
+
+// Runs in a forked child, so that the rest of the tests write synchronously.
+// Returns the count of messages written through the queue, and of fatal
+// messages, via fd.
+static void async_child(int fd) {
+    if (__android_log_async_enable(64 * 1024)) {
+        _exit(EXIT_FAILURE);
+    }
+
+    signal(SIGALRM, async_handler);
+    struct itimerval interval = { { 0, 100 }, { 0, 100 } };
+    setitimer(ITIMER_REAL, &interval, NULL);
+
+    static const int threads = 8;
+    pthread_t t[threads];
+    int sent[threads];
+    for (int i = 0; i < threads; ++i) {
+        sent[i] = 0;
+        pthread_create(&t[i], NULL, AsyncWriteFn, &sent[i]);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        __android_log_async_flush();
+    }
+    int total = 0;
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(t[i], NULL);
+        total += sent[i];
+    }
+
+    struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_REAL, &stop, NULL);
+    __android_log_async_flush();
+
+    int counts[2] = { total + async_handler_sent, async_fatal_sent };
+    _exit((write(fd, counts, sizeof(counts)) == sizeof(counts)) ?
+          EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+TEST(liblog, __android_log_async__contention_signal) {
+    int fd[2];
+    ASSERT_EQ(0, pipe(fd));
+
+    pid_t pid = fork();
+    ASSERT_LE(0, pid);
+    if (!pid) {
+        close(fd[0]);
+        async_child(fd[1]);
+    }
+    close(fd[1]);
+
+    // A writer, the handler or a fatal message waiting on a lock would
+    // leave the child hung rather than failing.
+    struct pollfd p = { fd[0], POLLIN, 0 };
+    int counts[2] = { -1, -1 };
+    if (poll(&p, 1, 30000) == 1) {
+        EXPECT_EQ((ssize_t)sizeof(counts), read(fd[0], counts, sizeof(counts)));
+    } else {
+        kill(pid, SIGKILL);
+        ADD_FAILURE() << "asynchronous logging hung";
+    }
+    close(fd[0]);
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(EXIT_SUCCESS, WEXITSTATUS(status));
+    usleep(1000000);
+
+    struct logger_list *logger_list;
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_MAIN, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, pid)));
+
+    int count = 0;
+    int fatal = 0;
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+        if ((log_msg.entry.pid != pid) || (log_msg.id() != LOG_ID_MAIN)) {
+            continue;
+        }
+        const char *tag = log_msg.msg() + 1;
+        if (!strcmp(tag, async_tag)) {
+            ++count;
+        } else if (!strcmp(tag, async_fatal_tag)) {
+            ++fatal;
+        }
+    }
+
+    android_logger_list_close(logger_list);
+
+    EXPECT_LT(0, counts[0]);
+    EXPECT_EQ(counts[0], count);
+    EXPECT_EQ(counts[1], fatal);
+}
+
 TEST(liblog, __android_log_btwrite__android_logger_list_read) {
     struct logger_list *logger_list;
 
@@ -1025,6 +1163,62 @@ TEST(liblog, __android_log_buf_print__maxtag) {
     android_logger_list_close(logger_list);
 }
 
+TEST(liblog, android_logger_list_set_filter) {
+    static const char pass_tag[] = "TEST_filter_pass";
+    static const char fail_tag[] = "TEST_filter_fail";
+    struct logger_list *logger_list;
+
+    pid_t pid = getpid();
+
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_MAIN, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid)));
+    EXPECT_EQ(-EINVAL, android_logger_list_set_filter(logger_list,
+                                                      NULL, "system", NULL));
+    EXPECT_EQ(0, android_logger_list_set_filter(logger_list,
+        "*:s TEST_filter_pass:i", NULL, "^keep"));
+
+    log_time ts(android_log_clockid());
+
+    EXPECT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         pass_tag, "keep"));
+    EXPECT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_DEBUG,
+                                         pass_tag, "keep"));
+    EXPECT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         pass_tag, "drop"));
+    EXPECT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         fail_tag, "keep"));
+    usleep(1000000);
+
+    int count = 0;
+
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+
+        ASSERT_EQ(log_msg.entry.pid, pid);
+
+        if ((log_msg.entry.sec < (ts.tv_sec - 1))
+         || ((ts.tv_sec + 1) < log_msg.entry.sec)
+         || (log_msg.id() != LOG_ID_MAIN)) {
+            continue;
+        }
+
+        // logd filtered out all but the first
+        AndroidLogEntry entry;
+        ASSERT_EQ(0, android_log_processLogBuffer(&log_msg.entry_v1, &entry));
+        EXPECT_STREQ(pass_tag, entry.tag);
+        EXPECT_EQ(ANDROID_LOG_INFO, entry.priority);
+        EXPECT_EQ(0, strncmp("keep", entry.message, 4));
+        ++count;
+    }
+
+    EXPECT_EQ(1, count);
+
+    android_logger_list_close(logger_list);
+}
+
 TEST(liblog, too_big_payload) {
     pid_t pid = getpid();
     static const char big_payload_tag[] = "TEST_big_payload_XXXX";
@@ -1232,6 +1426,269 @@ TEST(liblog, filterRule) {
     android_log_format_free(p_format);
 }
 
+TEST(liblog, filterRule_wildcard) {
+    AndroidLogFormat *p_format = android_log_format_new();
+
+    EXPECT_EQ(0, android_log_addFilterString(p_format,
+        "*:s random*:w random_tag:d *_glob:e rand?m:i"));
+
+    // exact beats prefix, prefix beats glob
+    EXPECT_TRUE(checkPriForTag(p_format, "random_tag", ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format, "random", ANDROID_LOG_WARN));
+    EXPECT_TRUE(checkPriForTag(p_format, "random_glob", ANDROID_LOG_WARN));
+    EXPECT_TRUE(checkPriForTag(p_format, "crap_glob", ANDROID_LOG_ERROR));
+    EXPECT_TRUE(checkPriForTag(p_format, "randxm", ANDROID_LOG_INFO));
+    EXPECT_FALSE(android_log_shouldPrintLine(p_format, "randxmm",
+                                             ANDROID_LOG_FATAL));
+
+    // longest prefix wins, later rules replace earlier ones
+    EXPECT_EQ(0, android_log_addFilterString(p_format,
+        "random_t*:e random*:i"));
+    EXPECT_TRUE(checkPriForTag(p_format, "random_tag", ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format, "random_tab", ANDROID_LOG_ERROR));
+    EXPECT_TRUE(checkPriForTag(p_format, "random_glob", ANDROID_LOG_INFO));
+
+    android_log_format_free(p_format);
+}
+
+TEST(liblog, filterRule_overlap) {
+    // A prefix rule hashes as its stem does, the exact rule for that stem
+    // shares its bucket. Each must keep its own priority whichever order
+    // they are added in, and a glob matching both must not win over them.
+    static const char *orders[] = {
+        "*:s random:d random*:w rand*m:e",
+        "*:s rand*m:e random*:w random:d",
+    };
+    for (size_t i = 0; i < (sizeof(orders) / sizeof(orders[0])); ++i) {
+        AndroidLogFormat *p_format = android_log_format_new();
+        EXPECT_EQ(0, android_log_addFilterString(p_format, orders[i]));
+
+        EXPECT_TRUE(checkPriForTag(p_format, "random", ANDROID_LOG_DEBUG))
+            << orders[i];
+        EXPECT_TRUE(checkPriForTag(p_format, "randomm", ANDROID_LOG_WARN))
+            << orders[i];
+        EXPECT_TRUE(checkPriForTag(p_format, "randomXm", ANDROID_LOG_WARN))
+            << orders[i];
+        EXPECT_TRUE(checkPriForTag(p_format, "randXm", ANDROID_LOG_ERROR))
+            << orders[i];
+        EXPECT_FALSE(android_log_shouldPrintLine(p_format, "rando",
+                                                 ANDROID_LOG_FATAL))
+            << orders[i];
+
+        // replacing one leaves the other alone
+        EXPECT_EQ(0, android_log_addFilterString(p_format, "random*:i"));
+        EXPECT_TRUE(checkPriForTag(p_format, "random", ANDROID_LOG_DEBUG))
+            << orders[i];
+        EXPECT_TRUE(checkPriForTag(p_format, "randomm", ANDROID_LOG_INFO))
+            << orders[i];
+        EXPECT_EQ(0, android_log_addFilterString(p_format, "random:v"));
+        EXPECT_TRUE(checkPriForTag(p_format, "random", ANDROID_LOG_VERBOSE))
+            << orders[i];
+        EXPECT_TRUE(checkPriForTag(p_format, "randomm", ANDROID_LOG_INFO))
+            << orders[i];
+
+        android_log_format_free(p_format);
+    }
+}
+
+TEST(liblog, filterRule_collision) {
+    AndroidLogFormat *p_format = android_log_format_new();
+
+    // "tag0062789" and "tag0279192" have the same length and the same 32
+    // bit FNV-1a hash, they are told apart by their content alone, as
+    // exact or as prefix rules.
+    EXPECT_EQ(0, android_log_addFilterString(p_format,
+        "*:s tag0062789:d tag0279192:e"));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0062789", ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0279192", ANDROID_LOG_ERROR));
+    EXPECT_EQ(0, android_log_addFilterString(p_format, "tag0279192*:w"));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0062789", ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0279192", ANDROID_LOG_ERROR));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag02791920", ANDROID_LOG_WARN));
+    EXPECT_FALSE(android_log_shouldPrintLine(p_format, "tag00627890",
+                                             ANDROID_LOG_FATAL));
+
+    // Enough rules that the table grows several times over, and buckets
+    // are shared; each tag keeps the priority last given to it.
+    static const char pris[] = "vdiwef";
+    static const size_t count = 300;
+    for (size_t pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < count; ++i) {
+            char rule[32];
+            snprintf(rule, sizeof(rule), "bucket%zu:%c", i,
+                     pris[(i + pass) % (sizeof(pris) - 1)]);
+            ASSERT_EQ(0, android_log_addFilterRule(p_format, rule)) << rule;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            char tag[32];
+            snprintf(tag, sizeof(tag), "bucket%zu", i);
+            android_LogPriority pri = (android_LogPriority)(ANDROID_LOG_VERBOSE
+                + (i + pass) % (sizeof(pris) - 1));
+            EXPECT_TRUE(checkPriForTag(p_format, tag, pri)) << tag;
+        }
+    }
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0062789", ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0279192", ANDROID_LOG_ERROR));
+    EXPECT_FALSE(android_log_shouldPrintLine(p_format, "bucket",
+                                             ANDROID_LOG_FATAL));
+
+    android_log_format_free(p_format);
+}
+
+static bool writeEventTagMap(const std::string &path, const char *content,
+                             time_t mtime) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t len = strlen(content);
+    bool ret = write(fd, content, len) == (ssize_t)len;
+    struct timeval times[2] = { { mtime, 0 }, { mtime, 0 } };
+    ret = !close(fd) && ret;
+    return ret && !utimes(path.c_str(), times);
+}
+
+static bool compileEventTagMap(const std::string &path, time_t mtime) {
+    std::string compiled = path + EVENT_TAG_MAP_COMPILED_SUFFIX;
+    int fd = open(compiled.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ret = !android_compileEventTagMap(path.c_str(), fd);
+    struct timeval times[2] = { { mtime, 0 }, { mtime, 0 } };
+    ret = !close(fd) && ret;
+    return ret && !utimes(compiled.c_str(), times);
+}
+
+// The tag android_openEventTagMap(path) gives for index, "" for none
+static std::string lookupEventTag(const std::string &path, unsigned index) {
+    EventTagMap *map = android_openEventTagMap(path.c_str());
+    if (!map) {
+        return "(no map)";
+    }
+    const char *tag = android_lookupEventTag(map, index);
+    std::string ret = tag ? tag : "";
+    android_closeEventTagMap(map);
+    return ret;
+}
+
+TEST(liblog, android_compileEventTagMap) {
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/data/local/tmp")
+                     + "/liblog_event_tag_map_test";
+    std::string compiled = path + EVENT_TAG_MAP_COMPILED_SUFFIX;
+    // as an image build stamps them
+    const time_t stamp = 1230768000;
+
+    // Compiled, opened and looked up, with the text map beside it
+    ASSERT_TRUE(writeEventTagMap(path,
+        "42 answer (value|1)\n"
+        "# comment\n"
+        "2718 e\n"
+        "1005 liblog (dropped|1)\n", stamp));
+    ASSERT_TRUE(compileEventTagMap(path, stamp));
+    EXPECT_EQ("answer", lookupEventTag(path, 42));
+    EXPECT_EQ("e", lookupEventTag(path, 2718));
+    EXPECT_EQ("liblog", lookupEventTag(path, 1005));
+    EXPECT_EQ("", lookupEventTag(path, 43));
+
+    // The compiled map stands for a text map of the same size and stamp,
+    // which shows it is what is being looked up in.
+    ASSERT_TRUE(writeEventTagMap(path,
+        "42 ANSWER (value|1)\n"
+        "# comment\n"
+        "2718 e\n"
+        "1005 liblog (dropped|1)\n", stamp));
+    EXPECT_EQ("answer", lookupEventTag(path, 42));
+
+    // Stale, the text map was edited after it was compiled
+    ASSERT_TRUE(writeEventTagMap(path,
+        "42 ANSWER (value|1)\n"
+        "# comment\n"
+        "2718 e\n"
+        "1005 liblog (dropped|1)\n", stamp + 1));
+    EXPECT_EQ("ANSWER", lookupEventTag(path, 42));
+
+    // Stale, the text map is no longer the size it was compiled from
+    ASSERT_TRUE(writeEventTagMap(path,
+        "42 question\n"
+        "2718 e\n", stamp));
+    EXPECT_EQ("question", lookupEventTag(path, 42));
+    EXPECT_EQ("", lookupEventTag(path, 1005));
+
+    // Corrupt, truncated compiled map
+    ASSERT_TRUE(compileEventTagMap(path, stamp));
+    struct stat st;
+    ASSERT_EQ(0, stat(compiled.c_str(), &st));
+    ASSERT_EQ(0, truncate(compiled.c_str(), st.st_size - 1));
+    ASSERT_TRUE(writeEventTagMap(path,
+        "42 reply\n"
+        "2718 e\n", stamp));
+    EXPECT_EQ("reply", lookupEventTag(path, 42));
+
+    // Corrupt, not a compiled map at all
+    ASSERT_TRUE(writeEventTagMap(compiled, "42 garbage\n", stamp));
+    EXPECT_EQ("reply", lookupEventTag(path, 42));
+
+    // Without a text map to compare against, the compiled map stands
+    ASSERT_TRUE(compileEventTagMap(path, stamp));
+    ASSERT_EQ(0, unlink(path.c_str()));
+    EXPECT_EQ("reply", lookupEventTag(path, 42));
+
+    unlink(compiled.c_str());
+}
+
+TEST(liblog, android_log_decoder) {
+    // [1,[-2,"ab"],3.5f]
+    static const uint8_t payload[] = {
+        EVENT_TYPE_LIST, 3,
+            EVENT_TYPE_LONG, 1, 0, 0, 0, 0, 0, 0, 0,
+            EVENT_TYPE_LIST, 2,
+                EVENT_TYPE_INT, 0xFE, 0xFF, 0xFF, 0xFF,
+                EVENT_TYPE_STRING, 2, 0, 0, 0, 'a', 'b',
+            EVENT_TYPE_FLOAT, 0x00, 0x00, 0x60, 0x40,
+        '\n'
+    };
+    AndroidEventLogDecoder decoder;
+    AndroidEventLogValue value;
+
+    android_log_decoder_init(&decoder, payload, sizeof(payload));
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_LIST, value.type);
+    EXPECT_EQ(3U, value.len);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_LONG, value.type);
+    EXPECT_EQ(1, value.data.int64);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_LIST, value.type);
+    EXPECT_EQ(2U, value.len);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_INT, value.type);
+    EXPECT_EQ(2U, value.depth);
+    EXPECT_EQ(-2, value.data.int32);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_STRING, value.type);
+    ASSERT_EQ(2U, value.len);
+    EXPECT_EQ(0, memcmp("ab", value.data.string, value.len));
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_LIST_STOP, value.type);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_FLOAT, value.type);
+    EXPECT_EQ(3.5f, value.data.float32);
+    ASSERT_EQ(1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_LIST_STOP, value.type);
+    EXPECT_EQ(0U, value.depth);
+    EXPECT_EQ(0, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(1U, decoder.len);
+
+    // Truncated string, and the error sticks
+    android_log_decoder_init(&decoder, payload + 18, 6);
+    EXPECT_EQ(-1, android_log_decoder_next(&decoder, &value));
+    EXPECT_EQ(EVENT_TYPE_UNKNOWN, value.type);
+    EXPECT_EQ(-1, android_log_decoder_next(&decoder, &value));
+}
+
 TEST(liblog, is_loggable) {
     static const char tag[] = "is_loggable";
     static const char log_namespace[] = "persist.log.tag.";
@@ -1517,6 +1974,70 @@ TEST(liblog, is_loggable) {
     property_set(key + base_offset, hold[3]);
 }
 
+static const char is_loggable_race_tag[] = "is_loggable_race";
+
+struct IsLoggableReader {
+    std::atomic<bool> stop;
+    std::atomic<int> loggable; // last answer, -1 until the first
+};
+
+// Keeps asking while the main thread changes the property under it
+static void *IsLoggableReaderFn(void *arg) {
+    IsLoggableReader *reader = static_cast<IsLoggableReader *>(arg);
+    while (!reader->stop) {
+        reader->loggable = __android_log_is_loggable(
+            ANDROID_LOG_DEBUG, is_loggable_race_tag, ANDROID_LOG_INFO);
+    }
+    return NULL;
+}
+
+// Wait up to a second for the reader to give the answer expected
+static bool waitLoggable(IsLoggableReader &reader, int expected) {
+    for (int retry = 1000; retry; --retry) {
+        if (reader.loggable == expected) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+TEST(liblog, is_loggable_concurrent) {
+    char key[PROP_NAME_MAX];
+    snprintf(key, sizeof(key), "log.tag.%s", is_loggable_race_tag);
+    char hold[PROP_VALUE_MAX];
+    property_get(key, hold, "");
+    property_set(key, "");
+
+    IsLoggableReader reader;
+    reader.stop = false;
+    reader.loggable = -1;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, IsLoggableReaderFn, &reader));
+    EXPECT_TRUE(waitLoggable(reader, 0));
+
+    // Each change is seen by the reader, which has the caches warm, and
+    // by a fresh call from here.
+    static const struct {
+        const char *value;
+        int loggable;
+    } changes[] = {
+        { "D", 1 }, { "S", 0 }, { "V", 1 }, { "I", 0 }, { "", 0 },
+    };
+    for (size_t i = 0; i < (sizeof(changes) / sizeof(changes[0])); ++i) {
+        property_set(key, changes[i].value);
+        EXPECT_TRUE(waitLoggable(reader, changes[i].loggable))
+            << key << "=" << changes[i].value;
+        EXPECT_EQ(changes[i].loggable, __android_log_is_loggable(
+            ANDROID_LOG_DEBUG, is_loggable_race_tag, ANDROID_LOG_INFO))
+            << key << "=" << changes[i].value;
+    }
+
+    reader.stop = true;
+    pthread_join(thread, NULL);
+    property_set(key, hold);
+}
+
 TEST(liblog, android_errorWriteWithInfoLog__android_logger_list_read__typical) {
     const int TAG = 123456781;
     const char SUBTAG[] = "test-subtag";
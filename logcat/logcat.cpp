@@ -8,6 +8,8 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -15,15 +17,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -67,6 +73,34 @@ struct log_device_t {
 
 namespace android {
 
+// Binary log segments, written with --segments -f, hold the log_msg
+// records read from logd, appended as they arrive after a
+// LogSegmentHeader. When a segment is rotated out, an index of its blocks
+// of roughly logSegmentBlockSize bytes is appended to it, closed by a
+// LogSegmentTrailer, so that --replay can skip over content by time and
+// buffer without reading it. A segment without an index, the current one
+// or one cut short, is walked record by record.
+static const uint32_t logSegmentMagic = 0x3147534c; // "LSG1"
+static const uint32_t logSegmentIndexMagic = 0x3149534c; // "LSI1"
+static const size_t logSegmentBlockSize = 64 * 1024;
+
+struct LogSegmentHeader {
+    uint32_t magic;
+    uint32_t hdr_size;
+};
+
+struct LogSegmentBlock {
+    uint32_t offset;    // of the first record
+    uint32_t idMask;    // buffers with records in the block
+    log_time first;     // earliest and latest record
+    log_time last;
+};
+
+struct LogSegmentTrailer {
+    uint32_t blocks;    // in the index ahead of the trailer
+    uint32_t magic;
+};
+
 /* Global Variables */
 
 static const char * g_outputFileName;
@@ -77,8 +111,19 @@ static size_t g_maxRotatedLogs = DEFAULT_MAX_ROTATED_LOGS;
 static int g_outFD = -1;
 static size_t g_outByteCount;
 static int g_printBinary;
+// --segments, -f logs to binary log segments rather than a raw stream
+static bool g_printSegments;
+// g_outFD is a binary log segment, see LogSegmentHeader
+static bool g_outSegment;
+// Index of the blocks written to the segment since it was started, only
+// kept if the segment was started from empty.
+static std::vector<LogSegmentBlock> g_segmentBlocks;
+static bool g_segmentIndexed;
 static int g_devCount;                              // >1 means multiple
 static pcrecpp::RE* g_regex;
+static const char *g_regexString;
+// Every filterspec added to g_logformat, in order, for logd
+static std::string g_filterSpec;
 // 0 means "infinite"
 static size_t g_maxCount;
 static size_t g_printCount;
@@ -92,6 +137,301 @@ static int openLogFile (const char *pathname)
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
+// Output is staged in an arena and written out with writev() once enough
+// has accumulated, or once it has been pending for outputFlushMs, rather
+// than with a write() per line. Lines too long for the space left in the
+// arena are formatted into their own buffer and written in the same writev.
+// g_outLock serializes the arena, the flusher thread and g_outFD.
+static const size_t outputArenaSize = 64 * 1024;
+static const size_t outputFlushSize = 32 * 1024;
+static const int outputIovMax = 64;
+static const long outputFlushMs = 100;
+
+static char g_outArena[outputArenaSize];
+static size_t g_outArenaLen;
+static struct iovec g_outIov[outputIovMax];
+static int g_outIovCnt;
+static bool g_outFlusher;
+static bool g_outError;
+static pthread_mutex_t g_outLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_outCond = PTHREAD_COND_INITIALIZER;
+
+static bool inOutputArena(const char *buf)
+{
+    return (buf >= g_outArena) && (buf < (g_outArena + outputArenaSize));
+}
+
+// g_outLock must be held when this function is called. On a write error
+// what is queued is discarded and g_outError set, for the caller to
+// logcat_panic() once it has released g_outLock.
+static void flushOutputLocked()
+{
+    struct iovec vec[outputIovMax];
+    struct iovec *iov = vec;
+    int iovcnt = g_outIovCnt;
+
+    memcpy(vec, g_outIov, iovcnt * sizeof(vec[0]));
+
+    while ((iovcnt > 0) && !g_outError) {
+        ssize_t ret = TEMP_FAILURE_RETRY(writev(g_outFD, iov, iovcnt));
+        if ((ret < 0) && (errno == EAGAIN)) {
+            struct pollfd p = { g_outFD, POLLOUT, 0 };
+            TEMP_FAILURE_RETRY(poll(&p, 1, -1));
+            continue;
+        }
+        if (ret <= 0) {
+            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+            g_outError = true;
+            break;
+        }
+        // skip over what was written, a partial write resumes mid-iovec
+        while ((iovcnt > 0) && ((size_t)ret >= iov->iov_len)) {
+            ret -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    for (int i = 0; i < g_outIovCnt; ++i) {
+        char *buf = static_cast<char *>(g_outIov[i].iov_base);
+        if (!inOutputArena(buf)) {
+            free(buf);
+        }
+    }
+    g_outIovCnt = 0;
+    g_outArenaLen = 0;
+}
+
+// Releases g_outLock, and exits if output has failed
+static void unlockOutput()
+{
+    bool error = g_outError;
+    pthread_mutex_unlock(&g_outLock);
+    if (error) {
+        logcat_panic(false, "output error");
+    }
+}
+
+static void flushOutput()
+{
+    pthread_mutex_lock(&g_outLock);
+    flushOutputLocked();
+    unlockOutput();
+}
+
+// Writes out whatever the main thread left pending for outputFlushMs
+static void *outputFlusher(void * /*obj*/)
+{
+    pthread_mutex_lock(&g_outLock);
+    for (;;) {
+        if (!g_outIovCnt) {
+            pthread_cond_wait(&g_outCond, &g_outLock);
+            continue;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += outputFlushMs * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_nsec -= 1000000000L;
+            ++ts.tv_sec;
+        }
+        pthread_cond_timedwait(&g_outCond, &g_outLock, &ts);
+        flushOutputLocked();
+        if (g_outError) {
+            unlockOutput();
+        }
+    }
+    return NULL;
+}
+
+// g_outLock must be held when this function is called. Makes sure there
+// is room to queue one more buffer.
+static void reserveOutputLocked(size_t len)
+{
+    if ((g_outIovCnt >= outputIovMax)
+            || (len > (outputArenaSize - g_outArenaLen))) {
+        flushOutputLocked();
+    }
+}
+
+// g_outLock must be held when this function is called. buf is either at
+// the end of the arena, or malloc()'d and now owned by the queue.
+static void queueOutputLocked(char *buf, size_t len)
+{
+    if (inOutputArena(buf)) {
+        g_outArenaLen += len;
+    }
+    struct iovec *last = g_outIovCnt ? &g_outIov[g_outIovCnt - 1] : NULL;
+    if (last && inOutputArena(buf)
+            && ((static_cast<char *>(last->iov_base) + last->iov_len) == buf)) {
+        last->iov_len += len;
+    } else {
+        g_outIov[g_outIovCnt].iov_base = buf;
+        g_outIov[g_outIovCnt].iov_len = len;
+        ++g_outIovCnt;
+    }
+
+    if ((g_outArenaLen >= outputFlushSize) || (g_outIovCnt >= outputIovMax)) {
+        flushOutputLocked();
+    } else if (g_outIovCnt == 1) {
+        if (!g_outFlusher) {
+            pthread_attr_t attr;
+            pthread_t thread;
+            if (!pthread_attr_init(&attr)) {
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                g_outFlusher = !pthread_create(&thread, &attr,
+                                               outputFlusher, NULL);
+                pthread_attr_destroy(&attr);
+            }
+        }
+        if (!g_outFlusher) { // no way to flush later, so do it now
+            flushOutputLocked();
+        } else {
+            pthread_cond_signal(&g_outCond);
+        }
+    }
+}
+
+static void output(const void *buf, size_t len)
+{
+    pthread_mutex_lock(&g_outLock);
+    reserveOutputLocked(len);
+    char *cp = g_outArena + g_outArenaLen;
+    memcpy(cp, buf, len);
+    queueOutputLocked(cp, len);
+    unlockOutput();
+}
+
+// Returns the formatted length of the line, or -1 if it could not be
+static ssize_t outputLogLine(const AndroidLogEntry *entry)
+{
+    size_t len = 0;
+
+    pthread_mutex_lock(&g_outLock);
+    reserveOutputLocked(0);
+    char *buf = android_log_formatLogLine(g_logformat,
+                                          g_outArena + g_outArenaLen,
+                                          outputArenaSize - g_outArenaLen,
+                                          entry, &len);
+    if (buf) {
+        queueOutputLocked(buf, len);
+    }
+    unlockOutput();
+
+    return buf ? (ssize_t)len : -1;
+}
+
+static bool isLogSegment(const char *data, size_t size)
+{
+    LogSegmentHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    return (header.magic == logSegmentMagic)
+        && (header.hdr_size == sizeof(header));
+}
+
+// Returns the length of the record at data, or 0 if there is no valid one
+static size_t logSegmentRecordLength(const char *data, size_t size)
+{
+    struct logger_entry_v4 entry;
+    if (size < sizeof(struct logger_entry)) {
+        return 0;
+    }
+    memset(&entry, 0, sizeof(entry));
+    memcpy(&entry, data, sizeof(struct logger_entry));
+    size_t hdr_size = entry.hdr_size ? entry.hdr_size
+                                     : sizeof(struct logger_entry);
+    if ((hdr_size < sizeof(struct logger_entry))
+            || (hdr_size > sizeof(struct logger_entry_v4))
+            || (entry.len > LOGGER_ENTRY_MAX_PAYLOAD)
+            || ((hdr_size + entry.len) > size)) {
+        return 0;
+    }
+    return hdr_size + entry.len;
+}
+
+// Returns the blocks of the segment at data, as indexed, or as one block
+// spanning every record if it has no index. *end is set past the records.
+static std::vector<LogSegmentBlock> logSegmentBlocks(const char *data,
+                                                     size_t size,
+                                                     size_t *end)
+{
+    std::vector<LogSegmentBlock> blocks;
+    LogSegmentTrailer trailer;
+
+    *end = size;
+    if (size >= (sizeof(LogSegmentHeader) + sizeof(trailer))) {
+        memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+        size_t indexSize = trailer.blocks * sizeof(LogSegmentBlock);
+        if ((trailer.magic == logSegmentIndexMagic) && trailer.blocks
+                && (trailer.blocks <= (size / sizeof(LogSegmentBlock)))
+                && ((sizeof(LogSegmentHeader) + indexSize + sizeof(trailer))
+                        <= size)) {
+            size_t index = size - sizeof(trailer) - indexSize;
+            blocks.resize(trailer.blocks);
+            memcpy(&blocks[0], data + index, indexSize);
+            uint32_t offset = sizeof(LogSegmentHeader);
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                if ((blocks[i].offset < offset) || (blocks[i].offset > index)) {
+                    blocks.clear();
+                    break;
+                }
+                offset = blocks[i].offset;
+            }
+            if (blocks.size()) {
+                *end = index;
+                return blocks;
+            }
+        }
+    }
+
+    LogSegmentBlock all = {
+        sizeof(LogSegmentHeader), (uint32_t)-1,
+        log_time::EPOCH, log_time(UINT32_MAX, NS_PER_SEC - 1)
+    };
+    blocks.push_back(all);
+    return blocks;
+}
+
+// Start a binary log segment in g_outFD, of g_outByteCount bytes so far
+static void startSegment()
+{
+    g_outSegment = true;
+    g_segmentBlocks.clear();
+    g_segmentIndexed = !g_outByteCount;
+    if (!g_outByteCount) {
+        LogSegmentHeader header = { logSegmentMagic, sizeof(header) };
+        output(&header, sizeof(header));
+        g_outByteCount = sizeof(header);
+    }
+}
+
+// Close the segment in g_outFD with the index of its blocks
+static void finishSegment()
+{
+    if (!g_outSegment || !g_segmentIndexed || g_segmentBlocks.empty()) {
+        return;
+    }
+    const char *index = reinterpret_cast<const char *>(&g_segmentBlocks[0]);
+    size_t len = g_segmentBlocks.size() * sizeof(LogSegmentBlock);
+    while (len) {
+        size_t chunk = std::min(len, outputArenaSize);
+        output(index, chunk);
+        index += chunk;
+        len -= chunk;
+    }
+    LogSegmentTrailer trailer = {
+        (uint32_t)g_segmentBlocks.size(), logSegmentIndexMagic
+    };
+    output(&trailer, sizeof(trailer));
+}
+
 static void rotateLogs()
 {
     int err;
@@ -101,6 +441,10 @@ static void rotateLogs()
         return;
     }
 
+    finishSegment();
+
+    pthread_mutex_lock(&g_outLock);
+    flushOutputLocked();
     close(g_outFD);
 
     // Compute the maximum number of digits needed to count up to g_maxRotatedLogs in decimal.
@@ -135,6 +479,7 @@ static void rotateLogs()
     }
 
     g_outFD = openLogFile(g_outputFileName);
+    unlockOutput();
 
     if (g_outFD < 0) {
         logcat_panic(false, "couldn't open output file");
@@ -142,13 +487,69 @@ static void rotateLogs()
 
     g_outByteCount = 0;
 
+    if (g_outSegment) {
+        startSegment();
+    }
 }
 
 void printBinary(struct log_msg *buf)
 {
-    size_t size = buf->len();
+    size_t len = buf->len();
+
+    if (!g_outSegment) {
+        output(buf, len);
+        return;
+    }
+    // not a buffer the index, or --replay, can account for
+    if ((unsigned)buf->id() >= LOG_ID_MAX) {
+        return;
+    }
+
+    log_time t(buf->entry.sec, buf->entry.nsec);
+    if (g_segmentBlocks.empty() || ((g_outByteCount
+            - g_segmentBlocks.back().offset) >= logSegmentBlockSize)) {
+        LogSegmentBlock block = { (uint32_t)g_outByteCount, 0, t, t };
+        g_segmentBlocks.push_back(block);
+    }
+    LogSegmentBlock &block = g_segmentBlocks.back();
+    block.idMask |= 1 << buf->id();
+    if (t < block.first) {
+        block.first = t;
+    }
+    if (t > block.last) {
+        block.last = t;
+    }
+
+    output(buf, len);
+    g_outByteCount += len;
+
+    if (g_logRotateSizeKBytes > 0
+        && (g_outByteCount / 1024) >= g_logRotateSizeKBytes
+    ) {
+        rotateLogs();
+    }
+}
+
+static int addFilterString(const char *filterString)
+{
+    int err = android_log_addFilterString(g_logformat, filterString);
+    if (err >= 0) {
+        g_filterSpec += ' ';
+        g_filterSpec += filterString;
+    }
+    return err;
+}
 
-    TEMP_FAILURE_RETRY(write(g_outFD, buf, size));
+// Can logd's POSIX extended regular expressions be trusted to match at
+// least everything PCRE would? Avoid escapes, where the syntaxes part ways,
+// '$', which PCRE also matches ahead of a trailing newline, and extended
+// and lazy constructs.
+static bool regexIsPortable(const char *regex)
+{
+    return !strpbrk(regex, "\\$")
+        && !strstr(regex, "(?") && !strstr(regex, "*?")
+        && !strstr(regex, "+?") && !strstr(regex, "??")
+        && !strstr(regex, "}?");
 }
 
 static bool regexOk(const AndroidLogEntry& entry)
@@ -164,7 +565,7 @@ static bool regexOk(const AndroidLogEntry& entry)
 
 static void processBuffer(log_device_t* dev, struct log_msg *buf)
 {
-    int bytesWritten = 0;
+    ssize_t bytesWritten = 0;
     int err;
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
@@ -195,7 +596,7 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
 
         g_printCount += match;
         if (match || g_printItAnyways) {
-            bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
+            bytesWritten = outputLogLine(&entry);
 
             if (bytesWritten < 0) {
                 logcat_panic(false, "output error");
@@ -223,14 +624,39 @@ static void maybePrintStart(log_device_t* dev, bool printDividers) {
             snprintf(buf, sizeof(buf), "--------- %s %s\n",
                      dev->printed ? "switch to" : "beginning of",
                      dev->device);
-            if (write(g_outFD, buf, strlen(buf)) < 0) {
-                logcat_panic(false, "output error");
-            }
+            output(buf, strlen(buf));
         }
         dev->printed = true;
     }
 }
 
+static void printLogMessage(log_device_t* devices, log_device_t*& dev,
+                            struct log_msg *log_msg, bool printDividers) {
+    static log_device_t unexpected("unexpected", false);
+    log_device_t* d;
+
+    for (d = devices; d; d = d->next) {
+        if (android_name_to_log_id(d->device) == log_msg->id()) {
+            break;
+        }
+    }
+    if (!d) {
+        g_devCount = 2; // set to Multiple
+        d = &unexpected;
+        d->binary = log_msg->id() == LOG_ID_EVENTS;
+    }
+
+    if (dev != d) {
+        dev = d;
+        maybePrintStart(dev, printDividers);
+    }
+    if (g_printBinary) {
+        printBinary(log_msg);
+    } else {
+        processBuffer(dev, log_msg);
+    }
+}
+
 static void setupOutput()
 {
 
@@ -270,6 +696,24 @@ static void setupOutput()
         }
 
         g_outByteCount = statbuf.st_size;
+
+        if (g_printSegments) {
+            // Append to a segment, or start one, after moving aside
+            // anything else, such as text from before, to keep it intact
+            char magic[sizeof(LogSegmentHeader)];
+            int fd = open(g_outputFileName, O_RDONLY | O_CLOEXEC);
+            ssize_t len = (fd < 0) ? -1 : read(fd, magic, sizeof(magic));
+            if (fd >= 0) {
+                close(fd);
+            }
+            g_outSegment = true;
+            if (g_outByteCount && ((len < 0)
+                    || !isLogSegment(magic, len))) {
+                rotateLogs();
+            } else {
+                startSegment();
+            }
+        }
     }
 }
 
@@ -330,6 +774,11 @@ static void show_help(const char *cmd)
                     "                  Set prune white and ~black list, using same format as\n"
                     "                  listed above. Must be quoted.\n"
                     "  --pid=<pid>     Only prints logs from the given pid.\n"
+                    "  --segments      Output the log in binary, as indexed segments that --replay\n"
+                    "                  reads back. Requires -f option\n"
+                    "  --replay=<file> Print the logs saved with --segments -f <file>, and its\n"
+                    "                  rotated logs, instead of reading the log buffers. Honors\n"
+                    "                  -b, -T <time> and --pid, defaults to all buffers.\n"
                     // Check ANDROID_LOG_WRAP_DEFAULT_TIMEOUT value for match to 2 hours
                     "  --wrap          Sleep for 2 hours or when buffer about to wrap whichever\n"
                     "                  comes first. Improves efficiency of polling by providing\n"
@@ -337,7 +786,8 @@ static void show_help(const char *cmd)
 
     fprintf(stderr,"\nfilterspecs are a series of \n"
                    "  <tag>[:priority]\n\n"
-                   "where <tag> is a log component tag (or * for all) and priority is:\n"
+                   "where <tag> is a log component tag (or * for all), which may end in\n"
+                   "* to match a prefix, or contain * and ? wildcards, and priority is:\n"
                    "  V    Verbose (default for <tag>)\n"
                    "  D    Debug (default for '*')\n"
                    "  I    Info\n"
@@ -348,6 +798,8 @@ static void show_help(const char *cmd)
                    "\n'*' by itself means '*:D' and <tag> by itself means <tag>:V.\n"
                    "If no '*' filterspec or -s on command line, all filter defaults to '*:V'.\n"
                    "eg: '*:S <tag>' prints only <tag>, '<tag>:S' suppresses all <tag> log messages.\n"
+                   "An exact <tag> takes precedence over the longest matching prefix, which takes\n"
+                   "precedence over wildcards.\n"
                    "\nIf not specified on the command line, filterspec is set from ANDROID_LOG_TAGS.\n"
                    "\nIf not specified with -v on command line, format is set from ANDROID_PRINTF_LOG\n"
                    "or defaults to \"threadtime\"\n\n");
@@ -418,6 +870,12 @@ static bool getSizeTArg(char *ptr, size_t *val, size_t min = 0,
 static void logcat_panic(bool showHelp, const char *fmt, ...)
 {
     va_list  args;
+
+    // Whatever can still be written, without panicking about it again
+    pthread_mutex_lock(&g_outLock);
+    flushOutputLocked();
+    pthread_mutex_unlock(&g_outLock);
+
     va_start(args, fmt);
     vfprintf(stderr, fmt,  args);
     va_end(args);
@@ -497,26 +955,55 @@ static log_time lastLogTime(char *outputFileName) {
         }
 
         bool found = false;
-        for (const auto& line : android::base::Split(file, "\n")) {
-            log_time t(log_time::EPOCH);
-            char *ep = parseTime(t, line.c_str());
-            if (!ep || (*ep != ' ')) {
-                continue;
-            }
-            // determine the time precision of the logs (eg: msec or usec)
-            for (unsigned long mod = 1UL; mod < modulo.tv_nsec; mod *= 10) {
-                if (t.tv_nsec % (mod * 10)) {
-                    modulo.tv_nsec = mod;
-                    break;
+        if (isLogSegment(file.data(), file.size())) {
+            // binary records carry the full time, to the nanosecond
+            modulo.tv_nsec = 1;
+            size_t end;
+            std::vector<LogSegmentBlock> blocks =
+                logSegmentBlocks(file.data(), file.size(), &end);
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                if ((blocks[i].last < now) && (blocks[i].last <= retval)) {
+                    continue;
+                }
+                size_t offset = blocks[i].offset;
+                size_t limit = ((i + 1) < blocks.size())
+                             ? blocks[i + 1].offset : end;
+                size_t size;
+                while ((offset < limit)
+                        && (size = logSegmentRecordLength(file.data() + offset,
+                                                          limit - offset))) {
+                    struct logger_entry entry;
+                    memcpy(&entry, file.data() + offset, sizeof(entry));
+                    log_time t(entry.sec, entry.nsec);
+                    if ((t < now) && (t > retval)) {
+                        retval = t;
+                        found = true;
+                    }
+                    offset += size;
                 }
             }
-            // We filter any times later than current as we may not have the
-            // year stored with each log entry. Also, since it is possible for
-            // entries to be recorded out of order (very rare) we select the
-            // maximum we find just in case.
-            if ((t < now) && (t > retval)) {
-                retval = t;
-                found = true;
+        } else {
+            for (const auto& line : android::base::Split(file, "\n")) {
+                log_time t(log_time::EPOCH);
+                char *ep = parseTime(t, line.c_str());
+                if (!ep || (*ep != ' ')) {
+                    continue;
+                }
+                // determine the time precision of the logs (eg: msec or usec)
+                for (unsigned long mod = 1UL; mod < modulo.tv_nsec; mod *= 10) {
+                    if (t.tv_nsec % (mod * 10)) {
+                        modulo.tv_nsec = mod;
+                        break;
+                    }
+                }
+                // We filter any times later than current as we may not have the
+                // year stored with each log entry. Also, since it is possible for
+                // entries to be recorded out of order (very rare) we select the
+                // maximum we find just in case.
+                if ((t < now) && (t > retval)) {
+                    retval = t;
+                    found = true;
+                }
             }
         }
         // We count on the basename file to be the definitive end, so stop here.
@@ -533,6 +1020,117 @@ static log_time lastLogTime(char *outputFileName) {
     return retval;
 }
 
+// Print the records in an mmap'd log segment, skipping indexed blocks that
+// hold nothing for the buffers in idMask at or after start.
+static void replaySegment(const char *data, size_t size, unsigned idMask,
+                          log_time start, pid_t pid, log_device_t* devices,
+                          log_device_t*& dev, bool printDividers) {
+    size_t end;
+    std::vector<LogSegmentBlock> blocks = logSegmentBlocks(data, size, &end);
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!(blocks[i].idMask & idMask) || (blocks[i].last < start)) {
+            continue;
+        }
+        size_t offset = blocks[i].offset;
+        size_t limit = ((i + 1) < blocks.size()) ? blocks[i + 1].offset : end;
+        size_t len;
+        while ((offset < limit)
+                && (len = logSegmentRecordLength(data + offset,
+                                                 limit - offset))) {
+            if (g_maxCount && (g_printCount >= g_maxCount)) {
+                return;
+            }
+            struct log_msg log_msg;
+            memcpy(log_msg.buf, data + offset, len);
+            log_msg.buf[len] = '\0';
+            offset += len;
+
+            // the segment is untrusted, the id may be anything
+            if (((unsigned)log_msg.id() >= LOG_ID_MAX)
+                    || !((1 << log_msg.id()) & idMask)
+                    || (log_time(log_msg.entry.sec, log_msg.entry.nsec) < start)
+                    || (pid && (log_msg.entry.pid != pid))) {
+                continue;
+            }
+            printLogMessage(devices, dev, &log_msg, printDividers);
+        }
+    }
+}
+
+// Print what was persisted with -f to fileName, and its rotated
+// fileName.<N> predecessors, oldest first.
+static void replayLogs(const char *fileName, unsigned idMask, log_time start,
+                       pid_t pid, log_device_t* devices, bool printDividers) {
+    std::string directory;
+    const char *file = strrchr(fileName, '/');
+    if (!file) {
+        directory = ".";
+        file = fileName;
+    } else {
+        directory.assign(fileName, file - fileName);
+        ++file;
+    }
+
+    std::vector<std::pair<unsigned long, std::string>> files;
+    std::unique_ptr<DIR, int(*)(DIR*)>
+            dir(opendir(directory.c_str()), closedir);
+    if (dir.get()) {
+        size_t len = strlen(file);
+        struct dirent *dp;
+        while ((dp = readdir(dir.get())) != NULL) {
+            if (strncmp(dp->d_name, file, len)
+                    || (dp->d_name[len] != '.')
+                    || (strspn(dp->d_name + len + 1, "0123456789")
+                            != strlen(dp->d_name + len + 1))
+                    || !dp->d_name[len + 1]) {
+                continue;
+            }
+            files.push_back(std::make_pair(
+                strtoul(dp->d_name + len + 1, NULL, 10),
+                directory + "/" + dp->d_name));
+        }
+    }
+    // highest rotation count is the oldest
+    std::sort(files.begin(), files.end());
+    std::reverse(files.begin(), files.end());
+    files.push_back(std::make_pair(0UL, std::string(fileName)));
+
+    log_device_t* dev = NULL;
+    for (const auto& f : files) {
+        int fd = open(f.second.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) || !S_ISREG(st.st_mode) || (st.st_size <= 0)) {
+            close(fd);
+            continue;
+        }
+        size_t size = st.st_size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "failed to map %s\n", f.second.c_str());
+            continue;
+        }
+
+        const char *data = static_cast<const char *>(map);
+        if (isLogSegment(data, size)) {
+            replaySegment(data, size, idMask, start, pid, devices, dev,
+                          printDividers);
+        } else if (!g_printBinary) {
+            // persisted as text, from before or with -v, hand over as is
+            for (size_t offset = 0; offset < size; ) {
+                size_t len = std::min(size - offset, outputArenaSize);
+                output(data + offset, len);
+                offset += len;
+            }
+        }
+        munmap(map, size);
+    }
+}
+
 } /* namespace android */
 
 
@@ -557,6 +1155,7 @@ int main(int argc, char **argv)
     log_time tail_time(log_time::EPOCH);
     size_t pid = 0;
     bool got_t = false;
+    const char *replayFileName = NULL;
 
     signal(SIGPIPE, exit);
 
@@ -575,6 +1174,8 @@ int main(int argc, char **argv)
         static const char pid_str[] = "pid";
         static const char wrap_str[] = "wrap";
         static const char print_str[] = "print";
+        static const char replay_str[] = "replay";
+        static const char segments_str[] = "segments";
         static const struct option long_options[] = {
           { "binary",        no_argument,       NULL,   'B' },
           { "buffer",        required_argument, NULL,   'b' },
@@ -593,8 +1194,10 @@ int main(int argc, char **argv)
           { print_str,       no_argument,       NULL,   0 },
           { "prune",         optional_argument, NULL,   'p' },
           { "regex",         required_argument, NULL,   'e' },
+          { replay_str,      required_argument, NULL,   0 },
           { "rotate-count",  required_argument, NULL,   'n' },
           { "rotate-kbytes", required_argument, NULL,   'r' },
+          { segments_str,    no_argument,       NULL,   0 },
           { "statistics",    no_argument,       NULL,   'S' },
           // hidden and undocumented reserved alias for -t
           { "tail",          required_argument, NULL,   't' },
@@ -643,11 +1246,20 @@ int main(int argc, char **argv)
                     g_printItAnyways = true;
                     break;
                 }
+                if (long_options[option_index].name == replay_str) {
+                    replayFileName = optarg;
+                    break;
+                }
+                if (long_options[option_index].name == segments_str) {
+                    g_printBinary = 1;
+                    g_printSegments = true;
+                    break;
+                }
             break;
 
             case 's':
                 // default to all silent
-                android_log_addFilterRule(g_logformat, "*:s");
+                addFilterString("*:s");
             break;
 
             case 'c':
@@ -698,6 +1310,7 @@ int main(int argc, char **argv)
 
             case 'e':
                 g_regex = new pcrecpp::RE(optarg);
+                g_regexString = optarg;
             break;
 
             case 'm': {
@@ -950,6 +1563,28 @@ int main(int argc, char **argv)
         g_printItAnyways = false;
     }
 
+    // --replay shows every buffer that was persisted unless told otherwise
+    unsigned replayIdMask = devices ? 0 : (unsigned)-1;
+    for (dev = devices; dev; dev = dev->next) {
+        replayIdMask |= 1 << android_name_to_log_id(dev->device);
+    }
+    if (!devices && replayFileName) {
+        for (int i = LOG_ID_MIN; i < LOG_ID_MAX; ++i) {
+            const char *name = android_log_id_to_name((log_id_t)i);
+            if (android_name_to_log_id(name) != (log_id_t)i) {
+                continue;
+            }
+            bool binary = (i == LOG_ID_EVENTS) || (i == LOG_ID_SECURITY);
+            log_device_t* d = new log_device_t(name, binary);
+            if (devices) {
+                dev = dev->next = d;
+            } else {
+                dev = devices = d;
+            }
+            g_devCount++;
+        }
+    }
+
     if (!devices) {
         dev = devices = new log_device_t("main", false);
         g_devCount = 1;
@@ -967,6 +1602,10 @@ int main(int argc, char **argv)
         logcat_panic(true, "-r requires -f as well\n");
     }
 
+    if (g_printSegments && g_outputFileName == NULL) {
+        logcat_panic(true, "--segments requires -f as well\n");
+    }
+
     setupOutput();
 
     if (hasSetLogFormat == 0) {
@@ -984,7 +1623,7 @@ int main(int argc, char **argv)
     }
 
     if (forceFilters) {
-        err = android_log_addFilterString(g_logformat, forceFilters);
+        err = addFilterString(forceFilters);
         if (err < 0) {
             logcat_panic(false, "Invalid filter expression in logcat args\n");
         }
@@ -993,7 +1632,7 @@ int main(int argc, char **argv)
         char *env_tags_orig = getenv("ANDROID_LOG_TAGS");
 
         if (env_tags_orig != NULL) {
-            err = android_log_addFilterString(g_logformat, env_tags_orig);
+            err = addFilterString(env_tags_orig);
 
             if (err < 0) {
                 logcat_panic(true,
@@ -1003,7 +1642,7 @@ int main(int argc, char **argv)
     } else {
         // Add from commandline
         for (int i = optind ; i < argc ; i++) {
-            err = android_log_addFilterString(g_logformat, argv[i]);
+            err = addFilterString(argv[i]);
 
             if (err < 0) {
                 logcat_panic(true, "Invalid filter expression '%s'\n", argv[i]);
@@ -1011,12 +1650,30 @@ int main(int argc, char **argv)
         }
     }
 
+    if (replayFileName) {
+        replayLogs(replayFileName, replayIdMask, tail_time, pid, devices,
+                   printDividers);
+        flushOutput();
+        return EXIT_SUCCESS;
+    }
+
     dev = devices;
     if (tail_time != log_time::EPOCH) {
         logger_list = android_logger_list_alloc_time(mode, tail_time, pid);
     } else {
         logger_list = android_logger_list_alloc(mode, tail_lines, pid);
     }
+    // Spare logd sending what processBuffer would drop, which still
+    // filters in case logd does not. Binary output is not filtered, and
+    // --print needs to see what the regex does not match.
+    if (logger_list && !g_printBinary) {
+        const char *regex = (g_regexString && !g_printItAnyways
+                && regexIsPortable(g_regexString)) ? g_regexString : NULL;
+        if (g_filterSpec.length() || regex) {
+            android_logger_list_set_filter(logger_list, g_filterSpec.c_str(),
+                                           NULL, regex);
+        }
+    }
     const char *openDeviceFail = NULL;
     const char *clearFail = NULL;
     const char *setSizeFail = NULL;
@@ -1192,11 +1849,9 @@ int main(int argc, char **argv)
     //LOG_EVENT_STRING(0, "whassup, doc?");
 
     dev = NULL;
-    log_device_t unexpected("unexpected", false);
 
     while (!g_maxCount || (g_printCount < g_maxCount)) {
         struct log_msg log_msg;
-        log_device_t* d;
         int ret = android_logger_list_read(logger_list, &log_msg);
 
         if (ret == 0) {
@@ -1217,28 +1872,11 @@ int main(int argc, char **argv)
             logcat_panic(false, "logcat read failure");
         }
 
-        for (d = devices; d; d = d->next) {
-            if (android_name_to_log_id(d->device) == log_msg.id()) {
-                break;
-            }
-        }
-        if (!d) {
-            g_devCount = 2; // set to Multiple
-            d = &unexpected;
-            d->binary = log_msg.id() == LOG_ID_EVENTS;
-        }
-
-        if (dev != d) {
-            dev = d;
-            maybePrintStart(dev, printDividers);
-        }
-        if (g_printBinary) {
-            printBinary(&log_msg);
-        } else {
-            processBuffer(dev, &log_msg);
-        }
+        printLogMessage(devices, dev, &log_msg, printDividers);
     }
 
+    flushOutput();
+
     android_logger_list_free(logger_list);
 
     return EXIT_SUCCESS;
@@ -20,8 +20,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include <log/log.h>
@@ -855,6 +862,161 @@ TEST(logcat, logrotate_nodir) {
                      " -n 256 -r 1024"));
 }
 
+TEST(logcat, logrotate_binary_replay) {
+    static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char tmp_out_dir[sizeof(tmp_out_dir_form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(tmp_out_dir, tmp_out_dir_form)));
+
+    static const char logcat_cmd[] = "logcat -b all -d --segments"
+                                     " -f %s/log.bin -n 32 -r 64";
+    static const char replay_cmd[] = "logcat --replay=%s/log.bin -b all"
+                                     " -v threadtime -v usec -v printable";
+    char command[sizeof(tmp_out_dir) + sizeof(replay_cmd)];
+
+    // the second run continues the segment the first left off in
+    snprintf(command, sizeof(command), logcat_cmd, tmp_out_dir);
+    EXPECT_FALSE(system(command));
+    EXPECT_FALSE(system(command));
+
+    snprintf(command, sizeof(command), replay_cmd, tmp_out_dir);
+    FILE *fp;
+    EXPECT_TRUE(NULL != (fp = popen(command, "r")));
+    if (fp) {
+        char buffer[BIG_BUFFER];
+        std::set<std::string> lines;
+        int count = 0;
+        int repeated = 0;
+
+        while (fgets(buffer, sizeof(buffer), fp)) {
+            if (!strncmp(begin, buffer, sizeof(begin) - 1)) {
+                continue;
+            }
+            ++count;
+            if (!lines.insert(buffer).second) {
+                ++repeated;
+            }
+        }
+        pclose(fp);
+        EXPECT_LT(0, count);
+        // one-line overlap is allowed where the second run picked up
+        EXPECT_GE(1, repeated);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", tmp_out_dir);
+    EXPECT_FALSE(system(command));
+}
+
+// Lines, less dividers, that command prints, or empty if it failed
+static std::vector<std::string> replayLines(const char *command) {
+    std::vector<std::string> lines;
+    FILE *fp = popen(command, "r");
+    if (!fp) {
+        return lines;
+    }
+    char buffer[BIG_BUFFER];
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        if (strncmp(begin, buffer, sizeof(begin) - 1)) {
+            lines.push_back(buffer);
+        }
+    }
+    if (pclose(fp)) {
+        lines.clear();
+    }
+    return lines;
+}
+
+TEST(logcat, logrotate_binary_replay_truncated) {
+    static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char tmp_out_dir[sizeof(tmp_out_dir_form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(tmp_out_dir, tmp_out_dir_form)));
+
+    static const char logcat_cmd[] = "logcat -b all -d --segments"
+                                     " -f %s/log.bin";
+    static const char replay_cmd[] = "logcat --replay=%s/log.bin -b all"
+                                     " -v threadtime -v usec -v printable";
+    char command[sizeof(tmp_out_dir) + sizeof(replay_cmd)];
+
+    snprintf(command, sizeof(command), logcat_cmd, tmp_out_dir);
+    EXPECT_FALSE(system(command));
+
+    snprintf(command, sizeof(command), replay_cmd, tmp_out_dir);
+    std::vector<std::string> whole = replayLines(command);
+    EXPECT_LT(0U, whole.size());
+
+    // cut the last record short, as a crash while writing it would
+    std::string segment = std::string(tmp_out_dir) + "/log.bin";
+    struct stat st;
+    ASSERT_EQ(0, stat(segment.c_str(), &st));
+    ASSERT_EQ(0, truncate(segment.c_str(), st.st_size - 1));
+
+    std::vector<std::string> cut = replayLines(command);
+    EXPECT_LT(0U, cut.size());
+    EXPECT_GT(whole.size(), cut.size());
+    for (size_t i = 0; (i < cut.size()) && (i < whole.size()); ++i) {
+        EXPECT_EQ(whole[i], cut[i]);
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", tmp_out_dir);
+    EXPECT_FALSE(system(command));
+}
+
+// Append a record for a main-like buffer to segment, as --segments writes
+static void appendSegmentRecord(std::string &segment, uint32_t lid,
+                                uint32_t sec, const char *msg) {
+    static const char tag[] = "logcat_test";
+    std::string payload(1, (char)ANDROID_LOG_INFO);
+    payload.append(tag, sizeof(tag));
+    payload.append(msg, strlen(msg) + 1);
+
+    struct logger_entry_v4 entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.len = payload.size();
+    entry.hdr_size = sizeof(entry);
+    entry.pid = getpid();
+    entry.tid = gettid();
+    entry.sec = sec;
+    entry.lid = lid;
+    segment.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    segment += payload;
+}
+
+TEST(logcat, replay_segment_untrusted) {
+    static const char tmp_out_dir_form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char tmp_out_dir[sizeof(tmp_out_dir_form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(tmp_out_dir, tmp_out_dir_form)));
+
+    // LogSegmentHeader, "LSG1", without an index as if never rotated out
+    static const uint32_t header[] = { 0x3147534c, 2 * sizeof(uint32_t) };
+    std::string segment(reinterpret_cast<const char *>(header),
+                        sizeof(header));
+    uint32_t sec = time(NULL);
+    appendSegmentRecord(segment, LOG_ID_MAIN, sec, "first");
+    appendSegmentRecord(segment, LOG_ID_MAX, sec, "unknown buffer");
+    appendSegmentRecord(segment, 0xDEADBEEF, sec, "garbage buffer");
+    appendSegmentRecord(segment, LOG_ID_MAIN, sec, "second");
+    appendSegmentRecord(segment, LOG_ID_MAIN, sec, "truncated");
+    segment.resize(segment.size() - 1);
+
+    std::string file = std::string(tmp_out_dir) + "/log.bin";
+    FILE *fp = fopen(file.c_str(), "w");
+    ASSERT_TRUE(NULL != fp);
+    EXPECT_EQ(segment.size(), fwrite(segment.data(), 1, segment.size(), fp));
+    EXPECT_EQ(0, fclose(fp));
+
+    static const char replay_cmd[] = "logcat --replay=%s/log.bin -b all"
+                                     " -v brief";
+    char command[sizeof(tmp_out_dir) + sizeof(replay_cmd)];
+    snprintf(command, sizeof(command), replay_cmd, tmp_out_dir);
+    std::vector<std::string> lines = replayLines(command);
+    ASSERT_EQ(2U, lines.size());
+    EXPECT_NE(std::string::npos, lines[0].find("logcat_test"));
+    EXPECT_NE(std::string::npos, lines[0].find("first"));
+    EXPECT_NE(std::string::npos, lines[1].find("second"));
+
+    snprintf(command, sizeof(command), "rm -rf %s", tmp_out_dir);
+    EXPECT_FALSE(system(command));
+}
+
 static void caught_blocking_clear(int /*signum*/) {
     unsigned long long v = 0xDEADBEEFA55C0000ULL;
 
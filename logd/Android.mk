@@ -11,13 +11,18 @@ LOCAL_SRC_FILES := \
     LogCommand.cpp \
     CommandListener.cpp \
     LogListener.cpp \
+    LogRing.cpp \
     LogReader.cpp \
     FlushCommand.cpp \
     LogBuffer.cpp \
     LogBufferElement.cpp \
+    LogBufferChunk.cpp \
+    LogFilter.cpp \
+    LogNameCache.cpp \
     LogTimes.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
+    LogRateLimit.cpp \
     libaudit.c \
     LogAudit.cpp \
     LogKlog.cpp \
@@ -28,7 +33,8 @@ LOCAL_SHARED_LIBRARIES := \
     liblog \
     libcutils \
     libbase \
-    libpackagelistparser
+    libpackagelistparser \
+    libz
 
 # This is what we want to do:
 #  event_logtags = $(shell \
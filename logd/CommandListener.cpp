@@ -47,6 +47,8 @@ CommandListener::CommandListener(LogBuffer *buf, LogReader * /*reader*/,
     registerCmd(new GetStatisticsCmd(buf));
     registerCmd(new SetPruneListCmd(buf));
     registerCmd(new GetPruneListCmd(buf));
+    registerCmd(new SetRateLimitCmd(buf));
+    registerCmd(new GetRateLimitCmd(buf));
     registerCmd(new ReinitCmd());
 }
 
@@ -283,6 +285,51 @@ int CommandListener::SetPruneListCmd::runCommand(SocketClient *cli,
     return 0;
 }
 
+CommandListener::GetRateLimitCmd::GetRateLimitCmd(LogBuffer *buf) :
+        LogCommand("getRateLimit"),
+        mBuf(*buf) {
+}
+
+int CommandListener::GetRateLimitCmd::runCommand(SocketClient *cli,
+                                         int /*argc*/, char ** /*argv*/) {
+    setname();
+    cli->sendMsg(package_string(mBuf.formatRateLimit()).c_str());
+    return 0;
+}
+
+CommandListener::SetRateLimitCmd::SetRateLimitCmd(LogBuffer *buf) :
+        LogCommand("setRateLimit"),
+        mBuf(*buf) {
+}
+
+int CommandListener::SetRateLimitCmd::runCommand(SocketClient *cli,
+                                         int argc, char **argv) {
+    setname();
+    if (!clientHasLogCredentials(cli)) {
+        cli->sendMsg("Permission Denied");
+        return 0;
+    }
+
+    std::string str;
+    for (int i = 1; i < argc; ++i) {
+        if (str.length()) {
+            str += " ";
+        }
+        str += argv[i];
+    }
+
+    int ret = mBuf.initRateLimit(str.c_str());
+
+    if (ret) {
+        cli->sendMsg("Invalid");
+        return 0;
+    }
+
+    cli->sendMsg("success");
+
+    return 0;
+}
+
 CommandListener::ReinitCmd::ReinitCmd() : LogCommand("reinit") {
 }
 
@@ -61,6 +61,8 @@ private:
     LogBufferCmd(GetStatistics)
     LogBufferCmd(GetPruneList)
     LogBufferCmd(SetPruneList)
+    LogBufferCmd(GetRateLimit)
+    LogBufferCmd(SetRateLimit)
 
     class ReinitCmd : public LogCommand {
     public:
@@ -32,14 +32,20 @@ FlushCommand::FlushCommand(LogReader &reader,
                            unsigned int logMask,
                            pid_t pid,
                            uint64_t start,
-                           uint64_t timeout) :
+                           uint64_t timeout,
+                           const LogFilter *filter) :
         mReader(reader),
         mNonBlock(nonBlock),
         mTail(tail),
         mLogMask(logMask),
         mPid(pid),
         mStart(start),
-        mTimeout((start > 1) ? timeout : 0) {
+        mTimeout((start > 1) ? timeout : 0),
+        mFilter(filter) {
+}
+
+FlushCommand::~FlushCommand() {
+    delete mFilter;
 }
 
 // runSocketCommand is called once for every open client on the
@@ -82,7 +88,8 @@ void FlushCommand::runSocketCommand(SocketClient *client) {
             return;
         }
         entry = new LogTimeEntry(mReader, client, mNonBlock, mTail, mLogMask,
-                                 mPid, mStart, mTimeout);
+                                 mPid, mStart, mTimeout, mFilter);
+        mFilter = NULL;
         times.push_front(entry);
     }
 
@@ -23,6 +23,7 @@ class LogBufferElement;
 
 #include "LogTimes.h"
 
+class LogFilter;
 class LogReader;
 
 class FlushCommand : public SocketClientCommand {
@@ -33,15 +34,19 @@ class FlushCommand : public SocketClientCommand {
     pid_t mPid;
     uint64_t mStart;
     uint64_t mTimeout;
+    const LogFilter *mFilter;
 
 public:
+    // Takes ownership of filter, handed on to a new LogTimeEntry
     FlushCommand(LogReader &mReader,
                  bool nonBlock = false,
                  unsigned long tail = -1,
                  unsigned int logMask = -1,
                  pid_t pid = 0,
                  uint64_t start = 1,
-                 uint64_t timeout = 0);
+                 uint64_t timeout = 0,
+                 const LogFilter *filter = NULL);
+    virtual ~FlushCommand();
     virtual void runSocketCommand(SocketClient *client);
 
     static bool hasReadLogs(SocketClient *client);
@@ -15,6 +15,7 @@
  */
 
 #include <ctype.h>
+#include <endian.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -22,10 +23,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <new>
 #include <unordered_map>
 
 #include <cutils/properties.h>
 #include <log/logger.h>
+#include <private/android_logger.h>
+#include <zlib.h>
 
 #include "LogBuffer.h"
 #include "LogKlog.h"
@@ -154,7 +159,7 @@ void LogBuffer::init() {
         // as the act of mounting /data would trigger persist.logd.timestamp to
         // be corrected. 1/30 corner case YMMV.
         //
-        pthread_mutex_lock(&mLogElementsLock);
+        wrlock();
         LogBufferElementCollection::iterator it = mLogElements.begin();
         while((it != mLogElements.end())) {
             LogBufferElement *e = *it;
@@ -169,7 +174,7 @@ void LogBuffer::init() {
             }
             ++it;
         }
-        pthread_mutex_unlock(&mLogElementsLock);
+        unlock();
     }
 
     // We may have been triggered by a SIGHUP. Release any sleeping reader
@@ -192,43 +197,312 @@ void LogBuffer::init() {
 }
 
 LogBuffer::LogBuffer(LastLogTimes *times):
+        mIndexPending(0),
+        mIndexCeiling(log_time::EPOCH),
         monotonic(android_log_clockid() == CLOCK_MONOTONIC),
+        compress(false),
+        dedup(false),
         mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+    log_id_for_each(i) {
+        mRepeat[i].uid = AID_ROOT;
+        mRepeat[i].pid = 0;
+        mRepeat[i].tid = 0;
+        mRepeat[i].count = 0;
+    }
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // log() must not starve behind a steady stream of readers
+    pthread_rwlockattr_setkind_np(&attr,
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&mLogElementsLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    sem_init(&mMaintain, 0, 0);
 
     init();
 }
 
-int LogBuffer::log(log_id_t log_id, log_time realtime,
-                   uid_t uid, pid_t pid, pid_t tid,
-                   const char *msg, unsigned short len) {
-    if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
-        return -EINVAL;
-    }
-
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
+// Returns true if the entry is to be retained. Called without
+// mLogElementsLock held.
+bool LogBuffer::isLoggable(log_id_t log_id, const char *msg,
+                           unsigned short len) {
     if (log_id != LOG_ID_SECURITY) {
         int prio = ANDROID_LOG_INFO;
         const char *tag = NULL;
         if (log_id == LOG_ID_EVENTS) {
-            tag = android::tagToName(elem->getTag());
+            tag = android::tagToName(LogBufferElement::getTag(log_id, msg, len));
         } else {
             prio = *msg;
             tag = msg + 1;
         }
-        if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
-            // Log traffic received to total
-            pthread_mutex_lock(&mLogElementsLock);
-            stats.add(elem);
-            stats.subtract(elem);
-            pthread_mutex_unlock(&mLogElementsLock);
-            delete elem;
-            return -EACCES;
+        return __android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE);
+    }
+    return true;
+}
+
+int LogBuffer::log(log_id_t log_id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid,
+                   const char *msg, unsigned short len) {
+    if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
+        return -EINVAL;
+    }
+
+    if (!isLoggable(log_id, msg, len)) {
+        // Log traffic received to total
+        wrlock();
+        stats.addTotal(log_id, len);
+        unlock();
+        return -EACCES;
+    }
+
+    wrlock();
+    int ret = -EBUSY;
+    if (admit_Locked(log_id, realtime, uid, pid, tid, len)) {
+        ret = repeat_Locked(log_id, realtime, uid, pid, tid, msg, len)
+            ? len
+            : log_Locked(log_id, realtime, uid, pid, tid, msg, len);
+    }
+    unlock();
+
+    return ret;
+}
+
+// Batched log(), inserts all the entries under one lock acquisition.
+// Returns the number of entries retained.
+size_t LogBuffer::log(const LogBufferEntry *entries, size_t count) {
+    bool loggable[count];
+    size_t retval = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const LogBufferEntry &entry = entries[i];
+        loggable[i] = (entry.log_id < LOG_ID_MAX) && (entry.log_id >= 0)
+                   && isLoggable(entry.log_id, entry.msg, entry.len);
+    }
+
+    wrlock();
+    for (size_t i = 0; i < count; ++i) {
+        const LogBufferEntry &entry = entries[i];
+        if (!loggable[i]) {
+            if ((entry.log_id < LOG_ID_MAX) && (entry.log_id >= 0)) {
+                stats.addTotal(entry.log_id, entry.len);
+            }
+            continue;
+        }
+        if (!admit_Locked(entry.log_id, entry.realtime,
+                          entry.uid, entry.pid, entry.tid, entry.len)) {
+            continue;
+        }
+        if (repeat_Locked(entry.log_id, entry.realtime,
+                          entry.uid, entry.pid, entry.tid,
+                          entry.msg, entry.len)) {
+            continue;
+        }
+        if (log_Locked(entry.log_id, entry.realtime,
+                       entry.uid, entry.pid, entry.tid,
+                       entry.msg, entry.len) >= 0) {
+            ++retval;
+        }
+    }
+    stats.addBatch(count);
+    unlock();
+
+    return retval;
+}
+
+// Rate limit admission, see LogRateLimit. What a bucket rejected is
+// summarized as a chatty placeholder ahead of the next message it admits,
+// or by maintain() if it admits none for a while, rather than stored to be
+// pruned later. Returns false if the message is to be rejected.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::admit_Locked(log_id_t log_id, log_time realtime,
+                             uid_t uid, pid_t pid, pid_t tid,
+                             unsigned short len) {
+    if ((log_id == LOG_ID_SECURITY) || !mRateLimit.enabled()) {
+        return true;
+    }
+
+    bool pending = mRateLimit.pending();
+    unsigned short dropped;
+    if (!mRateLimit.admit(log_id, realtime, uid, pid, tid, dropped)) {
+        // first rejected, have maintain() watch for it to go unreported
+        if (!pending) {
+            sem_post(&mMaintain);
+        }
+        // Log traffic received to total
+        stats.addTotal(log_id, len);
+        return false;
+    }
+    if (dropped) {
+        log_Locked(log_id, realtime, uid, pid, tid, "", 0, dropped);
+    }
+    return true;
+}
+
+// Fold an exact repeat of the last message logged to log_id, from the same
+// UID, PID and TID, into a count rather than storing it again. Returns true
+// if msg was folded, otherwise summarizes any run of repeats in progress
+// and makes msg the one to compare against. Text buffers only, a binary
+// event is not ours to rewrite.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::repeat_Locked(log_id_t log_id, log_time realtime,
+                              uid_t uid, pid_t pid, pid_t tid,
+                              const char *msg, unsigned short len) {
+    if (!dedup || (log_id == LOG_ID_EVENTS) || (log_id == LOG_ID_SECURITY)) {
+        return false;
+    }
+
+    LogRepeat &repeat = mRepeat[log_id];
+    // A run is cut at repeatWindow so a component spinning on one message
+    // is still seen, once a window, by readers.
+    if ((repeat.uid == uid) && (repeat.pid == pid) && (repeat.tid == tid)
+            && (repeat.msg.length() == len)
+            && !memcmp(repeat.msg.data(), msg, len)
+            && (realtime >= repeat.last)
+            && ((realtime - repeat.first).nsec() < repeatWindow)) {
+        // first repeat folded, have maintain() watch for the run to go idle
+        if (!repeat.count++) {
+            sem_post(&mMaintain);
+        }
+        repeat.last = realtime;
+        repeat.received = log_time(CLOCK_MONOTONIC);
+        // Log traffic received to total
+        stats.addTotal(log_id, len);
+        return true;
+    }
+
+    summarizeRepeat_Locked(log_id);
+    repeat.uid = uid;
+    repeat.pid = pid;
+    repeat.tid = tid;
+    repeat.first = repeat.last = realtime;
+    repeat.received = log_time(CLOCK_MONOTONIC);
+    repeat.msg.assign(msg, len);
+    return false;
+}
+
+// Log "last message repeated N times" for the run of repeats folded by
+// repeat_Locked, on behalf of the latest repeat, keeping the priority and
+// tag of the message repeated. Stamped no earlier than the newest entry in
+// the list so that it is appended in time order, rather than inserted
+// behind content that readers may already have passed.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::summarizeRepeat_Locked(log_id_t log_id) {
+    LogRepeat &repeat = mRepeat[log_id];
+    if (!repeat.count) {
+        return;
+    }
+
+    static const char format[] = "last message repeated %zu time%s";
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
+    const char *msg = repeat.msg.data();
+    char prio = ANDROID_LOG_INFO;
+    const char *tag = "chatty";
+    size_t tagLen = (repeat.msg.length() > 1)
+        ? strnlen(msg + 1, repeat.msg.length() - 1)
+        : repeat.msg.length();
+    if ((tagLen + 1) < repeat.msg.length()) {
+        prio = msg[0];
+        tag = msg + 1;
+    } else {
+        // not a well formed message, speak for it
+        tagLen = strlen(tag);
+    }
+    buffer[0] = prio;
+    memcpy(buffer + 1, tag, tagLen);
+    buffer[1 + tagLen] = '\0';
+    size_t len = 2 + tagLen;
+    int n = snprintf(buffer + len, sizeof(buffer) - len, format,
+                     repeat.count, (repeat.count > 1) ? "s" : "");
+    len = std::min(len + n + 1, sizeof(buffer));
+
+    log_time realtime = repeat.last;
+    if (!mLogElements.empty()) {
+        LogBufferElementCollection::iterator newest = mLogElements.end();
+        --newest;
+        if ((*newest)->getRealTime() > realtime) {
+            realtime = (*newest)->getRealTime();
+        }
+    }
+
+    repeat.count = 0;
+    log_Locked(log_id, realtime, repeat.uid, repeat.pid, repeat.tid,
+               buffer, len);
+}
+
+// Summarize the runs of repeats that have seen no further repeat for
+// repeatWindow, so that a component that spins and then goes quiet is
+// still reported. Idle is judged by when we received the latest repeat,
+// the client's timestamp can be anything. Returns true if anything was
+// logged.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::summarizeIdleRepeats_Locked() {
+    log_time now(CLOCK_MONOTONIC);
+    bool retval = false;
+
+    log_id_for_each(i) {
+        LogRepeat &repeat = mRepeat[i];
+        if (!repeat.count
+                || ((now - repeat.received).nsec() < repeatWindow)) {
+            continue;
+        }
+        summarizeRepeat_Locked(i);
+        retval = true;
+    }
+    return retval;
+}
+
+// Log the chatty placeholders for messages rate limited that have waited
+// too long for their bucket to admit another, stamped no earlier than the
+// newest entry in the list, as summarizeRepeat_Locked does. Returns true if
+// anything was logged.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::summarizeDropped_Locked() {
+    std::vector<RateLimitDropped> dropped;
+    mRateLimit.flush(dropped);
+
+    for (size_t i = 0; i < dropped.size(); ++i) {
+        log_time realtime = dropped[i].realtime;
+        if (!mLogElements.empty()) {
+            LogBufferElementCollection::iterator newest = mLogElements.end();
+            --newest;
+            if ((*newest)->getRealTime() > realtime) {
+                realtime = (*newest)->getRealTime();
+            }
         }
+        log_Locked(dropped[i].id, realtime, dropped[i].uid, dropped[i].pid,
+                   dropped[i].tid, "", 0, dropped[i].dropped);
     }
+    return !dropped.empty();
+}
 
-    pthread_mutex_lock(&mLogElementsLock);
+// A non-zero dropped logs a chatty placeholder for that many messages
+// instead of msg.
+//
+// mLogElementsLock must be held when this function is called.
+int LogBuffer::log_Locked(log_id_t log_id, log_time realtime,
+                          uid_t uid, pid_t pid, pid_t tid,
+                          const char *msg, unsigned short len,
+                          unsigned short dropped) {
+    LogBufferChunk *chunk = NULL;
+    bool sealPending = mChunks[log_id].sealPending();
+    void *storage = mChunks[log_id].allocate(
+        LogBufferElement::getAllocationSize(len), chunk);
+    if (!storage) {
+        return -ENOMEM;
+    }
+    LogBufferElement *elem = new (storage) LogBufferElement(
+        chunk, log_id, realtime, uid, pid, tid, msg, len);
+    if (dropped) {
+        elem->setDropped(dropped);
+    }
+    if (realtime > mIndexCeiling) {
+        mIndexCeiling = realtime;
+    }
 
     // Insert elements in time sorted order if possible
     //  NB: if end is region locked, place element at end of list
@@ -244,6 +518,7 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 
     if (last == mLogElements.end()) {
         mLogElements.push_back(elem);
+        indexAppend(elem);
     } else {
         uint64_t end = 1;
         bool end_set = false;
@@ -270,6 +545,7 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
         if (end_always
                 || (end_set && (end >= (*last)->getSequence()))) {
             mLogElements.push_back(elem);
+            indexAppend(elem);
         } else {
             mLogElements.insert(last,elem);
         }
@@ -279,16 +555,31 @@ int LogBuffer::log(log_id_t log_id, log_time realtime,
 
     stats.add(elem);
     maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    // a chunk retired, leave compressing it to maintain()
+    if (!sealPending && mChunks[log_id].sealPending()) {
+        sem_post(&mMaintain);
+    }
 
     return len;
 }
 
+// Content charged to log id "id" against its buffer size: the payload
+// sizes, less what compression saves. This is what pruning an element
+// releases, wherever in its chunk the element sits; the memory that sparse
+// chunks pin is bounded separately, see pruneOldestChunk().
+//
+// mLogElementsLock must be held when this function is called.
+size_t LogBuffer::sizeHeld(log_id_t id) {
+    size_t sizes = stats.sizes(id);
+    size_t savings = mChunks[id].savings();
+    return (savings < sizes) ? sizes - savings : 0;
+}
+
 // Prune at most 10% of the log entries or maxPrune, whichever is less.
 //
 // mLogElementsLock must be held when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
-    size_t sizes = stats.sizes(id);
+    size_t sizes = sizeHeld(id);
     unsigned long maxSize = log_buffer_size(id);
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
@@ -305,7 +596,147 @@ void LogBuffer::maybePrune(log_id_t id) {
             pruneRows = maxPrune;
         }
         prune(id, pruneRows);
+    } else if (mChunks[id].sizeInUse() > (2 * maxSize)) {
+        pruneOldestChunk(id);
+    }
+}
+
+// Chatty pruning of the worst UID releases single elements out of order,
+// which can leave retired chunks sparse yet pinned. Once they hold twice
+// the buffer size, age out whatever still pins the oldest chunk, oldest
+// first and regardless of who logged it, so that it is released whole.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::pruneOldestChunk(log_id_t id) {
+    LogBufferChunk *chunk = mChunks[id].oldest();
+    if (!chunk) {
+        return;
+    }
+
+    LogTimeEntry *oldest = NULL;
+
+    LogTimeEntry::lock();
+
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry *entry = (*times);
+        if (entry->owned_Locked() && entry->isWatching(id)
+                && (!oldest || (oldest->mStart > entry->mStart))) {
+            oldest = entry;
+        }
+        times++;
+    }
+
+    size_t live = chunk->getLive();
+    LogBufferElementCollection::iterator it =
+        mLastSet[id] ? mLast[id] : mLogElements.begin();
+    while (live && (it != mLogElements.end())) {
+        LogBufferElement *element = *it;
+
+        if (element->getLogId() != id) {
+            ++it;
+            continue;
+        }
+
+        if (!mLastSet[id] || ((*mLast[id])->getLogId() != id)) {
+            mLast[id] = it;
+            mLastSet[id] = true;
+        }
+
+        if (oldest && (oldest->mStart <= element->getSequence())) {
+            if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
+                oldest->triggerReader_Locked();
+            } else {
+                oldest->triggerSkip_Locked(id, live);
+            }
+            break;
+        }
+
+        // NB: chunk is released along with its last element
+        if (element->mChunk == chunk) {
+            --live;
+        }
+        it = erase(it);
+    }
+
+    LogTimeEntry::unlock();
+}
+
+// Record a mark for every indexInterval'th element appended to the list.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::indexAppend(LogBufferElement *element) {
+    if (++mIndexPending < indexInterval) {
+        return;
+    }
+    mIndexPending = 0;
+    LogBufferIndexMark mark = {
+        element->getSequence(), mIndexCeiling, element
+    };
+    mIndex.push_back(mark);
+}
+
+// Locate the mark referencing element, or mIndex.end() if it has none.
+//
+// mLogElementsLock must be held when this function is called.
+LogBuffer::LogBufferIndex::iterator LogBuffer::indexFind(
+        LogBufferElement *element) {
+    if (mIndex.empty()) {
+        return mIndex.end();
+    }
+    uint64_t sequence = element->getSequence();
+    // Fast path, pruning works from the oldest content
+    if (mIndex.front().sequence == sequence) {
+        return (mIndex.front().element == element) ? mIndex.begin()
+                                                    : mIndex.end();
+    }
+    LogBufferIndex::iterator it = std::lower_bound(
+        mIndex.begin(), mIndex.end(), sequence,
+        [](const LogBufferIndexMark &mark, uint64_t sequence) {
+            return mark.sequence < sequence;
+        });
+    if ((it != mIndex.end()) && (it->element != element)) {
+        it = mIndex.end();
+    }
+    return it;
+}
+
+// Position at or before the first element in the list that has a sequence
+// number above start. NB: any element that follows it and has a sequence
+// number at or below start must still be skipped by the caller.
+//
+// mLogElementsLock must be held when this function is called.
+LogBufferElementCollection::iterator LogBuffer::indexSeek(uint64_t start) {
+    LogBufferIndex::iterator it = std::upper_bound(
+        mIndex.begin(), mIndex.end(), start,
+        [](uint64_t start, const LogBufferIndexMark &mark) {
+            return start < mark.sequence;
+        });
+    if (it == mIndex.begin()) {
+        return mLogElements.begin();
     }
+    --it;
+    return LogBufferElementCollection::iterator_to(it->element);
+}
+
+uint64_t LogBuffer::seek(const log_time &start) {
+    uint64_t retval = 1;
+
+    rdlock();
+    LogBufferIndex::iterator it = std::lower_bound(
+        mIndex.begin(), mIndex.end(), start,
+        [](const LogBufferIndexMark &mark, const log_time &start) {
+            return mark.ceiling < start;
+        });
+    // Nothing logged up to and including the mark before it is as new as
+    // start, wherever in the list it was placed.
+    if (it != mIndex.begin()) {
+        --it;
+        retval = it->sequence;
+    }
+    unlock();
+
+    return retval;
 }
 
 LogBufferElementCollection::iterator LogBuffer::erase(
@@ -335,6 +766,13 @@ LogBufferElementCollection::iterator LogBuffer::erase(
         }
     }
 
+    {   // start of scope for index mark
+        LogBufferIndex::iterator found = indexFind(element);
+        if (found != mIndex.end()) {
+            mIndex.erase(found);
+        }
+    }
+
     bool setLast[LOG_ID_MAX];
     bool doSetLast = false;
     log_id_for_each(i) {
@@ -357,11 +795,284 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     } else {
         stats.subtract(element);
     }
-    delete element;
+    release(element);
 
     return it;
 }
 
+// Mark the element dropped, replacing it with a header-only copy so that
+// the chatty placeholder does not pin the chunk holding the payload.
+//
+// mLogElementsLock must be held when this function is called.
+LogBufferElementCollection::iterator LogBuffer::setDropped(
+        LogBufferElementCollection::iterator it, unsigned short dropped) {
+    LogBufferElement *element = *it;
+
+    if (!element->mChunk) {
+        element->setDropped(dropped);
+        return it;
+    }
+
+    void *storage = malloc(sizeof(LogBufferElement));
+    if (!storage) {
+        element->setDropped(dropped); // payload stays pinned, still correct
+        return it;
+    }
+    return relocate(it, new (storage) LogBufferElement(*element, dropped));
+}
+
+// Substitute replacement for the element at it in the list and in all the
+// iterator references to it, then release the original.
+//
+// mLogElementsLock must be held when this function is called.
+LogBufferElementCollection::iterator LogBuffer::relocate(
+        LogBufferElementCollection::iterator it,
+        LogBufferElement *replacement) {
+    LogBufferElement *element = *it;
+    log_id_t id = element->getLogId();
+
+    LogBufferElementCollection::iterator next =
+        mLogElements.replace(it, replacement);
+
+    {   // start of scope for uid found iterator
+        LogBufferIteratorMap::iterator found =
+            mLastWorstUid[id].find(element->getUid());
+        if ((found != mLastWorstUid[id].end())
+                && (it == found->second)) {
+            found->second = next;
+        }
+    }
+
+    {   // start of scope for pid found iterator
+        LogBufferPidIteratorMap::iterator found =
+            mLastWorstPidOfSystem[id].find(element->getPid());
+        if ((found != mLastWorstPidOfSystem[id].end())
+                && (it == found->second)) {
+            found->second = next;
+        }
+    }
+
+    {   // start of scope for index mark
+        LogBufferIndex::iterator found = indexFind(element);
+        if (found != mIndex.end()) {
+            found->element = replacement;
+        }
+    }
+
+    log_id_for_each(i) {
+        if (mLastSet[i] && (it == mLast[i])) {
+            mLast[i] = next;
+        }
+    }
+    release(element);
+
+    return next;
+}
+
+// Destroy the element and return its storage.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::release(LogBufferElement *element) {
+    LogBufferChunk *chunk = element->mChunk;
+    log_id_t id = element->getLogId();
+
+    if (!chunk) {
+        element->~LogBufferElement();
+        free(element);
+        return;
+    }
+
+    size_t len = element->mDropped ? 0 : element->mMsgLen;
+    // Leave a tombstone for seal() to skip as it walks the chunk
+    element->mChunk = NULL;
+    mChunks[id].release(chunk, len);
+}
+
+bool LogBuffer::maintain() {
+    rdlock();
+    bool repeating = mRateLimit.pending();
+    log_id_for_each(i) {
+        repeating |= mRepeat[i].count != 0;
+    }
+    unlock();
+
+    if (repeating) {
+        // Poll for the runs, or the rate limited, to go idle
+        struct timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_sec += repeatWindow / NS_PER_SEC;
+        while (sem_timedwait(&mMaintain, &timeout) && (errno == EINTR)) {
+            ;
+        }
+    } else {
+        while (sem_wait(&mMaintain) && (errno == EINTR)) {
+            ;
+        }
+    }
+
+    wrlock();
+    bool retval = summarizeIdleRepeats_Locked();
+    retval |= summarizeDropped_Locked();
+    unlock();
+
+    log_id_for_each(i) {
+        seal(i);
+    }
+
+    return retval;
+}
+
+// True if a reader thread may be positioned within chunk. Reader threads
+// flush the element at their mStart with the lock dropped, anything before
+// the oldest of them is safe to relocate.
+//
+// mLogElementsLock must be held when this function is called.
+bool LogBuffer::isBusy(LogBufferChunk *chunk) {
+    uint64_t oldest = ULLONG_MAX;
+    LogTimeEntry::lock();
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry *entry = (*times);
+        if (entry->owned_Locked() && (entry->mStart < oldest)) {
+            oldest = entry->mStart;
+        }
+        times++;
+    }
+    LogTimeEntry::unlock();
+
+    for (char *cp = chunk->begin(); cp < chunk->end();) {
+        LogBufferElement *element = reinterpret_cast<LogBufferElement *>(cp);
+        cp += LogBufferElement::getAllocationSize(element->mMsgLen);
+        if (element->mChunk && (element->getSequence() >= oldest)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Count the live elements of chunk, and copy out their payloads to raw if
+// not NULL. Returns the payload bytes.
+size_t LogBuffer::gatherPayloads(LogBufferChunk *chunk, char *raw,
+                                 size_t &count) {
+    size_t rawSize = 0;
+    count = 0;
+    for (char *cp = chunk->begin(); cp < chunk->end();) {
+        LogBufferElement *element = reinterpret_cast<LogBufferElement *>(cp);
+        cp += LogBufferElement::getAllocationSize(element->mMsgLen);
+        if (!element->mChunk) {
+            continue;
+        }
+        ++count;
+        if (raw && element->getMsgLen()) {
+            memcpy(raw + rawSize, element->getMsg(), element->getMsgLen());
+        }
+        rawSize += element->getMsgLen();
+    }
+    return rawSize;
+}
+
+// Compress the retired chunks of log id "id" that no reader is positioned
+// in, oldest first. The lock is only held to copy out the payloads of a
+// chunk, and then to swap in the result; the deflate itself runs with it
+// dropped so that log() and the readers are not held up behind it. A chunk
+// that does not compress well is not retried, one that changed or that a
+// reader moved into meanwhile is, once the next chunk retires.
+//
+// mLogElementsLock must not be held when this function is called.
+void LogBuffer::seal(log_id_t id) {
+    wrlock();
+    bool pending = mChunks[id].sealPending();
+    mChunks[id].clearSealPending();
+    unlock();
+
+    // binary content, little to gain, and getTag() needs direct access
+    if (!pending || !compress
+            || (id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY)) {
+        return;
+    }
+
+    uLongf bound = compressBound(LogBufferChunk::capacity);
+    std::unique_ptr<char[]> raw(
+        new (std::nothrow) char[LogBufferChunk::capacity]);
+    std::unique_ptr<char[]> compressed(new (std::nothrow) char[bound]);
+    if (!raw || !compressed) {
+        return;
+    }
+
+    for (;;) {
+        rdlock();
+        LogBufferChunk *chunk = mChunks[id].oldest();
+        while (chunk && LogBufferChunks::isSealed(chunk)) {
+            chunk = LogBufferChunks::next(chunk);
+        }
+        if (!chunk || isBusy(chunk)) {
+            unlock();
+            return;
+        }
+        uint64_t generation = LogBufferChunks::getGeneration(chunk);
+        size_t count;
+        size_t rawSize = gatherPayloads(chunk, raw.get(), count);
+        unlock();
+
+        // Not worth it unless we save at least 1/8th
+        uLongf compressedSize = bound;
+        bool worthwhile = count
+            && (compress2(reinterpret_cast<Bytef *>(compressed.get()),
+                          &compressedSize,
+                          reinterpret_cast<const Bytef *>(raw.get()), rawSize,
+                          Z_BEST_SPEED) == Z_OK)
+            && (compressedSize < (rawSize - rawSize / 8));
+
+        wrlock();
+        size_t liveCount;
+        if (!mChunks[id].isRetired(chunk, generation)
+                || (gatherPayloads(chunk, NULL, liveCount) != rawSize)
+                || (liveCount != count)
+                || isBusy(chunk)) {
+            unlock();
+            return;
+        }
+        LogBufferChunks::setSealed(chunk);
+        if (worthwhile) {
+            seal(id, chunk, count, compressed.get(), compressedSize, rawSize);
+        }
+        unlock();
+    }
+}
+
+// Swap the count live elements of chunk for a compressed chunk holding
+// their headers and the compressed payloads. Leaves chunk as-is if we ran
+// out of memory.
+//
+// mLogElementsLock must be held when this function is called.
+void LogBuffer::seal(log_id_t id, LogBufferChunk *chunk, size_t count,
+                     const char *compressed, size_t compressedSize,
+                     size_t rawSize) {
+    LogBufferChunk *sealed = mChunks[id].allocateCompressed(
+        count, sizeof(LogBufferElement), compressed, compressedSize, rawSize);
+    if (!sealed) {
+        return;
+    }
+
+    // chunk is released along with its last live element, stop there
+    char *header = sealed->begin();
+    size_t offset = 0;
+    for (char *cp = chunk->begin(); count;) {
+        LogBufferElement *element = reinterpret_cast<LogBufferElement *>(cp);
+        cp += LogBufferElement::getAllocationSize(element->mMsgLen);
+        if (!element->mChunk) {
+            continue;
+        }
+        --count;
+        LogBufferElement *replacement = new (header) LogBufferElement(
+            *element, sealed, offset);
+        header += sizeof(LogBufferElement);
+        offset += element->getMsgLen();
+        relocate(LogBufferElementCollection::iterator_to(element),
+                 replacement);
+    }
+}
+
 // Define a temporary mechanism to report the last LogBufferElement pointer
 // for the specified uid, pid and tid. Used below to help merge-sort when
 // pruning for worst UID.
@@ -553,20 +1264,20 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         pid_t worstPid = 0; // POSIX guarantees PID != 0
 
         if (worstUidEnabledForLogid(id) && mPrune.worstUidEnabled()) {
-            {   // begin scope for UID sorted list
-                std::unique_ptr<const UidEntry *[]> sorted = stats.sort(
-                    AID_ROOT, (pid_t)0, 2, id);
+            {   // begin scope for UID worst entries
+                const UidEntry *first, *second;
+                stats.worstUid(id, first, second);
 
-                if (sorted.get() && sorted[0] && sorted[1]) {
-                    worst_sizes = sorted[0]->getSizes();
+                if (first && second) {
+                    worst_sizes = first->getSizes();
                     // Calculate threshold as 12.5% of available storage
                     size_t threshold = log_buffer_size(id) / 8;
                     if ((worst_sizes > threshold)
                         // Allow time horizon to extend roughly tenfold, assume
                         // average entry length is 100 characters.
-                            && (worst_sizes > (10 * sorted[0]->getDropped()))) {
-                        worst = sorted[0]->getKey();
-                        second_worst_sizes = sorted[1]->getSizes();
+                            && (worst_sizes > (10 * first->getDropped()))) {
+                        worst = first->getKey();
+                        second_worst_sizes = second->getSizes();
                         if (second_worst_sizes < threshold) {
                             second_worst_sizes = threshold;
                         }
@@ -575,14 +1286,14 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
             }
 
             if ((worst == AID_SYSTEM) && mPrune.worstPidOfSystemEnabled()) {
-                // begin scope of PID sorted list
-                std::unique_ptr<const PidEntry *[]> sorted = stats.sort(
-                    worst, (pid_t)0, 2, id, worst);
-                if (sorted.get() && sorted[0] && sorted[1]) {
-                    worstPid = sorted[0]->getKey();
+                // begin scope of PID worst entries
+                const PidEntry *first, *second;
+                stats.worstPidOfSystem(id, first, second);
+                if (first && second) {
+                    worstPid = first->getKey();
                     second_worst_sizes = worst_sizes
-                                       - sorted[0]->getSizes()
-                                       + sorted[1]->getSizes();
+                                       - first->getSizes()
+                                       + second->getSizes();
                 }
             }
         }
@@ -732,7 +1443,8 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 it = erase(it);
             } else {
                 stats.drop(element);
-                element->setDropped(1);
+                it = setDropped(it, 1);
+                element = *it;
                 if (last.coalesce(element, 1)) {
                     it = erase(it, true);
                 } else {
@@ -785,7 +1497,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 break;
             }
 
-            if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+            if (sizeHeld(id) > (2 * log_buffer_size(id))) {
                 // kick a misbehaving log reader client off the island
                 oldest->release_Locked();
             } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -825,7 +1537,7 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
             if (oldest && (oldest->mStart <= element->getSequence())) {
                 busy = true;
-                if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+                if (sizeHeld(id) > (2 * log_buffer_size(id))) {
                     // kick a misbehaving log reader client off the island
                     oldest->release_Locked();
                 } else if (oldest->mTimeout.tv_sec || oldest->mTimeout.tv_nsec) {
@@ -848,6 +1560,14 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
 // clear all rows of type "id" from the buffer.
 bool LogBuffer::clear(log_id_t id, uid_t uid) {
+    // forget any run of repeats of what is being cleared
+    wrlock();
+    if ((uid == AID_ROOT) || (mRepeat[id].uid == uid)) {
+        mRepeat[id].count = 0;
+        mRepeat[id].msg.clear();
+    }
+    unlock();
+
     bool busy = true;
     // If it takes more than 4 tries (seconds) to clear, then kill reader(s)
     for (int retry = 4;;) {
@@ -856,9 +1576,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
             // one entry, not another clear run, so we are looking for
             // the quick side effect of the return value to tell us if
             // we have a _blocked_ reader.
-            pthread_mutex_lock(&mLogElementsLock);
+            wrlock();
             busy = prune(id, 1, uid);
-            pthread_mutex_unlock(&mLogElementsLock);
+            unlock();
             // It is still busy, blocked reader(s), lets kill them all!
             // otherwise, lets be a good citizen and preserve the slow
             // readers and let the clear run (below) deal with determining
@@ -877,9 +1597,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
                 LogTimeEntry::unlock();
             }
         }
-        pthread_mutex_lock(&mLogElementsLock);
+        wrlock();
         busy = prune(id, ULONG_MAX, uid);
-        pthread_mutex_unlock(&mLogElementsLock);
+        unlock();
         if (!busy || !--retry) {
             break;
         }
@@ -890,9 +1610,9 @@ bool LogBuffer::clear(log_id_t id, uid_t uid) {
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
-    size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    rdlock();
+    size_t retval = sizeHeld(id);
+    unlock();
     return retval;
 }
 
@@ -902,49 +1622,56 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
+    wrlock();
     log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
+    unlock();
     return 0;
 }
 
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    rdlock();
     size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    unlock();
     return retval;
 }
 
 uint64_t LogBuffer::flushTo(
         SocketClient *reader, const uint64_t start,
         bool privileged, bool security,
-        int (*filter)(const LogBufferElement *element, void *arg), void *arg) {
+        int (*filter)(const LogBufferElement *element, void *arg), void *arg,
+        const LogFilter *content) {
     LogBufferElementCollection::iterator it;
     uint64_t max = start;
     uid_t uid = reader->getUid();
+    LogBufferChunkCache cache;
+    size_t skipped = 0;
 
-    pthread_mutex_lock(&mLogElementsLock);
+    rdlock();
 
     if (start <= 1) {
         // client wants to start from the beginning
         it = mLogElements.begin();
     } else {
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        for (it = mLogElements.end(); it != mLogElements.begin(); /* do nothing */) {
-            --it;
-            LogBufferElement *element = *it;
-            if (element->getSequence() <= start) {
-                it++;
-                break;
-            }
-        }
+        // Client wants to start from some specified point, look it up in
+        // the sparse index rather than walk the list.
+        it = indexSeek(start);
     }
 
     for (; it != mLogElements.end(); ++it) {
         LogBufferElement *element = *it;
 
+        // Let writers in during long runs of skipped content, but only once
+        // positioned on an element that our region lock keeps from being
+        // pruned; runs of unwatched ids are held through to the next one.
+        if ((++skipped >= maxSkip)
+                && isRegionLocked(arg, element->getLogId(),
+                                  element->getSequence())) {
+            skipped = 0;
+            unlock();
+            rdlock();
+        }
+
         if (!privileged && (element->getUid() != uid)) {
             continue;
         }
@@ -957,6 +1684,30 @@ uint64_t LogBuffer::flushTo(
             continue;
         }
 
+        // Ahead of filter, so that tail counts only what will be sent
+        if (content) {
+            if (!content->accept(element, cache)) {
+                continue;
+            }
+            // A regex may take a while, match it with the lock dropped
+            // where our region lock keeps the element from being pruned
+            if (content->hasRegex(element)) {
+                bool locked = !isRegionLocked(arg, element->getLogId(),
+                                              element->getSequence());
+                if (!locked) {
+                    unlock();
+                }
+                bool match = content->match(element, cache);
+                if (!locked) {
+                    skipped = 0;
+                    rdlock();
+                }
+                if (!match) {
+                    continue;
+                }
+            }
+        }
+
         // NB: calling out to another object with mLogElementsLock held (safe)
         if (filter) {
             int ret = (*filter)(element, arg);
@@ -968,29 +1719,54 @@ uint64_t LogBuffer::flushTo(
             }
         }
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        unlock();
 
         // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader, this, privileged);
+        max = element->flushTo(reader, this, privileged, cache);
 
         if (max == element->FLUSH_ERROR) {
             return max;
         }
 
-        pthread_mutex_lock(&mLogElementsLock);
+        skipped = 0;
+        rdlock();
     }
-    pthread_mutex_unlock(&mLogElementsLock);
+    unlock();
 
     return max;
 }
 
+// Is the caller of flushTo, identified by its filter argument, a reader
+// whose region lock protects the element at sequence from being pruned or
+// relocated? prune() only honours the region lock of readers watching the
+// id being pruned, so an element of an id we do not watch is never safe.
+// If so flushTo may drop mLogElementsLock while positioned on it.
+bool LogBuffer::isRegionLocked(void *arg, log_id_t id, uint64_t sequence) {
+    bool retval = false;
+
+    LogTimeEntry::lock();
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry *entry = (*times);
+        if (entry == arg) {
+            retval = entry->owned_Locked() && entry->isWatching(id)
+                  && (entry->mStart <= sequence);
+            break;
+        }
+        times++;
+    }
+    LogTimeEntry::unlock();
+
+    return retval;
+}
+
 std::string LogBuffer::formatStatistics(uid_t uid, pid_t pid,
                                         unsigned int logMask) {
-    pthread_mutex_lock(&mLogElementsLock);
+    rdlock();
 
     std::string ret = stats.format(uid, pid, logMask);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    unlock();
 
     return ret;
 }
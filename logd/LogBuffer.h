@@ -17,9 +17,10 @@
 #ifndef _LOGD_LOG_BUFFER_H__
 #define _LOGD_LOG_BUFFER_H__
 
+#include <semaphore.h>
 #include <sys/types.h>
 
-#include <list>
+#include <deque>
 #include <string>
 
 #include <log/log.h>
@@ -27,7 +28,10 @@
 
 #include <private/android_filesystem_config.h>
 
+#include "LogBufferChunk.h"
 #include "LogBufferElement.h"
+#include "LogFilter.h"
+#include "LogRateLimit.h"
 #include "LogTimes.h"
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
@@ -73,15 +77,28 @@ static bool isMonotonic(const log_time &mono) {
 
 }
 
-typedef std::list<LogBufferElement *> LogBufferElementCollection;
+// A single log message for batched LogBuffer::log
+struct LogBufferEntry {
+    log_id_t log_id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    const char *msg;
+    unsigned short len;
+};
 
 class LogBuffer {
     LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    // Readers (flushTo) share, anything altering the list or stats excludes
+    pthread_rwlock_t mLogElementsLock;
+    // storage for the elements of each log id
+    LogBufferChunks mChunks[LOG_ID_MAX];
 
     LogStatistics stats;
 
     PruneList mPrune;
+    LogRateLimit mRateLimit;
     // watermark for last per log id
     LogBufferElementCollection::iterator mLast[LOG_ID_MAX];
     bool mLastSet[LOG_ID_MAX];
@@ -98,7 +115,46 @@ class LogBuffer {
 
     unsigned long mMaxSize[LOG_ID_MAX];
 
+    // Sparse index of every indexInterval'th element appended to the end of
+    // mLogElements. Appended elements carry the newest sequence number, so
+    // the marks are ordered by sequence and can be binary searched. The
+    // list is only roughly in time order (region locked inserts, clients
+    // with skewed clocks), so rather than the time of its element each
+    // mark records the newest time logged by any element with a sequence
+    // number up to its own; also ordered, and a safe bound for seek().
+    struct LogBufferIndexMark {
+        uint64_t sequence;
+        log_time ceiling;
+        LogBufferElement *element;
+    };
+    typedef std::deque<LogBufferIndexMark> LogBufferIndex;
+    LogBufferIndex mIndex;
+    size_t mIndexPending; // elements appended since the last mark
+    log_time mIndexCeiling; // newest time logged so far
+
+    // The last message logged to each log id, and the count of exact
+    // repeats of it since folded away rather than stored. The run is
+    // summarized as a "last message repeated" line when it ends, or once it
+    // has been idle for repeatWindow.
+    struct LogRepeat {
+        uid_t uid;
+        pid_t pid;
+        pid_t tid;
+        log_time first;    // of the message stored
+        log_time last;     // of the latest repeat
+        log_time received; // latest repeat, CLOCK_MONOTONIC on our clock
+        size_t count;
+        std::string msg;
+    };
+    LogRepeat mRepeat[LOG_ID_MAX];
+
+    // posted to wake maintain() for a retired chunk, a run of repeats, or a
+    // message rate limited
+    sem_t mMaintain;
+
     bool monotonic;
+    bool compress;
+    bool dedup;
 
 public:
     LastLogTimes &mTimes;
@@ -110,10 +166,19 @@ public:
     int log(log_id_t log_id, log_time realtime,
             uid_t uid, pid_t pid, pid_t tid,
             const char *msg, unsigned short len);
+    size_t log(const LogBufferEntry *entries, size_t count);
+    // Sequence number to flushTo() from to visit all content at or after
+    // realtime start, found without walking the list.
+    uint64_t seek(const log_time &start);
     uint64_t flushTo(SocketClient *writer, const uint64_t start,
                      bool privileged, bool security,
                      int (*filter)(const LogBufferElement *element, void *arg) = NULL,
-                     void *arg = NULL);
+                     void *arg = NULL, const LogFilter *content = NULL);
+
+    // Deferred work kept off the log() path, run in a loop by a background
+    // thread. Blocks until there is something to do, returns true if it
+    // logged anything readers should be notified of.
+    bool maintain();
 
     bool clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -125,26 +190,79 @@ public:
     void enableStatistics() {
         stats.enableStatistics();
     }
+    void enableCompression() { compress = true; }
+    void enableDedup() { dedup = true; }
 
     int initPrune(const char *cp) { return mPrune.init(cp); }
     std::string formatPrune() { return mPrune.format(); }
 
-    // helper must be protected directly or implicitly by lock()/unlock()
+    int initRateLimit(const char *cp) {
+        wrlock();
+        int ret = mRateLimit.init(cp);
+        unlock();
+        return ret;
+    }
+    std::string formatRateLimit() {
+        rdlock();
+        std::string ret = mRateLimit.format();
+        unlock();
+        return ret;
+    }
+
+    // helper must be protected directly or implicitly by wrlock()/unlock()
     const char *pidToName(pid_t pid) { return stats.pidToName(pid); }
     uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
     const char *uidToName(uid_t uid) { return stats.uidToName(uid); }
-    void lock() { pthread_mutex_lock(&mLogElementsLock); }
-    void unlock() { pthread_mutex_unlock(&mLogElementsLock); }
+    void wrlock() { pthread_rwlock_wrlock(&mLogElementsLock); }
+    void rdlock() { pthread_rwlock_rdlock(&mLogElementsLock); }
+    void unlock() { pthread_rwlock_unlock(&mLogElementsLock); }
 
 private:
 
     static constexpr size_t minPrune = 4;
     static constexpr size_t maxPrune = 256;
-
+    // elements skipped by flushTo before letting writers in
+    static constexpr size_t maxSkip = 256;
+    // elements between marks in mIndex
+    static constexpr size_t indexInterval = 256;
+    // longest run of repeats folded before one is stored again
+    static constexpr uint64_t repeatWindow = NS_PER_SEC;
+
+    bool isRegionLocked(void *arg, log_id_t id, uint64_t sequence);
+
+    bool isLoggable(log_id_t log_id, const char *msg, unsigned short len);
+    bool admit_Locked(log_id_t log_id, log_time realtime,
+                      uid_t uid, pid_t pid, pid_t tid, unsigned short len);
+    bool repeat_Locked(log_id_t log_id, log_time realtime,
+                       uid_t uid, pid_t pid, pid_t tid,
+                       const char *msg, unsigned short len);
+    void summarizeRepeat_Locked(log_id_t log_id);
+    bool summarizeIdleRepeats_Locked();
+    bool summarizeDropped_Locked();
+    int log_Locked(log_id_t log_id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid,
+                   const char *msg, unsigned short len,
+                   unsigned short dropped = 0);
+    size_t sizeHeld(log_id_t id);
     void maybePrune(log_id_t id);
+    void pruneOldestChunk(log_id_t id);
+    void indexAppend(LogBufferElement *element);
+    LogBufferIndex::iterator indexFind(LogBufferElement *element);
+    LogBufferElementCollection::iterator indexSeek(uint64_t start);
     bool prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool coalesce = false);
+    LogBufferElementCollection::iterator setDropped(
+        LogBufferElementCollection::iterator it, unsigned short dropped);
+    LogBufferElementCollection::iterator relocate(
+        LogBufferElementCollection::iterator it, LogBufferElement *replacement);
+    void release(LogBufferElement *element);
+    bool isBusy(LogBufferChunk *chunk);
+    static size_t gatherPayloads(LogBufferChunk *chunk, char *raw,
+                                 size_t &count);
+    void seal(log_id_t id);
+    void seal(log_id_t id, LogBufferChunk *chunk, size_t count,
+              const char *compressed, size_t compressedSize, size_t rawSize);
 };
 
 #endif // _LOGD_LOG_BUFFER_H__
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "LogBufferChunk.h"
+
+const size_t LogBufferChunk::capacity =
+    LogBufferChunk::chunk_size - sizeof(LogBufferChunk);
+
+LogBufferChunks::LogBufferChunks() :
+        mHead(NULL),
+        mSpare(NULL),
+        mOldest(NULL),
+        mNewest(NULL),
+        mAllocated(0),
+        mSavings(0),
+        mGeneration(0),
+        mSealPending(false) {
+}
+
+LogBufferChunks::~LogBufferChunks() {
+    // Caller has released all the elements, only head and spare remain
+    free(mHead);
+    free(mSpare);
+}
+
+// Add to the tail of the retired chunk list
+void LogBufferChunks::retire(LogBufferChunk *chunk) {
+    chunk->mNext = NULL;
+    chunk->mPrev = mNewest;
+    if (mNewest) {
+        mNewest->mNext = chunk;
+    } else {
+        mOldest = chunk;
+    }
+    mNewest = chunk;
+    chunk->mGeneration = ++mGeneration;
+}
+
+size_t LogBufferChunks::sizeInUse() const {
+    size_t retval = mAllocated;
+    if (mSpare) {
+        retval -= LogBufferChunk::chunk_size;
+    }
+    if (mHead) {
+        retval -= LogBufferChunk::capacity - mHead->mUsed;
+    }
+    return retval;
+}
+
+bool LogBufferChunks::isRetired(const LogBufferChunk *chunk,
+                                uint64_t generation) const {
+    for (LogBufferChunk *it = mOldest; it; it = it->mNext) {
+        if (it == chunk) {
+            return it->mGeneration == generation;
+        }
+    }
+    return false;
+}
+
+void *LogBufferChunks::allocate(size_t len, LogBufferChunk *&chunk) {
+    if (len > LogBufferChunk::capacity) {
+        return NULL;
+    }
+
+    if (!mHead || ((mHead->mUsed + len) > LogBufferChunk::capacity)) {
+        LogBufferChunk *next;
+        if (mHead && !mHead->mLive) {
+            // everything already expired, rewind in place
+            next = mHead;
+        } else {
+            next = mSpare;
+            if (next) {
+                mSpare = NULL;
+            } else {
+                next = static_cast<LogBufferChunk *>(
+                    malloc(LogBufferChunk::chunk_size));
+                if (!next) {
+                    return NULL;
+                }
+                mAllocated += LogBufferChunk::chunk_size;
+            }
+            if (mHead) {
+                // previous head is sealed, released when it empties
+                retire(mHead);
+                mSealPending = true;
+            }
+        }
+        next->mUsed = 0;
+        next->mLive = 0;
+        next->mLiveSize = 0;
+        next->mRawSize = 0;
+        next->mCompressedSize = 0;
+        next->mGeneration = 0;
+        next->mSealed = false;
+        mHead = next;
+    }
+
+    void *retval = mHead->data() + mHead->mUsed;
+    mHead->mUsed += len;
+    ++mHead->mLive;
+    chunk = mHead;
+    return retval;
+}
+
+void LogBufferChunks::release(LogBufferChunk *chunk, size_t len) {
+    if (chunk->isCompressed()) {
+        size_t savings = chunk->getSavings();
+        chunk->mLiveSize -= len;
+        mSavings -= savings - chunk->getSavings();
+    }
+
+    if (--chunk->mLive || (chunk == mHead)) {
+        return;
+    }
+
+    if (chunk->mPrev) {
+        chunk->mPrev->mNext = chunk->mNext;
+    } else {
+        mOldest = chunk->mNext;
+    }
+    if (chunk->mNext) {
+        chunk->mNext->mPrev = chunk->mPrev;
+    } else {
+        mNewest = chunk->mPrev;
+    }
+
+    if (!mSpare && !chunk->isCompressed()) {
+        mSpare = chunk;
+        return;
+    }
+    mAllocated -= chunk->isCompressed()
+                ? sizeof(LogBufferChunk) + chunk->mUsed + chunk->mCompressedSize
+                : LogBufferChunk::chunk_size;
+    free(chunk);
+}
+
+LogBufferChunk *LogBufferChunks::allocateCompressed(size_t count,
+                                                    size_t hdrLen,
+                                                    const char *compressed,
+                                                    size_t compressedSize,
+                                                    size_t rawSize) {
+    size_t used = count * hdrLen;
+    size_t len = sizeof(LogBufferChunk) + used + compressedSize;
+    LogBufferChunk *chunk = static_cast<LogBufferChunk *>(malloc(len));
+    if (!chunk) {
+        return NULL;
+    }
+    mAllocated += len;
+
+    chunk->mUsed = used;
+    chunk->mLive = count;
+    chunk->mLiveSize = rawSize;
+    chunk->mRawSize = rawSize;
+    chunk->mCompressedSize = compressedSize;
+    chunk->mSealed = true;
+    memcpy(chunk->data() + used, compressed, compressedSize);
+    mSavings += chunk->getSavings();
+    retire(chunk);
+
+    return chunk;
+}
+
+LogBufferChunkCache::LogBufferChunkCache() {
+    for (size_t i = 0; i < LOG_ID_MAX; ++i) {
+        mEntry[i].generation = 0;
+        mEntry[i].buffer = NULL;
+    }
+}
+
+LogBufferChunkCache::~LogBufferChunkCache() {
+    for (size_t i = 0; i < LOG_ID_MAX; ++i) {
+        free(mEntry[i].buffer);
+    }
+}
+
+const char *LogBufferChunkCache::getPayloads(log_id_t id,
+                                             const LogBufferChunk *chunk) {
+    Entry &entry = mEntry[id];
+
+    if (entry.buffer && (entry.generation == chunk->mGeneration)) {
+        return entry.buffer;
+    }
+
+    if (!entry.buffer) {
+        entry.buffer = static_cast<char *>(malloc(LogBufferChunk::capacity));
+        if (!entry.buffer) {
+            return NULL;
+        }
+    }
+    entry.generation = 0;
+
+    uLongf len = LogBufferChunk::capacity;
+    const Bytef *source = reinterpret_cast<const Bytef *>(chunk + 1)
+                        + chunk->mUsed;
+    if ((uncompress(reinterpret_cast<Bytef *>(entry.buffer), &len,
+                    source, chunk->mCompressedSize) != Z_OK)
+            || (len != chunk->mRawSize)) {
+        return NULL;
+    }
+    entry.generation = chunk->mGeneration;
+
+    return entry.buffer;
+}
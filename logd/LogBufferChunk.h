@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_CHUNK_H__
+#define _LOGD_LOG_BUFFER_CHUNK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <log/log.h>
+
+class LogBufferChunks;
+class LogBufferChunkCache;
+
+// A contiguous, append-only, block of storage for LogBufferElement headers
+// and their inline payloads. Released as a whole once the last element
+// carved out of it has been released.
+//
+// Once sealed, a chunk may be compacted into a compressed chunk where the
+// headers are packed at the front and the payloads follow as one deflate
+// stream, see LogBuffer::seal().
+class LogBufferChunk {
+    friend LogBufferChunks;
+    friend LogBufferChunkCache;
+
+    LogBufferChunk *mPrev;  // retired chunks, oldest first
+    LogBufferChunk *mNext;
+    size_t mUsed;           // bytes handed out
+    size_t mLive;           // elements not yet released
+    size_t mLiveSize;       // payload bytes of live elements, if compressed
+    size_t mRawSize;        // payload bytes in compressed stream
+    size_t mCompressedSize; // zero if not compressed
+    uint64_t mGeneration;   // unique per retired chunk
+    bool mSealed;           // no further compression attempts
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+
+    size_t getSavings() const {
+        return (mLiveSize > mCompressedSize) ? mLiveSize - mCompressedSize : 0;
+    }
+
+public:
+    static const size_t chunk_size = 64 * 1024; // including this header
+    static const size_t capacity;
+
+    size_t getLive() const { return mLive; }
+    bool isCompressed() const { return mCompressedSize != 0; }
+
+    // for walking the elements in the chunk
+    char *begin() { return data(); }
+    char *end() { return data() + mUsed; }
+};
+
+// Per log id storage engine, a ring of LogBufferChunk where only the head
+// is written. Log entries age out roughly in order, so chunks retire in
+// order and the most recently retired one is kept to recycle as the next
+// head. Must be protected by LogBuffer::mLogElementsLock.
+class LogBufferChunks {
+    LogBufferChunk *mHead;   // current write head
+    LogBufferChunk *mSpare;  // last retired chunk, recycled as next head
+    LogBufferChunk *mOldest; // retired chunks with live elements
+    LogBufferChunk *mNewest;
+    size_t mAllocated;       // bytes allocated, including spare
+    size_t mSavings;         // payload bytes saved by compression
+    uint64_t mGeneration;
+    bool mSealPending;       // chunk(s) retired since last seal()
+
+    LogBufferChunks(const LogBufferChunks &);
+    void operator=(const LogBufferChunks &);
+
+    void retire(LogBufferChunk *chunk);
+
+public:
+    LogBufferChunks();
+    ~LogBufferChunks();
+
+    // Returns len bytes of storage in *chunk, or NULL if out of memory
+    void *allocate(size_t len, LogBufferChunk *&chunk);
+    // Release an element holding len bytes of payload
+    void release(LogBufferChunk *chunk, size_t len);
+
+    // Compressed chunk of count headers of hdrLen followed by compressed
+    // payload, to be filled in by caller, or NULL if out of memory.
+    LogBufferChunk *allocateCompressed(size_t count, size_t hdrLen,
+                                       const char *compressed,
+                                       size_t compressedSize,
+                                       size_t rawSize);
+
+    // Iterate over retired chunks
+    LogBufferChunk *oldest() const { return mOldest; }
+    static LogBufferChunk *next(LogBufferChunk *chunk) { return chunk->mNext; }
+    static void setSealed(LogBufferChunk *chunk) { chunk->mSealed = true; }
+    static bool isSealed(const LogBufferChunk *chunk) { return chunk->mSealed; }
+    static uint64_t getGeneration(const LogBufferChunk *chunk) {
+        return chunk->mGeneration;
+    }
+    // true if chunk, which may since have been freed, is still retired
+    // and has not been recycled. Does not dereference a stale chunk.
+    bool isRetired(const LogBufferChunk *chunk, uint64_t generation) const;
+
+    bool sealPending() const { return mSealPending; }
+    void clearSealPending() { mSealPending = false; }
+
+    // bytes of memory held by this log id
+    size_t sizeAllocated() const { return mAllocated; }
+    // bytes of memory pinned by content, allocated less the spare and the
+    // unwritten tail of the head; includes the free space in sparse chunks
+    size_t sizeInUse() const;
+    // bytes of payload represented, but not held, due to compression
+    size_t savings() const { return mSavings; }
+};
+
+// Reader side cache of decompressed compressed chunk payloads. Only valid
+// for the duration of a LogBuffer::flushTo() call, since it relies on the
+// reader region lock to keep the chunk around while it is referenced.
+class LogBufferChunkCache {
+    struct Entry {
+        uint64_t generation;
+        char *buffer;
+    } mEntry[LOG_ID_MAX];
+
+    LogBufferChunkCache(const LogBufferChunkCache &);
+    void operator=(const LogBufferChunkCache &);
+
+public:
+    LogBufferChunkCache();
+    ~LogBufferChunkCache();
+
+    // Returns the uncompressed payloads of a compressed chunk, NULL on error
+    const char *getPayloads(log_id_t id, const LogBufferChunk *chunk);
+};
+
+#endif // _LOGD_LOG_BUFFER_CHUNK_H__
@@ -14,9 +14,7 @@
  * limitations under the License.
  */
 
-#include <ctype.h>
 #include <endian.h>
-#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -26,6 +24,7 @@
 #include <private/android_logger.h>
 
 #include "LogBuffer.h"
+#include "LogBufferChunk.h"
 #include "LogBufferElement.h"
 #include "LogCommand.h"
 #include "LogReader.h"
@@ -34,78 +33,80 @@
 const uint64_t LogBufferElement::FLUSH_ERROR(0);
 atomic_int_fast64_t LogBufferElement::sequence(1);
 
-LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
+LogBufferElement::LogBufferElement(LogBufferChunk *chunk, log_id_t log_id,
+                                   log_time realtime,
                                    uid_t uid, pid_t pid, pid_t tid,
                                    const char *msg, unsigned short len) :
+        mChunk(chunk),
         mLogId(log_id),
         mUid(uid),
         mPid(pid),
         mTid(tid),
         mMsgLen(len),
+        mDropped(0),
+        mOffset(0),
         mSequence(sequence.fetch_add(1, memory_order_relaxed)),
         mRealTime(realtime) {
-    mMsg = new char[len];
-    memcpy(mMsg, msg, len);
+    memcpy(getMsg(), msg, len);
 }
 
-LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
+LogBufferElement::LogBufferElement(const LogBufferElement &element,
+                                   unsigned short dropped) :
+        mChunk(NULL),
+        mLogId(element.mLogId),
+        mUid(element.mUid),
+        mPid(element.mPid),
+        mTid(element.mTid),
+        mMsgLen(0),
+        mDropped(dropped),
+        mOffset(0),
+        mSequence(element.mSequence),
+        mRealTime(element.mRealTime) {
 }
 
-uint32_t LogBufferElement::getTag() const {
-    if (((mLogId != LOG_ID_EVENTS) && (mLogId != LOG_ID_SECURITY)) ||
-            !mMsg || (mMsgLen < sizeof(uint32_t))) {
+LogBufferElement::LogBufferElement(const LogBufferElement &element,
+                                   LogBufferChunk *chunk, uint16_t offset) :
+        mChunk(chunk),
+        mLogId(element.mLogId),
+        mUid(element.mUid),
+        mPid(element.mPid),
+        mTid(element.mTid),
+        mMsgLen(element.mMsgLen),
+        mDropped(element.mDropped),
+        mOffset(offset),
+        mSequence(element.mSequence),
+        mRealTime(element.mRealTime) {
+}
+
+uint32_t LogBufferElement::getTag(log_id_t log_id, const char *msg,
+                                  unsigned short len) {
+    if (((log_id != LOG_ID_EVENTS) && (log_id != LOG_ID_SECURITY)) ||
+            !msg || (len < sizeof(uint32_t))) {
         return 0;
     }
-    return le32toh(reinterpret_cast<android_event_header_t *>(mMsg)->tag);
+    return le32toh(reinterpret_cast<const android_event_header_t *>(msg)->tag);
 }
 
-// caller must own and free character string
-char *android::tidToName(pid_t tid) {
-    char *retval = NULL;
-    char buffer[256];
-    snprintf(buffer, sizeof(buffer), "/proc/%u/comm", tid);
-    int fd = open(buffer, O_RDONLY);
-    if (fd >= 0) {
-        ssize_t ret = read(fd, buffer, sizeof(buffer));
-        if (ret >= (ssize_t)sizeof(buffer)) {
-            ret = sizeof(buffer) - 1;
-        }
-        while ((ret > 0) && isspace(buffer[ret - 1])) {
-            --ret;
-        }
-        if (ret > 0) {
-            buffer[ret] = '\0';
-            retval = strdup(buffer);
-        }
-        close(fd);
+// LOG_ID_EVENTS and LOG_ID_SECURITY are never compressed
+uint32_t LogBufferElement::getTag() const {
+    if (mDropped || (mChunk && mChunk->isCompressed())) {
+        return 0;
     }
+    return getTag(mLogId, getMsg(), mMsgLen);
+}
 
-    // if nothing for comm, check out cmdline
-    char *name = android::pidToName(tid);
-    if (!retval) {
-        retval = name;
-        name = NULL;
+const char *LogBufferElement::getPayload(LogBufferChunkCache &cache) const {
+    if (mDropped) {
+        return NULL;
     }
-
-    // check if comm is truncated, see if cmdline has full representation
-    if (name) {
-        // impossible for retval to be NULL if name not NULL
-        size_t retval_len = strlen(retval);
-        size_t name_len = strlen(name);
-        // KISS: ToDo: Only checks prefix truncated, not suffix, or both
-        if ((retval_len < name_len)
-                && !fast<strcmp>(retval, name + name_len - retval_len)) {
-            free(retval);
-            retval = name;
-        } else {
-            free(name);
-        }
+    if (mChunk && mChunk->isCompressed()) {
+        const char *payloads = cache.getPayloads(mLogId, mChunk);
+        return payloads ? payloads + mOffset : NULL;
     }
-    return retval;
+    return getMsg();
 }
 
-// assumption: mMsg == NULL
+// assumption: mDropped != 0
 size_t LogBufferElement::populateDroppedMessage(char *&buffer,
         LogBuffer *parent) {
     static const char tag[] = "chatty";
@@ -115,7 +116,7 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
     }
 
     static const char format_uid[] = "uid=%u%s%s expire %u line%s";
-    parent->lock();
+    parent->wrlock();
     const char *name = parent->uidToName(mUid);
     parent->unlock();
     const char *commName = android::tidToName(mTid);
@@ -123,7 +124,7 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
         commName = android::tidToName(mPid);
     }
     if (!commName) {
-        parent->lock();
+        parent->wrlock();
         commName = parent->pidToName(mPid);
         parent->unlock();
     }
@@ -200,7 +201,8 @@ size_t LogBufferElement::populateDroppedMessage(char *&buffer,
 }
 
 uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
-                                   bool privileged) {
+                                   bool privileged,
+                                   LogBufferChunkCache &cache) {
     struct logger_entry_v4 entry;
 
     memset(&entry, 0, sizeof(struct logger_entry_v4));
@@ -221,15 +223,19 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent,
 
     char *buffer = NULL;
 
-    if (!mMsg) {
+    if (mDropped) {
         entry.len = populateDroppedMessage(buffer, parent);
         if (!entry.len) {
             return mSequence;
         }
         iovec[1].iov_base = buffer;
     } else {
+        const char *payload = getPayload(cache);
+        if (!payload) {
+            return mSequence;
+        }
         entry.len = mMsgLen;
-        iovec[1].iov_base = mMsg;
+        iovec[1].iov_base = const_cast<char *>(payload);
     }
     iovec[1].iov_len = entry.len;
 
@@ -33,54 +33,167 @@ class LogBuffer;
                                  // chatty for the temporal expire messages
 #define EXPIRE_RATELIMIT 10      // maximum rate in seconds to report expiration
 
-class LogBufferElement {
+class LogBufferChunk;
+class LogBufferChunkCache;
+class LogBufferElementCollection;
+
+// Links for the intrusive, time sorted, LogBufferElementCollection
+class LogBufferElementLink {
+    friend LogBufferElementCollection;
+
+    LogBufferElementLink *mPrev;
+    LogBufferElementLink *mNext;
+
+protected:
+    LogBufferElementLink():mPrev(this), mNext(this) { }
+};
+
+// Header for a log entry, the payload follows inline in the same allocation.
+// Allocated from the LogBufferChunk of its log id, or from the heap once the
+// payload has been dropped (see LogBuffer::setDropped). In a compressed
+// chunk the payload is instead at mOffset in the chunk's compressed stream.
+class LogBufferElement : public LogBufferElementLink {
 
     friend LogBuffer;
 
+    LogBufferChunk *mChunk;       // NULL if heap allocated
     const log_id_t mLogId;
     const uid_t mUid;
     const pid_t mPid;
     const pid_t mTid;
-    char *mMsg;
-    union {
-        const unsigned short mMsgLen; // mMSg != NULL
-        unsigned short mDropped;      // mMsg == NULL
-    };
+    const unsigned short mMsgLen;
+    unsigned short mDropped;      // payload has been released if non-zero
+    const uint16_t mOffset;       // payload offset if compressed chunk
     const uint64_t mSequence;
     log_time mRealTime;
     static atomic_int_fast64_t sequence;
 
-    // assumption: mMsg == NULL
+    char *getMsg() const {
+        return const_cast<char *>(reinterpret_cast<const char *>(this + 1));
+    }
+
+    // assumption: mDropped != 0
     size_t populateDroppedMessage(char *&buffer,
                                   LogBuffer *parent);
 
 public:
-    LogBufferElement(log_id_t log_id, log_time realtime,
-                     uid_t uid, pid_t pid, pid_t tid,
+    // Bytes of storage required to hold an element with len bytes of payload
+    static size_t getAllocationSize(unsigned short len) {
+        return (sizeof(LogBufferElement) + len + sizeof(uint64_t) - 1)
+             & ~(sizeof(uint64_t) - 1);
+    }
+
+    // Placement constructed into getAllocationSize(len) bytes of storage
+    LogBufferElement(LogBufferChunk *chunk, log_id_t log_id,
+                     log_time realtime, uid_t uid, pid_t pid, pid_t tid,
                      const char *msg, unsigned short len);
-    virtual ~LogBufferElement();
+    // Header only heap copy of a dropped element
+    LogBufferElement(const LogBufferElement &element,
+                     unsigned short dropped);
+    // Header only copy for a compressed chunk
+    LogBufferElement(const LogBufferElement &element,
+                     LogBufferChunk *chunk, uint16_t offset);
 
     log_id_t getLogId() const { return mLogId; }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
-    unsigned short getDropped(void) const { return mMsg ? 0 : mDropped; }
+    unsigned short getDropped(void) const { return mDropped; }
+    // Payload is retained in its chunk, see LogBuffer::setDropped to release
     unsigned short setDropped(unsigned short value) {
-        if (mMsg) {
-            delete [] mMsg;
-            mMsg = NULL;
-        }
         return mDropped = value;
     }
-    unsigned short getMsgLen() const { return mMsg ? mMsgLen : 0; }
+    unsigned short getMsgLen() const { return mDropped ? 0 : mMsgLen; }
     uint64_t getSequence(void) const { return mSequence; }
     static uint64_t getCurrentSequence(void) { return sequence.load(memory_order_relaxed); }
     log_time getRealTime(void) const { return mRealTime; }
 
     uint32_t getTag(void) const;
+    static uint32_t getTag(log_id_t log_id, const char *msg,
+                           unsigned short len);
+    // getMsgLen() bytes of payload, NULL if dropped or on error
+    const char *getPayload(LogBufferChunkCache &cache) const;
 
     static const uint64_t FLUSH_ERROR;
-    uint64_t flushTo(SocketClient *writer, LogBuffer *parent, bool privileged);
+    uint64_t flushTo(SocketClient *writer, LogBuffer *parent, bool privileged,
+                     LogBufferChunkCache &cache);
+};
+
+// Intrusive doubly linked list of LogBufferElement, std::list work-alike for
+// the subset of operations needed by LogBuffer. Saves a node allocation and
+// a pointer indirection for every log entry.
+class LogBufferElementCollection {
+    LogBufferElementLink mHead; // sentinel, end()
+
+    LogBufferElementCollection(const LogBufferElementCollection &);
+    void operator=(const LogBufferElementCollection &);
+
+public:
+    class iterator {
+        friend LogBufferElementCollection;
+
+        LogBufferElementLink *mLink;
+
+        explicit iterator(LogBufferElementLink *link):mLink(link) { }
+
+    public:
+        iterator():mLink(NULL) { }
+
+        LogBufferElement *operator*() const {
+            return static_cast<LogBufferElement *>(mLink);
+        }
+        iterator &operator++() { mLink = mLink->mNext; return *this; }
+        iterator &operator--() { mLink = mLink->mPrev; return *this; }
+        iterator operator++(int) {
+            iterator it(*this);
+            mLink = mLink->mNext;
+            return it;
+        }
+        iterator operator--(int) {
+            iterator it(*this);
+            mLink = mLink->mPrev;
+            return it;
+        }
+        bool operator==(const iterator &rhs) const { return mLink == rhs.mLink; }
+        bool operator!=(const iterator &rhs) const { return mLink != rhs.mLink; }
+    };
+
+    LogBufferElementCollection() { }
+
+    iterator begin() { return iterator(mHead.mNext); }
+    iterator end() { return iterator(&mHead); }
+    bool empty() const { return mHead.mNext == &mHead; }
+
+    // insert element before position, return iterator to element
+    iterator insert(iterator position, LogBufferElement *element) {
+        LogBufferElementLink *next = position.mLink;
+        element->mNext = next;
+        element->mPrev = next->mPrev;
+        next->mPrev->mNext = element;
+        next->mPrev = element;
+        return iterator(element);
+    }
+
+    void push_back(LogBufferElement *element) { insert(end(), element); }
+
+    static iterator iterator_to(LogBufferElement *element) {
+        return iterator(element);
+    }
+
+    // unlink element, caller is responsible for releasing its storage
+    iterator erase(iterator it) {
+        LogBufferElementLink *link = it.mLink;
+        LogBufferElementLink *next = link->mNext;
+        link->mPrev->mNext = next;
+        next->mPrev = link->mPrev;
+        link->mPrev = link->mNext = link;
+        return iterator(next);
+    }
+
+    // substitute element in place of it, return iterator to element
+    iterator replace(iterator it, LogBufferElement *element) {
+        return insert(erase(it), element);
+    }
 };
 
 #endif
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "LogBufferElement.h"
+#include "LogFilter.h"
+
+// Does regex stay within the limits on what a reader may have us evaluate?
+// The count of repetitions is a rough measure, but nested or adjacent
+// repetitions are where backtracking blows up.
+static bool regexTractable(const char *regex, size_t maxLength,
+                           size_t maxRepeats) {
+    if (strlen(regex) > maxLength) {
+        return false;
+    }
+    size_t repeats = 0;
+    for (const char *cp = regex; *cp; ++cp) {
+        switch (*cp) {
+        case '\\':
+            // back-references are not regular, the rest is a literal
+            if (isdigit(cp[1])) {
+                return false;
+            }
+            if (cp[1]) {
+                ++cp;
+            }
+            break;
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            if (++repeats > maxRepeats) {
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+LogFilter::LogFilter(const char *tags, const char *uids, const char *regex) :
+        mFormat(NULL),
+        mHaveRegex(false) {
+    if (tags && *tags) {
+        mFormat = android_log_format_new();
+        if (mFormat && (android_log_addFilterString(mFormat, tags) < 0)) {
+            // Do not second guess the reader
+            android_log_format_free(mFormat);
+            mFormat = NULL;
+        }
+    }
+
+    while (uids && isdigit(*uids)) {
+        char *cp;
+        mUids.push_back(strtoul(uids, &cp, 10));
+        uids = (*cp == ',') ? cp + 1 : NULL;
+    }
+    std::sort(mUids.begin(), mUids.end());
+
+    if (regex && *regex
+            && regexTractable(regex, maxRegexLength, maxRegexRepeats)) {
+        mHaveRegex = !regcomp(&mRegex, regex, REG_EXTENDED | REG_NOSUB);
+    }
+}
+
+LogFilter::~LogFilter() {
+    if (mFormat) {
+        android_log_format_free(mFormat);
+    }
+    if (mHaveRegex) {
+        regfree(&mRegex);
+    }
+}
+
+// Returns the message text of a well formed text payload, and its tag in
+// tag, otherwise NULL.
+static const char *parseText(const LogBufferElement *element,
+                             LogBufferChunkCache &cache, const char *&tag) {
+    // <priority:1><tag:N>\0<message:N>\0
+    unsigned short len = element->getMsgLen();
+    const char *msg = element->getPayload(cache);
+    if (!msg || (len < 3) || msg[len - 1]) {
+        return NULL;
+    }
+    tag = msg + 1;
+    const char *message = tag + strlen(tag) + 1;
+    if (message >= (msg + len)) {
+        return NULL;
+    }
+    return message;
+}
+
+bool LogFilter::accept(const LogBufferElement *element,
+                       LogBufferChunkCache &cache) const {
+    if (!mUids.empty() && !std::binary_search(mUids.begin(), mUids.end(),
+                                              element->getUid())) {
+        return false;
+    }
+
+    log_id_t id = element->getLogId();
+    if (!mFormat || (id == LOG_ID_EVENTS) || (id == LOG_ID_SECURITY)) {
+        return true;
+    }
+
+    if (element->getDropped()) {
+        // Reported to the reader as an informational chatty message
+        return android_log_shouldPrintLine(mFormat, "chatty",
+                                           ANDROID_LOG_INFO);
+    }
+
+    const char *tag;
+    if (!parseText(element, cache, tag)) {
+        return true;
+    }
+    return android_log_shouldPrintLine(mFormat, tag,
+        static_cast<android_LogPriority>(tag[-1]));
+}
+
+bool LogFilter::hasRegex(const LogBufferElement *element) const {
+    log_id_t id = element->getLogId();
+    return mHaveRegex && !element->getDropped()
+        && (id != LOG_ID_EVENTS) && (id != LOG_ID_SECURITY);
+}
+
+bool LogFilter::match(const LogBufferElement *element,
+                      LogBufferChunkCache &cache) const {
+    if (!hasRegex(element)) {
+        return true;
+    }
+    const char *tag;
+    const char *message = parseText(element, cache, tag);
+    return !message || !regexec(&mRegex, message, 0, NULL, 0);
+}
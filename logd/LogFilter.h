@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FILTER_H__
+#define _LOGD_LOG_FILTER_H__
+
+#include <regex.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <log/logprint.h>
+
+class LogBufferChunkCache;
+class LogBufferElement;
+
+// Content filters a reader registers with its logdr command, so that
+// entries it would discard are never sent. The reader still applies its
+// own filters, this only has to let through a superset of what it keeps:
+// anything that can not be evaluated here is accepted.
+//
+//   tags=<tag>[:priority][,...]  filterspecs as understood by logcat
+//   uids=<uid>[,...]             entries logged by any of these uids
+//   regex=<expression>           POSIX extended, must be last, rest of line,
+//                                privileged readers only
+//
+// Tag, priority and regex filters only apply to the text log buffers. A
+// regex longer than maxRegexLength, with more than maxRegexRepeats
+// repetitions or with back-references is ignored, rather than let one
+// reader spend logd's time on it.
+class LogFilter {
+    static const size_t maxRegexLength = 256;
+    static const size_t maxRegexRepeats = 8;
+
+    AndroidLogFormat *mFormat; // NULL if no tags
+    std::vector<uid_t> mUids;  // sorted, empty if no uids
+    regex_t mRegex;
+    bool mHaveRegex;
+
+    LogFilter(const LogFilter &);
+    void operator=(const LogFilter &);
+
+public:
+    LogFilter(const char *tags, const char *uids, const char *regex);
+    ~LogFilter();
+
+    bool empty() const { return !mFormat && mUids.empty() && !mHaveRegex; }
+
+    // Filters by uid, tag and priority. Leaves the regex to match().
+    //
+    // mLogElementsLock must be held when this function is called.
+    bool accept(const LogBufferElement *element,
+                LogBufferChunkCache &cache) const;
+
+    // True if element is subject to match()
+    bool hasRegex(const LogBufferElement *element) const;
+    // Filters by regex. Only reads the payload, so may be called with
+    // mLogElementsLock dropped, where the element is kept from being
+    // pruned by other means.
+    bool match(const LogBufferElement *element,
+               LogBufferChunkCache &cache) const;
+};
+
+#endif // _LOGD_LOG_FILTER_H__
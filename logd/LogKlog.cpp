@@ -40,6 +40,11 @@
 
 static const char priority_message[] = { KMSG_PRIORITY(LOG_INFO), '\0' };
 
+// Longest record /dev/kmsg hands out, kernel/printk.c, not in uapi headers
+#ifndef CONSOLE_EXT_LOG_MAX
+#define CONSOLE_EXT_LOG_MAX 8192
+#endif
+
 // Parsing is hard
 
 // called if we see a '<', s is the next character, returns pointer after '>'
@@ -215,14 +220,18 @@ log_time LogKlog::correction =
         ? log_time::EPOCH
         : (log_time(CLOCK_REALTIME) - log_time(CLOCK_MONOTONIC));
 
-LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd) :
+LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+                 bool auditd, bool records) :
         SocketListener(fdRead, false),
         logbuf(buf),
         reader(reader),
         signature(CLOCK_MONOTONIC),
         initialized(false),
         enableLogging(true),
-        auditd(auditd) {
+        auditd(auditd),
+        records(records),
+        batchCount(0),
+        arenaUsed(0) {
     static const char klogd_message[] = "%slogd.klogd: %" PRIu64 "\n";
     char buffer[sizeof(priority_message) + sizeof(klogd_message) + 20 - 4];
     snprintf(buffer, sizeof(buffer), klogd_message, priority_message,
@@ -237,6 +246,33 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
         enableLogging = false;
     }
 
+    if (records) {
+        // One record per read, collect all that are pending. A record is
+        // at most CONSOLE_EXT_LOG_MAX bytes, a shorter read is refused.
+        char buffer[CONSOLE_EXT_LOG_MAX + 1];
+        for (;;) {
+            ssize_t retval = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
+            if (retval < 0) {
+                if ((errno == EINTR) || (errno == EPIPE)) {
+                    continue; // EPIPE: overwritten before we got to them
+                }
+                // EAGAIN: caught up. Anything else is about the record,
+                // not the fd, which we keep; dropping it stops klogd.
+                break;
+            }
+            if (retval == 0) {
+                break;
+            }
+            buffer[retval] = '\0';
+            char *newstr = reserve(retval);
+            if (parseRecord(buffer, retval, newstr, &batch[batchCount]) > 0) {
+                arenaUsed += batch[batchCount++].len;
+            }
+        }
+        flush();
+        return true;
+    }
+
     char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
     size_t len = 0;
 
@@ -249,6 +285,7 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
             break;
         }
         if (retval < 0) {
+            flush();
             return false;
         }
         len += retval;
@@ -265,14 +302,58 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
                 break;
             }
             if (*tok) {
-                log(tok, sublen);
+                char *newstr = reserve(sublen);
+                if (parseLine(tok, sublen, newstr, &batch[batchCount]) > 0) {
+                    arenaUsed += batch[batchCount++].len;
+                }
             }
         }
     }
+    flush();
 
     return true;
 }
 
+// Room needed by parse() for the entry of a record of len bytes. The
+// message and tag are each truncated to LOGGER_ENTRY_MAX_PAYLOAD, and the
+// entry adds three bytes: priority, and two nuls.
+static size_t entrySize(size_t len) {
+    static const size_t max = 2 * LOGGER_ENTRY_MAX_PAYLOAD;
+    return ((len < max) ? len : max) + 3;
+}
+
+// Returns room in the arena for the next batched entry, parsed from a
+// record of len bytes, logging the batch first if need be.
+char *LogKlog::reserve(size_t len) {
+    if ((batchCount >= maxBatch)
+            || ((arenaSize - arenaUsed) < entrySize(len))) {
+        flush();
+    }
+    return arena + arenaUsed;
+}
+
+// Log the batched entries under one lock acquisition, and notify readers
+// once.
+void LogKlog::flush() {
+    if (!batchCount) {
+        return;
+    }
+
+    logbuf->wrlock();
+    for (size_t i = 0; i < batchCount; ++i) {
+        if (batch[i].pid) {
+            batch[i].uid = logbuf->pidToUid(batch[i].pid);
+        }
+    }
+    logbuf->unlock();
+
+    if (logbuf->log(batch, batchCount)) {
+        reader->notifyNewLog();
+    }
+    batchCount = 0;
+    arenaUsed = 0;
+}
+
 
 void LogKlog::calculateCorrection(const log_time &monotonic,
                                   const char *real_string,
@@ -335,9 +416,6 @@ void LogKlog::sniffTime(log_time &now,
         cp = NULL;
     }
     if (cp) {
-        static const char healthd[] = "healthd";
-        static const char battery[] = ": battery ";
-
         len -= cp - *buf;
         if (len && isspace(*cp)) {
             ++cp;
@@ -345,61 +423,72 @@ void LogKlog::sniffTime(log_time &now,
         }
         *buf = cp;
 
+        sniffCorrection(now, cp, len, reverse);
+    } else {
         if (isMonotonic()) {
-            return;
+            now = log_time(CLOCK_MONOTONIC);
+        } else {
+            now = log_time(CLOCK_REALTIME);
         }
+    }
+}
 
-        const char *b;
-        if (((b = strnstr(cp, len, suspendStr)))
-                && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
-            len -= b - cp;
-            calculateCorrection(now, b, len);
-        } else if (((b = strnstr(cp, len, resumeStr)))
-                && ((size_t)((b += sizeof(resumeStr) - 1) - cp) < len)) {
-            len -= b - cp;
-            calculateCorrection(now, b, len);
-        } else if (((b = strnstr(cp, len, healthd)))
-                && ((size_t)((b += sizeof(healthd) - 1) - cp) < len)
-                && ((b = strnstr(b, len -= b - cp, battery)))
-                && ((size_t)((b += sizeof(battery) - 1) - cp) < len)) {
-            // NB: healthd is roughly 150us late, so we use it instead to
-            //     trigger a check for ntp-induced or hardware clock drift.
-            log_time real(CLOCK_REALTIME);
-            log_time mono(CLOCK_MONOTONIC);
-            correction = (real < mono) ? log_time::EPOCH : (real - mono);
-        } else if (((b = strnstr(cp, len, suspendedStr)))
-                && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
-            len -= b - cp;
-            log_time real;
-            char *endp;
-            real.tv_sec = strtol(b, &endp, 10);
-            if ((*endp == '.') && ((size_t)(endp - b) < len)) {
-                unsigned long multiplier = NS_PER_SEC;
-                real.tv_nsec = 0;
-                len -= endp - b;
-                while (--len && isdigit(*++endp) && (multiplier /= 10)) {
-                    real.tv_nsec += (*endp - '0') * multiplier;
-                }
-                if (reverse) {
-                    if (real > correction) {
-                        correction = log_time::EPOCH;
-                    } else {
-                        correction -= real;
-                    }
+// Track the monotonic to realtime correction through the suspend and resume
+// reports in the kernel log, and convert the monotonic time now.
+void LogKlog::sniffCorrection(log_time &now,
+                              const char *cp, size_t len,
+                              bool reverse) {
+    static const char healthd[] = "healthd";
+    static const char battery[] = ": battery ";
+
+    if (isMonotonic()) {
+        return;
+    }
+
+    const char *b;
+    if (((b = strnstr(cp, len, suspendStr)))
+            && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
+        len -= b - cp;
+        calculateCorrection(now, b, len);
+    } else if (((b = strnstr(cp, len, resumeStr)))
+            && ((size_t)((b += sizeof(resumeStr) - 1) - cp) < len)) {
+        len -= b - cp;
+        calculateCorrection(now, b, len);
+    } else if (((b = strnstr(cp, len, healthd)))
+            && ((size_t)((b += sizeof(healthd) - 1) - cp) < len)
+            && ((b = strnstr(b, len -= b - cp, battery)))
+            && ((size_t)((b += sizeof(battery) - 1) - cp) < len)) {
+        // NB: healthd is roughly 150us late, so we use it instead to
+        //     trigger a check for ntp-induced or hardware clock drift.
+        log_time real(CLOCK_REALTIME);
+        log_time mono(CLOCK_MONOTONIC);
+        correction = (real < mono) ? log_time::EPOCH : (real - mono);
+    } else if (((b = strnstr(cp, len, suspendedStr)))
+            && ((size_t)((b += sizeof(suspendStr) - 1) - cp) < len)) {
+        len -= b - cp;
+        log_time real;
+        char *endp;
+        real.tv_sec = strtol(b, &endp, 10);
+        if ((*endp == '.') && ((size_t)(endp - b) < len)) {
+            unsigned long multiplier = NS_PER_SEC;
+            real.tv_nsec = 0;
+            len -= endp - b;
+            while (--len && isdigit(*++endp) && (multiplier /= 10)) {
+                real.tv_nsec += (*endp - '0') * multiplier;
+            }
+            if (reverse) {
+                if (real > correction) {
+                    correction = log_time::EPOCH;
                 } else {
-                    correction += real;
+                    correction -= real;
                 }
+            } else {
+                correction += real;
             }
         }
-
-        convertMonotonicToReal(now);
-    } else {
-        if (isMonotonic()) {
-            now = log_time(CLOCK_MONOTONIC);
-        } else {
-            now = log_time(CLOCK_REALTIME);
-        }
     }
+
+    convertMonotonicToReal(now);
 }
 
 pid_t LogKlog::sniffPid(const char **buf, size_t len) {
@@ -582,6 +671,38 @@ static const char *strnrchr(const char *s, size_t len, char c) {
 // return -1 if message logd.klogd: <signature>
 //
 int LogKlog::log(const char *buf, size_t len) {
+    // Careful.
+    // We are using the stack to house the log buffer for speed reasons.
+    char newstr[entrySize(len)];
+    LogBufferEntry entry;
+    int rc = parseLine(buf, len, newstr, &entry);
+    if (rc <= 0) {
+        return rc;
+    }
+
+    if (entry.pid) {
+        logbuf->wrlock();
+        entry.uid = logbuf->pidToUid(entry.pid);
+        logbuf->unlock();
+    }
+
+    // Log message
+    rc = logbuf->log(entry.log_id, entry.realtime,
+                     entry.uid, entry.pid, entry.tid, entry.msg, entry.len);
+
+    // notify readers
+    if (!rc) {
+        reader->notifyNewLog();
+    }
+
+    return rc;
+}
+
+// Parse a line of the kernel log, "<PRI>[<TIME>] <message>", into entry.
+// The message is copied to newstr, which must hold entrySize(len) bytes.
+// Returns 1 if entry is to be logged, otherwise as log().
+int LogKlog::parseLine(const char *buf, size_t len,
+                       char *newstr, LogBufferEntry *entry) {
     if (auditd && strnstr(buf, len, " audit(")) {
         return 0;
     }
@@ -592,6 +713,68 @@ int LogKlog::log(const char *buf, size_t len) {
     log_time now;
     sniffTime(now, &p, len - (p - buf), false);
 
+    return parse(pri, now, buf, len, p, newstr, entry);
+}
+
+static int hexValue(char c) {
+    return isdigit(c) ? (c - '0') : (tolower(c) - 'a' + 10);
+}
+
+// Parse a /dev/kmsg record into entry, as parseLine(). The record is
+// "<PRI>,<SEQ>,<USEC>,<FLAGS>[,...];<message>\n" followed by dictionary
+// lines, which are ignored, and has a nul at buf[len]. The message escapes
+// non-printable characters as \xNN, it is unescaped in place.
+int LogKlog::parseRecord(char *buf, size_t len,
+                         char *newstr, LogBufferEntry *entry) {
+    char *msg = static_cast<char *>(memchr(buf, ';', len));
+    if (!msg) {
+        return 0;
+    }
+    char *cp;
+    int pri = strtol(buf, &cp, 10);
+    if ((cp == buf) || (*cp != ',')) {
+        return 0;
+    }
+    strtoull(cp + 1, &cp, 10); // sequence
+    if (*cp != ',') {
+        return 0;
+    }
+    unsigned long long usec = strtoull(cp + 1, &cp, 10);
+    if ((*cp != ',') && (*cp != ';')) {
+        return 0;
+    }
+
+    ++msg;
+    char *end = static_cast<char *>(memchr(msg, '\n', len - (msg - buf)));
+    if (!end) {
+        end = buf + len;
+    }
+    char *d = msg;
+    for (cp = msg; cp < end; ) {
+        if ((*cp == '\\') && ((end - cp) >= 4) && (cp[1] == 'x')
+                && isxdigit(cp[2]) && isxdigit(cp[3])) {
+            *d++ = (hexValue(cp[2]) << 4) | hexValue(cp[3]);
+            cp += 4;
+        } else {
+            *d++ = *cp++;
+        }
+    }
+    len = d - msg;
+
+    if (auditd && strnstr(msg, len, " audit(")) {
+        return 0;
+    }
+
+    log_time now(usec / 1000000, (usec % 1000000) * 1000);
+    sniffCorrection(now, msg, len, false);
+
+    return parse(pri, now, msg, len, msg, newstr, entry);
+}
+
+// The content of the kernel log record buf, of priority pri and time now,
+// starts at p. Parse it into entry, with the message copied to newstr.
+int LogKlog::parse(int pri, log_time now, const char *buf, size_t len,
+                   const char *p, char *newstr, LogBufferEntry *entry) {
     // sniff for start marker
     const char klogd_message[] = "logd.klogd: ";
     const char *start = strnstr(p, len - (p - buf), klogd_message);
@@ -612,15 +795,9 @@ int LogKlog::log(const char *buf, size_t len) {
         return 0;
     }
 
-    // Parse pid, tid and uid
+    // Parse pid and tid, the uid is looked up by the caller
     const pid_t pid = sniffPid(&p, len - (p - buf));
     const pid_t tid = pid;
-    uid_t uid = AID_ROOT;
-    if (pid) {
-        logbuf->lock();
-        uid = logbuf->pidToUid(pid);
-        logbuf->unlock();
-    }
 
     // Parse (rules at top) to pull out a tag from the incoming kernel message.
     // Some may view the following as an ugly heuristic, the desire is to
@@ -758,7 +935,7 @@ twoWord:    while (--taglen && !isspace(*++cp) && (*cp != ':'));
     //   eg: [143:healthd]healthd -> [143:healthd]
     taglen = etag - tag;
     // Mediatek-special printk induced stutter
-    const char *mp = strnrchr(tag, ']', taglen);
+    const char *mp = strnrchr(tag, taglen, ']');
     if (mp && (++mp < etag)) {
         size_t s = etag - mp;
         if (((s + s) < taglen) && !fast<memcmp>(mp, mp - 1 - s, s)) {
@@ -797,13 +974,6 @@ twoWord:    while (--taglen && !isspace(*++cp) && (*cp != ':'));
         return -EINVAL;
     }
 
-    // Careful.
-    // We are using the stack to house the log buffer for speed reasons.
-    // If we malloc'd this buffer, we could get away without n's USHRT_MAX
-    // test above, but we would then required a max(n, USHRT_MAX) as
-    // truncating length argument to logbuf->log() below. Gain is protection
-    // of stack sanity and speedup, loss is truncated long-line content.
-    char newstr[n];
     char *np = newstr;
 
     // Convert priority into single-byte Android logger priority
@@ -845,14 +1015,13 @@ twoWord:    while (--taglen && !isspace(*++cp) && (*cp != ':'));
         }
     }
 
-    // Log message
-    int rc = logbuf->log(LOG_ID_KERNEL, now, uid, pid, tid, newstr,
-                         (unsigned short) n);
-
-    // notify readers
-    if (!rc) {
-        reader->notifyNewLog();
-    }
+    entry->log_id = LOG_ID_KERNEL;
+    entry->realtime = now;
+    entry->uid = AID_ROOT;
+    entry->pid = pid;
+    entry->tid = tid;
+    entry->msg = newstr;
+    entry->len = n;
 
-    return rc;
+    return 1;
 }
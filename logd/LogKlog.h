@@ -20,6 +20,8 @@
 #include <sysutils/SocketListener.h>
 #include <log/log_read.h>
 
+#include "LogBuffer.h"
+
 char *log_strntok_r(char *s, size_t *len, char **saveptr, size_t *sublen);
 
 class LogBuffer;
@@ -37,11 +39,23 @@ class LogKlog : public SocketListener {
     // set if we are also running auditd, to filter out audit reports from
     // our copy of the kernel log
     bool auditd;
+    // fdRead is /dev/kmsg, one structured record per read, rather than
+    // the syslog lines of /proc/kmsg
+    const bool records;
+
+    // Entries parsed by onDataAvailable(), logged in one batch
+    static const size_t maxBatch = 64;
+    static const size_t arenaSize = 64 * 1024;
+    LogBufferEntry batch[maxBatch];
+    size_t batchCount;
+    char arena[arenaSize]; // message content of the batch
+    size_t arenaUsed;
 
     static log_time correction;
 
 public:
-    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd);
+    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+            bool auditd, bool records = false);
     int log(const char *buf, size_t len);
     void synchronize(const char *buf, size_t len);
 
@@ -51,7 +65,17 @@ public:
 
 protected:
     void sniffTime(log_time &now, const char **buf, size_t len, bool reverse);
+    void sniffCorrection(log_time &now, const char *buf, size_t len,
+                         bool reverse);
     pid_t sniffPid(const char **buf, size_t len);
+    int parse(int pri, log_time now, const char *buf, size_t len,
+              const char *p, char *newstr, LogBufferEntry *entry);
+    int parseLine(const char *buf, size_t len,
+                  char *newstr, LogBufferEntry *entry);
+    int parseRecord(char *buf, size_t len,
+                    char *newstr, LogBufferEntry *entry);
+    char *reserve(size_t len);
+    void flush();
     void calculateCorrection(const log_time &monotonic,
                              const char *real_string, size_t len);
     virtual bool onDataAvailable(SocketClient *cli);
@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <limits.h>
+#include <signal.h>
 #include <sys/cdefs.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -34,7 +36,8 @@
 LogListener::LogListener(LogBuffer *buf, LogReader *reader) :
         SocketListener(getLogSocket(), false),
         logbuf(buf),
-        reader(reader) {
+        reader(reader),
+        mRingsMapped(0) {
 }
 
 bool LogListener::onDataAvailable(SocketClient *cli) {
@@ -44,41 +47,161 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         name_set = true;
     }
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
-    struct iovec iov = { buffer, sizeof(buffer) };
-
-    char control[CMSG_SPACE(sizeof(struct ucred))] __aligned(4);
-    struct msghdr hdr = {
-        NULL,
-        0,
-        &iov,
-        1,
-        control,
-        sizeof(control),
-        0,
-    };
+    for (unsigned i = 0; i < maxBatch; ++i) {
+        mIov[i].iov_base = mBuffer[i];
+        mIov[i].iov_len = sizeof(mBuffer[i]);
+        struct msghdr *hdr = &mMsgs[i].msg_hdr;
+        hdr->msg_name = NULL;
+        hdr->msg_namelen = 0;
+        hdr->msg_iov = &mIov[i];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = mControl[i];
+        hdr->msg_controllen = sizeof(mControl[i]);
+        hdr->msg_flags = 0;
+        mMsgs[i].msg_len = 0;
+    }
 
     int socket = cli->getSocket();
 
     // To clear the entire buffer is secure/safe, but this contributes to 1.68%
     // overhead under logging load. We are safe because we check counts.
-    // memset(buffer, 0, sizeof(buffer));
-    ssize_t n = recvmsg(socket, &hdr, 0);
-    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+    // memset(mBuffer, 0, sizeof(mBuffer));
+    //
+    // We were woken because at least one datagram is queued, MSG_DONTWAIT
+    // collects whatever else has arrived behind it without blocking.
+    int count = recvmmsg(socket, mMsgs, maxBatch, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
         return false;
     }
 
+    LogBufferEntry entries[count];
+    size_t n = 0;
+    for (int i = 0; i < count; ++i) {
+        if (parse(&mMsgs[i].msg_hdr, mMsgs[i].msg_len, &entries[n])) {
+            ++n;
+        }
+    }
+
+    bool notify = n && logbuf->log(entries, n);
+    notify |= drainRings();
+    if (notify) {
+        reader->notifyNewLog();
+    }
+
+    return true;
+}
+
+// Accept the shared memory ring registered by a process, replacing any
+// previous one of the same pid, as long as its uid, and logd, are within
+// their limits for rings and the memory they map.
+void LogListener::addRing(struct ucred *cred, int fd,
+                          const char *msg, size_t len) {
+    android_log_ring_register_t reg;
+    if (len < sizeof(reg)) {
+        close(fd);
+        return;
+    }
+    memcpy(&reg, msg, sizeof(reg));
+    if (reg.magic != LOGGER_RING_MAGIC) {
+        close(fd);
+        return;
+    }
+
+    for (LogRingList::iterator it = mRings.begin(); it != mRings.end();) {
+        LogRing *ring = *it;
+        // replaced, or process has exited
+        if ((ring->getPid() == cred->pid)
+                || ((kill(ring->getPid(), 0) < 0) && (errno == ESRCH))) {
+            it = mRings.erase(it);
+            mRingsMapped -= ring->getMapSize();
+            delete ring;
+        } else {
+            ++it;
+        }
+    }
+
+    size_t uidRings = 0;
+    for (LogRingList::iterator it = mRings.begin(); it != mRings.end(); ++it) {
+        if ((*it)->getUid() == cred->uid) {
+            ++uidRings;
+        }
+    }
+    // never attached, process stays on the socket
+    if ((mRings.size() >= maxRings) || (uidRings >= maxRingsPerUid)
+            || (reg.size > maxRingsMapped)
+            || ((mRingsMapped + sizeof(android_log_ring_t) + reg.size)
+                    > maxRingsMapped)) {
+        close(fd);
+        return;
+    }
+
+    LogRing *ring = new LogRing(cred->uid, cred->pid, fd, reg.size);
+    if (!ring->isValid()) {
+        delete ring;
+        return;
+    }
+    mRingsMapped += ring->getMapSize();
+    mRings.push_back(ring);
+}
+
+// Returns true if any content was added to the logs
+bool LogListener::drainRings() {
+    LogBufferEntry entries[maxBatch];
+    bool retval = false;
+
+    for (LogRingList::iterator it = mRings.begin(); it != mRings.end(); ++it) {
+        LogRing *ring = *it;
+        ring->start();
+        size_t n;
+        do {
+            n = ring->drain(entries, mRingCopies, maxBatch);
+            if (n && logbuf->log(entries, n)) {
+                retval = true;
+            }
+            ring->release();
+        } while (n == maxBatch);
+    }
+
+    return retval;
+}
+
+// Validate one received datagram, and describe it in *entry. Returns false
+// if the datagram is to be ignored.
+bool LogListener::parse(struct msghdr *hdr, ssize_t n, LogBufferEntry *entry) {
     struct ucred *cred = NULL;
+    int fd = -1;
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != NULL) {
-        if (cmsg->cmsg_level == SOL_SOCKET
-                && cmsg->cmsg_type  == SCM_CREDENTIALS) {
-            cred = (struct ucred *)CMSG_DATA(cmsg);
-            break;
+        if (cmsg->cmsg_level == SOL_SOCKET) {
+            if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+                cred = (struct ucred *)CMSG_DATA(cmsg);
+            } else if ((cmsg->cmsg_type == SCM_RIGHTS) && (fd < 0)
+                    && (cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))) {
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
+    }
+
+    char *buffer = static_cast<char *>(hdr->msg_iov->iov_base);
+    android_log_header_t *header = reinterpret_cast<android_log_header_t *>(buffer);
+
+    if (fd >= 0) {
+        // Only a ring registration may carry a file descriptor
+        if ((n > (ssize_t)(sizeof(android_log_header_t)))
+                && (header->id == LOGGER_RING_ID)
+                && (cred != NULL) && (cred->uid != AID_LOGD)) {
+            addRing(cred, fd, buffer + sizeof(android_log_header_t),
+                    n - sizeof(android_log_header_t));
+        } else {
+            close(fd);
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        return false;
+    }
+
+    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+        return false;
     }
 
     if (cred == NULL) {
@@ -92,7 +215,10 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    android_log_header_t *header = reinterpret_cast<android_log_header_t *>(buffer);
+    // A doorbell, the rings are all drained on every wakeup
+    if (header->id == LOGGER_RING_ID) {
+        return false;
+    }
     if (/* header->id < LOG_ID_MIN || */ header->id >= LOG_ID_MAX || header->id == LOG_ID_KERNEL) {
         return false;
     }
@@ -103,17 +229,18 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    char *msg = ((char *)buffer) + sizeof(android_log_header_t);
     n -= sizeof(android_log_header_t);
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // NB: hdr->msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    if (logbuf->log((log_id_t)header->id, header->realtime,
-            cred->uid, cred->pid, header->tid, msg,
-            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0) {
-        reader->notifyNewLog();
-    }
+    entry->log_id = (log_id_t)header->id;
+    entry->realtime = header->realtime;
+    entry->uid = cred->uid;
+    entry->pid = cred->pid;
+    entry->tid = header->tid;
+    entry->msg = buffer + sizeof(android_log_header_t);
+    entry->len = ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
 
     return true;
 }
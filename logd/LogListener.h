@@ -17,13 +17,44 @@
 #ifndef _LOGD_LOG_LISTENER_H__
 #define _LOGD_LOG_LISTENER_H__
 
+#include <sys/socket.h>
+
+#include <list>
+
+#include <log/log_read.h>
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
+#include "LogRing.h"
 
 class LogListener : public SocketListener {
     LogBuffer *logbuf;
     LogReader *reader;
 
+    // Datagrams already queued on logdw are drained by one recvmmsg and
+    // handed to LogBuffer as a single batch, amortizing the syscall and the
+    // mLogElementsLock acquisition across a burst of log messages.
+    static const unsigned maxBatch = 32;
+    static const size_t bufferSize = sizeof_log_id_t + sizeof(uint16_t)
+                                   + sizeof(log_time)
+                                   + LOGGER_ENTRY_MAX_PAYLOAD;
+
+    struct mmsghdr mMsgs[maxBatch];
+    struct iovec mIov[maxBatch];
+    char mControl[maxBatch][CMSG_SPACE(sizeof(struct ucred))
+                            + CMSG_SPACE(sizeof(int))] __aligned(4);
+    char mBuffer[maxBatch][bufferSize];
+
+    // Shared memory rings registered by processes, drained on every wakeup.
+    // Their mappings live in logd, so they are limited per uid and in total.
+    static const size_t maxRings = 64;
+    static const size_t maxRingsPerUid = 8;
+    static const size_t maxRingsMapped = 16 * 1024 * 1024;
+    typedef std::list<LogRing *> LogRingList;
+    LogRingList mRings;
+    size_t mRingsMapped;
+    // logd owned copies of the records of one drain pass
+    char mRingCopies[maxBatch][LogRing::copySize];
+
 public:
     LogListener(LogBuffer *buf, LogReader *reader);
 
@@ -32,6 +63,9 @@ protected:
 
 private:
     static int getLogSocket();
+    bool parse(struct msghdr *hdr, ssize_t n, LogBufferEntry *entry);
+    void addRing(struct ucred *cred, int fd, const char *msg, size_t len);
+    bool drainRings();
 };
 
 #endif
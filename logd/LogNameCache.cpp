@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <list>
+#include <unordered_map>
+
+#include <private/android_filesystem_config.h>
+
+#include "LogUtils.h"
+
+// The names and uid of a pid or tid are read out of /proc, which costs
+// several open/read/close cycles for each lookup. Results are kept in a
+// bounded LRU keyed by pid. An entry is trusted for validInterval after it
+// was last confirmed, then confirmed again by checking that the process
+// start time has not changed, which detects the pid having been reused or
+// the process having exited. Names that are missing, or are still those of
+// an unspecialized zygote child, are looked up again at that point.
+
+// caller must own and free character string
+static char *readCmdline(pid_t pid) {
+    char *retval = NULL;
+    if (pid == 0) { // special case from auditd/klogd for kernel
+        retval = strdup("logd");
+    } else {
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer), "/proc/%u/cmdline", pid);
+        int fd = open(buffer, O_RDONLY);
+        if (fd >= 0) {
+            ssize_t ret = read(fd, buffer, sizeof(buffer));
+            if (ret > 0) {
+                buffer[sizeof(buffer)-1] = '\0';
+                // frameworks intermediate state
+                if (fast<strcmp>(buffer, "<pre-initialized>")) {
+                    retval = strdup(buffer);
+                }
+            }
+            close(fd);
+        }
+    }
+    return retval;
+}
+
+// caller must own and free character string
+static char *readComm(pid_t tid) {
+    char *retval = NULL;
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "/proc/%u/comm", tid);
+    int fd = open(buffer, O_RDONLY);
+    if (fd >= 0) {
+        ssize_t ret = read(fd, buffer, sizeof(buffer));
+        if (ret >= (ssize_t)sizeof(buffer)) {
+            ret = sizeof(buffer) - 1;
+        }
+        while ((ret > 0) && isspace(buffer[ret - 1])) {
+            --ret;
+        }
+        if (ret > 0) {
+            buffer[ret] = '\0';
+            retval = strdup(buffer);
+        }
+        close(fd);
+    }
+
+    // if nothing for comm, check out cmdline
+    char *name = readCmdline(tid);
+    if (!retval) {
+        retval = name;
+        name = NULL;
+    }
+
+    // check if comm is truncated, see if cmdline has full representation
+    if (name) {
+        // impossible for retval to be NULL if name not NULL
+        size_t retval_len = strlen(retval);
+        size_t name_len = strlen(name);
+        // KISS: ToDo: Only checks prefix truncated, not suffix, or both
+        if ((retval_len < name_len)
+                && !fast<strcmp>(retval, name + name_len - retval_len)) {
+            free(retval);
+            retval = name;
+        } else {
+            free(name);
+        }
+    }
+    return retval;
+}
+
+static uid_t readUid(pid_t pid) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "/proc/%u/status", pid);
+    FILE *fp = fopen(buffer, "r");
+    if (fp) {
+        while (fgets(buffer, sizeof(buffer), fp)) {
+            int uid;
+            if (sscanf(buffer, "Uid: %d", &uid) == 1) {
+                fclose(fp);
+                return uid;
+            }
+        }
+        fclose(fp);
+    }
+    return AID_LOGD; // associate this with the logger
+}
+
+// Process start time in clock ticks since boot, field 22 of stat. Returns
+// 0 if the process does not exist.
+static unsigned long long readStartTime(pid_t pid) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "/proc/%u/stat", pid);
+    int fd = open(buffer, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t ret = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (ret <= 0) {
+        return 0;
+    }
+    buffer[ret] = '\0';
+
+    // comm, field 2, is parenthesized and may itself contain spaces
+    const char *cp = strrchr(buffer, ')');
+    if (!cp) {
+        return 0;
+    }
+    for (int field = 2; field < 22; ++field) {
+        cp = strchr(cp + 1, ' ');
+        if (!cp) {
+            return 0;
+        }
+    }
+    return strtoull(cp + 1, NULL, 10);
+}
+
+namespace {
+
+class LogNameCache {
+    static const size_t maxEntries = 1024;
+    static const time_t validInterval = 1; // seconds
+
+    struct Entry {
+        pid_t pid;
+        unsigned long long start;
+        time_t validated;
+        bool haveCmdline;
+        bool haveComm;
+        bool haveUid;
+        char *cmdline;
+        char *comm;
+        uid_t uid;
+    };
+
+    typedef std::list<Entry> lru_t;  // most recently used first
+    lru_t lru;
+    std::unordered_map<pid_t, lru_t::iterator> map;
+    pthread_mutex_t lock;
+
+    static time_t now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec;
+    }
+
+    // Is a name unlikely to change for the life of the process?
+    static bool isFinal(const char *name) {
+        return name && fast<strncmp>(name, "zygote", 6);
+    }
+
+    static void clear(Entry &entry) {
+        free(entry.cmdline);
+        free(entry.comm);
+        entry.cmdline = NULL;
+        entry.comm = NULL;
+        entry.haveCmdline = entry.haveComm = entry.haveUid = false;
+    }
+
+    // Returns the entry for pid, moved to the front of the lru and
+    // confirmed as still describing the same process.
+    Entry &find(pid_t pid) {
+        time_t t = now();
+        std::unordered_map<pid_t, lru_t::iterator>::iterator it = map.find(pid);
+        if (it != map.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            Entry &entry = lru.front();
+            if ((t - entry.validated) >= validInterval) {
+                unsigned long long start = pid ? readStartTime(pid) : 0;
+                if (start != entry.start) {
+                    clear(entry); // pid has exited, or has been reused
+                    entry.start = start;
+                } else {
+                    // missing and zygote names may yet be filled in
+                    entry.haveCmdline = isFinal(entry.cmdline);
+                    entry.haveComm = isFinal(entry.comm);
+                }
+                entry.validated = t;
+            }
+            return entry;
+        }
+
+        if (lru.size() >= maxEntries) {
+            Entry &oldest = lru.back();
+            map.erase(oldest.pid);
+            clear(oldest);
+            lru.pop_back();
+        }
+        Entry entry = {
+            pid, pid ? readStartTime(pid) : 0, t,
+            false, false, false, NULL, NULL, AID_LOGD
+        };
+        lru.push_front(entry);
+        map[pid] = lru.begin();
+        return lru.front();
+    }
+
+public:
+    LogNameCache() {
+        pthread_mutex_init(&lock, NULL);
+    }
+
+    char *cmdline(pid_t pid) {
+        pthread_mutex_lock(&lock);
+        Entry &entry = find(pid);
+        if (!entry.haveCmdline) {
+            free(entry.cmdline);
+            entry.cmdline = readCmdline(pid);
+            entry.haveCmdline = true;
+        }
+        char *retval = entry.cmdline ? strdup(entry.cmdline) : NULL;
+        pthread_mutex_unlock(&lock);
+        return retval;
+    }
+
+    char *comm(pid_t tid) {
+        pthread_mutex_lock(&lock);
+        Entry &entry = find(tid);
+        if (!entry.haveComm) {
+            free(entry.comm);
+            entry.comm = readComm(tid);
+            entry.haveComm = true;
+        }
+        char *retval = entry.comm ? strdup(entry.comm) : NULL;
+        pthread_mutex_unlock(&lock);
+        return retval;
+    }
+
+    uid_t uid(pid_t pid) {
+        pthread_mutex_lock(&lock);
+        Entry &entry = find(pid);
+        if (!entry.haveUid) {
+            entry.uid = readUid(pid);
+            entry.haveUid = true;
+        }
+        uid_t retval = entry.uid;
+        pthread_mutex_unlock(&lock);
+        return retval;
+    }
+};
+
+LogNameCache nameCache;
+
+}
+
+namespace android {
+
+// caller must own and free character string
+char *pidToName(pid_t pid) {
+    return nameCache.cmdline(pid);
+}
+
+// caller must own and free character string
+char *tidToName(pid_t tid) {
+    return nameCache.comm(tid);
+}
+
+uid_t pidToUid(pid_t pid) {
+    return nameCache.uid(pid);
+}
+
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#include <android-base/stringprintf.h>
+#include <cutils/properties.h>
+#include <log/log_read.h>
+
+#include "LogRateLimit.h"
+
+// Token bucket admission
+
+RateLimit::RateLimit(uid_t uid, pid_t pid, uint32_t rate, uint32_t burst) :
+        mUid(uid),
+        mPid(pid),
+        mRate(rate),
+        mBurst(burst) {
+}
+
+int RateLimit::rank() const {
+    int rank = (mUid != uid_all) ? 4 : 0;
+    if (mPid == pid_each) {
+        rank += 1;
+    } else if (mPid != pid_none) {
+        rank += 2;
+    }
+    return rank;
+}
+
+bool RateLimit::matches(uid_t uid, pid_t pid) const {
+    return ((mUid == uid_all) || (mUid == uid))
+        && ((mPid == pid_none) || (mPid == pid_each) || (mPid == pid));
+}
+
+std::string RateLimit::format() const {
+    std::string string = (mUid == uid_all)
+        ? std::string("*")
+        : android::base::StringPrintf("%u", mUid);
+    if (mPid == pid_each) {
+        string += "/*";
+    } else if (mPid != pid_none) {
+        string += android::base::StringPrintf("/%u", mPid);
+    }
+    string += android::base::StringPrintf("=%u", mRate);
+    if (mRate && (mBurst != mRate)) {
+        string += android::base::StringPrintf(",%u", mBurst);
+    }
+    return string;
+}
+
+LogRateLimit::LogRateLimit() :
+        mDropping(0) {
+    init(NULL);
+}
+
+// Parse an unsigned decimal number, or '*' if wild is not NULL, advancing
+// str past it. Returns false if there is neither.
+static bool parseNumber(const char *&str, uint32_t &value, bool *wild) {
+    if (wild) {
+        *wild = false;
+        if (*str == '*') {
+            *wild = true;
+            ++str;
+            return true;
+        }
+    }
+    if (!isdigit(*str)) {
+        return false;
+    }
+    uint64_t number = 0;
+    do {
+        number = number * 10 + *str++ - '0';
+        if (number > UINT32_MAX) {
+            return false;
+        }
+    } while (isdigit(*str));
+    value = number;
+    return true;
+}
+
+// On error the rules in effect are left unchanged
+int LogRateLimit::init(const char *str) {
+    static const char _default[] = "default";
+    // default here means take ro.logd.ratelimit, persist.logd.ratelimit
+    // then internal default in that order.
+    if (str && !strcmp(str, _default)) {
+        str = NULL;
+    }
+    static const char _disable[] = "disable";
+    if (str && !strcmp(str, _disable)) {
+        str = "";
+    }
+
+    std::string limits;
+
+    if (str) {
+        limits = str;
+    } else {
+        char property[PROPERTY_VALUE_MAX];
+        property_get("ro.logd.ratelimit", property, _default);
+        limits = property;
+        property_get("persist.logd.ratelimit", property, limits.c_str());
+        // default here means take ro.logd.ratelimit
+        if (strcmp(property, _default)) {
+            limits = property;
+        }
+    }
+
+    // default here means take internal default, which is no limits.
+    if ((limits == _default) || (limits == _disable)) {
+        limits = "";
+    }
+
+    RateLimitCollection rules;
+    for (str = limits.c_str(); *str; ++str) {
+        if (isspace(*str)) {
+            continue;
+        }
+
+        uint32_t value = 0;
+        bool wild;
+        if (!parseNumber(str, value, &wild)) {
+            return 1;
+        }
+        uid_t uid = wild ? RateLimit::uid_all : value;
+
+        pid_t pid = RateLimit::pid_none;
+        if (*str == '/') {
+            ++str;
+            if (!parseNumber(str, value, &wild)
+                    || (!wild && ((value == 0) || (value > INT_MAX)))) {
+                return 1;
+            }
+            pid = wild ? RateLimit::pid_each : value;
+        }
+
+        uint32_t rate = 0;
+        if ((*str != '=') || !parseNumber(++str, rate, NULL)) {
+            return 1;
+        }
+        uint32_t burst = rate;
+        if (*str == ',') {
+            if (!parseNumber(++str, burst, NULL) || (rate && !burst)) {
+                return 1;
+            }
+        }
+
+        if (*str && !isspace(*str)) {
+            return 1;
+        }
+
+        // insert by rank, a later rule for the same UID/PID replaces
+        RateLimit limit(uid, pid, rate, burst);
+        RateLimitCollection::iterator it = rules.begin();
+        while (it != rules.end()) {
+            if ((it->mUid == uid) && (it->mPid == pid)) {
+                it = rules.erase(it);
+                continue;
+            }
+            if (it->rank() < limit.rank()) {
+                break;
+            }
+            ++it;
+        }
+        rules.insert(it, limit);
+
+        if (!*str) {
+            break;
+        }
+    }
+
+    mRules.swap(rules);
+    // what the old rules rejected is still reported by flush()
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+    while (!mBuckets.empty()) {
+        erase(mBuckets.begin(), now);
+    }
+    return 0;
+}
+
+std::string LogRateLimit::format() const {
+    std::string string;
+
+    for (RateLimitCollection::const_iterator it = mRules.begin();
+            it != mRules.end(); ++it) {
+        if (string.length()) {
+            string += " ";
+        }
+        string += it->format();
+    }
+
+    return string;
+}
+
+const RateLimit *LogRateLimit::find(uid_t uid, pid_t pid) const {
+    for (RateLimitCollection::const_iterator it = mRules.begin();
+            it != mRules.end(); ++it) {
+        if (it->matches(uid, pid)) {
+            return &*it;
+        }
+    }
+    return NULL;
+}
+
+void LogRateLimit::refill(Bucket &bucket, uint64_t now) const {
+    uint64_t full = (uint64_t)bucket.burst * NS_PER_SEC;
+    uint64_t elapsed = now - bucket.updated;
+    bucket.updated = now;
+    if (elapsed >= ((full - bucket.tokens) / bucket.rate)) {
+        bucket.tokens = full;
+    } else {
+        bucket.tokens += elapsed * bucket.rate;
+    }
+}
+
+// Report what bucket dropped, at most USHRT_MAX of it, to dropped
+void LogRateLimit::summarize(Bucket &bucket, uint64_t now,
+                             std::vector<RateLimitDropped> &dropped) {
+    RateLimitDropped summary = bucket.last;
+    summary.dropped = (bucket.dropped > USHRT_MAX) ? USHRT_MAX
+                                                   : bucket.dropped;
+    dropped.push_back(summary);
+    bucket.dropped -= summary.dropped;
+    bucket.summarized = now;
+    if (!bucket.dropped) {
+        --mDropping;
+    }
+}
+
+// Forget a bucket, leaving what it dropped to the next flush(). Beyond
+// maxBuckets of those the counts are lost, rather than let them grow
+// without bound between flushes.
+void LogRateLimit::erase(BucketCollection::iterator it, uint64_t now) {
+    while (it->dropped) {
+        if (mEvicted.size() < maxBuckets) {
+            summarize(*it, now, mEvicted);
+        } else {
+            it->dropped = 0;
+            --mDropping;
+        }
+    }
+    mBucketIndex.erase(it->key);
+    mBuckets.erase(it);
+}
+
+void LogRateLimit::flush(std::vector<RateLimitDropped> &dropped) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+
+    while (!mBuckets.empty()
+            && ((now - mBuckets.front().updated) >= bucketExpiry)) {
+        erase(mBuckets.begin(), now);
+    }
+
+    if (mDropping) {
+        for (BucketCollection::iterator it = mBuckets.begin();
+                it != mBuckets.end(); ++it) {
+            if (it->dropped && ((now - it->summarized) >= summaryInterval)) {
+                summarize(*it, now, dropped);
+            }
+        }
+    }
+
+    dropped.insert(dropped.end(), mEvicted.begin(), mEvicted.end());
+    mEvicted.clear();
+}
+
+bool LogRateLimit::admit(log_id_t id, log_time realtime, uid_t uid, pid_t pid,
+                         pid_t tid, unsigned short &dropped) {
+    dropped = 0;
+
+    const RateLimit *limit = find(uid, pid);
+    if (!limit || !limit->mRate) {
+        return true;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+
+    uint64_t key = ((uint64_t)uid << 32)
+                 | ((limit->mPid == RateLimit::pid_none) ? 0 : (uint32_t)pid);
+    BucketCollection::iterator it;
+    std::unordered_map<uint64_t, BucketCollection::iterator>::iterator index =
+        mBucketIndex.find(key);
+    if (index == mBucketIndex.end()) {
+        if (mBuckets.size() >= maxBuckets) {
+            erase(mBuckets.begin(), now);
+        }
+        Bucket bucket = {
+            key, (uint64_t)limit->mBurst * NS_PER_SEC, now, 0, 0,
+            limit->mRate, limit->mBurst, RateLimitDropped()
+        };
+        it = mBuckets.insert(mBuckets.end(), bucket);
+        mBucketIndex[key] = it;
+    } else {
+        // most recently used last
+        it = index->second;
+        mBuckets.splice(mBuckets.end(), mBuckets, it);
+    }
+
+    Bucket &bucket = *it;
+    refill(bucket, now);
+    if (bucket.tokens < NS_PER_SEC) {
+        if (!bucket.dropped) {
+            ++mDropping;
+        }
+        if (bucket.dropped < UINT32_MAX) {
+            ++bucket.dropped;
+        }
+        RateLimitDropped last = { id, realtime, uid, pid, tid, 0 };
+        bucket.last = last;
+        return false;
+    }
+    bucket.tokens -= NS_PER_SEC;
+
+    // Report at most once per summaryInterval, a steady overload would
+    // otherwise be summarized ahead of every message it is allowed.
+    if (bucket.dropped && ((now - bucket.summarized) >= summaryInterval)) {
+        dropped = (bucket.dropped > USHRT_MAX) ? USHRT_MAX : bucket.dropped;
+        bucket.dropped -= dropped;
+        bucket.summarized = now;
+        if (!bucket.dropped) {
+            --mDropping;
+        }
+    }
+    return true;
+}
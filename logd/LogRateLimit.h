@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RATE_LIMIT_H__
+#define _LOGD_LOG_RATE_LIMIT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <log/log.h>
+#include <log/log_read.h>
+
+// Token bucket admission of log messages
+
+class RateLimit {
+    friend class LogRateLimit;
+
+    const uid_t mUid;
+    const pid_t mPid;
+    const uint32_t mRate;   // messages per second, 0 is unlimited
+    const uint32_t mBurst;  // messages admitted back to back
+
+    // Higher is more specific
+    int rank() const;
+
+public:
+    static const uid_t uid_all = (uid_t) -1;
+    static const pid_t pid_none = (pid_t) 0;  // one bucket for the UID
+    static const pid_t pid_each = (pid_t) -1; // a bucket for every PID
+
+    RateLimit(uid_t uid, pid_t pid, uint32_t rate, uint32_t burst);
+
+    bool matches(uid_t uid, pid_t pid) const;
+
+    std::string format() const;
+};
+
+typedef std::list<RateLimit> RateLimitCollection;
+
+// Messages a bucket rejected, to be logged as a chatty placeholder on
+// behalf of the latest of them.
+struct RateLimitDropped {
+    log_id_t id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    unsigned short dropped;
+};
+
+// Rules are matched most specific first, a UID over any UID, then a PID
+// over every PID over the UID as a whole, see README.property for the
+// format. Each UID, or UID/PID, that a rule matches is charged against its
+// own bucket. Messages that find their bucket empty are rejected and
+// counted, to be summarized when the bucket admits again, or by flush()
+// if it does not within summaryInterval. At most maxBuckets are kept,
+// the least recently used is evicted to make room, and those unused for
+// bucketExpiry are forgotten by flush().
+class LogRateLimit {
+    static const size_t maxBuckets = 1024;
+    static const uint64_t summaryInterval = 1000000000ULL; // nanoseconds
+    static const uint64_t bucketExpiry = 60 * summaryInterval;
+
+    struct Bucket {
+        uint64_t key;
+        uint64_t tokens;      // nanoseconds of credit, a message costs a second
+        uint64_t updated;     // CLOCK_MONOTONIC nanoseconds
+        uint64_t summarized;  // when dropped was last reported
+        uint32_t dropped;     // since the last report
+        uint32_t rate;
+        uint32_t burst;
+        RateLimitDropped last; // latest message rejected
+    };
+    typedef std::list<Bucket> BucketCollection;
+
+    RateLimitCollection mRules;
+    // least recently used first
+    BucketCollection mBuckets;
+    std::unordered_map<uint64_t, BucketCollection::iterator> mBucketIndex;
+    // buckets with dropped pending
+    size_t mDropping;
+    // pending summaries of evicted buckets
+    std::vector<RateLimitDropped> mEvicted;
+
+    const RateLimit *find(uid_t uid, pid_t pid) const;
+    void refill(Bucket &bucket, uint64_t now) const;
+    void summarize(Bucket &bucket, uint64_t now,
+                   std::vector<RateLimitDropped> &dropped);
+    void erase(BucketCollection::iterator it, uint64_t now);
+
+public:
+    LogRateLimit();
+
+    int init(const char *str);
+    bool enabled() const { return !mRules.empty(); }
+
+    // Returns false if the message is to be rejected. Otherwise dropped is
+    // set to the count of rejected messages due to be summarized ahead of
+    // this one, zero if none.
+    bool admit(log_id_t id, log_time realtime, uid_t uid, pid_t pid,
+               pid_t tid, unsigned short &dropped);
+
+    // True if rejected messages wait on flush() to be summarized
+    bool pending() const { return mDropping || !mEvicted.empty(); }
+    // Append the summaries that have waited summaryInterval for the bucket
+    // to admit again, or whose bucket is gone, to dropped. Forget expired
+    // buckets.
+    void flush(std::vector<RateLimitDropped> &dropped);
+
+    std::string format() const;
+};
+
+#endif // _LOGD_LOG_RATE_LIMIT_H__
@@ -20,7 +20,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <string>
+
 #include <cutils/sockets.h>
+#include <private/android_logger.h>
 
 #include "FlushCommand.h"
 #include "LogBuffer.h"
@@ -47,7 +50,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         name_set = true;
     }
 
-    char buffer[255];
+    char buffer[LOGGER_READER_COMMAND_MAX];
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -56,9 +59,48 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     }
     buffer[len] = '\0';
 
+    // Takes the rest of the command, so must be parsed and cut off first
+    const char *regex = NULL;
+    static const char _regex[] = " regex=";
+    char *cp = strstr(buffer, _regex);
+    if (cp) {
+        *cp = '\0';
+        regex = cp + sizeof(_regex) - 1;
+    }
+
+    std::string tags;
+    static const char _tags[] = " tags=";
+    cp = strstr(buffer, _tags);
+    if (cp) {
+        cp += sizeof(_tags) - 1;
+        tags = std::string(cp, strcspn(cp, " "));
+    }
+
+    std::string uids;
+    static const char _uids[] = " uids=";
+    cp = strstr(buffer, _uids);
+    if (cp) {
+        cp += sizeof(_uids) - 1;
+        uids = std::string(cp, strcspn(cp, " "));
+    }
+
+    // Only those who may read every log get to spend our time on a regex
+    if (regex && !FlushCommand::hasReadLogs(cli)) {
+        regex = NULL;
+    }
+
+    LogFilter *filter = NULL;
+    if (regex || tags.length() || uids.length()) {
+        filter = new LogFilter(tags.c_str(), uids.c_str(), regex);
+        if (filter->empty()) {
+            delete filter;
+            filter = NULL;
+        }
+    }
+
     unsigned long tail = 0;
     static const char _tail[] = " tail=";
-    char *cp = strstr(buffer, _tail);
+    cp = strstr(buffer, _tail);
     if (cp) {
         tail = atol(cp + sizeof(_tail) - 1);
     }
@@ -119,6 +161,9 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     uint64_t sequence = 1;
     // Convert realtime to sequence number
     if (start != log_time::EPOCH) {
+        // Skip directly to the neighbourhood of start
+        sequence = logbuf().seek(start);
+
         class LogFindStart {
             const pid_t mPid;
             const unsigned mLogMask;
@@ -172,6 +217,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
 
         if (!logFindStart.found()) {
             if (nonBlock) {
+                delete filter;
                 doSocketDelete(cli);
                 return false;
             }
@@ -179,7 +225,8 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         }
     }
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout);
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, timeout,
+                         filter);
 
     // Set acceptable upper limit to wait for slow reader processing b/27242723
     struct timeval t = { LOGD_SNDTIMEO, 0 };
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log/logger.h>
+
+#include "LogBuffer.h"
+#include "LogRing.h"
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS 1034
+#endif
+
+// Only a memfd sealed at its size is safe to map: any other file can be
+// truncated under us (SIGBUS) or backed by something that blocks on fault.
+// F_GET_SEALS fails for everything but shmem backed files.
+static bool isSealed(int fd) {
+    int seals = fcntl(fd, F_GET_SEALS);
+    return (seals >= 0)
+        && ((seals & LOGGER_RING_SEALS) == LOGGER_RING_SEALS);
+}
+
+LogRing::LogRing(uid_t uid, pid_t pid, int fd, uint32_t size) :
+        mUid(uid),
+        mPid(pid),
+        mRing(NULL),
+        mMapSize(sizeof(android_log_ring_t) + size),
+        mSize(size),
+        mRead(0),
+        mPending(0),
+        mEnd(0),
+        mBroken(false) {
+    struct stat st;
+
+    if ((size >= LOGGER_RING_MIN) && (size <= LOGGER_RING_MAX)
+            && !(size & (size - 1))
+            && isSealed(fd)
+            && !fstat(fd, &st) && (st.st_size >= (off_t)mMapSize)) {
+        void *map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            mRing = reinterpret_cast<android_log_ring_t *>(map);
+        }
+    }
+    close(fd);
+
+    if (!mRing) {
+        return;
+    }
+    if ((mRing->magic != LOGGER_RING_MAGIC) || (mRing->size != mSize)) {
+        mBroken = true;
+        return;
+    }
+
+    // Pick up where a previous logd left off
+    mRead = mPending = mEnd = __atomic_load_n(&mRing->read, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&mRing->doorbell, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&mRing->attached, 1, __ATOMIC_RELEASE);
+}
+
+LogRing::~LogRing() {
+    if (mRing) {
+        __atomic_store_n(&mRing->attached, 0, __ATOMIC_RELEASE);
+        munmap(mRing, mMapSize);
+    }
+}
+
+void LogRing::start() {
+    if (!isValid()) {
+        return;
+    }
+    __atomic_store_n(&mRing->doorbell, 1, __ATOMIC_SEQ_CST);
+    mEnd = __atomic_load_n(&mRing->reserve, __ATOMIC_SEQ_CST);
+    if ((mEnd - mRead) > mSize) {
+        mEnd = mRead + mSize;
+    }
+}
+
+// Checks made on our copy of a record's payload: a text message must hold
+// a known priority and a nul terminated tag, an event its tag.
+static bool isWellFormed(log_id_t id, const char *msg, size_t len) {
+    if (id == LOG_ID_EVENTS) {
+        return len >= sizeof(uint32_t);
+    }
+    if ((len < 3) || (msg[0] < ANDROID_LOG_VERBOSE)
+            || (msg[0] > ANDROID_LOG_FATAL)) {
+        return false;
+    }
+    return memchr(msg + 1, '\0', len - 1) != NULL;
+}
+
+size_t LogRing::drain(LogBufferEntry *entries, char (*copies)[copySize],
+                      size_t max) {
+    size_t count = 0;
+    char *data = reinterpret_cast<char *>(mRing + 1);
+
+    while (isValid() && (count < max) && (mPending < mEnd)) {
+        uint32_t offset = mPending & (mSize - 1);
+        android_log_ring_record_t *record =
+            reinterpret_cast<android_log_ring_record_t *>(data + offset);
+
+        uint32_t state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+        if (!(state & LOGGER_RING_READY)) {
+            break;
+        }
+        uint32_t length = state & LOGGER_RING_LENGTH;
+        if (!length || (length & (sizeof(uint64_t) - 1))
+                || (length > (mSize - offset))) {
+            mBroken = true;
+            break;
+        }
+        mPending += length;
+        if (state & LOGGER_RING_PAD) {
+            continue;
+        }
+        if (length < sizeof(*record)) {
+            mBroken = true;
+            break;
+        }
+
+        // Copy out before checking, the writer can still scribble on it
+        android_log_ring_record_t header;
+        memcpy(&header, record, sizeof(header));
+        uint16_t id = header.id;
+        uint16_t len = header.len;
+        if ((len > (length - sizeof(*record)))
+                || (len > LOGGER_ENTRY_MAX_PAYLOAD) || !len
+                || (id >= LOG_ID_MAX) || (id == LOG_ID_KERNEL)
+                || (id == LOG_ID_SECURITY)) {
+            continue;
+        }
+        char *msg = copies[count];
+        memcpy(msg, record + 1, len);
+        msg[len] = '\0';
+        if (!isWellFormed(static_cast<log_id_t>(id), msg, len)) {
+            continue;
+        }
+
+        LogBufferEntry &entry = entries[count++];
+        entry.log_id = static_cast<log_id_t>(id);
+        entry.realtime = header.realtime;
+        entry.uid = mUid;
+        entry.pid = mPid;
+        entry.tid = header.tid;
+        entry.msg = msg;
+        entry.len = len;
+    }
+
+    return count;
+}
+
+void LogRing::release() {
+    if (!mRing || (mPending == mRead)) {
+        return;
+    }
+
+    // Writers rely on unused space reading as zero, with no stale
+    // LOGGER_RING_READY state in it.
+    char *data = reinterpret_cast<char *>(mRing + 1);
+    uint32_t offset = mRead & (mSize - 1);
+    uint64_t length = mPending - mRead;
+    if (length > (mSize - offset)) {
+        memset(data + offset, 0, mSize - offset);
+        length -= mSize - offset;
+        offset = 0;
+    }
+    memset(data + offset, 0, length);
+
+    mRead = mPending;
+    __atomic_store_n(&mRing->read, mRead, __ATOMIC_RELEASE);
+}
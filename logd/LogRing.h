@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RING_H__
+#define _LOGD_LOG_RING_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <private/android_logger.h>
+
+struct LogBufferEntry;
+
+// logd's end of the shared memory ring a process registered through
+// __android_log_ring_enable(). The process owns the content, so everything
+// read out of the ring is validated, and a ring that is found corrupt is
+// no longer drained.
+class LogRing {
+    const uid_t mUid;
+    const pid_t mPid;
+    android_log_ring_t *mRing;
+    size_t mMapSize;
+    uint32_t mSize;     // our copy, the ring header is not trusted
+    uint64_t mRead;     // consumed and released
+    uint64_t mPending;  // consumed, to be released
+    uint64_t mEnd;      // limit of this drain pass
+    bool mBroken;
+
+public:
+    // Takes ownership of fd
+    LogRing(uid_t uid, pid_t pid, int fd, uint32_t size);
+    ~LogRing();
+
+    // Room to copy a record into, payload plus a terminating nul
+    static const size_t copySize = LOGGER_ENTRY_MAX_PAYLOAD + 1;
+
+    bool isValid() const { return mRing && !mBroken; }
+    uid_t getUid() const { return mUid; }
+    pid_t getPid() const { return mPid; }
+    size_t getMapSize() const { return mMapSize; }
+
+    // Ask for a doorbell on the next write, and bound the drain pass.
+    void start();
+    // Copy up to max records out of the ring into copies, and describe
+    // those that are well formed in entries. Returns the count. The ring
+    // is never handed to LogBuffer directly, the process can still write
+    // to it, and a check made there would not hold.
+    size_t drain(LogBufferEntry *entries, char (*copies)[copySize],
+                 size_t max);
+    // Hand the drained space back to the writers.
+    void release();
+};
+
+#endif // _LOGD_LOG_RING_H__
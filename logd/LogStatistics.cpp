@@ -14,7 +14,6 @@
  * limitations under the License.
  */
 
-#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -23,7 +22,10 @@
 
 #include "LogStatistics.h"
 
-LogStatistics::LogStatistics() : enable(false) {
+LogStatistics::LogStatistics() :
+        mBatches(0),
+        mBatchedElements(0),
+        enable(false) {
     log_id_for_each(id) {
         mSizes[id] = 0;
         mElements[id] = 0;
@@ -33,39 +35,14 @@ LogStatistics::LogStatistics() : enable(false) {
     }
 }
 
-namespace android {
-
-// caller must own and free character string
-char *pidToName(pid_t pid) {
-    char *retval = NULL;
-    if (pid == 0) { // special case from auditd/klogd for kernel
-        retval = strdup("logd");
-    } else {
-        char buffer[512];
-        snprintf(buffer, sizeof(buffer), "/proc/%u/cmdline", pid);
-        int fd = open(buffer, O_RDONLY);
-        if (fd >= 0) {
-            ssize_t ret = read(fd, buffer, sizeof(buffer));
-            if (ret > 0) {
-                buffer[sizeof(buffer)-1] = '\0';
-                // frameworks intermediate state
-                if (fast<strcmp>(buffer, "<pre-initialized>")) {
-                    retval = strdup(buffer);
-                }
-            }
-            close(fd);
-        }
-    }
-    return retval;
-}
-
-}
-
 void LogStatistics::add(LogBufferElement *element) {
     log_id_t log_id = element->getLogId();
     unsigned short size = element->getMsgLen();
     mSizes[log_id] += size;
     ++mElements[log_id];
+    if (element->getDropped()) {
+        ++mDroppedElements[log_id];
+    }
 
     mSizesTotal[log_id] += size;
     ++mElementsTotal[log_id];
@@ -494,6 +471,11 @@ std::string LogStatistics::format(uid_t uid, pid_t pid,
         spaces += spaces_total;
     }
 
+    if (mBatches) {
+        output += android::base::StringPrintf(
+            "\nBatched  %zu/%zu", mBatchedElements, mBatches);
+    }
+
     // Report on Chattiest
 
     std::string name;
@@ -544,27 +526,6 @@ std::string LogStatistics::format(uid_t uid, pid_t pid,
     return output;
 }
 
-namespace android {
-
-uid_t pidToUid(pid_t pid) {
-    char buffer[512];
-    snprintf(buffer, sizeof(buffer), "/proc/%u/status", pid);
-    FILE *fp = fopen(buffer, "r");
-    if (fp) {
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            int uid;
-            if (sscanf(buffer, "Uid: %d", &uid) == 1) {
-                fclose(fp);
-                return uid;
-            }
-        }
-        fclose(fp);
-    }
-    return AID_LOGD; // associate this with the logger
-}
-
-}
-
 uid_t LogStatistics::pidToUid(pid_t pid) {
     return pidTable.add(pid)->second.getUid();
 }
@@ -24,6 +24,7 @@
 #include <algorithm> // std::max
 #include <string>    // std::string
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/stringprintf.h>
 #include <log/log.h>
@@ -41,6 +42,63 @@ template <typename TKey, typename TEntry>
 class LogHashtable {
 
     std::unordered_map<TKey, TEntry> map;
+    // Max-heap of the entries by getSizes(), maintained as entries change
+    // so that the worst offenders are available without a sort. Each entry
+    // records its position in the heap.
+    std::vector<TEntry *> heap;
+
+    void swap(size_t i, size_t j) {
+        std::swap(heap[i], heap[j]);
+        heap[i]->index = i;
+        heap[j]->index = j;
+    }
+
+    void siftUp(size_t i) {
+        while (i) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent]->getSizes() >= heap[i]->getSizes()) {
+                break;
+            }
+            swap(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        for (;;) {
+            size_t largest = i;
+            size_t child = 2 * i + 1;
+            for (size_t end = child + 2; (child < end) && (child < heap.size()); ++child) {
+                if (heap[child]->getSizes() > heap[largest]->getSizes()) {
+                    largest = child;
+                }
+            }
+            if (largest == i) {
+                break;
+            }
+            swap(i, largest);
+            i = largest;
+        }
+    }
+
+    void insert(TEntry &entry) {
+        entry.index = heap.size();
+        heap.push_back(&entry);
+        siftUp(entry.index);
+    }
+
+    void remove(TEntry &entry) {
+        size_t i = entry.index;
+        size_t last = heap.size() - 1;
+        if (i != last) {
+            swap(i, last);
+        }
+        heap.pop_back();
+        if (i != last) {
+            siftUp(i);
+            siftDown(heap[i]->index);
+        }
+    }
 
 public:
 
@@ -85,12 +143,28 @@ public:
         return sorted;
     }
 
+    // Largest and second largest entries by size, NULL if there are fewer
+    // entries. Does not walk the table.
+    void worst(const TEntry *&first, const TEntry *&second) const {
+        first = heap.empty() ? NULL : heap[0];
+        second = NULL;
+        if (heap.size() > 1) {
+            second = heap[1];
+            if ((heap.size() > 2)
+                    && (heap[2]->getSizes() > second->getSizes())) {
+                second = heap[2];
+            }
+        }
+    }
+
     inline iterator add(TKey key, LogBufferElement *element) {
         iterator it = map.find(key);
         if (it == map.end()) {
             it = map.insert(std::make_pair(key, TEntry(element))).first;
+            insert(it->second);
         } else {
             it->second.add(element);
+            siftUp(it->second.index);
         }
         return it;
     }
@@ -99,6 +173,7 @@ public:
         iterator it = map.find(key);
         if (it == map.end()) {
             it = map.insert(std::make_pair(key, TEntry(key))).first;
+            insert(it->second);
         } else {
             it->second.add(key);
         }
@@ -107,8 +182,14 @@ public:
 
     void subtract(TKey key, LogBufferElement *element) {
         iterator it = map.find(key);
-        if ((it != map.end()) && it->second.subtract(element)) {
+        if (it == map.end()) {
+            return;
+        }
+        if (it->second.subtract(element)) {
+            remove(it->second);
             map.erase(it);
+        } else {
+            siftDown(it->second.index);
         }
     }
 
@@ -116,6 +197,7 @@ public:
         iterator it = map.find(key);
         if (it != map.end()) {
             it->second.drop(element);
+            siftDown(it->second.index);
         }
     }
 
@@ -164,9 +246,10 @@ namespace EntryBaseConstants {
 
 struct EntryBase {
     size_t size;
+    size_t index; // position in the LogHashtable heap
 
-    EntryBase():size(0) { }
-    EntryBase(LogBufferElement *element):size(element->getMsgLen()) { }
+    EntryBase():size(0), index(0) { }
+    EntryBase(LogBufferElement *element):size(element->getMsgLen()), index(0) { }
 
     size_t getSizes() const { return size; }
 
@@ -247,10 +330,6 @@ struct UidEntry : public EntryBaseDropped {
     std::string format(const LogStatistics &stat, log_id_t id) const;
 };
 
-namespace android {
-uid_t pidToUid(pid_t pid);
-}
-
 struct PidEntry : public EntryBaseDropped {
     const pid_t pid;
     uid_t uid;
@@ -410,6 +489,8 @@ class LogStatistics {
     size_t mDroppedElements[LOG_ID_MAX];
     size_t mSizesTotal[LOG_ID_MAX];
     size_t mElementsTotal[LOG_ID_MAX];
+    size_t mBatches;          // batched receives from LogListener
+    size_t mBatchedElements;  // datagrams received in those batches
     bool enable;
 
     // uid to size list
@@ -441,6 +522,16 @@ public:
     void enableStatistics() { enable = true; }
 
     void add(LogBufferElement *entry);
+    // Datagrams received together by one LogListener wakeup
+    void addBatch(size_t count) {
+        ++mBatches;
+        mBatchedElements += count;
+    }
+    // Log traffic received but not retained in the buffer
+    void addTotal(log_id_t log_id, unsigned short size) {
+        mSizesTotal[log_id] += size;
+        ++mElementsTotal[log_id];
+    }
     void subtract(LogBufferElement *entry);
     // entry->setDropped(1) must follow this call
     void drop(LogBufferElement *entry);
@@ -451,13 +542,14 @@ public:
         --mDroppedElements[log_id];
     }
 
-    std::unique_ptr<const UidEntry *[]> sort(uid_t uid, pid_t pid,
-                                             size_t len, log_id id) {
-        return uidTable[id].sort(uid, pid, len);
+    // Two chattiest UIDs, and two chattiest PIDs of the system UID, in O(1)
+    void worstUid(log_id id, const UidEntry *&first,
+                  const UidEntry *&second) const {
+        uidTable[id].worst(first, second);
     }
-    std::unique_ptr<const PidEntry *[]> sort(uid_t uid, pid_t pid,
-                                             size_t len, log_id id, uid_t) {
-        return pidSystemTable[id].sort(uid, pid, len);
+    void worstPidOfSystem(log_id id, const PidEntry *&first,
+                          const PidEntry *&second) const {
+        pidSystemTable[id].worst(first, second);
     }
 
     // fast track current value by id only
@@ -27,7 +27,8 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid,
-                           uint64_t start, uint64_t timeout) :
+                           uint64_t start, uint64_t timeout,
+                           const LogFilter *filter) :
         mRefCount(1),
         mRelease(false),
         mError(false),
@@ -39,6 +40,7 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         mCount(0),
         mTail(tail),
         mIndex(0),
+        mFilter(filter),
         mClient(client),
         mStart(start),
         mNonBlock(nonBlock),
@@ -49,6 +51,10 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
     cleanSkip_Locked();
 }
 
+LogTimeEntry::~LogTimeEntry() {
+    delete mFilter;
+}
+
 void LogTimeEntry::startReader_Locked(void) {
     pthread_attr_t attr;
 
@@ -151,10 +157,12 @@ void *LogTimeEntry::threadStart(void *obj) {
         unlock();
 
         if (me->mTail) {
-            logbuf.flushTo(client, start, privileged, security, FilterFirstPass, me);
+            logbuf.flushTo(client, start, privileged, security,
+                           FilterFirstPass, me, me->mFilter);
             me->leadingDropped = true;
         }
-        start = logbuf.flushTo(client, start, privileged, security, FilterSecondPass, me);
+        start = logbuf.flushTo(client, start, privileged, security,
+                               FilterSecondPass, me, me->mFilter);
 
         lock();
 
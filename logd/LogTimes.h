@@ -28,6 +28,7 @@
 
 class LogReader;
 class LogBufferElement;
+class LogFilter;
 
 class LogTimeEntry {
     static pthread_mutex_t timesLock;
@@ -47,11 +48,15 @@ class LogTimeEntry {
     unsigned long mCount;
     unsigned long mTail;
     unsigned long mIndex;
+    const LogFilter *mFilter;
 
 public:
+    // Takes ownership of filter
     LogTimeEntry(LogReader &reader, SocketClient *client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 uint64_t start, uint64_t timeout);
+                 uint64_t start, uint64_t timeout,
+                 const LogFilter *filter = NULL);
+    ~LogTimeEntry();
 
     SocketClient *mClient;
     uint64_t mStart;
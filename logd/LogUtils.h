@@ -30,9 +30,11 @@ namespace android {
 // Furnished in main.cpp. Caller must own and free returned value
 char *uidToName(uid_t uid);
 
-// Furnished in LogStatistics.cpp. Caller must own and free returned value
+// Furnished in LogNameCache.cpp. Caller must own and free returned value
 char *pidToName(pid_t pid);
 char *tidToName(pid_t tid);
+// Furnished in LogNameCache.cpp. Thread safe.
+uid_t pidToUid(pid_t pid);
 
 // Furnished in main.cpp. Thread safe.
 const char *tagToName(uint32_t tag);
@@ -272,6 +272,22 @@ static void *reinit_thread_start(void * /*obj*/) {
         if (logBuf) {
             logBuf->init();
             logBuf->initPrune(NULL);
+            logBuf->initRateLimit(NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static void *maintain_thread_start(void *obj) {
+    prctl(PR_SET_NAME, "logd.maintain");
+    set_sched_policy(0, SP_BACKGROUND);
+    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_BACKGROUND);
+
+    LogReader *reader = static_cast<LogReader *>(obj);
+    for (;;) {
+        if (reader->logbuf().maintain()) {
+            reader->notifyNewLog();
         }
     }
 
@@ -371,13 +387,21 @@ static void readDmesg(LogAudit *al, LogKlog *kl) {
 // transitory per-client threads are created for each reader.
 int main(int argc, char *argv[]) {
     int fdPmesg = -1;
+    bool kmsgRecords = false;
     bool klogd = property_get_bool("logd.kernel",
                                    BOOL_DEFAULT_TRUE |
                                    BOOL_DEFAULT_FLAG_PERSIST |
                                    BOOL_DEFAULT_FLAG_ENG |
                                    BOOL_DEFAULT_FLAG_SVELTE);
     if (klogd) {
-        fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        // Prefer the structured records of /dev/kmsg, which carry their
+        // timestamp and need no line splitting.
+        fdPmesg = open("/dev/kmsg", O_RDONLY | O_NDELAY | O_CLOEXEC);
+        if (fdPmesg >= 0) {
+            kmsgRecords = true;
+        } else {
+            fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        }
     }
     fdDmesg = open("/dev/kmsg", O_WRONLY);
 
@@ -463,6 +487,18 @@ int main(int argc, char *argv[]) {
         logBuf->enableStatistics();
     }
 
+    if (property_get_bool("logd.compress",
+                          BOOL_DEFAULT_TRUE |
+                          BOOL_DEFAULT_FLAG_PERSIST)) {
+        logBuf->enableCompression();
+    }
+
+    if (property_get_bool("logd.dedup",
+                          BOOL_DEFAULT_FALSE |
+                          BOOL_DEFAULT_FLAG_PERSIST)) {
+        logBuf->enableDedup();
+    }
+
     // LogReader listens on /dev/socket/logdr. When a client
     // connects, log entries in the LogBuffer are written to the client.
 
@@ -471,6 +507,22 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    // Maintenance Thread, compresses retired log content and summarizes
+    // idle runs of repeats off the log() path
+    if (!pthread_attr_init(&attr)) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        pthread_attr_setschedparam(&attr, &param);
+        pthread_attr_setschedpolicy(&attr, SCHED_BATCH);
+        if (!pthread_attr_setdetachstate(&attr,
+                                         PTHREAD_CREATE_DETACHED)) {
+            pthread_t thread;
+            pthread_create(&thread, &attr, maintain_thread_start, reader);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
     // LogListener listens on /dev/socket/logdw for client
     // initiated log messages. New log entries are added to LogBuffer
     // and LogReader is notified to send updates to connected clients.
@@ -508,7 +560,8 @@ int main(int argc, char *argv[]) {
 
     LogKlog *kl = NULL;
     if (klogd) {
-        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL);
+        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL,
+                         kmsgRecords);
     }
 
     readDmesg(al, kl);
@@ -23,6 +23,57 @@ LOCAL_PATH := $(call my-dir)
 test_module_prefix := logd-
 test_tags := tests
 
+benchmark_c_flags := \
+    -I$(LOCAL_PATH)/.. \
+    -I$(LOCAL_PATH)/../../liblog/tests \
+    -Wall -Wextra \
+    -Werror \
+    -fno-builtin \
+    -DAUDITD_LOG_TAG=1003 -DLOGD_LOG_TAG=1004
+
+# logd less main.cpp and CommandListener.cpp, linked in process
+logd_src_files := \
+    ../LogCommand.cpp \
+    ../LogListener.cpp \
+    ../LogRing.cpp \
+    ../LogReader.cpp \
+    ../FlushCommand.cpp \
+    ../LogBuffer.cpp \
+    ../LogBufferElement.cpp \
+    ../LogBufferChunk.cpp \
+    ../LogFilter.cpp \
+    ../LogNameCache.cpp \
+    ../LogTimes.cpp \
+    ../LogStatistics.cpp \
+    ../LogWhiteBlackList.cpp \
+    ../LogRateLimit.cpp \
+    ../libaudit.c \
+    ../LogAudit.cpp \
+    ../LogKlog.cpp
+
+logd_shared_libraries := \
+    libsysutils \
+    liblog \
+    libcutils \
+    libbase \
+    libpackagelistparser \
+    libz
+
+benchmark_src_files := \
+    ../../liblog/tests/benchmark_main.cpp \
+    logd_benchmark.cpp \
+    $(logd_src_files)
+
+# Build benchmarks for the logd buffer. Run with:
+#   adb shell /data/nativetest/logd-benchmarks/logd-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)benchmarks
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_CFLAGS += $(benchmark_c_flags)
+LOCAL_SHARED_LIBRARIES := $(logd_shared_libraries)
+LOCAL_SRC_FILES := $(benchmark_src_files)
+include $(BUILD_NATIVE_TEST)
+
 # -----------------------------------------------------------------------------
 # Unit tests.
 # -----------------------------------------------------------------------------
@@ -30,12 +81,16 @@ test_tags := tests
 test_c_flags := \
     -fstack-protector-all \
     -g \
+    -I$(LOCAL_PATH)/.. \
     -Wall -Wextra \
     -Werror \
     -fno-builtin \
+    -DAUDITD_LOG_TAG=1003 -DLOGD_LOG_TAG=1004
 
+# Tests against the running logd, and of an in-process LogBuffer
 test_src_files := \
-    logd_test.cpp
+    logd_test.cpp \
+    $(logd_src_files)
 
 # Build tests for the logger. Run with:
 #   adb shell /data/nativetest/logd-unit-tests/logd-unit-tests
@@ -43,6 +98,6 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := $(test_module_prefix)unit-tests
 LOCAL_MODULE_TAGS := $(test_tags)
 LOCAL_CFLAGS += $(test_c_flags)
-LOCAL_SHARED_LIBRARIES := libbase libcutils liblog
+LOCAL_SHARED_LIBRARIES := $(logd_shared_libraries)
 LOCAL_SRC_FILES := $(test_src_files)
 include $(BUILD_NATIVE_TEST)
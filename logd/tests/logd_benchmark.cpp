@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+#include <private/android_filesystem_config.h>
+#include <sysutils/SocketClient.h>
+
+#include "benchmark.h"
+
+#include "LogBuffer.h"
+#include "LogUtils.h"
+
+// Drive an in-process LogBuffer, the stage of logd all ingest sources and
+// readers meet at, without the sockets and threads around it. The socket
+// ingest path from a client is measured by liblog-benchmarks.
+
+// Furnished in main.cpp for logd, the benchmark has no package list,
+// event tag map or properties to consult.
+char *android::uidToName(uid_t) {
+    return NULL;
+}
+
+const char *android::tagToName(uint32_t) {
+    return NULL;
+}
+
+bool property_get_bool(const char *, int flag) {
+    return flag & BOOL_DEFAULT_TRUE;
+}
+
+static uint64_t NanoTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<uint64_t>(t.tv_sec) * NS_PER_SEC + t.tv_nsec;
+}
+
+// Large enough for the ingest benchmarks to rarely prune
+static const unsigned long largeBuffer = 64 * 1024 * 1024UL;
+
+// One LogBuffer for all the benchmarks, emptied and resized by each
+static LogBuffer *logBuffer(unsigned long size) {
+    static LogBuffer *logbuf;
+    if (!logbuf) {
+        logbuf = new LogBuffer(new LastLogTimes());
+    }
+    log_id_for_each(id) {
+        logbuf->clear(id);
+        logbuf->setSize(id, size);
+    }
+    return logbuf;
+}
+
+// Fill msg with a len byte text payload: priority, tag and message.
+static unsigned short makeMessage(char *msg, unsigned short len, unsigned i) {
+    static const char tag[] = "logd_benchmark";
+    static const unsigned short minimum = 1 + sizeof(tag) + 16;
+    if (len < minimum) {
+        len = minimum;
+    }
+    if (len > LOGGER_ENTRY_MAX_PAYLOAD) {
+        len = LOGGER_ENTRY_MAX_PAYLOAD;
+    }
+    msg[0] = ANDROID_LOG_INFO;
+    memcpy(msg + 1, tag, sizeof(tag));
+    char *cp = msg + 1 + sizeof(tag);
+    size_t text = len - 1 - sizeof(tag);
+    int n = snprintf(cp, text, "%u ", i);
+    memset(cp + n, 'x', text - n - 1);
+    cp[text - 1] = '\0';
+    return len;
+}
+
+// Half of the messages come from a single chatty UID, the rest spread over
+// the remaining uids - 1 application UIDs.
+static uid_t pickUid(unsigned i, unsigned uids) {
+    if ((uids <= 1) || !(i & 1)) {
+        return AID_APP;
+    }
+    return AID_APP + 1 + ((i * 2654435761U) >> 8) % (uids - 1);
+}
+
+/*
+ *	Measure LogBuffer::log() of a single message of the argument's size,
+ * into a buffer large enough to rarely prune.
+ */
+static void BM_log_ingest(int iters, int size) {
+    LogBuffer *logbuf = logBuffer(largeBuffer);
+    char msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    unsigned short len = makeMessage(msg, size, 0);
+
+    for (int i = 0; i < iters; ++i) {
+        log_time realtime(CLOCK_REALTIME);
+        uint64_t start = NanoTime();
+        StartBenchmarkTiming(start);
+        logbuf->log(LOG_ID_MAIN, realtime, pickUid(i, 16), 1000 + (i & 15),
+                    1000 + (i & 15), msg, len);
+        uint64_t stop = NanoTime();
+        StopBenchmarkTiming(stop);
+        AddBenchmarkLatency(stop - start);
+    }
+
+    SetBenchmarkBytesProcessed((uint64_t)iters * len);
+}
+BENCHMARK(BM_log_ingest)->Arg(32)->Arg(128)->Arg(512)->Arg(1024)->Arg(4068);
+
+/*
+ *	Measure LogBuffer::log() as LogListener and LogKlog use it, with
+ * batches of the argument's count of 128 byte messages. ns/op is per
+ * message, latency per batch.
+ */
+static void BM_log_ingest_batch(int iters, int count) {
+    LogBuffer *logbuf = logBuffer(largeBuffer);
+    char msg[128];
+    unsigned short len = makeMessage(msg, sizeof(msg), 0);
+    LogBufferEntry entries[count];
+
+    for (int i = 0; i < iters; i += count) {
+        int batch = std::min(count, iters - i);
+        log_time realtime(CLOCK_REALTIME);
+        for (int j = 0; j < batch; ++j) {
+            LogBufferEntry &entry = entries[j];
+            entry.log_id = LOG_ID_MAIN;
+            entry.realtime = realtime;
+            entry.uid = pickUid(i + j, 16);
+            entry.pid = entry.tid = 1000 + ((i + j) & 15);
+            entry.msg = msg;
+            entry.len = len;
+        }
+        uint64_t start = NanoTime();
+        StartBenchmarkTiming(start);
+        logbuf->log(entries, batch);
+        uint64_t stop = NanoTime();
+        StopBenchmarkTiming(stop);
+        AddBenchmarkLatency(stop - start);
+    }
+
+    SetBenchmarkBytesProcessed((uint64_t)iters * len);
+}
+BENCHMARK(BM_log_ingest_batch)->Arg(1)->Arg(8)->Arg(32)->Arg(64);
+
+/*
+ *	Measure LogBuffer::log() of 128 byte messages spread over the
+ * argument's count of UIDs, the cost of the statistics tables.
+ */
+static void BM_log_ingest_uids(int iters, int uids) {
+    LogBuffer *logbuf = logBuffer(largeBuffer);
+    char msg[128];
+    unsigned short len = makeMessage(msg, sizeof(msg), 0);
+
+    for (int i = 0; i < iters; ++i) {
+        log_time realtime(CLOCK_REALTIME);
+        uint64_t start = NanoTime();
+        StartBenchmarkTiming(start);
+        logbuf->log(LOG_ID_MAIN, realtime, pickUid(i, uids), 1000 + (i & 15),
+                    1000 + (i & 15), msg, len);
+        uint64_t stop = NanoTime();
+        StopBenchmarkTiming(stop);
+        AddBenchmarkLatency(stop - start);
+    }
+
+    SetBenchmarkBytesProcessed((uint64_t)iters * len);
+}
+BENCHMARK(BM_log_ingest_uids)->Arg(1)->Arg(16)->Arg(256)->Arg(4096);
+
+/*
+ *	Measure LogBuffer::log() into a full buffer of the argument's size in
+ * KB, where every message pays for the prune that makes room for it. The
+ * latency percentiles expose the cost of the passes that do the work.
+ */
+static void BM_log_prune(int iters, int kbytes) {
+    LogBuffer *logbuf = logBuffer(kbytes * 1024UL);
+    char msg[128];
+    unsigned short len = makeMessage(msg, sizeof(msg), 0);
+    static const unsigned uids = 64;
+
+    // fill to capacity, untimed
+    unsigned long size = kbytes * 1024UL;
+    for (unsigned i = 0; logbuf->getSizeUsed(LOG_ID_MAIN) < size; ++i) {
+        logbuf->log(LOG_ID_MAIN, log_time(CLOCK_REALTIME), pickUid(i, uids),
+                    1000 + (i & 15), 1000 + (i & 15), msg, len);
+    }
+
+    for (int i = 0; i < iters; ++i) {
+        log_time realtime(CLOCK_REALTIME);
+        uint64_t start = NanoTime();
+        StartBenchmarkTiming(start);
+        logbuf->log(LOG_ID_MAIN, realtime, pickUid(i, uids), 1000 + (i & 15),
+                    1000 + (i & 15), msg, len);
+        uint64_t stop = NanoTime();
+        StopBenchmarkTiming(stop);
+        AddBenchmarkLatency(stop - start);
+    }
+
+    SetBenchmarkBytesProcessed((uint64_t)iters * len);
+}
+BENCHMARK(BM_log_prune)->Arg(256)->Arg(1024)->Arg(4096);
+
+struct Reader {
+    LogBuffer *logbuf;
+    int fd[2];
+    pthread_t flush;
+    pthread_t drain;
+    uint64_t latency;
+};
+
+// Consume what flushTo() sends, as a logcat would
+static void *drainReader(void *arg) {
+    Reader *reader = static_cast<Reader *>(arg);
+    char buffer[LOGGER_ENTRY_MAX_LEN + 1];
+    while (recv(reader->fd[1], buffer, sizeof(buffer), 0) > 0) {
+        ;
+    }
+    return NULL;
+}
+
+static void *flushReader(void *arg) {
+    Reader *reader = static_cast<Reader *>(arg);
+    SocketClient client(reader->fd[0], false, false);
+    uint64_t start = NanoTime();
+    reader->logbuf->flushTo(&client, 1, true, false);
+    reader->latency = NanoTime() - start;
+    shutdown(reader->fd[0], SHUT_WR);
+    return NULL;
+}
+
+/*
+ *	Measure LogBuffer::flushTo() of 128 byte messages to the argument's
+ * count of concurrent readers, each reading the whole buffer. ns/op is per
+ * message delivered to all readers, latency is that of each reader's pass.
+ */
+static void BM_flushTo_readers(int iters, int readers) {
+    LogBuffer *logbuf = logBuffer(largeBuffer);
+    char msg[128];
+    unsigned short len = makeMessage(msg, sizeof(msg), 0);
+
+    for (int i = 0; i < iters; ++i) {
+        logbuf->log(LOG_ID_MAIN, log_time(CLOCK_REALTIME), pickUid(i, 16),
+                    1000 + (i & 15), 1000 + (i & 15), msg, len);
+    }
+
+    Reader reader[readers];
+    for (int i = 0; i < readers; ++i) {
+        reader[i].logbuf = logbuf;
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, reader[i].fd) ||
+                pthread_create(&reader[i].drain, NULL, drainReader,
+                               &reader[i])) {
+            fprintf(stderr, "reader %d setup failed\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < readers; ++i) {
+        pthread_create(&reader[i].flush, NULL, flushReader, &reader[i]);
+    }
+    for (int i = 0; i < readers; ++i) {
+        pthread_join(reader[i].flush, NULL);
+        pthread_join(reader[i].drain, NULL);
+    }
+    StopBenchmarkTiming();
+
+    for (int i = 0; i < readers; ++i) {
+        close(reader[i].fd[0]);
+        close(reader[i].fd[1]);
+        AddBenchmarkLatency(reader[i].latency);
+    }
+
+    SetBenchmarkBytesProcessed((uint64_t)iters * len * readers);
+}
+BENCHMARK(BM_flushTo_readers)->Arg(1)->Arg(4)->Arg(16);
@@ -17,20 +17,35 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
+#include <algorithm>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include <android-base/macros.h>
 #include <android-base/stringprintf.h>
 #include <cutils/sockets.h>
 #include <log/log.h>
 #include <log/logger.h>
+#include <private/android_filesystem_config.h>
+#include <private/android_logger.h>
+#include <sysutils/SocketClient.h>
 
+#include "../LogBuffer.h"
+#include "../LogKlog.h"
+#include "../LogListener.h"
 #include "../LogReader.h" // pickup LOGD_SNDTIMEO
+#include "../LogUtils.h"
 
 /*
  * returns statistics
@@ -768,3 +783,886 @@ TEST(logd, SNDTIMEO) {
 
     close(fd);
 }
+
+static std::string send_to_control(int sock, const char *command) {
+    std::string response;
+    if (write(sock, command, strlen(command) + 1) > 0) {
+        char buffer[256];
+        memset(buffer, 0, sizeof(buffer));
+        ssize_t ret = read(sock, buffer, sizeof(buffer) - 1);
+        if (ret > 0) {
+            response = std::string(buffer, ret);
+        }
+    }
+    return response;
+}
+
+TEST(logd, ratelimit) {
+    int sock = socket_local_client("logd",
+                                   ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                   SOCK_STREAM);
+
+    ASSERT_TRUE(sock >= 0);
+
+    std::string before = send_to_control(sock, "getRateLimit");
+    EXPECT_NE(std::string::npos, before.find('\f'));
+
+    // rejected rules must leave those in effect alone
+    std::string response = send_to_control(sock, "setRateLimit 1000/=1");
+    EXPECT_EQ(0, strncmp(response.c_str(), "Invalid", 7)) << response;
+    response = send_to_control(sock, "setRateLimit *=10,0");
+    EXPECT_EQ(0, strncmp(response.c_str(), "Invalid", 7)) << response;
+
+    EXPECT_EQ(before, send_to_control(sock, "getRateLimit"));
+
+    close(sock);
+}
+
+// The tests below drive an in-process LogBuffer, as logd-benchmarks does,
+// so that they do not depend on how the device's logd is configured.
+
+// Furnished in main.cpp for logd, there is no package list, event tag map
+// or properties to consult in process.
+char *android::uidToName(uid_t) {
+    return NULL;
+}
+
+const char *android::tagToName(uint32_t) {
+    return NULL;
+}
+
+bool property_get_bool(const char *, int flag) {
+    return flag & BOOL_DEFAULT_TRUE;
+}
+
+static LogBuffer *newLogBuffer(unsigned long size) {
+    LogBuffer *logbuf = new LogBuffer(new LastLogTimes());
+    logbuf->enableStatistics();
+    log_id_for_each(id) {
+        logbuf->setSize(id, size);
+    }
+    return logbuf;
+}
+
+// Fill msg with a text payload of priority, tag and text, returns its length
+static unsigned short makeMessage(char *msg, size_t size,
+                                  const char *tag, const char *text) {
+    int len = snprintf(msg, size, "%c%s%c%s", ANDROID_LOG_INFO, tag, 0, text);
+    return (len < 0) ? 0 : std::min(size, (size_t)len + 1);
+}
+
+struct FlushedEntry {
+    log_id_t id;
+    uid_t uid;
+    pid_t pid;
+    log_time realtime;
+    std::string msg; // payload as sent, priority and tag included
+    // text of a text payload
+    const char *text() const {
+        return msg.c_str() + 1 + strlen(msg.c_str() + 1) + 1;
+    }
+};
+
+struct Flusher {
+    LogBuffer *logbuf;
+    uint64_t start;
+    const LogFilter *content;
+    int fd;
+};
+
+static void *flushThread(void *arg) {
+    Flusher *flusher = static_cast<Flusher *>(arg);
+    SocketClient client(flusher->fd, false, false);
+    flusher->logbuf->flushTo(&client, flusher->start, true, true,
+                             NULL, NULL, flusher->content);
+    shutdown(flusher->fd, SHUT_WR);
+    return NULL;
+}
+
+// Everything flushTo() sends a privileged reader after sequence start, and
+// past content filters if any, as logcat would receive it.
+static std::vector<FlushedEntry> flushAll(LogBuffer *logbuf,
+                                          uint64_t start = 0,
+                                          const LogFilter *content = NULL) {
+    std::vector<FlushedEntry> entries;
+    int fd[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd)) {
+        ADD_FAILURE() << "socketpair " << strerror(errno);
+        return entries;
+    }
+
+    Flusher flusher = { logbuf, start, content, fd[0] };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flushThread, &flusher)) {
+        ADD_FAILURE() << "pthread_create";
+        close(fd[0]);
+        close(fd[1]);
+        return entries;
+    }
+
+    log_msg msg;
+    ssize_t len;
+    while ((len = recv(fd[1], msg.buf, sizeof(msg.buf), 0)) > 0) {
+        EXPECT_EQ((ssize_t)(msg.entry.hdr_size + msg.entry.len), len);
+        FlushedEntry entry;
+        entry.id = (log_id_t)msg.entry_v4.lid;
+        entry.uid = msg.entry_v4.uid;
+        entry.pid = msg.entry.pid;
+        entry.realtime = log_time(msg.entry.sec, msg.entry.nsec);
+        entry.msg.assign(msg.msg(), msg.entry.len);
+        entries.push_back(entry);
+    }
+
+    pthread_join(thread, NULL);
+    close(fd[0]);
+    close(fd[1]);
+    return entries;
+}
+
+TEST(logd, prune_keeps_budget) {
+    static const unsigned long size = 256 * 1024;
+    LogBuffer *logbuf = newLogBuffer(size);
+
+    // Half the content from one chatty UID, the rest spread over others,
+    // so that pruning singles out the chatty UID and leaves chunks sparse.
+    char msg[200];
+    std::string text(160, 'x');
+    unsigned short len = makeMessage(msg, sizeof(msg), "logd.prune",
+                                     text.c_str());
+    log_time realtime(CLOCK_REALTIME);
+    for (unsigned i = 0; i < 20 * size / len; ++i) {
+        uid_t uid = (i & 1) ? AID_APP + 1 + (i % 7) : AID_APP;
+        ASSERT_LT(0, logbuf->log(LOG_ID_MAIN, realtime, uid, uid, uid,
+                                 msg, len));
+    }
+
+    // Pruned back to within the budget, but not far below it
+    unsigned long used = logbuf->getSizeUsed(LOG_ID_MAIN);
+    EXPECT_GE(size, used);
+    EXPECT_LE(size * 3 / 4, used);
+
+    // What is used is what a reader gets back, the chatty UID included
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    size_t kept = 0;
+    size_t chatty = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].msg == std::string(msg, len)) {
+            kept += len;
+            if (entries[i].uid == AID_APP) {
+                ++chatty;
+            }
+        }
+    }
+    EXPECT_EQ(used, kept);
+    EXPECT_LT(0U, chatty);
+}
+
+// Log repeats of one message to main, stamped from realtime on
+static void logRepeats(LogBuffer *logbuf, log_time realtime,
+                       const char *text, int repeats) {
+    char msg[100];
+    unsigned short len = makeMessage(msg, sizeof(msg), "logd.dedup", text);
+    for (int i = 0; i < repeats; ++i) {
+        ASSERT_LT(0, logbuf->log(LOG_ID_MAIN, realtime,
+                                 AID_APP, AID_APP, AID_APP, msg, len));
+        realtime += log_time(0, 1000);
+    }
+}
+
+TEST(logd, dedup) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+    logbuf->enableDedup();
+
+    static const int repeats = 10;
+    log_time realtime(CLOCK_REALTIME);
+    logRepeats(logbuf, realtime, "spinning", repeats);
+    // ends the run of repeats
+    logRepeats(logbuf, realtime + log_time(1, 0), "done", 1);
+
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    ASSERT_EQ(3U, entries.size());
+    EXPECT_STREQ("spinning", entries[0].text());
+    EXPECT_STREQ("last message repeated 9 times", entries[1].text());
+    EXPECT_STREQ("done", entries[2].text());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        EXPECT_EQ(LOG_ID_MAIN, entries[i].id);
+        EXPECT_EQ(AID_APP, entries[i].uid);
+        EXPECT_EQ(ANDROID_LOG_INFO, entries[i].msg[0]);
+        EXPECT_STREQ("logd.dedup", entries[i].msg.c_str() + 1);
+    }
+    // in time order, the summary on behalf of the latest repeat
+    EXPECT_EQ(realtime + log_time(0, (repeats - 1) * 1000),
+              entries[1].realtime);
+}
+
+TEST(logd, dedup_idle) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+    logbuf->enableDedup();
+
+    // Stamped an hour ago by the client, idle is still judged from when
+    // logd received the repeats, which is now.
+    log_time realtime(CLOCK_REALTIME);
+    realtime -= log_time(60 * 60, 0);
+    logRepeats(logbuf, realtime, "idle", 2);
+
+    // the first repeat wakes maintain(), the run is not idle yet
+    EXPECT_FALSE(logbuf->maintain());
+    ASSERT_EQ(1U, flushAll(logbuf).size());
+
+    // nothing ends the run, maintain() must summarize it once it goes quiet
+    bool summarized = false;
+    for (int i = 0; !summarized && (i < 5); ++i) {
+        summarized = logbuf->maintain();
+    }
+    EXPECT_TRUE(summarized);
+
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    ASSERT_EQ(2U, entries.size());
+    EXPECT_STREQ("idle", entries[0].text());
+    EXPECT_STREQ("last message repeated 1 time", entries[1].text());
+    EXPECT_EQ(realtime + log_time(0, 1000), entries[1].realtime);
+}
+
+TEST(logd, ratelimit_burst) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+    ASSERT_EQ(0, logbuf->initRateLimit("*=1,5"));
+    EXPECT_EQ("*=1,5", logbuf->formatRateLimit());
+    // rejected rules leave those in effect alone
+    EXPECT_NE(0, logbuf->initRateLimit("1000/=1"));
+    EXPECT_NE(0, logbuf->initRateLimit("*=10,0"));
+    EXPECT_EQ("*=1,5", logbuf->formatRateLimit());
+
+    // a burst is cut at the size of the bucket
+    char msg[100];
+    unsigned short len = makeMessage(msg, sizeof(msg), "logd.ratelimit",
+                                     "burst");
+    log_time realtime(CLOCK_REALTIME);
+    int admitted = 0;
+    for (int i = 0; i < 20; ++i) {
+        if (logbuf->log(LOG_ID_MAIN, realtime, AID_APP, getpid(), gettid(),
+                        msg, len) > 0) {
+            ++admitted;
+        }
+    }
+    EXPECT_EQ(5, admitted);
+
+    // the bucket admits nothing more, maintain() reports what it dropped
+    EXPECT_TRUE(logbuf->maintain());
+
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    ASSERT_EQ(6U, entries.size());
+    for (size_t i = 0; i < 5; ++i) {
+        EXPECT_STREQ("burst", entries[i].text());
+    }
+    EXPECT_EQ(AID_APP, entries[5].uid);
+    EXPECT_STREQ("chatty", entries[5].msg.c_str() + 1);
+    std::string text = entries[5].text();
+    EXPECT_EQ(0U, text.find("uid=10000")) << text;
+    EXPECT_NE(std::string::npos, text.find(" expire 15 lines")) << text;
+}
+
+TEST(logd, content_filter) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+
+    static const struct {
+        const char *tag;
+        const char *text;
+    } messages[] = {
+        { "logd.filter", "keep 1" },
+        { "logd.filter", "drop 2" },
+        { "logd.other", "keep 3" },
+        { "logd.filter", "keep 4" },
+    };
+    log_time realtime(CLOCK_REALTIME);
+    for (size_t i = 0; i < arraysize(messages); ++i) {
+        char msg[100];
+        unsigned short len = makeMessage(msg, sizeof(msg), messages[i].tag,
+                                         messages[i].text);
+        ASSERT_LT(0, logbuf->log(LOG_ID_MAIN, realtime, AID_APP, getpid(),
+                                 gettid(), msg, len));
+    }
+
+    LogFilter filter("logd.filter:I *:S", NULL, "^keep");
+    std::vector<FlushedEntry> entries = flushAll(logbuf, 0, &filter);
+    ASSERT_EQ(2U, entries.size());
+    EXPECT_STREQ("keep 1", entries[0].text());
+    EXPECT_STREQ("keep 4", entries[1].text());
+
+    // past the limits, a regex is ignored rather than evaluated
+    EXPECT_FALSE(LogFilter(NULL, NULL, "^keep").empty());
+    EXPECT_TRUE(LogFilter(NULL, NULL, "(k)\\1").empty());
+    EXPECT_TRUE(LogFilter(NULL, NULL, std::string(300, 'k').c_str()).empty());
+    EXPECT_TRUE(LogFilter(NULL, NULL, "a*b*c*d*e*f*g*h*i*").empty());
+    EXPECT_EQ(4U, flushAll(logbuf, 0, NULL).size());
+}
+
+TEST(logd, sealed_chunks_read_back) {
+    static const unsigned long size = 1024 * 1024;
+    LogBuffer *logbuf = newLogBuffer(size);
+    logbuf->enableCompression();
+
+    // Several chunks worth of compressible text, within the budget so that
+    // nothing is pruned, each message told apart by its sequence number.
+    std::vector<std::string> texts;
+    unsigned long logged = 0;
+    log_time realtime(CLOCK_REALTIME);
+    for (unsigned i = 0; logged < 3 * LogBufferChunk::capacity; ++i) {
+        char text[160];
+        snprintf(text, sizeof(text), "sealed %u %s", i,
+                 std::string(100 + i % 32, 'a' + i % 26).c_str());
+        char msg[200];
+        unsigned short len = makeMessage(msg, sizeof(msg), "logd.seal", text);
+        ASSERT_LT(0, logbuf->log(LOG_ID_MAIN, realtime + log_time(0, i),
+                                 AID_APP, i, i, msg, len));
+        texts.push_back(text);
+        logged += len;
+    }
+
+    // maintain() seals the retired chunks, which then take up less room
+    unsigned long used = logbuf->getSizeUsed(LOG_ID_MAIN);
+    logbuf->maintain();
+    EXPECT_GT(used, logbuf->getSizeUsed(LOG_ID_MAIN));
+
+    // A reader from the start gets every message back intact, in order
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    ASSERT_EQ(texts.size(), entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        EXPECT_EQ(LOG_ID_MAIN, entries[i].id);
+        EXPECT_EQ(AID_APP, entries[i].uid);
+        EXPECT_EQ((pid_t)i, entries[i].pid);
+        EXPECT_EQ(realtime + log_time(0, i), entries[i].realtime);
+        EXPECT_EQ(ANDROID_LOG_INFO, entries[i].msg[0]);
+        EXPECT_STREQ("logd.seal", entries[i].msg.c_str() + 1);
+        EXPECT_EQ(texts[i], entries[i].text());
+    }
+}
+
+// LogListener and LogReader take logdw and logdr from init's environment
+// when there, hand them sockets of our own rather than logd's.
+static void setControlSocket(const char *name, int fd) {
+    std::string key = android::base::StringPrintf(ANDROID_SOCKET_ENV_PREFIX "%s",
+                                                  name);
+    setenv(key.c_str(), android::base::StringPrintf("%d", fd).c_str(), 1);
+}
+
+class TestListener : public LogListener {
+public:
+    TestListener(LogBuffer *buf, LogReader *reader) :
+            LogListener(buf, reader) {
+    }
+    using LogListener::onDataAvailable;
+};
+
+// Send a datagram to logdw as liblog would. A header alone if text is
+// NULL, and with a file descriptor attached if fd is not -1.
+static void sendDatagram(int sock, uint8_t id, uint16_t tid,
+                         log_time realtime, const char *text, int fd = -1) {
+    android_log_header_t header;
+    header.id = id;
+    header.tid = tid;
+    header.realtime = realtime;
+    char msg[100];
+    unsigned short len = text ? makeMessage(msg, sizeof(msg), "logd.listener",
+                                            text) : 0;
+
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { msg, len },
+    };
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = len ? 2 : 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    ASSERT_LT(0, sendmsg(sock, &hdr, 0)) << strerror(errno);
+}
+
+TEST(logd, listener_batch) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+
+    int fd[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fd));
+    int reader_sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    ASSERT_LE(0, reader_sock);
+    setControlSocket("logdw", fd[0]);
+    setControlSocket("logdr", reader_sock);
+    LogReader *reader = new LogReader(logbuf);
+    TestListener *listener = new TestListener(logbuf, reader);
+    SocketClient cli(fd[0], false);
+
+    // More than one recvmmsg worth, every third datagram one to ignore:
+    // too short, for a log id that can not be written, a ring doorbell, or
+    // carrying a file descriptor that is not a ring registration.
+    std::vector<std::string> texts;
+    log_time realtime(CLOCK_REALTIME);
+    for (unsigned i = 0; i < 80; ++i) {
+        std::string text = android::base::StringPrintf("batch %u", i);
+        if ((i % 3) != 1) {
+            sendDatagram(fd[1], LOG_ID_MAIN, i, realtime + log_time(0, i),
+                         text.c_str());
+            texts.push_back(text);
+            continue;
+        }
+        switch ((i / 3) % 5) {
+        case 0:
+            sendDatagram(fd[1], LOG_ID_MAIN, i, realtime, NULL);
+            break;
+        case 1:
+            sendDatagram(fd[1], LOG_ID_MAX, i, realtime, text.c_str());
+            break;
+        case 2:
+            sendDatagram(fd[1], LOG_ID_KERNEL, i, realtime, text.c_str());
+            break;
+        case 3:
+            sendDatagram(fd[1], LOGGER_RING_ID, i, realtime, text.c_str());
+            break;
+        case 4:
+            sendDatagram(fd[1], LOG_ID_MAIN, i, realtime, text.c_str(),
+                         reader_sock);
+            break;
+        }
+    }
+    int batches = 0;
+    while (listener->onDataAvailable(&cli)) {
+        ++batches;
+    }
+    EXPECT_LT(1, batches);
+
+    std::vector<FlushedEntry> entries = flushAll(logbuf);
+    ASSERT_EQ(texts.size(), entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        EXPECT_EQ(LOG_ID_MAIN, entries[i].id);
+        EXPECT_EQ(getuid(), entries[i].uid);
+        EXPECT_EQ(getpid(), entries[i].pid);
+        EXPECT_STREQ("logd.listener", entries[i].msg.c_str() + 1);
+        EXPECT_EQ(texts[i], entries[i].text());
+    }
+
+    // Without credentials, there is no telling who sent them, all ignored
+    int off = 0;
+    ASSERT_EQ(0, setsockopt(fd[0], SOL_SOCKET, SO_PASSCRED, &off, sizeof(off)));
+    for (unsigned i = 0; i < 3; ++i) {
+        sendDatagram(fd[1], LOG_ID_MAIN, i, realtime, "anonymous");
+    }
+    EXPECT_TRUE(listener->onDataAvailable(&cli));
+    EXPECT_FALSE(listener->onDataAvailable(&cli));
+    EXPECT_EQ(texts.size(), flushAll(logbuf).size());
+
+    unsetenv(ANDROID_SOCKET_ENV_PREFIX "logdw");
+    unsetenv(ANDROID_SOCKET_ENV_PREFIX "logdr");
+    close(fd[1]);
+}
+
+TEST(logd, seek_start_time) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+    logbuf->enableCompression();
+
+    // Enough to prune the oldest content and retire many chunks, with the
+    // odd client clock skewed ahead or behind so that the list is not
+    // strictly in time order.
+    log_time realtime(CLOCK_REALTIME);
+    for (unsigned i = 0; i < 10000; ++i) {
+        log_time stamp = realtime + log_time(0, i * 1000);
+        if ((i % 997) == 0) {
+            stamp += log_time(0, 200 * 1000);
+        } else if ((i % 991) == 0) {
+            stamp -= log_time(0, 200 * 1000);
+        }
+        std::string text = android::base::StringPrintf(
+            "seek %u %s", i, std::string(80, 'a' + i % 26).c_str());
+        char msg[120];
+        unsigned short len = makeMessage(msg, sizeof(msg), "logd.seek",
+                                         text.c_str());
+        ASSERT_LT(0, logbuf->log(LOG_ID_MAIN, stamp, AID_APP, getpid(),
+                                 gettid(), msg, len));
+    }
+    // seals the retired chunks, relocating their elements
+    logbuf->maintain();
+
+    std::vector<FlushedEntry> all = flushAll(logbuf);
+    ASSERT_LT(1000U, all.size());
+    ASSERT_GT(10000U, all.size());
+
+    // The first message a reader started at seek(start) gets that is at or
+    // after start, as logcat -T start shows first, is the one a reader from
+    // the beginning of the buffer would have found.
+    std::vector<log_time> starts;
+    starts.push_back(realtime - log_time(60, 0));
+    starts.push_back(realtime + log_time(60, 0));
+    for (size_t i = 0; i < all.size(); i += 37) {
+        starts.push_back(all[i].realtime);
+        starts.push_back(all[i].realtime + log_time(0, 1));
+    }
+    for (size_t s = 0; s < starts.size(); ++s) {
+        const log_time &start = starts[s];
+        size_t expect = 0;
+        while ((expect < all.size()) && (all[expect].realtime < start)) {
+            ++expect;
+        }
+
+        std::vector<FlushedEntry> entries = flushAll(logbuf,
+                                                     logbuf->seek(start));
+        size_t first = 0;
+        while ((first < entries.size()) && (entries[first].realtime < start)) {
+            ++first;
+        }
+        if (expect == all.size()) {
+            EXPECT_EQ(entries.size(), first) << s;
+            continue;
+        }
+        ASSERT_GT(entries.size(), first) << s;
+        EXPECT_EQ(all[expect].msg, entries[first].msg) << s;
+        EXPECT_EQ(all[expect].realtime, entries[first].realtime) << s;
+        // and nothing at or after start is left out
+        EXPECT_EQ(all.size() - expect, entries.size() - first) << s;
+    }
+
+    // Seeking skips the bulk of the buffer for a start near its end
+    log_time late = all[all.size() * 9 / 10].realtime;
+    EXPECT_GT(all.size() / 2, flushAll(logbuf, logbuf->seek(late)).size());
+}
+
+// Sizes by key, as LogStatistics accounts them for worstUid() and
+// worstPidOfSystem(): an entry lasts until it has no size and no drops.
+struct WorstModel {
+    struct Sizes {
+        size_t size;
+        size_t dropped;
+    };
+    std::map<uint32_t, Sizes> keys;
+
+    void add(uint32_t key, size_t len) {
+        keys[key].size += len;
+    }
+    void subtract(uint32_t key, size_t len, bool dropped) {
+        Sizes &sizes = keys[key];
+        sizes.size -= len;
+        sizes.dropped -= dropped;
+        if (!sizes.size && !sizes.dropped) {
+            keys.erase(key);
+        }
+    }
+    void drop(uint32_t key, size_t len) {
+        keys[key].size -= len;
+        keys[key].dropped += 1;
+    }
+
+    // Linear scan for the two largest sizes
+    template <typename TEntry>
+    void check(const TEntry *first, const TEntry *second) const {
+        size_t sizes[2] = { 0, 0 };
+        for (auto it = keys.begin(); it != keys.end(); ++it) {
+            size_t size = it->second.size;
+            if (size > sizes[0]) {
+                sizes[1] = sizes[0];
+                sizes[0] = size;
+            } else if (size > sizes[1]) {
+                sizes[1] = size;
+            }
+        }
+        ASSERT_EQ(!keys.empty(), first != NULL);
+        ASSERT_EQ(keys.size() > 1, second != NULL);
+        if (first) {
+            EXPECT_EQ(sizes[0], first->getSizes());
+            EXPECT_TRUE(keys.count(first->getKey()));
+        }
+        if (second) {
+            EXPECT_EQ(sizes[1], second->getSizes());
+            EXPECT_TRUE(keys.count(second->getKey()));
+            EXPECT_NE(first->getKey(), second->getKey());
+        }
+    }
+};
+
+TEST(logd, statistics_worst) {
+    LogStatistics stats;
+    WorstModel uids, pids;
+    std::vector<LogBufferElement *> elements;
+    char msg[LOGGER_ENTRY_MAX_PAYLOAD];
+    memset(msg, 'x', sizeof(msg));
+
+    srand(1);
+    for (unsigned i = 0; i < 20000; ++i) {
+        int op = rand() % 10;
+        if ((op < 6) || elements.empty()) {
+            // a handful of UIDs, the system UID logging from several PIDs
+            uid_t uid = (rand() % 3) ? AID_APP + rand() % 16 : AID_SYSTEM;
+            pid_t pid = 1000000 + rand() % 8;
+            unsigned short len = 1 + rand() % 500;
+            void *storage = malloc(LogBufferElement::getAllocationSize(len));
+            LogBufferElement *element = new (storage) LogBufferElement(
+                NULL, LOG_ID_MAIN, log_time(CLOCK_REALTIME), uid, pid, pid,
+                msg, len);
+            stats.add(element);
+            uids.add(uid, len);
+            if (uid == AID_SYSTEM) {
+                pids.add(pid, len);
+            }
+            elements.push_back(element);
+        } else {
+            size_t index = rand() % elements.size();
+            LogBufferElement *element = elements[index];
+            uid_t uid = element->getUid();
+            pid_t pid = element->getPid();
+            size_t len = element->getMsgLen();
+            if ((op < 8) && !element->getDropped()) {
+                stats.drop(element);
+                element->setDropped(1);
+                uids.drop(uid, len);
+                if (uid == AID_SYSTEM) {
+                    pids.drop(pid, len);
+                }
+            } else {
+                bool dropped = element->getDropped();
+                stats.subtract(element);
+                uids.subtract(uid, len, dropped);
+                if (uid == AID_SYSTEM) {
+                    pids.subtract(pid, len, dropped);
+                }
+                elements[index] = elements.back();
+                elements.pop_back();
+                element->~LogBufferElement();
+                free(element);
+            }
+        }
+
+        const UidEntry *firstUid, *secondUid;
+        stats.worstUid(LOG_ID_MAIN, firstUid, secondUid);
+        uids.check(firstUid, secondUid);
+        const PidEntry *firstPid, *secondPid;
+        stats.worstPidOfSystem(LOG_ID_MAIN, firstPid, secondPid);
+        pids.check(firstPid, secondPid);
+        if (HasFatalFailure() || HasNonfatalFailure()) {
+            FAIL() << "after " << i + 1 << " operations";
+        }
+    }
+
+    for (size_t i = 0; i < elements.size(); ++i) {
+        stats.subtract(elements[i]);
+        elements[i]->~LogBufferElement();
+        free(elements[i]);
+    }
+    const UidEntry *firstUid, *secondUid;
+    stats.worstUid(LOG_ID_MAIN, firstUid, secondUid);
+    EXPECT_TRUE(firstUid == NULL);
+}
+
+// A child process that renames itself on request, see renameChild()
+struct NamedChild {
+    pid_t pid;
+    int to;   // names to take
+    int from; // acknowledgements
+};
+
+static bool spawnNamed(NamedChild &child) {
+    int to[2], from[2];
+    if (pipe(to)) {
+        return false;
+    }
+    if (pipe(from)) {
+        close(to[0]);
+        close(to[1]);
+        return false;
+    }
+    child.pid = fork();
+    if (child.pid == 0) {
+        close(to[1]);
+        close(from[0]);
+        char name[16];
+        while (read(to[0], name, sizeof(name)) == (ssize_t)sizeof(name)) {
+            prctl(PR_SET_NAME, name);
+            write(from[1], "", 1);
+        }
+        _exit(0);
+    }
+    close(to[0]);
+    close(from[1]);
+    child.to = to[1];
+    child.from = from[0];
+    return child.pid > 0;
+}
+
+static void renameChild(const NamedChild &child, const char *name) {
+    char buffer[16] = {};
+    strncpy(buffer, name, sizeof(buffer) - 1);
+    ASSERT_EQ((ssize_t)sizeof(buffer), write(child.to, buffer, sizeof(buffer)));
+    char ack;
+    ASSERT_EQ(1, read(child.from, &ack, 1));
+}
+
+static void stopChild(const NamedChild &child) {
+    close(child.to);
+    close(child.from);
+    waitpid(child.pid, NULL, 0);
+}
+
+static std::string tidName(pid_t tid) {
+    char *name = android::tidToName(tid);
+    std::string retval = name ? name : "<NULL>";
+    free(name);
+    return retval;
+}
+
+TEST(logd, name_cache) {
+    // As many entries as LogNameCache holds, keyed by pids that can not
+    // exist so that they are not already in the cache.
+    static const size_t maxEntries = 1024;
+    static const pid_t fresh = 0x40000000;
+
+    NamedChild child;
+    ASSERT_TRUE(spawnNamed(child));
+    renameChild(child, "logd.first");
+    EXPECT_EQ("logd.first", tidName(child.pid));
+
+    // The name is cached, as long as the entry is not the least recently
+    // used when the cache is full.
+    renameChild(child, "logd.second");
+    for (size_t i = 0; i < maxEntries - 1; ++i) {
+        free(android::tidToName(fresh + i));
+    }
+    EXPECT_EQ("logd.first", tidName(child.pid));
+    for (size_t i = 0; i < maxEntries; ++i) {
+        free(android::tidToName(fresh + maxEntries + i));
+    }
+    EXPECT_EQ("logd.second", tidName(child.pid));
+
+    // Once the process has exited and its pid been reused, the entry is
+    // no longer trusted after validInterval. Reuse needs ns_last_pid to be
+    // writable, otherwise it is only seen that the process has exited.
+    pid_t pid = child.pid;
+    stopChild(child);
+    usleep(50000); // a different start time, in clock ticks
+    NamedChild reused;
+    reused.pid = -1;
+    FILE *fp = fopen("/proc/sys/kernel/ns_last_pid", "w");
+    if (fp) {
+        bool set = fprintf(fp, "%d", pid - 1) > 0;
+        set &= !fclose(fp);
+        if (set && spawnNamed(reused) && (reused.pid != pid)) {
+            stopChild(reused);
+            reused.pid = -1;
+        }
+    }
+    if (reused.pid == pid) {
+        renameChild(reused, "logd.third");
+    } else {
+        fprintf(stderr, "pid %d not reused, checking exit only\n", pid);
+    }
+    sleep(2);
+    if (reused.pid == pid) {
+        EXPECT_EQ("logd.third", tidName(pid));
+        stopChild(reused);
+    } else {
+        EXPECT_EQ("<NULL>", tidName(pid));
+    }
+}
+
+// Reads no kernel log of its own, records are handed to parseRecord()
+class TestKlog : public LogKlog {
+public:
+    explicit TestKlog(LogBuffer *buf) :
+            LogKlog(buf, NULL, -1, -1, false, true) {
+    }
+    using LogKlog::parseRecord;
+};
+
+struct KmsgEntry {
+    int result;
+    char pri;
+    std::string tag;
+    std::string message;
+};
+
+// Parse one /dev/kmsg record, into exactly the room LogKlog reserves for it.
+// The read buffer may hold stale content past the record.
+static KmsgEntry parseKmsg(TestKlog &klog, const std::string &record,
+                           const char *stale = "") {
+    std::vector<char> buf(record.begin(), record.end());
+    buf.insert(buf.end(), stale, stale + strlen(stale) + 1);
+    size_t len = record.size();
+    std::vector<char> newstr(std::min(len, 2 * (size_t)LOGGER_ENTRY_MAX_PAYLOAD)
+                             + 3);
+    LogBufferEntry entry;
+    KmsgEntry retval;
+    retval.result = klog.parseRecord(&buf[0], len, &newstr[0], &entry);
+    retval.pri = 0;
+    if (retval.result > 0) {
+        EXPECT_EQ(LOG_ID_KERNEL, entry.log_id);
+        EXPECT_GE(newstr.size(), entry.len);
+        retval.pri = entry.msg[0];
+        retval.tag = entry.msg + 1;
+        retval.message = entry.msg + 1 + retval.tag.size() + 1;
+        EXPECT_EQ(entry.len, 1 + retval.tag.size() + 1
+                             + retval.message.size() + 1);
+    }
+    return retval;
+}
+
+TEST(logd, klog_parse_record) {
+    LogBuffer *logbuf = newLogBuffer(256 * 1024);
+    TestKlog klog(logbuf);
+
+    // \xNN escapes are undone, anything short of one is taken as is, and
+    // the dictionary continuation lines are dropped.
+    KmsgEntry entry = parseKmsg(klog,
+        "6,1,1000000,-;wlan0: caf\\xc3\\xa9 \\x5c \\xzz \\x\\x4\n"
+        " SUBSYSTEM=net\n"
+        " DEVICE=+net:wlan0\n");
+    ASSERT_LT(0, entry.result);
+    EXPECT_EQ(ANDROID_LOG_INFO, entry.pri);
+    EXPECT_EQ("wlan0", entry.tag);
+    EXPECT_EQ("caf\xc3\xa9 \\ \\xzz \\x\\x4", entry.message);
+
+    // an escaped newline is content, not the end of the message
+    entry = parseKmsg(klog, "3,2,2000000,c;usb: one\\x0atwo\n SUBSYSTEM=usb\n");
+    ASSERT_LT(0, entry.result);
+    EXPECT_EQ(ANDROID_LOG_ERROR, entry.pri);
+    EXPECT_EQ("usb", entry.tag);
+    EXPECT_EQ("one\ntwo", entry.message);
+
+    // an escape cut short by the end of the record does not borrow from
+    // what is past it
+    entry = parseKmsg(klog, "6,3,3000000,-;tail: end\\x4", "1\\x41");
+    ASSERT_LT(0, entry.result);
+    EXPECT_EQ("tail", entry.tag);
+    EXPECT_EQ("end\\x4", entry.message);
+
+    // not records
+    EXPECT_EQ(0, parseKmsg(klog, "6,4,4000000 no separator\n").result);
+    EXPECT_EQ(0, parseKmsg(klog, "x,5,5000000,-;bad: priority\n").result);
+    EXPECT_EQ(0, parseKmsg(klog, "6,6;bad: fields\n").result);
+
+    // A record of the full CONSOLE_EXT_LOG_MAX, all escapes, unescapes to a
+    // quarter of the size.
+    static const size_t consoleExtLogMax = 8192;
+    std::string record = "4,7,7000000,-;big: ";
+    size_t escapes = (consoleExtLogMax - 1 - record.size()) / 4;
+    for (size_t i = 0; i < escapes; ++i) {
+        record += "\\x41";
+    }
+    record += "\n";
+    ASSERT_EQ(consoleExtLogMax, record.size());
+    entry = parseKmsg(klog, record);
+    ASSERT_LT(0, entry.result);
+    EXPECT_EQ(ANDROID_LOG_WARN, entry.pri);
+    EXPECT_EQ("big", entry.tag);
+    EXPECT_EQ(std::string(escapes, 'A'), entry.message);
+
+    // and unescaped, the message is cut at the payload maximum
+    record = "4,8,8000000,-;big: ";
+    record += std::string(consoleExtLogMax - 1 - record.size(), 'C');
+    record += "\n";
+    entry = parseKmsg(klog, record);
+    ASSERT_LT(0, entry.result);
+    EXPECT_EQ("big", entry.tag);
+    EXPECT_EQ(std::string(LOGGER_ENTRY_MAX_PAYLOAD, 'C'), entry.message);
+}